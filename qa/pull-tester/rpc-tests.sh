@@ -75,6 +75,8 @@ testScripts=(
     'rewind_index.py'
     'p2p_txexpiry_dos.py'
     'p2p_node_bloom.py'
+    'p2p_compactblocks.py'
+    'p2p_sendheaders.py'
     'regtest_signrawtransaction.py'
     'finalsaplingroot.py'
 );
@@ -94,6 +96,7 @@ testScriptsExt=(
     'invalidblockrequest.py'
 #    'forknotify.py'
     'p2p-acceptblock.py'
+    'p2p_many_peers.py'
 );
 
 if [ "x$ENABLE_ZMQ" = "x1" ]; then
@@ -0,0 +1,94 @@
+#!/usr/bin/env python2
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Relay blocks along a line of three nodes whose mempools already hold the
+# block's transactions, and check they travel as compact blocks: rebuilt from
+# the mempool without asking for transactions, for a fraction of the bytes.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, start_nodes, connect_nodes_bi, \
+    sync_blocks, sync_mempools, log_filename
+
+import re
+
+NUM_TXS = 40
+
+
+class CompactBlocksTest(BitcoinTestFramework):
+
+    def setup_nodes(self):
+        return start_nodes(3, self.options.tmpdir, [["-debug=cmpctblock", "-debug=net"]] * 3)
+
+    def setup_network(self, split=False):
+        self.nodes = self.setup_nodes()
+        connect_nodes_bi(self.nodes, 0, 1)
+        connect_nodes_bi(self.nodes, 1, 2)
+        self.is_network_split = False
+        self.sync_all()
+
+    def bytes_received(self, n):
+        return self.nodes[n].getnettotals()['totalbytesrecv']
+
+    def log_lines(self, n):
+        with open(log_filename(self.options.tmpdir, n, "debug.log")) as f:
+            return f.readlines()
+
+    def messages_received(self, n, since, command):
+        # -debug=net logs "received: <command> (<size> bytes) peer=<id>" for every message
+        pattern = re.compile(r"received: %s \(" % command)
+        return len([line for line in self.log_lines(n)[since:] if pattern.search(line)])
+
+    def reconstructions(self, n, blockhash):
+        # "Successfully reconstructed block <hash> with <prefilled> txn prefilled,
+        # <mempool> txn from mempool and <requested> txn requested"
+        pattern = re.compile(r"reconstructed block %s with (\d+) txn prefilled, (\d+) txn from mempool and (\d+) txn requested" % blockhash)
+        with open(log_filename(self.options.tmpdir, n, "debug.log")) as f:
+            return [tuple(int(x) for x in m.groups()) for m in (pattern.search(line) for line in f) if m]
+
+    def relay_block(self, ntxs):
+        address = self.nodes[2].getnewaddress()
+        for i in range(ntxs):
+            self.nodes[0].sendtoaddress(address, 0.1)
+        sync_mempools(self.nodes)
+        assert_equal(len(self.nodes[2].getrawmempool()), ntxs)
+
+        before = [self.bytes_received(n) for n in range(3)]
+        loglines = [len(self.log_lines(n)) for n in range(3)]
+        blockhash = self.nodes[0].generate(1)[0]
+        sync_blocks(self.nodes)
+        size = self.nodes[0].getblock(blockhash)['size']
+
+        for n in (1, 2):
+            received = self.bytes_received(n) - before[n]
+            rebuilt = self.reconstructions(n, blockhash)
+            assert_equal(len(rebuilt), 1)
+            prefilled, frommempool, requested = rebuilt[0]
+            # The cmpctblock is one trip, every getblocktxn answered by a blocktxn one more
+            assert self.messages_received(n, loglines[n], "cmpctblock") >= 1
+            roundtrips = 1 + self.messages_received(n, loglines[n], "blocktxn")
+            print "node%d: block of %d bytes, %d txs, received %d bytes in %d round-trip(s), %d prefilled, %d from mempool" % \
+                (n, size, ntxs + 1, received, roundtrips, prefilled, frommempool)
+            assert_equal(prefilled + frommempool + requested, ntxs + 1)
+            assert_equal(requested, 0)
+            assert_equal(roundtrips, 1)
+            assert received < size, "compact block relay used %d bytes for a %d byte block" % (received, size)
+
+        assert_equal(len(self.nodes[2].getrawmempool()), 0)
+
+    def run_test(self):
+        # The cached chain is old, so the nodes take its next block as the end
+        # of initial download and ask node0, then node1, to push new blocks
+        self.nodes[0].generate(1)
+        sync_blocks(self.nodes)
+
+        print "Relaying a block"
+        self.relay_block(NUM_TXS)
+        print "Relaying a larger block"
+        self.relay_block(3 * NUM_TXS)
+
+
+if __name__ == '__main__':
+    CompactBlocksTest().main()
@@ -0,0 +1,83 @@
+#!/usr/bin/env python2
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Open more inbound connections than select() can wait on (FD_SETSIZE, 1024)
+# and check that the node accepts and services all of them, then notices
+# when half of them go away.
+#
+
+from test_framework.mininode import NodeConn, msg_version, sha256
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import initialize_chain_clean, start_node, \
+    p2p_port, assert_equal
+
+import resource
+import socket
+import struct
+import time
+
+# Current node protocol version, anything below MIN_PEER_PROTO_VERSION is dropped
+PROTOCOL_VERSION = 170009
+NUM_PEERS = 1500
+
+
+def frame_message(message):
+    data = message.serialize()
+    header = NodeConn.MAGIC_BYTES["regtest"]
+    header += message.command + "\x00" * (12 - len(message.command))
+    header += struct.pack("<I", len(data))
+    header += sha256(sha256(data))[:4]
+    return header + data
+
+
+class ManyPeersTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print "Initializing test directory "+self.options.tmpdir
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self):
+        # Every peer needs a descriptor here and in the node
+        soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+        self.num_peers = min(NUM_PEERS, hard - 200)
+        resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+        self.nodes = [start_node(0, self.options.tmpdir,
+                                 ["-epoll", "-maxconnections=%d" % (self.num_peers + 50)])]
+        self.is_network_split = False
+
+    def wait_for_connections(self, count, timeout=120):
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            if self.nodes[0].getconnectioncount() == count:
+                return
+            time.sleep(0.5)
+        assert_equal(self.nodes[0].getconnectioncount(), count)
+
+    def run_test(self):
+        print "Opening %d connections" % self.num_peers
+        peers = []
+        for i in range(self.num_peers):
+            s = socket.create_connection(("127.0.0.1", p2p_port(0)))
+            s.sendall(frame_message(msg_version(PROTOCOL_VERSION)))
+            peers.append(s)
+        self.wait_for_connections(self.num_peers)
+
+        # The node has to keep answering while it services every socket
+        info = self.nodes[0].getpeerinfo()
+        assert_equal(len(info), self.num_peers)
+        assert_equal(len([p for p in info if p['version'] == PROTOCOL_VERSION]), self.num_peers)
+
+        print "Closing half of them"
+        for s in peers[::2]:
+            s.close()
+        self.wait_for_connections(self.num_peers - len(peers[::2]))
+
+        for s in peers[1::2]:
+            s.close()
+        self.wait_for_connections(0)
+
+
+if __name__ == '__main__':
+    ManyPeersTest().main()
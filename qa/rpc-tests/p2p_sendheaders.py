@@ -0,0 +1,143 @@
+#!/usr/bin/env python2
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Check a new block is announced by headers to a peer that sent sendheaders
+# and already has the parent's header, and by inv to a peer that did not
+# opt in or that the headers would not connect for.
+#
+
+from test_framework.mininode import NodeConn, NodeConnCB, NetworkThread, \
+    CBlockLocator, msg_getheaders, msg_sendheaders, mininode_lock, \
+    SAPLING_PROTO_VERSION
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import initialize_chain_clean, start_nodes, \
+    p2p_port, assert_equal
+
+import time
+
+
+class TestNode(NodeConnCB):
+    def __init__(self):
+        NodeConnCB.__init__(self)
+        self.create_callback_map()
+        self.connection = None
+        self.block_invs = []
+        self.headers = []
+
+    def add_connection(self, conn):
+        self.connection = conn
+
+    def wait_for_verack(self):
+        while True:
+            with mininode_lock:
+                if self.verack_received:
+                    return
+            time.sleep(0.05)
+
+    def send_message(self, message):
+        self.connection.send_message(message)
+
+    # Only record the announcements, never fetch the block
+    def on_inv(self, conn, message):
+        self.block_invs.extend("%064x" % i.hash for i in message.inv if i.type == 2)
+
+    def on_headers(self, conn, message):
+        self.headers.extend(h.hash for h in message.headers)
+
+    def clear(self):
+        with mininode_lock:
+            self.block_invs = []
+            self.headers = []
+
+    # Wait until blockhash was announced, then return how: "inv" or "headers"
+    def wait_for_announce(self, blockhash, timeout=30):
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            with mininode_lock:
+                if blockhash in self.headers:
+                    assert blockhash not in self.block_invs
+                    return "headers"
+                if blockhash in self.block_invs:
+                    return "inv"
+            time.sleep(0.05)
+        raise AssertionError("block %s was never announced" % blockhash)
+
+    def wait_for_headers(self, blockhash, timeout=30):
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            with mininode_lock:
+                if blockhash in self.headers:
+                    return
+            time.sleep(0.05)
+        raise AssertionError("no headers up to %s" % blockhash)
+
+
+class SendHeadersTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print "Initializing test directory "+self.options.tmpdir
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self):
+        self.nodes = start_nodes(1, self.options.tmpdir, [["-debug=net"]])
+
+    # Ask for the headers after the tip's parent, so the node knows the peer
+    # has the tip's header
+    def sync_headers(self, test_node):
+        tip = self.nodes[0].getbestblockhash()
+        parent = self.nodes[0].getblockheader(tip)['previousblockhash']
+        getheaders = msg_getheaders()
+        getheaders.locator = CBlockLocator()
+        getheaders.locator.vHave = [int(parent, 16)]
+        test_node.send_message(getheaders)
+        test_node.wait_for_headers(tip)
+
+    def run_test(self):
+        inv_node = TestNode()
+        headers_node = TestNode()
+
+        connections = []
+        connections.append(NodeConn('127.0.0.1', p2p_port(0), self.nodes[0],
+                                    inv_node, "regtest", SAPLING_PROTO_VERSION))
+        connections.append(NodeConn('127.0.0.1', p2p_port(0), self.nodes[0],
+                                    headers_node, "regtest", SAPLING_PROTO_VERSION))
+        inv_node.add_connection(connections[0])
+        headers_node.add_connection(connections[1])
+
+        NetworkThread().start()
+
+        inv_node.wait_for_verack()
+        headers_node.wait_for_verack()
+        headers_node.send_message(msg_sendheaders())
+
+        self.nodes[0].generate(10)
+
+        # The node doesn't know the peer has the parent's header yet, so even
+        # a peer that opted in gets an inv
+        headers_node.clear()
+        blockhash = self.nodes[0].generate(1)[0]
+        assert_equal(headers_node.wait_for_announce(blockhash), "inv")
+
+        # Once it has served the peer the tip's header, the next block is
+        # announced by headers, to the peer that asked for them only
+        self.sync_headers(headers_node)
+        for i in range(3):
+            inv_node.clear()
+            headers_node.clear()
+            blockhash = self.nodes[0].generate(1)[0]
+            assert_equal(headers_node.wait_for_announce(blockhash), "headers")
+            assert_equal(inv_node.wait_for_announce(blockhash), "inv")
+            with mininode_lock:
+                assert_equal(headers_node.headers, [blockhash])
+
+        # Both peers are still connected and in good standing
+        peerinfo = self.nodes[0].getpeerinfo()
+        assert_equal(len(peerinfo), 2)
+        assert_equal([p["banscore"] for p in peerinfo], [0, 0])
+
+        [ c.disconnect_node() for c in connections ]
+
+if __name__ == '__main__':
+    SendHeadersTest().main()
@@ -1182,6 +1182,22 @@ class msg_mempool(object):
         return "msg_mempool()"
 
 
+class msg_sendheaders(object):
+    command = "sendheaders"
+
+    def __init__(self):
+        pass
+
+    def deserialize(self, f):
+        pass
+
+    def serialize(self):
+        return ""
+
+    def __repr__(self):
+        return "msg_sendheaders()"
+
+
 # getheaders message has
 # number of entries
 # vector of hashes
@@ -1317,7 +1333,8 @@ class NodeConnCB(object):
             "headers": self.on_headers,
             "getheaders": self.on_getheaders,
             "reject": self.on_reject,
-            "mempool": self.on_mempool
+            "mempool": self.on_mempool,
+            "sendheaders": self.on_sendheaders
         }
 
     def deliver(self, conn, message):
@@ -1363,6 +1380,7 @@ class NodeConnCB(object):
     def on_close(self, conn): pass
     def on_mempool(self, conn): pass
     def on_pong(self, conn, message): pass
+    def on_sendheaders(self, conn, message): pass
 
 
 # The actual NodeConn class
@@ -1384,7 +1402,8 @@ class NodeConn(asyncore.dispatcher):
         "headers": msg_headers,
         "getheaders": msg_getheaders,
         "reject": msg_reject,
-        "mempool": msg_mempool
+        "mempool": msg_mempool,
+        "sendheaders": msg_sendheaders
     }
     MAGIC_BYTES = {
         "mainnet": "\x24\xe9\x27\x64",   # mainnet
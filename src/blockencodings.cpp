@@ -0,0 +1,179 @@
+#include "blockencodings.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "util.h"
+#include "version.h"
+
+#include <unordered_map>
+
+#include <boost/foreach.hpp>
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, const std::set<uint16_t>& setPrefill) :
+        nonce(GetRand(std::numeric_limits<uint64_t>::max())),
+        header(block)
+{
+    FillShortTxIDSelector();
+
+    std::set<uint16_t> setIndexes(setPrefill);
+    setIndexes.insert(0); // the coinbase is never in anyone's mempool
+    int32_t nLastIndex = -1;
+    for (std::set<uint16_t>::const_iterator it = setIndexes.begin(); it != setIndexes.end() && *it < block.vtx.size(); ++it) {
+        PrefilledTransaction prefilled;
+        prefilled.index = *it - nLastIndex - 1;
+        prefilled.tx = block.vtx[*it];
+        prefilledtxn.push_back(prefilled);
+        nLastIndex = *it;
+    }
+
+    shorttxids.reserve(block.vtx.size() - prefilledtxn.size());
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        if (setIndexes.count(i) == 0)
+            shorttxids.push_back(GetShortID(block.vtx[i].GetHash()));
+    }
+}
+
+void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const {
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << header << nonce;
+    CSHA256 hasher;
+    hasher.Write((unsigned char*)&(*stream.begin()), stream.end() - stream.begin());
+    uint256 shorttxidhash;
+    hasher.Finalize(shorttxidhash.begin());
+    shorttxidk0 = shorttxidhash.GetCheapHash();
+    shorttxidk1 = ReadLE64(shorttxidhash.begin() + 8);
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const {
+    static_assert(SHORTTXIDS_LENGTH == 6, "shorttxids calculation assumes 6-byte shorttxids");
+    return CSipHasher(shorttxidk0, shorttxidk1).Write(txhash.begin(), 32).Finalize() & 0xffffffffffffL;
+}
+
+ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock) {
+    if (cmpctblock.header.IsNull() || (cmpctblock.shorttxids.empty() && cmpctblock.prefilledtxn.empty()))
+        return READ_STATUS_INVALID;
+    // Indexes are 16 bits, larger blocks are only ever sent whole
+    if (cmpctblock.BlockTxCount() > (size_t)std::numeric_limits<uint16_t>::max() + 1)
+        return READ_STATUS_INVALID;
+
+    assert(header.IsNull() && txn_available.empty());
+    header = cmpctblock.header;
+    txn_available.resize(cmpctblock.BlockTxCount());
+
+    int32_t lastprefilledindex = -1;
+    for (size_t i = 0; i < cmpctblock.prefilledtxn.size(); i++) {
+        if (cmpctblock.prefilledtxn[i].tx.IsNull())
+            return READ_STATUS_INVALID;
+
+        lastprefilledindex += cmpctblock.prefilledtxn[i].index + 1; // index is a uint16_t, so can't overflow here
+        if (lastprefilledindex > std::numeric_limits<uint16_t>::max())
+            return READ_STATUS_INVALID;
+        if ((uint32_t)lastprefilledindex > cmpctblock.shorttxids.size() + i) {
+            // A prefilled index past the short ids plus the prefilled
+            // transactions so far would leave a slot with neither
+            return READ_STATUS_INVALID;
+        }
+        txn_available[lastprefilledindex] = std::make_shared<const CTransaction>(cmpctblock.prefilledtxn[i].tx);
+    }
+    prefilled_count = cmpctblock.prefilledtxn.size();
+
+    // Map short ids to their positions. A well-formed compact block spreads
+    // them evenly, so a heavily loaded bucket only comes from someone trying
+    // to make lookups slow and is treated as a failure. With up to ~16000
+    // transactions, more than 12 entries in one bucket should happen about
+    // once per million blocks.
+    std::unordered_map<uint64_t, uint16_t> shorttxids(cmpctblock.shorttxids.size());
+    uint16_t index_offset = 0;
+    for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
+        while (txn_available[i + index_offset])
+            index_offset++;
+        shorttxids[cmpctblock.shorttxids[i]] = i + index_offset;
+        if (shorttxids.bucket_size(shorttxids.bucket(cmpctblock.shorttxids[i])) > 12)
+            return READ_STATUS_FAILED;
+    }
+    // Two transactions of the block share a short id, fall back to the full block
+    if (shorttxids.size() != cmpctblock.shorttxids.size())
+        return READ_STATUS_FAILED;
+
+    // Look the rest up in a snapshot of the mempool, without holding mempool.cs
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = pool->GetSnapshot();
+    std::vector<bool> have_txn(txn_available.size());
+    for (std::map<uint256, CTransactionRef>::const_iterator it = snapshot->mapTx.begin(); it != snapshot->mapTx.end(); ++it) {
+        uint64_t shortid = cmpctblock.GetShortID(it->first);
+        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
+        if (idit != shorttxids.end()) {
+            if (!have_txn[idit->second]) {
+                txn_available[idit->second] = it->second;
+                have_txn[idit->second] = true;
+                mempool_count++;
+            } else if (txn_available[idit->second]) {
+                // Two mempool transactions match, ask for it rather than
+                // lose a round-trip when FillBlock fails
+                txn_available[idit->second].reset();
+                mempool_count--;
+            }
+        }
+        // Stop early once everything is found, at the small risk of
+        // missing a second match for one of the ids
+        if (mempool_count == shorttxids.size())
+            break;
+    }
+
+    LogPrint("cmpctblock", "Initialized PartiallyDownloadedBlock for block %s using a cmpctblock of size %lu\n",
+             cmpctblock.header.GetHash().ToString(), GetSerializeSize(cmpctblock, SER_NETWORK, PROTOCOL_VERSION));
+
+    return READ_STATUS_OK;
+}
+
+bool PartiallyDownloadedBlock::IsTxAvailable(size_t index) const {
+    assert(!header.IsNull());
+    assert(index < txn_available.size());
+    return txn_available[index] ? true : false;
+}
+
+std::vector<uint16_t> PartiallyDownloadedBlock::GetMissing() const {
+    std::vector<uint16_t> vMissing;
+    for (size_t i = 0; i < txn_available.size(); i++) {
+        if (!txn_available[i])
+            vMissing.push_back(i);
+    }
+    return vMissing;
+}
+
+ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<CTransaction>& vtx_missing) const {
+    assert(!header.IsNull());
+    block = header;
+    block.vtx.resize(txn_available.size());
+
+    size_t tx_missing_offset = 0;
+    for (size_t i = 0; i < txn_available.size(); i++) {
+        if (!txn_available[i]) {
+            if (vtx_missing.size() <= tx_missing_offset)
+                return READ_STATUS_INVALID;
+            block.vtx[i] = vtx_missing[tx_missing_offset++];
+        } else
+            block.vtx[i] = *txn_available[i];
+    }
+    if (vtx_missing.size() != tx_missing_offset)
+        return READ_STATUS_INVALID;
+
+    // A short id matching the wrong mempool transaction shows up here. That
+    // is our bad luck rather than the peer's fault, so the block must not be
+    // handed to validation and marked invalid; ask for it whole instead.
+    bool fMutated = false;
+    if (block.BuildMerkleTree(&fMutated) != header.hashMerkleRoot || fMutated)
+        return READ_STATUS_FAILED;
+
+    LogPrint("cmpctblock", "Successfully reconstructed block %s with %lu txn prefilled, %lu txn from mempool and %lu txn requested\n",
+             header.GetHash().ToString(), prefilled_count, mempool_count, vtx_missing.size());
+    if (vtx_missing.size() < 5) {
+        BOOST_FOREACH(const CTransaction& tx, vtx_missing)
+            LogPrint("cmpctblock", "Reconstructed block %s required tx %s\n", header.GetHash().ToString(), tx.GetHash().ToString());
+    }
+
+    return READ_STATUS_OK;
+}
@@ -0,0 +1,152 @@
+#include "blockfile.h"
+
+#include "crypto/common.h"
+#include "main.h"
+#include "util.h"
+
+#include <algorithm>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CBlockFileCache blockFileCache;
+
+CBlockFileMapping::~CBlockFileMapping()
+{
+#ifndef WIN32
+    munmap((void*)pbegin, nSize);
+#endif
+}
+
+std::shared_ptr<const CBlockFileMapping> CBlockFileMapping::Map(const boost::filesystem::path& path)
+{
+    std::shared_ptr<const CBlockFileMapping> mapping;
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+        return mapping;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED)
+            mapping.reset(new CBlockFileMapping((const char*)p, st.st_size));
+        else
+            LogPrintf("Unable to map block file %s: %s\n", path.string(), strerror(errno));
+    }
+    // The mapping keeps its own reference to the file
+    close(fd);
+#endif
+    return mapping;
+}
+
+void CBlockFileCache::SetMaxFiles(size_t nMaxFilesIn)
+{
+    LOCK(cs);
+    nMaxFiles = nMaxFilesIn;
+    while (listLRU.size() > nMaxFiles) {
+        mapFiles.erase(listLRU.back());
+        listLRU.pop_back();
+    }
+}
+
+std::shared_ptr<const CBlockFileMapping> CBlockFileCache::GetMapping(const CDiskBlockPos& pos, size_t nEnd)
+{
+    AssertLockHeld(cs);
+    std::map<int, CEntry>::iterator it = mapFiles.find(pos.nFile);
+    if (it != mapFiles.end()) {
+        listLRU.splice(listLRU.begin(), listLRU, it->second.itLRU);
+        if (it->second.mapping->size() >= nEnd)
+            return it->second.mapping;
+        // The block was appended after the file was mapped
+        listLRU.erase(it->second.itLRU);
+        mapFiles.erase(it);
+    }
+
+    std::shared_ptr<const CBlockFileMapping> mapping = CBlockFileMapping::Map(GetBlockPosFilename(pos, "blk"));
+    if (!mapping || mapping->size() < nEnd)
+        return std::shared_ptr<const CBlockFileMapping>();
+
+    listLRU.push_front(pos.nFile);
+    CEntry& entry = mapFiles[pos.nFile];
+    entry.mapping = mapping;
+    entry.itLRU = listLRU.begin();
+    while (listLRU.size() > nMaxFiles) {
+        mapFiles.erase(listLRU.back());
+        listLRU.pop_back();
+    }
+    return mapping;
+}
+
+bool CBlockFileCache::GetBlockSpan(const CDiskBlockPos& pos, std::shared_ptr<const CBlockFileMapping>& mapping, const char*& pbegin, const char*& pend)
+{
+    // Every block is preceded by the message start and its serialized size
+    if (pos.IsNull() || pos.nPos < 8)
+        return false;
+
+    LOCK(cs);
+    if (nMaxFiles == 0)
+        return false;
+    mapping = GetMapping(pos, (size_t)pos.nPos);
+    if (!mapping)
+        return false;
+    uint32_t nBlockSize = ReadLE32((const unsigned char*)mapping->begin() + pos.nPos - 4);
+    if (nBlockSize > MAX_BLOCKFILE_SIZE)
+        return false;
+    size_t nEnd = (size_t)pos.nPos + nBlockSize;
+    if (mapping->size() < nEnd && !(mapping = GetMapping(pos, nEnd)))
+        return false;
+
+    pbegin = mapping->begin() + pos.nPos;
+    pend = mapping->begin() + nEnd;
+    return true;
+}
+
+bool CBlockFileCache::Open(const CDiskBlockPos& pos, CBlockFileReader& reader)
+{
+    std::shared_ptr<const CBlockFileMapping> mapping;
+    const char* pbegin;
+    const char* pend;
+    if (!GetBlockSpan(pos, mapping, pbegin, pend))
+        return false;
+    reader.Reset(mapping, pbegin, pend);
+    return true;
+}
+
+void CBlockFileCache::Prefetch(const CDiskBlockPos& pos, size_t nBytes)
+{
+#ifndef WIN32
+    std::shared_ptr<const CBlockFileMapping> mapping;
+    const char* pbegin;
+    const char* pend;
+    if (!GetBlockSpan(pos, mapping, pbegin, pend))
+        return;
+    if (nBytes > 0)
+        pend = pbegin + std::min(nBytes, (size_t)(mapping->begin() + mapping->size() - pbegin));
+
+    // madvise wants a page aligned start
+    static const uintptr_t nPageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t nStart = (uintptr_t)pbegin & ~(nPageSize - 1);
+    madvise((void*)nStart, (uintptr_t)pend - nStart, MADV_WILLNEED);
+#endif
+}
+
+void CBlockFileCache::Invalidate(int nFile)
+{
+    LOCK(cs);
+    std::map<int, CEntry>::iterator it = mapFiles.find(nFile);
+    if (it != mapFiles.end()) {
+        listLRU.erase(it->second.itLRU);
+        mapFiles.erase(it);
+    }
+}
+
+void CBlockFileCache::Clear()
+{
+    LOCK(cs);
+    mapFiles.clear();
+    listLRU.clear();
+}
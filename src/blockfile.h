@@ -0,0 +1,154 @@
+#ifndef BLOCKFILE_H
+#define BLOCKFILE_H
+
+#include "serialize.h"
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+struct CDiskBlockPos;
+
+/** Default number of block files kept mapped by the block file cache (0 disables it) */
+static const int DEFAULT_BLOCKFILE_CACHE = sizeof(void*) >= 8 ? 64 : 0;
+
+/** A blk?????.dat file mapped read-only into memory, unmapped on destruction */
+class CBlockFileMapping
+{
+private:
+    const char* pbegin;
+    size_t nSize;
+
+    CBlockFileMapping(const CBlockFileMapping&);
+    CBlockFileMapping& operator=(const CBlockFileMapping&);
+
+public:
+    CBlockFileMapping(const char* pbeginIn, size_t nSizeIn) : pbegin(pbeginIn), nSize(nSizeIn) {}
+    ~CBlockFileMapping();
+
+    /** Map the whole file at path, or return NULL if it cannot be mapped */
+    static std::shared_ptr<const CBlockFileMapping> Map(const boost::filesystem::path& path);
+
+    const char* begin() const { return pbegin; }
+    size_t size() const { return nSize; }
+};
+
+/**
+ * Read-only stream over a span of a mapped block file. Objects are
+ * deserialized straight from the mapped pages, and the reader holds a
+ * reference to the mapping so the span stays valid even if the cache
+ * evicts or replaces the file while the read is in progress.
+ */
+class CBlockFileReader
+{
+private:
+    const int nType;
+    const int nVersion;
+
+    std::shared_ptr<const CBlockFileMapping> mapping;
+    const char* pcur;
+    const char* pend;
+
+public:
+    CBlockFileReader(int nTypeIn, int nVersionIn) : nType(nTypeIn), nVersion(nVersionIn), pcur(NULL), pend(NULL) {}
+
+    void Reset(const std::shared_ptr<const CBlockFileMapping>& mappingIn, const char* pbeginIn, const char* pendIn)
+    {
+        mapping = mappingIn;
+        pcur = pbeginIn;
+        pend = pendIn;
+    }
+
+    bool IsNull() const { return !mapping; }
+
+    //
+    // Stream subset
+    //
+    int GetType() const          { return nType; }
+    int GetVersion() const       { return nVersion; }
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > (size_t)(pend - pcur))
+            throw std::ios_base::failure("CBlockFileReader::read: end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+    }
+
+    void ignore(size_t nSize)
+    {
+        if (nSize > (size_t)(pend - pcur))
+            throw std::ios_base::failure("CBlockFileReader::ignore: end of data");
+        pcur += nSize;
+    }
+
+    template<typename T>
+    CBlockFileReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        if (!mapping)
+            throw std::ios_base::failure("CBlockFileReader::operator>>: no mapping");
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+};
+
+/**
+ * Bounded, thread-safe cache of mapped block files, used for the read
+ * side of the block store. Each read is bounded by the block length
+ * recorded in the 8 byte header WriteBlockToDisk puts in front of
+ * every block, and a file is mapped again if a block was appended past
+ * the end of the current mapping. The least recently used file is
+ * unmapped once more than nMaxFiles are open.
+ *
+ * Open() returns false when the cache is disabled, on platforms without
+ * mmap and when a file cannot be mapped; callers then fall back to the
+ * stdio path through OpenBlockFile.
+ */
+class CBlockFileCache
+{
+private:
+    typedef std::list<int> LRUList;
+    struct CEntry {
+        std::shared_ptr<const CBlockFileMapping> mapping;
+        LRUList::iterator itLRU;
+    };
+
+    mutable CCriticalSection cs;
+    std::map<int, CEntry> mapFiles;
+    LRUList listLRU;
+    size_t nMaxFiles;
+
+    /** Return the mapping of nFile, mapping it again if it does not cover nEnd bytes */
+    std::shared_ptr<const CBlockFileMapping> GetMapping(const CDiskBlockPos& pos, size_t nEnd);
+    /** Find the span of the block at pos, or return false */
+    bool GetBlockSpan(const CDiskBlockPos& pos, std::shared_ptr<const CBlockFileMapping>& mapping, const char*& pbegin, const char*& pend);
+
+public:
+    CBlockFileCache() : nMaxFiles(0) {}
+
+    void SetMaxFiles(size_t nMaxFilesIn);
+    bool IsEnabled() const { LOCK(cs); return nMaxFiles > 0; }
+
+    /** Point reader at the block stored at pos */
+    bool Open(const CDiskBlockPos& pos, CBlockFileReader& reader);
+
+    /**
+     * Hint that the block at pos will be read soon, so the kernel can
+     * start paging it in. With nBytes the hint covers that many bytes
+     * from pos instead of just the block, for sequential scans.
+     */
+    void Prefetch(const CDiskBlockPos& pos, size_t nBytes = 0);
+
+    /** Drop the mapping of nFile, e.g. because it was truncated or deleted */
+    void Invalidate(int nFile);
+    void Clear();
+};
+
+extern CBlockFileCache blockFileCache;
+
+#endif // BLOCKFILE_H
@@ -0,0 +1,241 @@
+#include "blockfilter.h"
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "util.h"
+
+#include <algorithm>
+
+CBlockFilterDB *pblockfilterdb = NULL;
+
+static const char DB_BLOCK_FILTER = 'f';
+
+namespace {
+
+/** Writes bits most significant first into a byte vector */
+class BitWriter
+{
+    std::vector<unsigned char>& vch;
+    unsigned char nBuffer;
+    int nBits;
+
+public:
+    BitWriter(std::vector<unsigned char>& vchIn) : vch(vchIn), nBuffer(0), nBits(0) {}
+
+    void Write(uint64_t data, int nCount)
+    {
+        while (nCount > 0) {
+            int nTake = std::min(8 - nBits, nCount);
+            unsigned char bits = (data >> (nCount - nTake)) & ((1 << nTake) - 1);
+            nBuffer |= bits << (8 - nBits - nTake);
+            nBits += nTake;
+            nCount -= nTake;
+            if (nBits == 8) {
+                vch.push_back(nBuffer);
+                nBuffer = 0;
+                nBits = 0;
+            }
+        }
+    }
+
+    void Flush()
+    {
+        if (nBits > 0)
+            vch.push_back(nBuffer);
+        nBuffer = 0;
+        nBits = 0;
+    }
+};
+
+class BitReader
+{
+    const std::vector<unsigned char>& vch;
+    size_t nPos;
+    int nBits;
+
+public:
+    BitReader(const std::vector<unsigned char>& vchIn) : vch(vchIn), nPos(0), nBits(0) {}
+
+    bool Read(uint64_t& data, int nCount)
+    {
+        data = 0;
+        while (nCount > 0) {
+            if (nPos >= vch.size())
+                return false;
+            int nTake = std::min(8 - nBits, nCount);
+            unsigned char bits = (vch[nPos] >> (8 - nBits - nTake)) & ((1 << nTake) - 1);
+            data = (data << nTake) | bits;
+            nBits += nTake;
+            nCount -= nTake;
+            if (nBits == 8) {
+                nPos++;
+                nBits = 0;
+            }
+        }
+        return true;
+    }
+};
+
+bool GolombRiceDecode(BitReader& reader, uint8_t P, uint64_t& delta)
+{
+    uint64_t q = 0, bit;
+    while (true) {
+        if (!reader.Read(bit, 1))
+            return false;
+        if (!bit)
+            break;
+        q++;
+    }
+    uint64_t r;
+    if (!reader.Read(r, P))
+        return false;
+    delta = (q << P) + r;
+    return true;
+}
+
+/** Map each element uniformly onto [0, nElements * FILTER_M), sorted */
+std::vector<uint64_t> HashedSet(const uint256& blockHash, uint32_t nElements, const BlockFilterElements& elements)
+{
+    const uint64_t k0 = ReadLE64(blockHash.begin());
+    const uint64_t k1 = ReadLE64(blockHash.begin() + 8);
+    const uint64_t F = (uint64_t)nElements * CBlockFilter::FILTER_M;
+
+    std::vector<uint64_t> vHashed;
+    vHashed.reserve(elements.size());
+    for (BlockFilterElements::const_iterator it = elements.begin(); it != elements.end(); ++it) {
+        uint64_t h = CSipHasher(k0, k1).Write(it->data(), it->size()).Finalize();
+        vHashed.push_back((uint64_t)(((unsigned __int128)h * F) >> 64));
+    }
+    std::sort(vHashed.begin(), vHashed.end());
+    return vHashed;
+}
+
+}
+
+std::vector<unsigned char> CBlockFilter::OutPointElement(const uint256& hash, uint32_t n)
+{
+    std::vector<unsigned char> vch(hash.begin(), hash.end());
+    unsigned char buf[4];
+    WriteLE32(buf, n);
+    vch.insert(vch.end(), buf, buf + 4);
+    return vch;
+}
+
+void CBlockFilter::GetBlockElements(const CBlock& block, BlockFilterElements& elements)
+{
+    for (const CTransaction& tx : block.vtx) {
+        for (const CTxOut& txout : tx.vout) {
+            const CScript& script = txout.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            elements.insert(std::vector<unsigned char>(script.begin(), script.end()));
+
+            // Cryptocondition outputs are looked up by their owner pubkey,
+            // the same one the wallet checks in IsMine. The wallet has no
+            // script to look for a bare multisig output by either, only the
+            // keys in it.
+            if (script.IsPayToCryptoCondition()) {
+                txnouttype whichType;
+                std::vector<std::vector<unsigned char> > vSolutions;
+                if (Solver(script, whichType, vSolutions) && vSolutions.size() > 1)
+                    elements.insert(vSolutions[1]);
+            } else {
+                txnouttype whichType;
+                std::vector<std::vector<unsigned char> > vSolutions;
+                if (Solver(script, whichType, vSolutions) && whichType == TX_MULTISIG) {
+                    // First and last are the key counts
+                    for (size_t i = 1; i + 1 < vSolutions.size(); i++)
+                        elements.insert(vSolutions[i]);
+                }
+            }
+        }
+        if (!tx.IsCoinBase()) {
+            for (const CTxIn& txin : tx.vin)
+                elements.insert(OutPointElement(txin.prevout.hash, txin.prevout.n));
+        }
+    }
+}
+
+CBlockFilter::CBlockFilter(const CBlock& block) : nFlags(0), nElements(0)
+{
+    for (const CTransaction& tx : block.vtx) {
+        if (!tx.vjoinsplit.empty() || !tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty()) {
+            nFlags |= FILTER_HAS_SHIELDED;
+            break;
+        }
+    }
+    BlockFilterElements elements;
+    GetBlockElements(block, elements);
+    Build(block.GetHash(), elements);
+}
+
+void CBlockFilter::Build(const uint256& blockHash, const BlockFilterElements& elements)
+{
+    nElements = elements.size();
+    vData.clear();
+    if (nElements == 0)
+        return;
+
+    std::vector<uint64_t> vHashed = HashedSet(blockHash, nElements, elements);
+    BitWriter writer(vData);
+    uint64_t last = 0;
+    for (uint64_t value : vHashed) {
+        uint64_t delta = value - last;
+        uint64_t q = delta >> FILTER_P;
+        while (q > 0) {
+            int nBits = std::min<uint64_t>(q, 64);
+            writer.Write(~0ULL, nBits);
+            q -= nBits;
+        }
+        writer.Write(0, 1);
+        writer.Write(delta, FILTER_P);
+        last = value;
+    }
+    writer.Flush();
+}
+
+bool CBlockFilter::MatchAny(const uint256& blockHash, const BlockFilterElements& elements) const
+{
+    if (nElements == 0 || elements.empty())
+        return false;
+
+    std::vector<uint64_t> vQuery = HashedSet(blockHash, nElements, elements);
+    std::vector<uint64_t>::const_iterator itQuery = vQuery.begin();
+
+    BitReader reader(vData);
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < nElements; i++) {
+        uint64_t delta;
+        if (!GolombRiceDecode(reader, FILTER_P, delta))
+            return true; // corrupt filter, be conservative
+        value += delta;
+
+        while (itQuery != vQuery.end() && *itQuery < value)
+            ++itQuery;
+        if (itQuery == vQuery.end())
+            return false;
+        if (*itQuery == value)
+            return true;
+    }
+    return false;
+}
+
+CBlockFilterDB::CBlockFilterDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "filters", nCacheSize, fMemory, fWipe) { }
+
+bool CBlockFilterDB::WriteFilter(const uint256& blockHash, const CBlockFilter& filter)
+{
+    return Write(std::make_pair(DB_BLOCK_FILTER, blockHash), filter);
+}
+
+bool CBlockFilterDB::ReadFilter(const uint256& blockHash, CBlockFilter& filter) const
+{
+    return Read(std::make_pair(DB_BLOCK_FILTER, blockHash), filter);
+}
+
+bool CBlockFilterDB::EraseFilter(const uint256& blockHash)
+{
+    return Erase(std::make_pair(DB_BLOCK_FILTER, blockHash));
+}
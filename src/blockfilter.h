@@ -0,0 +1,80 @@
+#ifndef BLOCKFILTER_H
+#define BLOCKFILTER_H
+
+#include "dbwrapper.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <set>
+#include <vector>
+
+class CBlock;
+
+/** Raw byte strings a block filter is built from and queried with */
+typedef std::set<std::vector<unsigned char> > BlockFilterElements;
+
+/**
+ * Compact wallet-relevance filter for one block: a Golomb-coded set over
+ * the scriptPubKeys created, the owner pubkeys of cryptocondition outputs,
+ * the pubkeys of bare multisig outputs and the outpoints spent by the block's transactions. Matching can give
+ * false positives (about 1 in FILTER_M per element) but never false
+ * negatives, so a block whose filter does not match can be skipped by a
+ * rescan unless it carries shielded data.
+ */
+class CBlockFilter
+{
+public:
+    /** Golomb-Rice parameter and false positive rate, as in BIP158 */
+    static const uint8_t FILTER_P = 19;
+    static const uint64_t FILTER_M = 784931;
+
+    enum {
+        /** The block has Sprout or Sapling components, which no filter can rule out */
+        FILTER_HAS_SHIELDED = 1,
+    };
+
+    uint8_t nFlags;
+    uint32_t nElements;
+    std::vector<unsigned char> vData;
+
+    CBlockFilter() : nFlags(0), nElements(0) {}
+    CBlockFilter(const CBlock& block);
+
+    /** Collect the elements a block filter is built from */
+    static void GetBlockElements(const CBlock& block, BlockFilterElements& elements);
+    /** Serialized form of an outpoint element */
+    static std::vector<unsigned char> OutPointElement(const uint256& hash, uint32_t n);
+
+    /** Returns true if any of the query elements may be in the set */
+    bool MatchAny(const uint256& blockHash, const BlockFilterElements& elements) const;
+
+    bool HasShielded() const { return (nFlags & FILTER_HAS_SHIELDED) != 0; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nFlags);
+        READWRITE(VARINT(nElements));
+        READWRITE(vData);
+    }
+
+private:
+    void Build(const uint256& blockHash, const BlockFilterElements& elements);
+};
+
+/** Per-block filter index, kept in its own database next to the block index */
+class CBlockFilterDB : public CDBWrapper
+{
+public:
+    CBlockFilterDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    bool WriteFilter(const uint256& blockHash, const CBlockFilter& filter);
+    bool ReadFilter(const uint256& blockHash, CBlockFilter& filter) const;
+    bool EraseFilter(const uint256& blockHash);
+};
+
+/** Global filter index, NULL unless -blockfilterindex is set */
+extern CBlockFilterDB *pblockfilterdb;
+
+#endif  /* BLOCKFILTER_H */
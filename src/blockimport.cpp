@@ -0,0 +1,125 @@
+#include "blockimport.h"
+
+#include "clientversion.h"
+
+#include <atomic>
+#include <string.h>
+
+void FindBlockSpans(const char* pbegin, const char* pend, const CMessageHeader::MessageStartChars& pchMessageStart,
+                    unsigned int nMaxSize, std::vector<CBlockFileSpan>& vSpans)
+{
+    const char* p = pbegin;
+    while (pend - p >= (ptrdiff_t)(MESSAGE_START_SIZE + sizeof(uint32_t))) {
+        // The zeroed, preallocated end of a block file goes by at memchr speed
+        p = (const char*)memchr(p, pchMessageStart[0], pend - p - MESSAGE_START_SIZE - sizeof(uint32_t) + 1);
+        if (p == NULL)
+            break;
+        if (memcmp(p, pchMessageStart, MESSAGE_START_SIZE) != 0) {
+            p++;
+            continue;
+        }
+        const unsigned char* pch = (const unsigned char*)p + MESSAGE_START_SIZE;
+        unsigned int nSize = pch[0] | (pch[1] << 8) | (pch[2] << 16) | ((uint32_t)pch[3] << 24);
+        const char* pblock = p + MESSAGE_START_SIZE + sizeof(uint32_t);
+        if (nSize < 80 || nSize > nMaxSize || (size_t)(pend - pblock) < nSize) {
+            p++;
+            continue;
+        }
+        CBlockFileSpan span;
+        span.nPos = pblock - pbegin;
+        span.nSize = nSize;
+        vSpans.push_back(span);
+        p = pblock + nSize;
+    }
+}
+
+/** Run f(i) for i in [0, n) on up to nThreads threads, this one included */
+template <typename F>
+static void ParallelFor(int nThreads, size_t n, const F& f)
+{
+    std::atomic<size_t> nNextIndex(0);
+    auto work = [&]() {
+        for (size_t i = nNextIndex++; i < n; i = nNextIndex++)
+            f(i);
+    };
+    boost::thread_group group;
+    for (int t = 1; t < nThreads && (size_t)t < n; t++)
+        group.create_thread(work);
+    work();
+    group.join_all();
+}
+
+CBlockFileParser::CBlockFileParser(const std::shared_ptr<const CBlockFileMapping>& mappingIn, const CMessageHeader::MessageStartChars& pchMessageStart,
+                                   unsigned int nMaxBlockSize, int nThreadsIn, const MarkKnownFunc& fnMarkKnownIn) :
+    mapping(mappingIn), nThreads(std::max(nThreadsIn, 1)), fnMarkKnown(fnMarkKnownIn), nNext(0)
+{
+    FindBlockSpans(mapping->begin(), mapping->begin() + mapping->size(), pchMessageStart, nMaxBlockSize, vSpans);
+    StartBatch();
+}
+
+CBlockFileParser::~CBlockFileParser()
+{
+    // A batch is bounded, so this doesn't hold up a shutdown for long
+    if (threadParse.joinable())
+        threadParse.join();
+}
+
+void CBlockFileParser::StartBatch()
+{
+    vParsed.clear();
+    size_t nBytes = 0;
+    while (nNext + vParsed.size() < vSpans.size() && nBytes < IMPORT_BATCH_SIZE) {
+        vParsed.push_back(CImportedBlock());
+        vParsed.back().span = vSpans[nNext + vParsed.size() - 1];
+        nBytes += vParsed.back().span.nSize;
+    }
+    nNext += vParsed.size();
+    if (!vParsed.empty())
+        threadParse = boost::thread(&CBlockFileParser::ParseBatch, this);
+}
+
+void CBlockFileParser::ParseBatch()
+{
+    const char* pbegin = mapping->begin();
+
+    ParallelFor(nThreads, vParsed.size(), [&](size_t i) {
+        CImportedBlock& imported = vParsed[i];
+        CBlockFileReader reader(SER_DISK, CLIENT_VERSION);
+        reader.Reset(mapping, pbegin + imported.span.nPos, pbegin + imported.span.nPos + imported.span.nSize);
+        try {
+            CBlockHeader header;
+            reader >> header;
+            imported.hash = header.GetHash();
+        } catch (const std::exception& e) {
+            imported.strError = e.what();
+        }
+    });
+
+    if (fnMarkKnown)
+        fnMarkKnown(vParsed);
+
+    ParallelFor(nThreads, vParsed.size(), [&](size_t i) {
+        CImportedBlock& imported = vParsed[i];
+        if (imported.fKnown || !imported.strError.empty())
+            return;
+        CBlockFileReader reader(SER_DISK, CLIENT_VERSION);
+        reader.Reset(mapping, pbegin + imported.span.nPos, pbegin + imported.span.nPos + imported.span.nSize);
+        try {
+            reader >> imported.block;
+            imported.fParsed = true;
+        } catch (const std::exception& e) {
+            imported.block.SetNull();
+            imported.strError = e.what();
+        }
+    });
+}
+
+bool CBlockFileParser::NextBatch(std::vector<CImportedBlock>& vBatch)
+{
+    if (!threadParse.joinable())
+        return false;
+    threadParse.join();
+    vBatch.swap(vParsed);
+    StartBatch();
+    return true;
+}
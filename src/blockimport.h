@@ -0,0 +1,94 @@
+#ifndef KOMODO_BLOCKIMPORT_H
+#define KOMODO_BLOCKIMPORT_H
+
+#include "blockfile.h"
+#include "primitives/block.h"
+#include "protocol.h"
+#include "uint256.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+
+/** Default for -importthreads, 0 picks one per core */
+static const int DEFAULT_IMPORT_THREADS = 0;
+/** Most threads parsing blocks during an import */
+static const int MAX_IMPORT_THREADS = 8;
+/** Blocks are parsed in batches of about this many bytes, one batch ahead of the one being imported */
+static const size_t IMPORT_BATCH_SIZE = 32 << 20;
+
+/** A block found in a block file */
+struct CBlockFileSpan
+{
+    //! Where the serialized block starts, after the message start and size
+    uint64_t nPos;
+    unsigned int nSize;
+};
+
+/**
+ * Find the blocks in [pbegin, pend): a message start followed by a size
+ * between 80 bytes and nMaxSize that fits in what is left. The scan goes
+ * on after the block, so what looks like a message start inside one is
+ * not taken for another.
+ */
+void FindBlockSpans(const char* pbegin, const char* pend, const CMessageHeader::MessageStartChars& pchMessageStart,
+                    unsigned int nMaxSize, std::vector<CBlockFileSpan>& vSpans);
+
+/** A block of a file being imported */
+struct CImportedBlock
+{
+    CBlockFileSpan span;
+    uint256 hash;
+    //! In the block index with its data already, so the body was left alone
+    bool fKnown;
+    //! Whether block holds the deserialized block, otherwise strError says why not
+    bool fParsed;
+    std::string strError;
+    CBlock block;
+
+    CImportedBlock() : fKnown(false), fParsed(false) {}
+};
+
+/**
+ * Parses the blocks of a mapped block file on a pool of threads and hands
+ * them back in file order, a batch at a time. While one batch is being
+ * imported the next one is parsed: first every header is hashed, then the
+ * batch is shown to fnMarkKnown, which sets fKnown on blocks that need no
+ * parsing, and the remaining bodies are deserialized, transaction hashes
+ * included.
+ */
+class CBlockFileParser
+{
+public:
+    typedef std::function<void(std::vector<CImportedBlock>&)> MarkKnownFunc;
+
+    CBlockFileParser(const std::shared_ptr<const CBlockFileMapping>& mappingIn, const CMessageHeader::MessageStartChars& pchMessageStart,
+                     unsigned int nMaxBlockSize, int nThreadsIn, const MarkKnownFunc& fnMarkKnownIn = MarkKnownFunc());
+    ~CBlockFileParser();
+
+    size_t GetBlockCount() const { return vSpans.size(); }
+    /** The next batch in file order, false once the file is done */
+    bool NextBatch(std::vector<CImportedBlock>& vBatch);
+
+private:
+    std::shared_ptr<const CBlockFileMapping> mapping;
+    std::vector<CBlockFileSpan> vSpans;
+    int nThreads;
+    MarkKnownFunc fnMarkKnown;
+
+    //! The batch being parsed, from span nNext on
+    boost::thread threadParse;
+    std::vector<CImportedBlock> vParsed;
+    size_t nNext;
+
+    CBlockFileParser(const CBlockFileParser&);
+    CBlockFileParser& operator=(const CBlockFileParser&);
+
+    void StartBatch();
+    void ParseBatch();
+};
+
+#endif // KOMODO_BLOCKIMPORT_H
@@ -0,0 +1,293 @@
+#include "blockprefetch.h"
+
+#include "main.h"
+#include "util.h"
+
+#include <algorithm>
+
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+CBlockPrefetcher blockPrefetcher;
+
+CCoinsViewPrefetch::CCoinsViewPrefetch(CCoinsView *viewIn) : CCoinsViewBacked(viewIn), nStagedSize(0), nGeneration(0), nHits(0), nStaged(0) {}
+
+bool CCoinsViewPrefetch::GetCoins(const uint256 &txid, CCoins &coins) const
+{
+    {
+        LOCK(cs);
+        boost::unordered_map<uint256, CCoins, CCoinsKeyHasher>::iterator it = mapStaged.find(txid);
+        if (it != mapStaged.end()) {
+            nStagedSize -= it->second.DynamicMemoryUsage();
+            coins.swap(it->second);
+            mapStaged.erase(it);
+            nHits++;
+            return true;
+        }
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewPrefetch::HaveCoins(const uint256 &txid) const
+{
+    {
+        LOCK(cs);
+        if (mapStaged.count(txid))
+            return true;
+    }
+    return base->HaveCoins(txid);
+}
+
+bool CCoinsViewPrefetch::BatchWrite(CCoinsMap &mapCoins,
+                                    const uint256 &hashBlock,
+                                    const uint256 &hashSproutAnchor,
+                                    const uint256 &hashSaplingAnchor,
+                                    CAnchorsSproutMap &mapSproutAnchors,
+                                    CAnchorsSaplingMap &mapSaplingAnchors,
+                                    CNullifiersMap &mapSproutNullifiers,
+                                    CNullifiersMap &mapSaplingNullifiers)
+{
+    bool fOk = base->BatchWrite(mapCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor,
+                                mapSproutAnchors, mapSaplingAnchors, mapSproutNullifiers, mapSaplingNullifiers);
+    // The cache above is empty now and would take staged coins it just
+    // changed as current, and reads that ran across the write may have
+    // seen either side of it
+    Clear();
+    return fOk;
+}
+
+void CCoinsViewPrefetch::Prefetch(const std::vector<uint256> &vTxids)
+{
+    uint64_t nStart;
+    {
+        LOCK(cs);
+        nStart = nGeneration;
+    }
+    std::vector<std::pair<uint256, CCoins> > vFound;
+    BOOST_FOREACH(const uint256 &txid, vTxids) {
+        {
+            LOCK(cs);
+            if (nGeneration != nStart || nStagedSize >= MAX_PREFETCH_COINS_SIZE)
+                return;
+            if (mapStaged.count(txid))
+                continue;
+        }
+        CCoins coins;
+        if (base->GetCoins(txid, coins)) {
+            vFound.push_back(std::make_pair(txid, CCoins()));
+            vFound.back().second.swap(coins);
+        }
+    }
+
+    LOCK(cs);
+    if (nGeneration != nStart)
+        return;
+    for (size_t i = 0; i < vFound.size() && nStagedSize < MAX_PREFETCH_COINS_SIZE; i++) {
+        if (mapStaged.count(vFound[i].first))
+            continue;
+        CCoins &coins = mapStaged[vFound[i].first];
+        coins.swap(vFound[i].second);
+        nStagedSize += coins.DynamicMemoryUsage();
+        nStaged++;
+    }
+}
+
+void CCoinsViewPrefetch::Clear()
+{
+    LOCK(cs);
+    nGeneration++;
+    mapStaged.clear();
+    nStagedSize = 0;
+}
+
+void CCoinsViewPrefetch::GetPrefetchStats(uint64_t &nStagedOut, uint64_t &nHitsOut) const
+{
+    LOCK(cs);
+    nStagedOut = nStaged;
+    nHitsOut = nHits;
+}
+
+void CBlockPrefetcher::Init(size_t nDepthIn, CCoinsViewPrefetch *pcoinsIn)
+{
+    Stop();
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nDepth = nDepthIn;
+    pcoins = pcoinsIn;
+}
+
+bool CBlockPrefetcher::IsEnabled()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return nDepth > 0;
+}
+
+std::shared_ptr<CPrefetchedBlock> CBlockPrefetcher::Prepare(const CQueuedBlock &queued, CCoinsViewPrefetch *pcoinsIn)
+{
+    std::shared_ptr<CPrefetchedBlock> prepared = std::make_shared<CPrefetchedBlock>();
+    const CBlock &block = prepared->block;
+    // A block that can't be read is left to ConnectTip, which reports it
+    if (!ReadBlockFromDisk(queued.nHeight, prepared->block, queued.pos, false) || block.GetHash() != queued.hash)
+        return prepared;
+    prepared->fRead = true;
+
+    std::vector<uint256> vTxids, vBlockTxids;
+    prepared->txdata.reserve(block.vtx.size());
+    vBlockTxids.reserve(block.vtx.size());
+    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+        prepared->txdata.emplace_back(tx);
+        vBlockTxids.push_back(tx.GetHash());
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn &txin, tx.vin)
+                vTxids.push_back(txin.prevout.hash);
+        }
+    }
+    if (pcoinsIn == NULL)
+        return prepared;
+
+    // Outputs of the block itself and of blocks not yet connected are not
+    // below the cache, those lookups just miss
+    std::sort(vTxids.begin(), vTxids.end());
+    vTxids.erase(std::unique(vTxids.begin(), vTxids.end()), vTxids.end());
+    std::sort(vBlockTxids.begin(), vBlockTxids.end());
+    std::vector<uint256> vSpent;
+    vSpent.reserve(vTxids.size());
+    std::set_difference(vTxids.begin(), vTxids.end(), vBlockTxids.begin(), vBlockTxids.end(), std::back_inserter(vSpent));
+    pcoinsIn->Prefetch(vSpent);
+    return prepared;
+}
+
+/** Whether one of pindexA and pindexB is an ancestor of the other */
+static bool IsSameChain(const CBlockIndex *pindexA, const CBlockIndex *pindexB)
+{
+    if (pindexA->GetHeight() > pindexB->GetHeight())
+        std::swap(pindexA, pindexB);
+    return pindexB->GetAncestor(pindexA->GetHeight()) == pindexA;
+}
+
+void CBlockPrefetcher::Start(const std::vector<CBlockIndex*> &vpindex)
+{
+    AssertLockHeld(cs_main);
+    if (vpindex.empty())
+        return;
+    bool fSameChain;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (nDepth == 0)
+            return;
+        fSameChain = !fRunning || IsSameChain(pindexLastQueued, vpindex.back());
+    }
+    // The blocks queued are not going to be connected now, as after a reorg
+    if (!fSameChain)
+        Stop();
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    // Nothing to overlap with a single block
+    if (!fRunning && vpindex.size() < 2)
+        return;
+    int nHeightQueued = fRunning ? pindexLastQueued->GetHeight() : -1;
+    BOOST_FOREACH(const CBlockIndex *pindex, vpindex) {
+        if (pindex->GetHeight() <= nHeightQueued)
+            continue;
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            break;
+        CQueuedBlock queued;
+        queued.pindex = pindex;
+        queued.hash = pindex->GetBlockHash();
+        queued.nHeight = pindex->GetHeight();
+        queued.pos = pindex->GetBlockPos();
+        queue.push_back(queued);
+        pindexLastQueued = pindex;
+        fRunning = true;
+    }
+    cond.notify_all();
+}
+
+std::shared_ptr<CPrefetchedBlock> CBlockPrefetcher::Get(const CBlockIndex *pindex)
+{
+    // Called with cs_main held, in the middle of connecting blocks
+    boost::this_thread::disable_interruption di;
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while (true) {
+        std::map<const CBlockIndex*, std::shared_ptr<CPrefetchedBlock> >::iterator it = mapDone.find(pindex);
+        if (it != mapDone.end()) {
+            std::shared_ptr<CPrefetchedBlock> prepared = it->second;
+            mapDone.erase(it);
+            nReady++;
+            // A slot is free for the next block
+            cond.notify_all();
+            return prepared;
+        }
+        if (setWorking.count(pindex)) {
+            cond.wait(lock);
+            continue;
+        }
+        for (std::deque<CQueuedBlock>::iterator itQueued = queue.begin(); itQueued != queue.end(); ++itQueued) {
+            if (itQueued->pindex == pindex) {
+                CQueuedBlock queued = *itQueued;
+                queue.erase(itQueued);
+                nInline++;
+                lock.unlock();
+                // Its coins would be read right away anyway
+                return Prepare(queued, NULL);
+            }
+        }
+        return std::shared_ptr<CPrefetchedBlock>();
+    }
+}
+
+void CBlockPrefetcher::Stop()
+{
+    boost::this_thread::disable_interruption di;
+    CCoinsViewPrefetch *pcoinsStop;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (!fRunning)
+            return;
+        queue.clear();
+        while (!setWorking.empty())
+            cond.wait(lock);
+        mapDone.clear();
+        fRunning = false;
+        pindexLastQueued = NULL;
+        pcoinsStop = pcoins;
+        LogPrint("bench", "  - Prefetch: %u blocks ready, %u read inline\n", nReady, nInline);
+    }
+    if (pcoinsStop != NULL) {
+        uint64_t nStaged, nHits;
+        pcoinsStop->GetPrefetchStats(nStaged, nHits);
+        LogPrint("bench", "  - Prefetch: %u coins staged, %u used\n", nStaged, nHits);
+        pcoinsStop->Clear();
+    }
+}
+
+void CBlockPrefetcher::ThreadPrefetch()
+{
+    while (true) {
+        CQueuedBlock queued;
+        CCoinsViewPrefetch *pcoinsRun;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            // Interruption point
+            while (queue.empty() || setWorking.size() + mapDone.size() >= nDepth)
+                cond.wait(lock);
+            queued = queue.front();
+            queue.pop_front();
+            setWorking.insert(queued.pindex);
+            pcoinsRun = pcoins;
+        }
+        std::shared_ptr<CPrefetchedBlock> prepared = Prepare(queued, pcoinsRun);
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            setWorking.erase(queued.pindex);
+            // Stop() waits for us and drops this if the run was abandoned
+            mapDone[queued.pindex] = prepared;
+            cond.notify_all();
+        }
+    }
+}
+
+void ThreadBlockPrefetch()
+{
+    RenameThread("komodo-prefetch");
+    blockPrefetcher.ThreadPrefetch();
+}
@@ -0,0 +1,148 @@
+#ifndef KOMODO_BLOCKPREFETCH_H
+#define KOMODO_BLOCKPREFETCH_H
+
+#include "chain.h"
+#include "coins.h"
+#include "primitives/block.h"
+#include "script/interpreter.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/** Default for -prefetchblocks, how many blocks to prepare ahead of the one being connected */
+static const int DEFAULT_PREFETCH_BLOCKS = 16;
+/** Threads preparing blocks when prefetching is on */
+static const int BLOCK_PREFETCH_THREADS = 2;
+/** Memory the staged coins may take, beyond which prefetched inputs are left to be read as usual */
+static const size_t MAX_PREFETCH_COINS_SIZE = 64 << 20;
+
+/**
+ * CCoinsView between pcoinsTip and the coin database holding coins read
+ * ahead of time for blocks about to be connected. A staged entry is handed
+ * out once, as the cache above keeps it from then on.
+ *
+ * The cache above only reads what it does not hold, and what it does not
+ * hold is unchanged below it until it flushes, so a staged entry is good
+ * until the next BatchWrite. That clears the stage, and a read that
+ * started before it is not staged.
+ */
+class CCoinsViewPrefetch : public CCoinsViewBacked
+{
+private:
+    mutable CCriticalSection cs;
+    mutable boost::unordered_map<uint256, CCoins, CCoinsKeyHasher> mapStaged;
+    mutable size_t nStagedSize;
+    //! Bumped by every flush, so reads that overlap one are thrown away
+    uint64_t nGeneration;
+    mutable uint64_t nHits;
+    uint64_t nStaged;
+
+public:
+    CCoinsViewPrefetch(CCoinsView *viewIn);
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    bool BatchWrite(CCoinsMap &mapCoins,
+                    const uint256 &hashBlock,
+                    const uint256 &hashSproutAnchor,
+                    const uint256 &hashSaplingAnchor,
+                    CAnchorsSproutMap &mapSproutAnchors,
+                    CAnchorsSaplingMap &mapSaplingAnchors,
+                    CNullifiersMap &mapSproutNullifiers,
+                    CNullifiersMap &mapSaplingNullifiers);
+
+    /** Read the coins of vTxids from the view below and stage those that exist */
+    void Prefetch(const std::vector<uint256> &vTxids);
+    /** Drop whatever was staged and not used */
+    void Clear();
+    /** Coins staged and coins handed out since startup */
+    void GetPrefetchStats(uint64_t &nStagedOut, uint64_t &nHitsOut) const;
+};
+
+/** A block read and prepared for ConnectBlock off the validation thread */
+struct CPrefetchedBlock
+{
+    CBlock block;
+    //! Sighash midstates, one per transaction
+    std::vector<PrecomputedTransactionData> txdata;
+    bool fRead;
+
+    CPrefetchedBlock() : fRead(false) {}
+};
+
+/**
+ * Prepares the blocks ActivateBestChainStep is about to connect while it
+ * connects the ones before them: reads and deserializes each block,
+ * computes its sighash midstates and stages the coins its inputs spend.
+ * Validation itself stays in chain order on the thread holding cs_main,
+ * since checks like komodo_checkPOW, notary and staking rules depend on
+ * the tip.
+ *
+ * The window runs across the steps of one ActivateBestChain, each step
+ * only adding the blocks past what is already queued, and is abandoned
+ * when the chain being connected changes or the activation ends.
+ */
+class CBlockPrefetcher
+{
+private:
+    struct CQueuedBlock {
+        const CBlockIndex *pindex;
+        uint256 hash;
+        int nHeight;
+        CDiskBlockPos pos;
+    };
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<CQueuedBlock> queue;
+    std::set<const CBlockIndex*> setWorking;
+    std::map<const CBlockIndex*, std::shared_ptr<CPrefetchedBlock> > mapDone;
+    //! Whether blocks were queued since the last Stop()
+    bool fRunning;
+    //! The last block queued since then, the end of the window
+    const CBlockIndex *pindexLastQueued;
+    size_t nDepth;
+    CCoinsViewPrefetch *pcoins;
+    //! Blocks that were ready when asked for, and blocks prepared by the caller itself
+    uint64_t nReady;
+    uint64_t nInline;
+
+    static std::shared_ptr<CPrefetchedBlock> Prepare(const CQueuedBlock &queued, CCoinsViewPrefetch *pcoinsIn);
+
+public:
+    CBlockPrefetcher() : fRunning(false), pindexLastQueued(NULL), nDepth(0), pcoins(NULL), nReady(0), nInline(0) {}
+
+    /** Set how many blocks may be prepared ahead, 0 to disable, and where to stage coins */
+    void Init(size_t nDepthIn, CCoinsViewPrefetch *pcoinsIn);
+    bool IsEnabled();
+
+    /**
+     * Queue the blocks about to be connected, in the order they will be,
+     * past those already queued. A window that leads off the chain of
+     * vpindex is abandoned first. Requires cs_main.
+     */
+    void Start(const std::vector<CBlockIndex*> &vpindex);
+    /**
+     * The prepared pindex, waiting for it if it is being worked on and
+     * preparing it here if no worker got to it yet. NULL if not queued.
+     */
+    std::shared_ptr<CPrefetchedBlock> Get(const CBlockIndex *pindex);
+    /** Abandon what is queued, wait for blocks being prepared and drop them and the staged coins */
+    void Stop();
+
+    void ThreadPrefetch();
+};
+
+extern CBlockPrefetcher blockPrefetcher;
+
+void ThreadBlockPrefetch();
+
+#endif // KOMODO_BLOCKPREFETCH_H
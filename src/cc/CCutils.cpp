@@ -593,9 +593,10 @@ int32_t myIs_coinaddr_inmempoolvout(char const *logcategory,char *coinaddr)
     int32_t i,n; char destaddr[64];
     if ( KOMODO_NSPV_SUPERLITE )
         return(NSPV_coinaddr_inmempool(logcategory,coinaddr,1));
-    BOOST_FOREACH(const CTxMemPoolEntry &e,mempool.mapTx)
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = mempool.GetSnapshot();
+    for (auto &entry : snapshot->mapTx)
     {
-        const CTransaction &tx = e.GetTx();
+        const CTransaction &tx = *entry.second;
         if ( (n= tx.vout.size()) > 0 )
         {
             const uint256 &txid = tx.GetHash();
@@ -616,9 +617,8 @@ int32_t myIs_coinaddr_inmempoolvout(char const *logcategory,char *coinaddr)
 extern struct NSPV_mempoolresp NSPV_mempoolresult;
 extern bool NSPV_evalcode_inmempool(uint8_t evalcode,uint8_t funcid);
 
-int32_t myGet_mempool_txs(std::vector<CTransaction> &txs,uint8_t evalcode,uint8_t funcid)
+int32_t myGet_mempool_txs(std::vector<CTransactionRef> &txs,uint8_t evalcode,uint8_t funcid)
 {
-    int i=0;
 
     if ( KOMODO_NSPV_SUPERLITE )
     {
@@ -627,16 +627,19 @@ int32_t myGet_mempool_txs(std::vector<CTransaction> &txs,uint8_t evalcode,uint8_
         NSPV_evalcode_inmempool(evalcode,funcid);
         for (int i=0;i<NSPV_mempoolresult.numtxids;i++)
         {
-            if (myGetTransaction(NSPV_mempoolresult.txids[i],tx,hashBlock)!=0) txs.push_back(tx);
+            if (myGetTransaction(NSPV_mempoolresult.txids[i],tx,hashBlock)!=0) txs.push_back(std::make_shared<const CTransaction>(tx));
         }
         return (NSPV_mempoolresult.numtxids);
     }
-    BOOST_FOREACH(const CTxMemPoolEntry &e,mempool.mapTx)
-    {
-        txs.push_back(e.GetTx());
-        i++;
-    }
-    return(i);
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = mempool.GetSnapshot();
+    const std::vector<CTransactionRef> &evaltxs = snapshot->GetEvalTxs(evalcode,funcid);
+    size_t n = txs.size();
+    txs.insert(txs.end(),evaltxs.begin(),evaltxs.end());
+    // Token transactions carry the opret of the contract inside their own and
+    // are indexed as tokens, so the caller decodes those itself
+    if ( evalcode != EVAL_TOKENS )
+        snapshot->GetEvalTxs(EVAL_TOKENS,txs);
+    return(txs.size() - n);
 }
 
 int32_t CCCointxidExists(char const *logcategory,uint256 cointxid)
@@ -431,11 +431,11 @@ int64_t AddChannelsInputs(struct CCcontract_info *cp,CMutableTransaction &mtx, C
     {
         txid=zeroid;
         int32_t mindepth=CHANNELS_MAXPAYMENTS;
-        std::vector<CTransaction> tmp_txs;
+        std::vector<CTransactionRef> tmp_txs;
         myGet_mempool_txs(tmp_txs,EVAL_CHANNELS,'P');
-        for (std::vector<CTransaction>::const_iterator it=tmp_txs.begin(); it!=tmp_txs.end(); it++)
+        for (std::vector<CTransactionRef>::const_iterator it=tmp_txs.begin(); it!=tmp_txs.end(); it++)
         {
-            const CTransaction &txmempool = *it;
+            const CTransaction &txmempool = **it;
             const uint256 &hash = txmempool.GetHash();
 
             if ((numvouts=txmempool.vout.size()) > 0 && DecodeChannelsOpRet(txmempool.vout[numvouts-1].scriptPubKey,tokenid,tmp_txid,srcpub,destpub,param1,param2,param3)=='P' &&
@@ -746,11 +746,11 @@ UniValue ChannelsInfo(const CPubKey& pk,uint256 channeltxid)
                 DecodeChannelsOpRet(tx.vout[numvouts-1].scriptPubKey,tokenid,tmp_txid,srcpub,destpub,param1,param2,param3)!=0 && (tmp_txid==channeltxid || tx.GetHash()==channeltxid))
                     txs.push_back(tx);               
         }
-        std::vector<CTransaction> tmp_txs;
+        std::vector<CTransactionRef> tmp_txs;
         myGet_mempool_txs(tmp_txs,EVAL_CHANNELS,'P');
-        for (std::vector<CTransaction>::const_iterator it=tmp_txs.begin(); it!=tmp_txs.end(); it++)
+        for (std::vector<CTransactionRef>::const_iterator it=tmp_txs.begin(); it!=tmp_txs.end(); it++)
         {
-            const CTransaction &txmempool = *it;
+            const CTransaction &txmempool = **it;
 
             if ((numvouts=txmempool.vout.size()) > 0 && DecodeChannelsOpRet(txmempool.vout[numvouts-1].scriptPubKey,tokenid,tmp_txid,srcpub,destpub,param1,param2,param3) == 'P' && tmp_txid==channeltxid)
                 txs.push_back(txmempool);                
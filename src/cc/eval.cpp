@@ -26,6 +26,7 @@
 #include "chain.h"
 #include "core_io.h"
 #include "crosschain.h"
+#include "perfstats.h"
 
 bool CClib_Dispatch(const CC *cond,Eval *eval,std::vector<uint8_t> paramsNull,const CTransaction &txTo,unsigned int nIn);
 char *CClib_name();
@@ -37,14 +38,15 @@ extern pthread_mutex_t KOMODO_CC_mutex;
 bool RunCCEval(const CC *cond, const CTransaction &tx, unsigned int nIn)
 {
     EvalRef eval;
-    pthread_mutex_lock(&KOMODO_CC_mutex);
+    LOCK_PTHREAD_MUTEX(&KOMODO_CC_mutex);
     bool out = eval->Dispatch(cond, tx, nIn);
-    pthread_mutex_unlock(&KOMODO_CC_mutex);
+    UNLOCK_PTHREAD_MUTEX(&KOMODO_CC_mutex);
     if ( eval->state.IsValid() != out)
         fprintf(stderr,"out %d vs %d isValid\n",(int32_t)out,(int32_t)eval->state.IsValid());
     //assert(eval->state.IsValid() == out);
 
     if (eval->state.IsValid()) return true;
+    perfCCEvalRejects.Add();
 
     std::string lvl = eval->state.IsInvalid() ? "Invalid" : "Error!";
     fprintf(stderr, "CC Eval %s %s: %s spending tx %s\n",
@@ -66,6 +68,21 @@ bool RunCCEval(const CC *cond, const CTransaction &tx, unsigned int nIn)
 }
 
 
+/*
+ * Perf stat for an evalcode. Whoever spends a condition picks its code, so
+ * only the built-in ones get a stat of their own
+ */
+#define EVAL_GENERATE_PERFSTAT(L,I) if (ecode == I) return perfCCEval.Get(ecode);
+
+static const CPerfStat& EvalPerfStat(uint8_t ecode)
+{
+    FOREACH_EVAL(EVAL_GENERATE_PERFSTAT);
+    if ( ecode >= EVAL_FIRSTUSER && ecode <= EVAL_LASTUSER )
+        return perfCCEvalCClib;
+    return perfCCEvalOther;
+}
+
+
 /*
  * Test the validity of an Eval node
  */
@@ -76,6 +93,7 @@ bool Eval::Dispatch(const CC *cond, const CTransaction &txTo, unsigned int nIn)
         return Invalid("empty-eval");
 
     uint8_t ecode = cond->code[0];
+    CPerfTimer perfTimer(EvalPerfStat(ecode));
     if ( ASSETCHAINS_CCDISABLES[ecode] != 0 )
     {
         // check if a height activation has been set. 
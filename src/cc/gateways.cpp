@@ -499,14 +499,14 @@ int32_t GatewaysBindExists(struct CCcontract_info *cp,CPubKey gatewayspk,uint256
             }
         }
     }
-    std::vector<CTransaction> tmp_txs;
+    std::vector<CTransactionRef> tmp_txs;
     myGet_mempool_txs(tmp_txs,EVAL_GATEWAYS,'B');
-    for (std::vector<CTransaction>::const_iterator it=tmp_txs.begin(); it!=tmp_txs.end(); it++)
+    for (std::vector<CTransactionRef>::const_iterator it=tmp_txs.begin(); it!=tmp_txs.end(); it++)
     {
-        const CTransaction &txmempool = *it;
+        const CTransaction &txmempool = **it;
 
-        if ((numvouts=txmempool.vout.size()) > 0 && DecodeGatewaysOpRet(tx.vout[numvouts-1].scriptPubKey)=='B')
-            if (DecodeGatewaysBindOpRet(depositaddr,tx.vout[numvouts-1].scriptPubKey,tokenid,coin,totalsupply,oracletxid,M,N,pubkeys,taddr,prefix,prefix2,wiftype) == 'B' &&
+        if ((numvouts=txmempool.vout.size()) > 0 && DecodeGatewaysOpRet(txmempool.vout[numvouts-1].scriptPubKey)=='B')
+            if (DecodeGatewaysBindOpRet(depositaddr,txmempool.vout[numvouts-1].scriptPubKey,tokenid,coin,totalsupply,oracletxid,M,N,pubkeys,taddr,prefix,prefix2,wiftype) == 'B' &&
             tokenid == reftokenid)
                 return(1);
     }
@@ -275,34 +275,118 @@ bool payments_lockedblocks(uint256 blockhash,int32_t lockedblocks,int32_t &block
     return true;
 }
 
+// The daily address snapshot as payments needs it: the scriptPubKey and
+// amount of every address in snapshot order, running totals, and a hashed
+// index from script bytes to position so excluded addresses can be found
+// without scanning. Rebuilt only when komodo_dailysnapshot replaces
+// vAddressSnapshot, guarded by cs_main like the snapshot itself.
+class CPaymentsSnapshot
+{
+public:
+    int32_t nHeight;
+    std::vector<CScript> vScriptPubKeys;
+    std::vector<int64_t> vAmounts;
+    std::vector<unsigned __int128> vTotals;                 // vTotals[j] = vAmounts[0] + ... + vAmounts[j-1]
+    std::unordered_multimap<std::string,int32_t> mapIndex;  // script bytes -> positions
+
+    CPaymentsSnapshot() : nHeight(-1) { }
+
+    bool IsCurrent() const
+    {
+        return nHeight == lastSnapShotHeight && vAmounts.size() == vAddressSnapshot.size();
+    }
+
+    void Build()
+    {
+        vScriptPubKeys.clear(); vAmounts.clear(); vTotals.clear(); mapIndex.clear();
+        vScriptPubKeys.reserve(vAddressSnapshot.size());
+        vAmounts.reserve(vAddressSnapshot.size());
+        vTotals.reserve(vAddressSnapshot.size() + 1);
+        vTotals.push_back(0);
+        for ( auto &address : vAddressSnapshot )
+        {
+            CScript scriptPubKey = GetScriptForDestination(address.second);
+            mapIndex.insert(std::make_pair(std::string(scriptPubKey.begin(), scriptPubKey.end()), (int32_t)vScriptPubKeys.size()));
+            vScriptPubKeys.push_back(scriptPubKey);
+            vAmounts.push_back(address.first);
+            vTotals.push_back(vTotals.back() + (uint64_t)address.first);
+        }
+        nHeight = lastSnapShotHeight;
+    }
+
+    // undecodable addresses all share the empty script, so a script can appear more than once.
+    void Find(const std::vector<uint8_t> &scriptPubKey, int32_t bottom, std::vector<int32_t> &positions) const
+    {
+        auto range = mapIndex.equal_range(std::string(scriptPubKey.begin(), scriptPubKey.end()));
+        for (auto it = range.first; it != range.second; ++it)
+            if ( it->second >= bottom )
+                positions.push_back(it->second);
+    }
+};
+
+static CPaymentsSnapshot paymentsSnapshot;
+
+static const CPaymentsSnapshot &payments_snapshot()
+{
+    if ( !paymentsSnapshot.IsCurrent() )
+        paymentsSnapshot.Build();
+    return(paymentsSnapshot);
+}
+
+static void mpz_set_u128( mpz_t rop, unsigned __int128 op )
+{
+    mpz_import(rop, 1, 1, sizeof(op), 0, 0, &op);
+}
+
 int32_t payments_getallocations(int32_t top, int32_t bottom, const std::vector<std::vector<uint8_t>> &excludeScriptPubKeys, mpz_t &mpzTotalAllocations, std::vector<CScript> &scriptPubKeys,  std::vector<int64_t> &allocations)
 {
-    mpz_t mpzAllocation; int32_t i =0;
-    for (int32_t j = bottom; j < vAddressSnapshot.size(); j++)
+    const CPaymentsSnapshot &snapshot = payments_snapshot();
+    int32_t size = (int32_t)snapshot.vAmounts.size(), end, i = 0;
+    if ( bottom < 0 || bottom >= size )
+        return(0);
+    // positions of excluded addresses at or above bottom, in snapshot order.
+    std::vector<int32_t> excluded;
+    for ( auto &skipkey : excludeScriptPubKeys )
+        snapshot.Find(skipkey, bottom, excluded);
+    std::sort(excluded.begin(), excluded.end());
+    excluded.erase(std::unique(excluded.begin(), excluded.end()), excluded.end());
+    // pay up to top-bottom addresses, stepping over excluded ones. It can be less than this, if less address exist on chain, return the number we got.
+    // When the range is empty the scan stops at bottom if that address is excluded and otherwise runs to the end of the snapshot.
+    if ( top - bottom > 0 )
     {
-        auto &address = vAddressSnapshot[j];
-        CScript scriptPubKey = GetScriptForDestination(address.second); 
-        bool skip = false;
-        // skip excluded addresses. 
-        for ( auto skipkey : excludeScriptPubKeys ) 
+        end = bottom + (top - bottom);
+        for ( auto j : excluded )
         {
-            if ( scriptPubKey == CScript(skipkey.begin(), skipkey.end()) )
-                skip = true;
+            if ( j < end )
+                end++;
+            else break;
         }
-        if ( !skip )
+        end = std::min(end, size);
+    }
+    else if ( top == bottom && !excluded.empty() && excluded[0] == bottom )
+        end = bottom;
+    else end = size;
+    unsigned __int128 total = snapshot.vTotals[end] - snapshot.vTotals[bottom];
+    scriptPubKeys.reserve(scriptPubKeys.size() + (end - bottom));
+    allocations.reserve(allocations.size() + (end - bottom));
+    std::vector<int32_t>::const_iterator skip = excluded.begin();
+    for (int32_t j = bottom; j < end; j++)
+    {
+        if ( skip != excluded.end() && *skip == j )
         {
-            mpz_init(mpzAllocation); 
-            i++;
-            //fprintf(stderr, "address: %s nValue.%li \n", CBitcoinAddress(address.second).ToString().c_str(), address.first);
-            scriptPubKeys.push_back(scriptPubKey);
-            allocations.push_back(address.first);
-            mpz_set_lli(mpzAllocation,address.first);
-            mpz_add(mpzTotalAllocations,mpzTotalAllocations,mpzAllocation); 
-            mpz_clear(mpzAllocation);
+            total -= (uint64_t)snapshot.vAmounts[j];
+            ++skip;
+            continue;
         }
-        if ( i+bottom == top ) 
-            break; // we reached top amount to pay, it can be less than this, if less address exist on chain, return the number we got.
+        scriptPubKeys.push_back(snapshot.vScriptPubKeys[j]);
+        allocations.push_back(snapshot.vAmounts[j]);
+        i++;
     }
+    mpz_t mpzAllocation;
+    mpz_init(mpzAllocation);
+    mpz_set_u128(mpzAllocation,total);
+    mpz_add(mpzTotalAllocations,mpzTotalAllocations,mpzAllocation);
+    mpz_clear(mpzAllocation);
     return(i);
 }
 
@@ -349,9 +349,10 @@ static uint64_t myIs_unlockedtx_inmempool(uint256 &txid,int32_t &vout,uint64_t r
     memset(&txid,0,sizeof(txid));
     vout = -1;
     nValue = 0;
-    BOOST_FOREACH(const CTxMemPoolEntry &e,mempool.mapTx)
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = mempool.GetSnapshot();
+    for (auto &entry : snapshot->mapTx)
     {
-        const CTransaction &tx = e.GetTx();
+        const CTransaction &tx = *entry.second;
         if ( tx.vout.size() > 0 && tx.vout[0].nValue >= needed )
         {
             const uint256 &hash = tx.GetHash();
@@ -19,9 +19,79 @@
  ******************************************************************************/
 
 #include "chain.h"
+#include "main.h"
+#include "txdb.h"
 
 using namespace std;
 
+/**
+ * CBlockIndex solution storage
+ *
+ * Once an index entry is in the block tree db its solution is dropped from
+ * memory. Solutions read back are kept in a small LRU so that serving the
+ * same run of headers to several peers only goes to disk once.
+ */
+static const size_t SOLUTION_CACHE_SIZE = 4096;
+
+static CCriticalSection cs_solutioncache;
+static std::list<std::pair<uint256, std::vector<unsigned char> > > listSolutionCache;
+static std::map<uint256, std::list<std::pair<uint256, std::vector<unsigned char> > >::iterator> mapSolutionCache;
+
+std::vector<unsigned char> CBlockIndex::GetSolution() const
+{
+    if (HasSolution())
+        return nSolution;
+
+    const uint256 hash = GetBlockHash();
+    {
+        LOCK(cs_solutioncache);
+        auto it = mapSolutionCache.find(hash);
+        if (it != mapSolutionCache.end()) {
+            listSolutionCache.splice(listSolutionCache.begin(), listSolutionCache, it->second);
+            return it->second->second;
+        }
+    }
+
+    CDiskBlockIndex dbindex;
+    if (!pblocktree->ReadDiskBlockIndex(hash, dbindex)) {
+        LogPrintf("%s: failed to read index entry of block %s\n", __func__, hash.ToString());
+        throw std::runtime_error("Failed to read block index entry");
+    }
+
+    LOCK(cs_solutioncache);
+    if (mapSolutionCache.count(hash) == 0) {
+        listSolutionCache.push_front(std::make_pair(hash, dbindex.nSolution));
+        mapSolutionCache[hash] = listSolutionCache.begin();
+        if (listSolutionCache.size() > SOLUTION_CACHE_SIZE) {
+            mapSolutionCache.erase(listSolutionCache.back().first);
+            listSolutionCache.pop_back();
+        }
+    }
+    return dbindex.nSolution;
+}
+
+void CBlockIndex::TrimSolution()
+{
+    // swap rather than clear so the allocation is actually released
+    std::vector<unsigned char>().swap(nSolution);
+    fSolutionTrimmed = true;
+}
+
+CBlockHeader CBlockIndex::GetBlockHeader() const
+{
+    CBlockHeader block;
+    block.nVersion       = nVersion;
+    if (pprev)
+        block.hashPrevBlock = pprev->GetBlockHash();
+    block.hashMerkleRoot = hashMerkleRoot;
+    block.hashFinalSaplingRoot   = hashFinalSaplingRoot;
+    block.nTime          = nTime;
+    block.nBits          = nBits;
+    block.nNonce         = nNonce;
+    block.nSolution      = GetSolution();
+    return block;
+}
+
 /**
  * CChain implementation
  */
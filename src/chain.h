@@ -305,10 +305,14 @@ public:
     unsigned int nTime;
     unsigned int nBits;
     uint256 nNonce;
+    //! Empty once trimmed, see TrimSolution(). Use GetSolution() to read it.
     std::vector<unsigned char> nSolution;
 
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
+
+    //! (memory only) nSolution was freed after the index was written to the block tree db
+    bool fSolutionTrimmed;
     
     void SetNull()
     {
@@ -329,6 +333,7 @@ public:
         hashSproutAnchor = uint256();
         hashFinalSproutRoot = uint256();
         nSequenceId = 0;
+        fSolutionTrimmed = false;
         nSproutValue = boost::none;
         nChainSproutValue = boost::none;
         nSaplingValue = 0;
@@ -389,21 +394,20 @@ public:
         return ret;
     }
 
-    CBlockHeader GetBlockHeader() const
+    //! The full header, reading the solution back from disk if it was trimmed
+    CBlockHeader GetBlockHeader() const;
+
+    bool HasSolution() const
     {
-        CBlockHeader block;
-        block.nVersion       = nVersion;
-        if (pprev)
-            block.hashPrevBlock = pprev->GetBlockHash();
-        block.hashMerkleRoot = hashMerkleRoot;
-        block.hashFinalSaplingRoot   = hashFinalSaplingRoot;
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
-        block.nSolution      = nSolution;
-        return block;
+        return !fSolutionTrimmed;
     }
 
+    //! The equihash solution, from memory or from the block tree db
+    std::vector<unsigned char> GetSolution() const;
+
+    //! Free the in-memory solution. Only valid once this index is on disk.
+    void TrimSolution();
+
     uint256 GetBlockHash() const
     {
         return *phashBlock;
@@ -468,15 +472,22 @@ public:
     CBlockIndex* GetAncestor(int height);
     const CBlockIndex* GetAncestor(int height) const;
 
+    // the PoS fields live in the nonce, so these do not need the solution
     int32_t GetVerusPOSTarget() const
     {
-        return GetBlockHeader().GetVerusPOSTarget();
+        CBlockHeader block;
+        block.nNonce = nNonce;
+        return block.GetVerusPOSTarget();
     }
 
     bool IsVerusPOSBlock() const
     {
         if ( ASSETCHAINS_LWMAPOS != 0 )
-            return GetBlockHeader().IsVerusPOSBlock();
+        {
+            CBlockHeader block;
+            block.nNonce = nNonce;
+            return block.IsVerusPOSBlock();
+        }
         else return(0);
     }
 };
@@ -493,6 +504,10 @@ public:
 
     explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        if (!HasSolution()) {
+            nSolution = pindex->GetSolution();
+            fSolutionTrimmed = false;
+        }
     }
 
     ADD_SERIALIZE_METHODS;
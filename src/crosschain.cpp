@@ -17,7 +17,9 @@
 #include "crosschain.h"
 #include "importcoin.h"
 #include "main.h"
+#include "momaccumulator.h"
 #include "notarisationdb.h"
+#include "perfstats.h"
 #include "merkleblock.h"
 
 #include "cc/CCinclude.h"
@@ -125,6 +127,7 @@ end:
 template <typename IsTarget>
 int ScanNotarisationsFromHeight(int nHeight, const IsTarget f, Notarisation &found)
 {
+    CPerfTimer perfTimer(perfNotarisationScan);
     int limit = std::min(nHeight + NOTARISATION_SCAN_LIMIT_BLOCKS, chainActive.Height());
     int start = std::max(nHeight, 1);
 
@@ -456,6 +459,7 @@ TxProof GetAssetchainProof(uint256 hash,CTransaction burnTx)
     }
 
     // build merkle chain from blocks to MoM
+    if (!momAccumulator.GetMoMBranch(nota.second.height, nota.second.MoMDepth, nIndex, branch))
     {
         std::vector<uint256> leaves, tree;
         for (int i=0; i<nota.second.MoMDepth; i++) {
@@ -465,8 +469,10 @@ TxProof GetAssetchainProof(uint256 hash,CTransaction burnTx)
         bool fMutated;
         BuildMerkleTree(&fMutated, leaves, tree);
         branch = GetMerkleBranch(nIndex, leaves.size(), tree);
+    }
 
-        // Check branch
+    // Check branch
+    {
         uint256 ourResult = SafeCheckMerkleBranch(blockIndex->hashMerkleRoot, branch, nIndex);
         if (nota.second.MoM != ourResult)
             throw std::runtime_error("Failed merkle block->MoM");
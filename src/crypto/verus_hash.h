@@ -74,7 +74,14 @@ class CVerusHashV2
         static void Hash(void *result, const void *data, size_t len);
         static void (*haraka512Function)(unsigned char *out, const unsigned char *in);
 
+        // hash n independent inputs into n consecutive 32 byte results, running
+        // four of them side by side through the multi-lane haraka kernel when
+        // the CPU has AES-NI and one at a time otherwise
+        static void HashBatch(unsigned char *results, const unsigned char *const *data, const size_t *lens, size_t n);
+
         static void init();
+        // fOptimized false selects the portable code whatever the CPU, for the tests
+        static void init(bool fOptimized);
 
         CVerusHashV2() {}
 
@@ -111,6 +118,12 @@ class CVerusHashV2
         }
 
     private:
+        static bool fMultiLane;
+
+        template <int LANES>
+        static void HashLanes(unsigned char *results, const unsigned char *const *data, const size_t *lens,
+                              void (*harakaLanes)(unsigned char *out, const unsigned char *in));
+
         // only buf1, the first source, needs to be zero initialized
         unsigned char buf1[64] = {0}, buf2[64];
         unsigned char *curBuf = buf1, *result = buf2;
@@ -119,6 +132,7 @@ class CVerusHashV2
 
 extern void verus_hash(void *result, const void *data, size_t len);
 extern void verus_hash_v2(void *result, const void *data, size_t len);
+extern void verus_hash_v2_batch(void *results, const void *const *data, const size_t *lens, size_t n);
 
 inline bool IsCPUVerusOptimized()
 {
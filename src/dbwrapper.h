@@ -152,6 +152,11 @@ public:
         return piter->value().size();
     }
 
+    void GetValueBytes(std::vector<char>& vchValue) {
+        leveldb::Slice slValue = piter->value();
+        vchValue.assign(slValue.data(), slValue.data() + slValue.size());
+    }
+
 };
 
 class CDBWrapper
@@ -0,0 +1,153 @@
+#include "headercache.h"
+
+#include "chain.h"
+#include "main.h"
+#include "memusage.h"
+#include "primitives/block.h"
+#include "version.h"
+
+#include <algorithm>
+
+CHeaderCache headerCache;
+
+CHeaderBucket::CHeaderBucket(int nFirstHeightIn, const std::vector<CBlockHeader>& vHeaders, const std::vector<uint256>& vHashesIn) :
+    nFirstHeight(nFirstHeightIn), vHashes(vHashesIn)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    vOffsets.reserve(vHeaders.size() + 1);
+    for (size_t i = 0; i < vHeaders.size(); i++) {
+        vOffsets.push_back(ss.size());
+        // with the empty transaction count, as CNetworkBlockHeader sends it
+        ss << CNetworkBlockHeader(vHeaders[i]);
+    }
+    vOffsets.push_back(ss.size());
+    vData.assign(ss.begin(), ss.end());
+}
+
+bool CHeaderBucket::Matches(int nHeight, const uint256& hash) const
+{
+    return nHeight >= nFirstHeight && nHeight < nFirstHeight + (int)vHashes.size() && vHashes[nHeight - nFirstHeight] == hash;
+}
+
+void CHeaderBucket::Write(CDataStream& ss, int nFromHeight, int nToHeight) const
+{
+    assert(nFromHeight >= nFirstHeight && nToHeight <= nFirstHeight + (int)vHashes.size());
+    uint32_t nBegin = vOffsets[nFromHeight - nFirstHeight], nEnd = vOffsets[nToHeight - nFirstHeight];
+    ss.write(&vData[0] + nBegin, nEnd - nBegin);
+}
+
+size_t CHeaderBucket::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(vHashes) + memusage::DynamicUsage(vOffsets) + memusage::DynamicUsage(vData);
+}
+
+void CHeaderCache::SetMaxSize(size_t nMaxSizeIn)
+{
+    LOCK(cs);
+    nMaxSize = nMaxSizeIn;
+    while (nSize > nMaxSize && !mapBuckets.empty())
+        Erase(mapBuckets.find(listBuckets.back().first));
+}
+
+void CHeaderCache::Clear()
+{
+    LOCK(cs);
+    listBuckets.clear();
+    mapBuckets.clear();
+    nSize = 0;
+}
+
+void CHeaderCache::Erase(std::map<int, BucketList::iterator>::iterator it)
+{
+    AssertLockHeld(cs);
+    nSize -= it->second->second->DynamicMemoryUsage();
+    listBuckets.erase(it->second);
+    mapBuckets.erase(it);
+}
+
+std::shared_ptr<const CHeaderBucket> CHeaderCache::Get(int nBucket, int nHeight, const uint256& hash)
+{
+    LOCK(cs);
+    std::map<int, BucketList::iterator>::iterator it = mapBuckets.find(nBucket);
+    if (it == mapBuckets.end() || !it->second->second->Matches(nHeight, hash))
+        return std::shared_ptr<const CHeaderBucket>();
+    listBuckets.splice(listBuckets.begin(), listBuckets, it->second);
+    return it->second->second;
+}
+
+void CHeaderCache::Put(int nBucket, const std::shared_ptr<const CHeaderBucket>& bucket)
+{
+    LOCK(cs);
+    std::map<int, BucketList::iterator>::iterator it = mapBuckets.find(nBucket);
+    if (it != mapBuckets.end())
+        Erase(it);
+    size_t nUsage = bucket->DynamicMemoryUsage();
+    if (nUsage > nMaxSize)
+        return;
+    while (nSize + nUsage > nMaxSize)
+        Erase(mapBuckets.find(listBuckets.back().first));
+    listBuckets.push_front(std::make_pair(nBucket, bucket));
+    mapBuckets[nBucket] = listBuckets.begin();
+    nSize += nUsage;
+}
+
+void CHeaderCache::WriteHeaders(CDataStream& ss, const CBlockIndex* pindexLast, int nCount)
+{
+    const int nEnd = pindexLast->GetHeight() + 1;
+    int nHeight = nEnd - nCount;
+    assert(nHeight >= 0);
+    WriteCompactSize(ss, nCount);
+
+    while (nHeight < nEnd) {
+        const int nBucket = nHeight / BUCKET_SIZE;
+        const int nBucketStart = nBucket * BUCKET_SIZE;
+        const int nNext = std::min(nBucketStart + BUCKET_SIZE, nEnd);
+        // The last header this bucket gives us, on the chain being served
+        const CBlockIndex* pindexUpTo = pindexLast->GetAncestor(nNext - 1);
+
+        std::shared_ptr<const CHeaderBucket> bucket = Get(nBucket, nNext - 1, pindexUpTo->GetBlockHash());
+        if (!bucket) {
+            // A whole bucket of the active chain is built once and kept, a
+            // part of one at the tip or off the active chain only served
+            bool fWhole = false;
+            int nFrom = nHeight;
+            std::vector<const CBlockIndex*> vTrimmed;
+            std::vector<CBlockHeader> vHeaders;
+            std::vector<uint256> vHashes;
+            {
+                LOCK(cs_main);
+                const CBlockIndex* pindexTo = pindexUpTo;
+                const CBlockIndex* pindexBucketEnd = chainActive[nBucketStart + BUCKET_SIZE - 1];
+                if (pindexBucketEnd != NULL && pindexBucketEnd->GetAncestor(nNext - 1) == pindexUpTo) {
+                    fWhole = true;
+                    nFrom = nBucketStart;
+                    pindexTo = pindexBucketEnd;
+                }
+                size_t nHeaders = pindexTo->GetHeight() - nFrom + 1;
+                vTrimmed.resize(nHeaders);
+                vHeaders.resize(nHeaders);
+                vHashes.resize(nHeaders);
+                for (const CBlockIndex* pindex = pindexTo; pindex != NULL && pindex->GetHeight() >= nFrom; pindex = pindex->pprev) {
+                    size_t i = pindex->GetHeight() - nFrom;
+                    vHashes[i] = pindex->GetBlockHash();
+                    if (pindex->HasSolution())
+                        vHeaders[i] = pindex->GetBlockHeader();
+                    else
+                        vTrimmed[i] = pindex;
+                }
+            }
+
+            // A trimmed entry stays trimmed and its header fields never change,
+            // so reading its solution back from disk needs no lock
+            for (size_t i = 0; i < vTrimmed.size(); i++) {
+                if (vTrimmed[i] != NULL)
+                    vHeaders[i] = vTrimmed[i]->GetBlockHeader();
+            }
+            bucket = std::make_shared<const CHeaderBucket>(nFrom, vHeaders, vHashes);
+            if (fWhole)
+                Put(nBucket, bucket);
+        }
+        bucket->Write(ss, nHeight, nNext);
+        nHeight = nNext;
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef KOMODO_HEADERCACHE_H
+#define KOMODO_HEADERCACHE_H
+
+#include "streams.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+
+class CBlockHeader;
+class CBlockIndex;
+
+/** Default for -headercache, in MiB */
+static const unsigned int DEFAULT_HEADER_CACHE_SIZE = 32;
+
+/** The serialized headers of a bucket of consecutive blocks, as they go into a headers message */
+class CHeaderBucket
+{
+public:
+    int nFirstHeight;
+    std::vector<uint256> vHashes;
+    //! Where each header starts in vData, plus the end
+    std::vector<uint32_t> vOffsets;
+    std::vector<char> vData;
+
+    CHeaderBucket(int nFirstHeightIn, const std::vector<CBlockHeader>& vHeaders, const std::vector<uint256>& vHashesIn);
+
+    /** Whether the bucket holds hash at nHeight, and so every header up to it */
+    bool Matches(int nHeight, const uint256& hash) const;
+    /** Append the headers from nFromHeight up to, not including, nToHeight */
+    void Write(CDataStream& ss, int nFromHeight, int nToHeight) const;
+    size_t DynamicMemoryUsage() const;
+};
+
+/**
+ * Serialized getheaders replies. Headers are kept in buckets of BUCKET_SIZE
+ * heights, so a reply starting anywhere is spliced together from at most
+ * two of them instead of being built header by header from the block index,
+ * where solutions are usually trimmed to disk. Buckets are checked against
+ * the chain being served, so a reorg just makes a stale one miss.
+ */
+class CHeaderCache
+{
+public:
+    //! One full headers message
+    static const int BUCKET_SIZE = 160;
+
+    CHeaderCache() : nMaxSize(DEFAULT_HEADER_CACHE_SIZE << 20), nSize(0) {}
+
+    void SetMaxSize(size_t nMaxSizeIn);
+    void Clear();
+
+    /**
+     * Serialize the payload of a headers message: the nCount headers ending
+     * at pindexLast. Takes cs_main only to look at the block index, and
+     * must be called without it, as trimmed solutions are read from disk.
+     */
+    void WriteHeaders(CDataStream& ss, const CBlockIndex* pindexLast, int nCount);
+
+private:
+    typedef std::list<std::pair<int, std::shared_ptr<const CHeaderBucket> > > BucketList;
+
+    mutable CCriticalSection cs;
+    //! Most recently used first
+    BucketList listBuckets;
+    std::map<int, BucketList::iterator> mapBuckets;
+    size_t nMaxSize;
+    size_t nSize;
+
+    std::shared_ptr<const CHeaderBucket> Get(int nBucket, int nHeight, const uint256& hash);
+    void Put(int nBucket, const std::shared_ptr<const CHeaderBucket>& bucket);
+    void Erase(std::map<int, BucketList::iterator>::iterator it);
+};
+
+extern CHeaderCache headerCache;
+
+#endif // KOMODO_HEADERCACHE_H
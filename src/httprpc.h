@@ -49,4 +49,12 @@ void InterruptREST();
  */
 void StopREST();
 
+/** Serve the performance stats at /metrics for Prometheus to scrape.
+ * Precondition; HTTP and RPC has been started.
+ */
+bool StartPrometheus();
+/** Stop serving the performance stats.
+ */
+void StopPrometheus();
+
 #endif
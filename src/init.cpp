@@ -35,6 +35,11 @@
 #include "httprpc.h"
 #include "key.h"
 #include "notarisationdb.h"
+#include "blockfile.h"
+#include "blockfilter.h"
+#include "blockimport.h"
+#include "blockprefetch.h"
+#include "headercache.h"
 
 #ifdef ENABLE_MINING
 #include "key_io.h"
@@ -45,6 +50,7 @@
 #include "net.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 #include "scheduler.h"
 #include "txdb.h"
@@ -199,6 +205,7 @@ public:
 
 static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
+static CCoinsViewPrefetch *pcoinsprefetch = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
 void Interrupt(boost::thread_group& threadGroup)
@@ -231,6 +238,7 @@ void Shutdown()
 
     StopHTTPRPC();
     StopREST();
+    StopPrometheus();
     StopRPC();
     StopHTTPServer();
 #ifdef ENABLE_WALLET
@@ -266,13 +274,21 @@ void Shutdown()
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
+        blockPrefetcher.Init(0, NULL);
+        delete pcoinsprefetch;
+        pcoinsprefetch = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
+        delete pcoinsflush;
+        pcoinsflush = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        delete pblockfilterdb;
+        pblockfilterdb = NULL;
     }
+    blockFileCache.Clear();
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(true);
@@ -376,10 +392,14 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("This help message"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-assumevalidnotarized=<hash>", _("Skip script and CC checks of this notarized block and its ancestors past the last checkpoint (default: 0, check them all)"));
+    strUsage += HelpMessageOpt("-backgroundflush", strprintf(_("Write chainstate flushes to disk in the background instead of holding up validation (default: %u)"), DEFAULT_BACKGROUND_FLUSH));
+    strUsage += HelpMessageOpt("-blockfilecache=<n>", strprintf(_("Keep up to <n> block files mapped into memory for block and transaction reads, 0 to disable (default: %u)"), DEFAULT_BLOCKFILE_CACHE));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 288));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), 3));
     strUsage += HelpMessageOpt("-clientname=<SomeName>", _("Full node client name, default 'MagicBean'"));
+    strUsage += HelpMessageOpt("-coinsbyoutpoint", strprintf(_("Store the chainstate as one record per unspent output, migrating an existing chainstate in the background; older versions can only use it again after -reindex (default: %u)"), DEFAULT_COINS_BY_OUTPOINT));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), "komodo.conf"));
     if (mode == HMM_BITCOIND)
     {
@@ -390,7 +410,11 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-exportdir=<dir>", _("Specify directory to be used when exporting data"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-headercache=<n>", strprintf(_("Keep up to <n> megabytes of serialized headers to answer getheaders with (default: %u)"), DEFAULT_HEADER_CACHE_SIZE));
+    strUsage += HelpMessageOpt("-importthreads=<n>", strprintf(_("Set the number of threads parsing blocks for -reindex and -loadblock (up to %d, 0 = auto, 1 = parse serially, default: %d)"),
+        MAX_IMPORT_THREADS, DEFAULT_IMPORT_THREADS));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
+    strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes, evicting the lowest fee rate packages first (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-mempooltxinputlimit=<n>", _("[DEPRECATED FROM OVERWINTER] Set the maximum number of transparent inputs in a transaction that the mempool will accept (default: 0 = no limit applied)"));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
@@ -398,10 +422,12 @@ std::string HelpMessage(HelpMessageMode mode)
 #ifndef _WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), "komodod.pid"));
 #endif
+    strUsage += HelpMessageOpt("-prefetchblocks=<n>", strprintf(_("When connecting several blocks, read and prepare up to <n> of them ahead of the one being validated, 0 to disable (default: %u)"), DEFAULT_PREFETCH_BLOCKS));
     strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode disables wallet support and is incompatible with -txindex. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild block chain index from current blk000??.dat files on startup"));
+    strUsage += HelpMessageOpt("-trimsolutions", strprintf(_("Keep block header solutions on disk instead of in memory once the block index is written, reading them back when headers are served (default: %u)"), DEFAULT_TRIM_SOLUTIONS));
 #if !defined(WIN32)
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
@@ -409,6 +435,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain a full address index, used to query for the balance, txids and unspent outputs for addresses (default: %u)"), DEFAULT_ADDRESSINDEX));
     strUsage += HelpMessageOpt("-timestampindex", strprintf(_("Maintain a timestamp index for block hashes, used to query blocks hashes by a range of timestamps (default: %u)"), DEFAULT_TIMESTAMPINDEX));
     strUsage += HelpMessageOpt("-spentindex", strprintf(_("Maintain a full spent index, used to query the spending txid and input index for an outpoint (default: %u)"), DEFAULT_SPENTINDEX));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain compact per-block wallet filters, used to speed up rescans and served to nSPV clients (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
     strUsage += HelpMessageOpt("-asmap=<file>", strprintf("Specify asn mapping used for bucketing of the peers (default: %s). Relative paths will be prefixed by the net-specific datadir location.", DEFAULT_ASMAP_FILENAME));
@@ -419,6 +446,9 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-discover", _("Discover own IP addresses (default: 1 when listening and no -externalip or -proxy)"));
     strUsage += HelpMessageOpt("-dns", _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + _("(default: 1)"));
     strUsage += HelpMessageOpt("-dnsseed", _("Query for peer addresses via DNS lookup, if low on addresses (default: 1 unless -connect)"));
+#ifdef HAVE_SYS_EPOLL_H
+    strUsage += HelpMessageOpt("-epoll", strprintf(_("Wait on peer sockets with epoll instead of select(), lifting the FD_SETSIZE limit on -maxconnections (default: %u)"), DEFAULT_EPOLL));
+#endif
     strUsage += HelpMessageOpt("-externalip=<ip>", _("Specify your own public address"));
     strUsage += HelpMessageOpt("-forcednsseed", strprintf(_("Always query for peer addresses via DNS lookup (default: %u)"), 0));
     strUsage += HelpMessageOpt("-listen", _("Accept connections from outside (default: 1 if no -proxy or -connect)"));
@@ -436,6 +466,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), 1));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+    strUsage += HelpMessageOpt("-servingthreads=<n>", strprintf(_("Number of threads answering getdata, getheaders and nSPV requests from peers, 0 answers them on the message handler thread (default: %d)"), DEFAULT_SERVING_THREADS));
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
@@ -504,13 +535,16 @@ std::string HelpMessage(HelpMessageMode mode)
         _("If <category> is not supplied or if <category> = 1, output all debugging information.") + " " + _("<category> can be:") + " " + debugCategories + ".");
     strUsage += HelpMessageOpt("-experimentalfeatures", _("Enable use of experimental features"));
     strUsage += HelpMessageOpt("-help-debug", _("Show all debugging options (usage: --help -help-debug)"));
+    strUsage += HelpMessageOpt("-lockprofile", strprintf(_("Time the waits for and holds of cs_main, cs_wallet, mempool.cs and the komodo mutexes by lock site, see getlockprofile (default: %u)"), DEFAULT_LOCK_PROFILE));
+    if (showDebug)
+        strUsage += HelpMessageOpt("-lockprofilesample=<n>", strprintf("Time one in every <n> lock acquisitions with -lockprofile (default: %u)", DEFAULT_LOCK_PROFILE_SAMPLE));
     strUsage += HelpMessageOpt("-logips", strprintf(_("Include IP addresses in debug output (default: %u)"), 0));
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), 1));
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", 15));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", 0));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> entries (default: %u)", 50000));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> entries (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying (default: %s)"),
@@ -524,6 +558,7 @@ std::string HelpMessage(HelpMessageMode mode)
             "This is intended for regression testing tools and app development.");
     }
     strUsage += HelpMessageOpt("-shrinkdebugfile", _("Shrink debug.log file on client startup (default: 1 when no -debug)"));
+    strUsage += HelpMessageOpt("-startupbench", strprintf(_("Log how long each stage of startup takes, prefixed with startupbench (default: %u)"), DEFAULT_STARTUPBENCH));
     strUsage += HelpMessageOpt("-testnet", _("Use the test network"));
 
     strUsage += HelpMessageGroup(_("Node relay options:"));
@@ -557,6 +592,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-prometheus", strprintf(_("Serve the stats of getperfstats at /metrics in the Prometheus text format, without authentication (default: %u)"), 0));
     strUsage += HelpMessageOpt("-rpcbind=<addr>", _("Bind to given address to listen for JSON-RPC connections. Use [host]:port notation for IPv6. This option can be specified multiple times (default: bind to all interfaces)"));
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
@@ -693,7 +729,7 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
             if (!file)
                 break; // This error is logged in OpenBlockFile
             LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(file, &pos);
+            ImportBlockFile(file, GetBlockPosFilename(pos, "blk"), &pos);
             nFile++;
         }
         pblocktree->WriteReindexing(false);
@@ -712,7 +748,7 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
             CImportingNow imp;
             boost::filesystem::path pathBootstrapOld = GetDataDir() / "bootstrap.dat.old";
             LogPrintf("Importing bootstrap.dat...\n");
-            LoadExternalBlockFile(file);
+            ImportBlockFile(file, pathBootstrap);
             RenameOver(pathBootstrap, pathBootstrapOld);
         } else {
             LogPrintf("Warning: Could not open bootstrap file %s\n", pathBootstrap.string());
@@ -725,7 +761,7 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         if (file) {
             CImportingNow imp;
             LogPrintf("Importing blocks file %s...\n", path.string());
-            LoadExternalBlockFile(file);
+            ImportBlockFile(file, path);
         } else {
             LogPrintf("Warning: Could not open blocks file %s\n", path.string());
         }
@@ -737,6 +773,30 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     }
 }
 
+void ThreadMigrateCoins()
+{
+    RenameThread("komodo-coinsmigrate");
+    LogPrintf("Moving the chainstate to per-outpoint records in the background\n");
+    int64_t nStart = GetTimeMillis();
+    size_t nTotal = 0;
+    while (true) {
+        boost::this_thread::interruption_point();
+        size_t nMigrated = 0;
+        bool fDone = false;
+        if (!pcoinsdbview->MigrateCoins(10000, nMigrated, fDone)) {
+            // Picked up again from the last committed batch on the next start
+            LogPrintf("Error writing the chainstate migration, will resume on restart\n");
+            return;
+        }
+        nTotal += nMigrated;
+        if (fDone)
+            break;
+        if (nTotal % 1000000 < nMigrated)
+            LogPrintf("Chainstate migration: %u transactions moved\n", nTotal);
+    }
+    LogPrintf("Chainstate migration done: %u transactions moved in %dms\n", nTotal, GetTimeMillis() - nStart);
+}
+
 void ThreadNotifyRecentlyAdded()
 {
     while (true) {
@@ -914,6 +974,8 @@ bool AppInitServers(boost::thread_group& threadGroup)
         return false;
     if (GetBoolArg("-rest", false) && !StartREST())
         return false;
+    if (GetBoolArg("-prometheus", false) && !StartPrometheus())
+        return false;
     if (!StartHTTPServer())
         return false;
     return true;
@@ -926,6 +988,7 @@ extern int32_t KOMODO_REWIND;
 
 bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 {
+    const int64_t nInitStart = GetTimeMillis();
     // ********************************************************* Step 1: setup
 #ifdef _MSC_VER
     // Turn off Microsoft heap dump noise
@@ -1006,6 +1069,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     fPrintToConsole = GetBoolArg("-printtoconsole", false);
     fLogTimestamps = GetBoolArg("-logtimestamps", true);
     fLogIPs = GetBoolArg("-logips", false);
+    if (GetBoolArg("-lockprofile", DEFAULT_LOCK_PROFILE))
+        SetLockProfile(true, GetArg("-lockprofilesample", DEFAULT_LOCK_PROFILE_SAMPLE));
 
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("Zcash version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
@@ -1093,7 +1158,15 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     nMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     //fprintf(stderr,"nMaxConnections %d\n",nMaxConnections);
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+#ifdef HAVE_SYS_EPOLL_H
+    fUseEpoll = GetBoolArg("-epoll", DEFAULT_EPOLL);
+#endif
+    // select() can only wait on descriptors below FD_SETSIZE, epoll has no such limit
+    nMaxSelectConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+    if (fUseEpoll)
+        nMaxConnections = std::max(nMaxConnections, 0);
+    else
+        nMaxConnections = nMaxSelectConnections;
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     //fprintf(stderr,"nMaxConnections %d FD_SETSIZE.%d nBind.%d expr.%d \n",nMaxConnections,FD_SETSIZE,nBind,(int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS));
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
@@ -1153,6 +1226,15 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", true);
+    // Off unless a block is given. Checkpoint ancestors skip these checks and
+    // proofs anyway, so it only matters past the last checkpoint, and the
+    // block has to be notarized once connected or the node warns
+    hashAssumeValidNotarized = uint256S(GetArg("-assumevalidnotarized", "0"));
+    if (!hashAssumeValidNotarized.IsNull())
+        LogPrintf("Assuming the scripts of block %s and its ancestors are valid\n", hashAssumeValidNotarized.ToString());
+    fTrimSolutions = GetBoolArg("-trimsolutions", DEFAULT_TRIM_SOLUTIONS);
+    fStartupBench = GetBoolArg("-startupbench", DEFAULT_STARTUPBENCH);
+    blockFileCache.SetMaxFiles(std::max<int64_t>(0, GetArg("-blockfilecache", DEFAULT_BLOCKFILE_CACHE)));
 
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
@@ -1400,8 +1482,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadEquihashCheck);
+        }
+    }
+
+    int nPrefetchBlocks = std::max(0, (int)GetArg("-prefetchblocks", DEFAULT_PREFETCH_BLOCKS));
+    if (nPrefetchBlocks > 0) {
+        LogPrintf("Preparing up to %d blocks ahead of validation\n", nPrefetchBlocks);
+        for (int i = 0; i < BLOCK_PREFETCH_THREADS; i++)
+            threadGroup.create_thread(&ThreadBlockPrefetch);
     }
 
     // Start the lightweight task scheduler thread
@@ -1654,6 +1745,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
+    int64_t nHeaderCache = std::max((int64_t)0, GetArg("-headercache", DEFAULT_HEADER_CACHE_SIZE)) << 20;
+    headerCache.SetMaxSize(nHeaderCache);
+    LogPrintf("* Using up to %.1fMiB for serialized headers\n", nHeaderCache * (1.0 / 1024 / 1024));
 
     if ( fReindex == 0 )
     {
@@ -1691,16 +1785,35 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
-                delete pcoinsdbview;
+                blockPrefetcher.Init(0, NULL);
+                delete pcoinsprefetch;
                 delete pcoinscatcher;
+                delete pcoinsflush;
+                pcoinsflush = NULL;
+                delete pcoinsdbview;
                 delete pblocktree;
                 delete pnotarisations;
+                delete pblockfilterdb;
+                pblockfilterdb = NULL;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex, dbCompression, dbMaxOpenFiles);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
-                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
-                pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                if (pcoinsdbview->GetVersion() > CHAINSTATE_VERSION) {
+                    strLoadError = _("The chainstate was written by a newer version of this software. Upgrade, or rebuild it with -reindex");
+                    break;
+                }
+                if (GetBoolArg("-backgroundflush", DEFAULT_BACKGROUND_FLUSH)) {
+                    pcoinsflush = new CCoinsViewBackgroundFlush(pcoinsdbview);
+                    pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsflush);
+                } else {
+                    pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                }
+                pcoinsprefetch = new CCoinsViewPrefetch(pcoinscatcher);
+                pcoinsTip = new CCoinsViewCache(pcoinsprefetch);
+                blockPrefetcher.Init(nPrefetchBlocks, pcoinsprefetch);
                 pnotarisations = new NotarisationDB(100*1024*1024, false, fReindex);
+                if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+                    pblockfilterdb = new CBlockFilterDB(16*1024*1024, false, fReindex);
 
 
                 if (fReindex) {
@@ -1765,7 +1878,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 }
                 if ( KOMODO_REWIND == 0 )
                 {
-                    if (!CVerifyDB().VerifyDB(pcoinsdbview, GetArg("-checklevel", 3),
+                    if (!CVerifyDB().VerifyDB(pcoinsflush ? (CCoinsView*)pcoinsflush : pcoinsdbview, GetArg("-checklevel", 3),
                                               GetArg("-checkblocks", 288))) {
                         strLoadError = _("Corrupted block database detected");
                         break;
@@ -1809,6 +1922,15 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         return false;
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
+    if (fStartupBench)
+        LogPrintf("startupbench: block index loaded %dms after start\n", GetTimeMillis() - nInitStart);
+
+    // The layout is recorded in the chainstate, so once started a migration
+    // carries on across restarts whether or not the option is still given
+    if (GetBoolArg("-coinsbyoutpoint", DEFAULT_COINS_BY_OUTPOINT) && pcoinsdbview->GetCoinsLayout() == COINS_LAYOUT_TXID)
+        pcoinsdbview->StartCoinsMigration();
+    if (pcoinsdbview->GetCoinsLayout() == COINS_LAYOUT_MIGRATING)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "coinsmigrate", &ThreadMigrateCoins));
 
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
@@ -1911,7 +2033,20 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         RegisterValidationInterface(pwalletMain);
 
         CBlockIndex *pindexRescan = chainActive.Tip();
-        if (clearWitnessCaches || GetBoolArg("-rescan", false))
+        CBlockLocator rescanLocator;
+        bool fFullRescan = clearWitnessCaches || GetBoolArg("-rescan", false);
+        // A full rescan starts over, whatever an interrupted one got to
+        if (fFullRescan)
+            CWalletDB(strWalletFile).EraseRescanProgress();
+        if (!fFullRescan && CWalletDB(strWalletFile).ReadRescanProgress(rescanLocator))
+        {
+            // A previous rescan was interrupted, continue from its last checkpoint
+            pindexRescan = FindForkInGlobalIndex(chainActive, rescanLocator);
+            LogPrintf("Resuming interrupted rescan from block %i\n", pindexRescan->GetHeight());
+            if (pindexRescan == chainActive.Tip())
+                CWalletDB(strWalletFile).EraseRescanProgress();
+        }
+        else if (fFullRescan)
         {
             pwalletMain->ClearNoteWitnessCache();
             pindexRescan = chainActive.Genesis();
@@ -2084,6 +2219,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     SetRPCWarmupFinished();
     uiInterface.InitMessage(_("Done loading"));
+    if (fStartupBench)
+        LogPrintf("startupbench: done loading %dms after start\n", GetTimeMillis() - nInitStart);
 
 #ifdef ENABLE_WALLET
     if (pwalletMain) {
@@ -886,18 +886,9 @@ int32_t komodo_block2pubkey33(uint8_t *pubkey33,CBlock *block)
 
 int32_t komodo_blockload(CBlock& block,CBlockIndex *pindex)
 {
-    block.SetNull();
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pindex->GetBlockPos(),true),SER_DISK,CLIENT_VERSION);
-    if (filein.IsNull())
+    // goes through the block file cache, falling back to the stdio read
+    if ( ReadBlockFromDisk(pindex->GetHeight(),block,pindex->GetBlockPos(),false) == 0 )
         return(-1);
-    // Read block
-    try { filein >> block; }
-    catch (const std::exception& e)
-    {
-        fprintf(stderr,"readblockfromdisk err B\n");
-        return(-1);
-    }
     return(0);
 }
 
@@ -2299,6 +2290,7 @@ bool KOMODO_TEST_ASSETCHAIN_SKIP_POW = 0;
 
 int32_t komodo_checkPOW(int64_t stakeTxValue, int32_t slowflag,CBlock *pblock,int32_t height)
 {
+    CPerfTimer perfTimer(perfKomodoCheckPOW);
     uint256 hash,merkleroot; arith_uint256 bnTarget,bhash; bool fNegative,fOverflow; uint8_t *script,pubkey33[33],pubkeys[64][33]; int32_t i,scriptlen,possible,PoSperc,is_PoSblock=0,n,failed = 0,notaryid = -1; int64_t checktoshis,value; CBlockIndex *pprev;
     if ( KOMODO_TEST_ASSETCHAIN_SKIP_POW == 0 && Params().NetworkIDString() == "regtest" )
         KOMODO_TEST_ASSETCHAIN_SKIP_POW = 1;
@@ -2587,6 +2579,9 @@ int64_t komodo_coinsupply(int64_t *zfundsp,int64_t *sproutfundsp,int32_t height)
         {
             if ( pindex->newcoins == 0 && pindex->zfunds == 0 )
             {
+                // the walk goes backwards, so start paging in the parent while this one is parsed
+                if ( pindex->pprev != 0 && pindex->pprev->newcoins == 0 && pindex->pprev->zfunds == 0 )
+                    blockFileCache.Prefetch(pindex->pprev->GetBlockPos());
                 if ( komodo_blockload(block,pindex) == 0 )
                     pindex->newcoins = komodo_newcoins(&pindex->zfunds,&pindex->sproutfunds,pindex->GetHeight(),&block);
                 else
@@ -2643,6 +2638,7 @@ struct komodo_staking *komodo_addutxo(struct komodo_staking *array,int32_t *numk
 
 int32_t komodo_staked(CMutableTransaction &txNew,uint32_t nBits,uint32_t *blocktimep,uint32_t *txtimep,uint256 *utxotxidp,int32_t *utxovoutp,uint64_t *utxovaluep,uint8_t *utxosig, uint256 merkleroot)
 {
+    CPerfTimer perfTimer(perfKomodoStaked);
     static struct komodo_staking *array; static int32_t numkp,maxkp; static uint32_t lasttime;
     int32_t PoSperc = 0, newStakerActive; 
     set<CBitcoinAddress> setAddress; struct komodo_staking *kp; int32_t winners,segid,minage,nHeight,counter=0,i,m,siglen=0,nMinDepth = 1,nMaxDepth = 99999999; vector<COutput> vecOutputs; uint32_t block_from_future_rejecttime,besttime,eligible,earliest = 0; CScript best_scriptPubKey; arith_uint256 mindiff,ratio,bnTarget,tmpTarget; CBlockIndex *tipindex,*pindex; CTxDestination address; bool fNegative,fOverflow; uint8_t hashbuf[256]; CTransaction tx; uint256 hashBlock;
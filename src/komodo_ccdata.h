@@ -16,6 +16,8 @@
 #ifndef H_KOMODOCCDATA_H
 #define H_KOMODOCCDATA_H
 
+#include "momaccumulator.h"
+
 struct komodo_ccdata *CC_data;
 int32_t CC_firstheight;
 
@@ -28,6 +30,9 @@ uint256 komodo_calcMoM(int32_t height,int32_t MoMdepth)
     MoMdepth &= 0xffff;  // In case it includes the ccid
     if ( MoMdepth >= height )
         return(zero);
+    uint256 MoM;
+    if ( momAccumulator.GetMoM(height,MoMdepth,MoM) != 0 )
+        return(MoM);
     for (i=0; i<MoMdepth; i++)
     {
         if ( (pindex= komodo_chainactive(height - i)) != 0 )
@@ -445,6 +445,25 @@ void NSPV_remoterpc_purge(struct NSPV_remoterpcresp *ptr)
         memset(ptr,0,sizeof(*ptr));
 }
 
+int32_t NSPV_rwblockfilterresp(int32_t rwflag,uint8_t *serialized,struct NSPV_blockfilterresp *ptr)
+{
+    int32_t len = 0;
+    len += iguana_rwbignum(rwflag,&serialized[len],sizeof(ptr->blockhash),(uint8_t *)&ptr->blockhash);
+    len += iguana_rwnum(rwflag,&serialized[len],sizeof(ptr->height),&ptr->height);
+    len += iguana_rwuint8vec(rwflag,&serialized[len],&ptr->filterlen,&ptr->filter);
+    return(len);
+}
+
+void NSPV_blockfilterresp_purge(struct NSPV_blockfilterresp *ptr)
+{
+    if ( ptr != 0 )
+    {
+        if ( ptr->filter != 0 )
+            free(ptr->filter);
+        memset(ptr,0,sizeof(*ptr));
+    }
+}
+
 // useful utility functions
 
 uint256 NSPV_doublesha256(uint8_t *data,int32_t datalen)
@@ -54,6 +54,8 @@
 #define NSPV_CC_TXIDS 16
 #define NSPV_REMOTERPC 0x14
 #define NSPV_REMOTERPCRESP 0x15
+#define NSPV_BLOCKFILTER 0x16
+#define NSPV_BLOCKFILTERRESP 0x17
 
 int32_t NSPV_gettransaction(int32_t skipvalidation,int32_t vout,uint256 txid,int32_t height,CTransaction &tx,uint256 &hashblock,int32_t &txheight,int32_t &currentheight,int64_t extradata,uint32_t tiptime,int64_t &rewardsum);
 UniValue NSPV_spend(char *srcaddr,char *destaddr,int64_t satoshis);
@@ -189,4 +191,11 @@ struct NSPV_remoterpcresp
     char json[11000];
 };
 
+struct NSPV_blockfilterresp
+{
+    uint256 blockhash;
+    int32_t height,filterlen;
+    uint8_t *filter;
+};
+
 #endif // KOMODO_NSPV_DEFSH
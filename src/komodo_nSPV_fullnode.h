@@ -20,6 +20,7 @@
 // NSPV_get... functions need to return the exact serialized length, which is the size of the structure minus size of pointers, plus size of allocated data
 
 #include "notarisationdb.h"
+#include "blockfilter.h"
 #include "rpc/server.h"
 
 static std::map<std::string,bool> nspv_remote_commands =  {{"channelsopen", true},{"channelspayment", true},{"channelsclose", true},{"channelsrefund", true},
@@ -123,7 +124,8 @@ int32_t NSPV_setequihdr(struct NSPV_equihdr *hdr,int32_t height)
         hdr->nTime = pindex->nTime;
         hdr->nBits = pindex->nBits;
         hdr->nNonce = pindex->nNonce;
-        memcpy(hdr->nSolution,&pindex->nSolution[0],sizeof(hdr->nSolution));
+        std::vector<unsigned char> solution = pindex->GetSolution();
+        memcpy(hdr->nSolution,&solution[0],sizeof(hdr->nSolution));
         return(sizeof(*hdr));
     }
     return(-1);
@@ -803,6 +805,25 @@ int32_t NSPV_gettxproof(struct NSPV_txproof *ptr,int32_t vout,uint256 txid,int32
     return(sizeof(*ptr) - sizeof(ptr->tx) - sizeof(ptr->txproof) + ptr->txlen + ptr->txprooflen);
 }
 
+int32_t NSPV_getblockfilter(struct NSPV_blockfilterresp *ptr,int32_t height)
+{
+    CBlockIndex *pindex; CBlockFilter filter;
+    if ( pblockfilterdb == 0 || height < 0 || height > chainActive.Height() || (pindex= chainActive[height]) == 0 )
+        return(-1);
+    if ( pblockfilterdb->ReadFilter(pindex->GetBlockHash(),filter) == 0 )
+        return(-1);
+    CDataStream ss(SER_NETWORK,PROTOCOL_VERSION);
+    ss << filter;
+    if ( ss.size() == 0 || ss.size() >= MAX_TX_SIZE_AFTER_SAPLING )
+        return(-1);
+    ptr->blockhash = pindex->GetBlockHash();
+    ptr->height = height;
+    ptr->filterlen = (int32_t)ss.size();
+    ptr->filter = (uint8_t *)malloc(ptr->filterlen);
+    memcpy(ptr->filter,&ss[0],ptr->filterlen);
+    return(sizeof(*ptr) - sizeof(ptr->filter) + ptr->filterlen);
+}
+
 int32_t NSPV_getntzsproofresp(struct NSPV_ntzsproofresp *ptr,uint256 prevntztxid,uint256 nextntztxid)
 {
     int32_t i; uint256 hashBlock,bhash0,bhash1,desttxid0,desttxid1; CTransaction tx;
@@ -867,8 +888,17 @@ int32_t NSPV_getspentinfo(struct NSPV_spentinfo *ptr,uint256 txid,int32_t vout)
     return(len);
 }
 
+// the request types are the even ids up to NSPV_BLOCKFILTER, anything else shares one stat
+const CPerfStat &NSPV_requeststat(const std::vector<uint8_t> &request)
+{
+    if ( request.empty() || (request[0] & 1) != 0 || request[0] > NSPV_BLOCKFILTER )
+        return(perfNSPVOtherRequests);
+    return(perfNSPVRequests.Get(request[0]));
+}
+
 void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a request
 {
+    CPerfTimer perfTimer(NSPV_requeststat(request));
     int32_t len,slen,ind,reqheight,n; std::vector<uint8_t> response; uint32_t timestamp = (uint32_t)time(NULL);
     if ( (len= request.size()) > 0 )
     {
@@ -1165,6 +1195,29 @@ void komodo_nSPVreq(CNode *pfrom,std::vector<uint8_t> request) // received a req
                 }                
             }
         }
+        else if ( request[0] == NSPV_BLOCKFILTER )
+        {
+            if ( timestamp > pfrom->prevtimes[ind] )
+            {
+                struct NSPV_blockfilterresp F; int32_t height;
+                if ( len == 1+sizeof(height) )
+                {
+                    iguana_rwnum(0,&request[1],sizeof(height),&height);
+                    memset(&F,0,sizeof(F));
+                    if ( (slen= NSPV_getblockfilter(&F,height)) > 0 )
+                    {
+                        response.resize(1 + slen);
+                        response[0] = NSPV_BLOCKFILTERRESP;
+                        if ( NSPV_rwblockfilterresp(1,&response[1],&F) == slen )
+                        {
+                            pfrom->PushMessage("nSPV",response);
+                            pfrom->prevtimes[ind] = timestamp;
+                        }
+                        NSPV_blockfilterresp_purge(&F);
+                    }
+                }
+            }
+        }
         else if (request[0] == NSPV_CCMODULEUTXOS)  // get cc module utxos from coinaddr for the requested amount, evalcode, funcid list and txid
         {
             //fprintf(stderr,"utxos: %u > %u, ind.%d, len.%d\n",timestamp,pfrom->prevtimes[ind],ind,len);
@@ -27,8 +27,9 @@
 #define dstr(x) ((double)(x) / SATOSHIDEN)
 #define portable_mutex_t pthread_mutex_t
 #define portable_mutex_init(ptr) pthread_mutex_init(ptr,NULL)
-#define portable_mutex_lock pthread_mutex_lock
-#define portable_mutex_unlock pthread_mutex_unlock
+// Timed by the lock contention profiler while it is on
+#define portable_mutex_lock(ptr) LOCK_PTHREAD_MUTEX(ptr)
+#define portable_mutex_unlock(ptr) UNLOCK_PTHREAD_MUTEX(ptr)
 
 extern void verus_hash(void *result, const void *data, size_t len);
 
@@ -26,6 +26,7 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockencodings.h"
 #include "importcoin.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -33,10 +34,17 @@
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
 #include "deprecation.h"
+#include "blockprefetch.h"
+#include "headercache.h"
 #include "init.h"
 #include "merkleblock.h"
 #include "metrics.h"
+#include "momaccumulator.h"
 #include "notarisationdb.h"
+#include "perfstats.h"
+#include "blockfile.h"
+#include "blockfilter.h"
+#include "blockimport.h"
 #include "net.h"
 #include "pow.h"
 #include "script/interpreter.h"
@@ -108,6 +116,9 @@ bool fPruneMode = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = true;
+uint256 hashAssumeValidNotarized;
+bool fTrimSolutions = DEFAULT_TRIM_SOLUTIONS;
+bool fStartupBench = false;
 bool fCoinbaseEnforcedProtectionEnabled = true;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
@@ -325,6 +336,18 @@ namespace {
         int nBlocksInFlightValidHeaders;
         //! Whether we consider this a preferred download peer.
         bool fPreferredDownload;
+        //! Whether this peer speaks version 1 compact blocks (sendcmpct).
+        bool fSupportsCompact;
+        //! Whether this peer wants new blocks pushed as cmpctblock rather than announced by inv.
+        bool fPreferCompactAnnounce;
+        //! The block we are rebuilding from this peer's cmpctblock, waiting on its blocktxn.
+        std::shared_ptr<PartiallyDownloadedBlock> partialBlock;
+        //! Whether this peer wants new blocks announced by headers rather than inv (sendheaders).
+        bool fPreferHeaders;
+        //! The best header we sent this peer, in a headers reply or announcement.
+        CBlockIndex *pindexBestHeaderSent;
+        //! Length of the current run of headers announcements from this peer that didn't connect.
+        int nUnconnectingHeaders;
 
         CNodeState() {
             fCurrentlyConnected = false;
@@ -338,12 +361,22 @@ namespace {
             nBlocksInFlight = 0;
             nBlocksInFlightValidHeaders = 0;
             fPreferredDownload = false;
+            fSupportsCompact = false;
+            fPreferCompactAnnounce = false;
+            fPreferHeaders = false;
+            pindexBestHeaderSent = NULL;
+            nUnconnectingHeaders = 0;
         }
     };
 
     /** Map maintaining per-node state. Requires cs_main. */
     map<NodeId, CNodeState> mapNodeState;
 
+    /** Peers we asked to push new blocks as cmpctblock, oldest first. Requires cs_main. */
+    list<NodeId> lNodesAnnouncingCompact;
+    /** Peers kept in high-bandwidth compact block mode at once */
+    static const unsigned int MAX_COMPACT_ANNOUNCERS = 3;
+
     // Requires cs_main.
     CNodeState *State(NodeId pnode) {
         map<NodeId, CNodeState>::iterator it = mapNodeState.find(pnode);
@@ -398,20 +431,14 @@ namespace {
         mapBlocksInFlight.erase(entry.hash);
         EraseOrphansFor(nodeid);
         nPreferredDownload -= state->fPreferredDownload;
+        lNodesAnnouncingCompact.remove(nodeid);
 
         mapNodeState.erase(nodeid);
     }
 
-    void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+    void LimitMempoolSize(CTxMemPool& pool, size_t limit)
     {
-        /*    int expired = pool.Expire(GetTime() - age);
-         if (expired != 0)
-         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
-
-         std::vector<uint256> vNoSpendsRemaining;
-         pool.TrimToSize(limit, &vNoSpendsRemaining);
-         BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
-         pcoinsTip->Uncache(removed);*/
+        pool.TrimToSize(limit);
     }
 
     // Requires cs_main.
@@ -483,6 +510,51 @@ namespace {
         }
     }
 
+    /** Remember pindex as sent to the peer in a headers message. Requires cs_main. */
+    void UpdateBestHeaderSent(NodeId nodeid, CBlockIndex *pindex) {
+        CNodeState *state = State(nodeid);
+        assert(state != NULL);
+        if (state->pindexBestHeaderSent == NULL || pindex->chainPower > state->pindexBestHeaderSent->chainPower)
+            state->pindexBestHeaderSent = pindex;
+    }
+
+    /** Whether the peer has pindex: it announced it or a descendant, or we sent it. Requires cs_main. */
+    bool PeerHasHeader(CNodeState *state, const CBlockIndex *pindex) {
+        if (pindex == NULL)
+            return false;
+        if (state->pindexBestKnownBlock && pindex == state->pindexBestKnownBlock->GetAncestor(pindex->GetHeight()))
+            return true;
+        if (state->pindexBestHeaderSent && pindex == state->pindexBestHeaderSent->GetAncestor(pindex->GetHeight()))
+            return true;
+        return false;
+    }
+
+    /** Ask pfrom, which just gave us a new tip, to push the next ones as
+     *  cmpctblock, dropping the peer we asked longest ago. Requires cs_main. */
+    void MaybeSetPeerAsAnnouncingCompact(CNode* pfrom) {
+        CNodeState *state = State(pfrom->GetId());
+        if (state == NULL || !state->fSupportsCompact)
+            return;
+
+        list<NodeId>::iterator it = std::find(lNodesAnnouncingCompact.begin(), lNodesAnnouncingCompact.end(), pfrom->GetId());
+        if (it != lNodesAnnouncingCompact.end()) {
+            lNodesAnnouncingCompact.splice(lNodesAnnouncingCompact.end(), lNodesAnnouncingCompact, it);
+            return;
+        }
+        if (lNodesAnnouncingCompact.size() >= MAX_COMPACT_ANNOUNCERS) {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodes) {
+                if (pnode->GetId() == lNodesAnnouncingCompact.front()) {
+                    pnode->PushMessage("sendcmpct", false, (uint64_t)1);
+                    break;
+                }
+            }
+            lNodesAnnouncingCompact.pop_front();
+        }
+        pfrom->PushMessage("sendcmpct", true, (uint64_t)1);
+        lNodesAnnouncingCompact.push_back(pfrom->GetId());
+    }
+
     /** Find the last common ancestor two blocks have.
      *  Both pa and pb must be non-NULL. */
     CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
@@ -643,6 +715,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CCoinsViewBackgroundFlush *pcoinsflush = NULL;
 
 // Komodo globals
 
@@ -2007,6 +2080,8 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         
         CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx), fSpendsCoinbase, consensusBranchId);
         unsigned int nSize = entry.GetTxSize();
+        // Notarisations skip the pool's min fee and eviction, up to a cap
+        entry.SetEvictionExempt(pool.HasExemptRoom(nSize) && CTxMemPool::IsSignedNotarisation(tx, view, chainActive.Height() + 1, chainActive.LastTip()->nTime));
         
         // Accept a tx if it contains joinsplits and has at least the default fee specified by z_sendmany.
         if (tx.vjoinsplit.size() > 0 && nFees >= ASYNC_RPC_OPERATION_DEFAULT_MINERS_FEE) {
@@ -2021,6 +2096,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
             }
         }
         
+        // Once the pool has had to evict, newcomers must outbid what was evicted
+        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        if (mempoolRejectFee > 0 && nFees < mempoolRejectFee && !entry.IsEvictionExempt())
+        {
+            return state.DoS(0, error("AcceptToMemoryPool: mempool min fee not met %s, %d < %d", hash.ToString(), nFees, mempoolRejectFee), REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+        }
+
         // Require that free transactions have sufficient priority to be mined in the next block.
         if (GetBoolArg("-relaypriority", false) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
             fprintf(stderr,"accept failure.6\n");
@@ -2115,6 +2197,11 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                 }
             }
         }
+
+        // Make room if the pool has grown past -maxmempool, which may evict tx itself
+        LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
     // This should be here still? 
     //SyncWithWallets(tx, NULL); 
@@ -2252,19 +2339,9 @@ bool myGetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlo
         CDiskTxPos postx;
         //fprintf(stderr,"ReadTxIndex\n");
         if (pblocktree->ReadTxIndex(hash, postx)) {
-            //fprintf(stderr,"OpenBlockFile\n");
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
             CBlockHeader header;
-            //fprintf(stderr,"seek and read\n");
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
-            } catch (const std::exception& e) {
-                return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-            }
+            if (!ReadTxFromDisk(postx, header, txOut))
+                return false;
             hashBlock = header.GetHash();
             if (txOut.GetHash() != hash)
                 return error("%s: txid mismatch", __func__);
@@ -2310,17 +2387,9 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
     if (fTxIndex) {
         CDiskTxPos postx;
         if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
             CBlockHeader header;
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
-            } catch (const std::exception& e) {
-                return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-            }
+            if (!ReadTxFromDisk(postx, header, txOut))
+                return false;
             hashBlock = header.GetHash();
             if (txOut.GetHash() != hash)
                 return error("%s: txid mismatch", __func__);
@@ -2397,22 +2466,48 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     return true;
 }
 
+bool ReadTxFromDisk(const CDiskTxPos& postx, CBlockHeader& header, CTransaction& tx)
+{
+    CBlockFileReader reader(SER_DISK, CLIENT_VERSION);
+    try {
+        if (blockFileCache.Open(postx, reader))
+        {
+            reader >> header;
+            reader.ignore(postx.nTxOffset);
+            reader >> tx;
+        }
+        else
+        {
+            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+            if (file.IsNull())
+                return error("%s: OpenBlockFile failed", __func__);
+            file >> header;
+            fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+            file >> tx;
+        }
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
 bool ReadBlockFromDisk(int32_t height,CBlock& block, const CDiskBlockPos& pos,bool checkPOW)
 {
     uint8_t pubkey33[33];
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-    {
-        //fprintf(stderr,"readblockfromdisk err A\n");
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
-    }
-
-    // Read block
+    // Read block, straight from the mapped file when the block file cache has it
+    CBlockFileReader reader(SER_DISK, CLIENT_VERSION);
     try {
-        filein >> block;
+        if (blockFileCache.Open(pos, reader))
+            reader >> block;
+        else
+        {
+            CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+            filein >> block;
+        }
     }
     catch (const std::exception& e) {
         fprintf(stderr,"readblockfromdisk err B\n");
@@ -3112,6 +3207,7 @@ void ConnectNotarisations(const CBlock &block, int height)
 {
     // Record Notarisations
     NotarisationsInBlock notarisations = ScanBlockNotarisations(block, height);
+    CacheBlockNotarisations(block.GetHash(), notarisations);
     if (notarisations.size() > 0) {
         CDBBatch batch = CDBBatch(*pnotarisations);
         batch.Write(block.GetHash(), notarisations);
@@ -3127,7 +3223,9 @@ void DisconnectNotarisations(const CBlock &block)
 {
     // Delete from notarisations cache
     NotarisationsInBlock nibs;
-    if (GetBlockNotarisations(block.GetHash(), nibs)) {
+    bool fFound = GetBlockNotarisations(block.GetHash(), nibs);
+    UncacheBlockNotarisations(block.GetHash());
+    if (fFound) {
         CDBBatch batch = CDBBatch(*pnotarisations);
         batch.Erase(block.GetHash());
         EraseBackNotarisations(nibs, batch);
@@ -3324,7 +3422,10 @@ void static FlushBlockFile(bool fFinalize = false)
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
         if (fFinalize)
+        {
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
+            blockFileCache.Invalidate(nLastBlockFile);
+        }
         FileCommit(fileOld);
         fclose(fileOld);
     }
@@ -3347,6 +3448,30 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CEquihashCheck> equihashcheckqueue(8);
+//! A queue runs one batch at a time, see CCheckQueueControl
+static boost::mutex cs_equihashcheckqueue;
+
+void ThreadEquihashCheck() {
+    RenameThread("komodo-equihash");
+    equihashcheckqueue.Thread();
+}
+
+bool CheckEquihashSolutions(const std::vector<const CBlockHeader*>& vpheaders, bool fCache)
+{
+    if (nScriptCheckThreads == 0 || vpheaders.empty())
+        return true;
+    const CChainParams& chainparams = Params();
+    std::vector<CEquihashCheck> vChecks;
+    vChecks.reserve(vpheaders.size());
+    BOOST_FOREACH(const CBlockHeader* pheader, vpheaders)
+        vChecks.push_back(CEquihashCheck(pheader, &chainparams, fCache));
+    boost::unique_lock<boost::mutex> lock(cs_equihashcheckqueue);
+    CCheckQueueControl<CEquihashCheck> control(&equihashcheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -3413,6 +3538,57 @@ void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const
 }
 
 
+/**
+ * Whether the scripts and CC conditions of pindex go unchecked: it is the
+ * -assumevalidnotarized block or one of its ancestors, and the best header
+ * chain still builds on that block.
+ */
+static bool IsAssumedValidNotarized(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (hashAssumeValidNotarized.IsNull() || pindexBestHeader == NULL)
+        return false;
+    BlockMap::const_iterator mi = mapBlockIndex.find(hashAssumeValidNotarized);
+    if (mi == mapBlockIndex.end() || mi->second == NULL)
+        return false;
+    const CBlockIndex* pindexAssumed = mi->second;
+    if (pindexAssumed->GetHeight() < pindex->GetHeight())
+        return false;
+    return pindexAssumed->GetAncestor(pindex->GetHeight()) == pindex &&
+           pindexBestHeader->GetAncestor(pindexAssumed->GetHeight()) == pindexAssumed;
+}
+
+/**
+ * Notarisations are only known for the blocks connected so far, so the
+ * -assumevalidnotarized block is held to one once the tip has gone past it.
+ * Either way it is settled once.
+ */
+static void CheckAssumedValidNotarized()
+{
+    AssertLockHeld(cs_main);
+    static bool fSettled = false;
+    if (fSettled || hashAssumeValidNotarized.IsNull())
+        return;
+    BlockMap::const_iterator mi = mapBlockIndex.find(hashAssumeValidNotarized);
+    if (mi == mapBlockIndex.end() || mi->second == NULL || !chainActive.Contains(mi->second))
+        return;
+    const CBlockIndex* pindexAssumed = mi->second;
+
+    int32_t notarizedht, prevMoMheight; uint256 notarizedhash, txid;
+    notarizedht = komodo_notarized_height(&prevMoMheight, &notarizedhash, &txid);
+    if (notarizedht >= pindexAssumed->GetHeight() && chainActive[notarizedht] != NULL && chainActive[notarizedht]->GetBlockHash() == notarizedhash) {
+        LogPrintf("%s: block %s at height %d is covered by the notarisation of height %d\n", __func__,
+                  hashAssumeValidNotarized.ToString(), pindexAssumed->GetHeight(), notarizedht);
+        fSettled = true;
+    } else if (chainActive.Height() > pindexAssumed->GetHeight() + ASSUMEVALID_NOTARIZED_WINDOW) {
+        std::string strWarning = strprintf(_("Warning: block %s, assumed valid by -assumevalidnotarized, is not notarized %d blocks later. Restart with -reindex -assumevalidnotarized=0 to check the scripts it skipped."),
+                                           hashAssumeValidNotarized.ToString(), ASSUMEVALID_NOTARIZED_WINDOW);
+        LogPrintf("%s: %s\n", __func__, strWarning);
+        strMiscWarning = strWarning;
+        fSettled = true;
+    }
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -3421,7 +3597,7 @@ static int64_t nTimeTotal = 0;
 bool FindBlockPos(int32_t tmpflag,CValidationState &state, CDiskBlockPos &pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fKnown = false);
 bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBlockIndex *pindexNew, const CDiskBlockPos& pos);
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck,bool fCheckPOW)
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck,bool fCheckPOW, const std::vector<PrecomputedTransactionData>* pvTxData)
 {
     CDiskBlockPos blockPos;
     const CChainParams& chainparams = Params();
@@ -3431,6 +3607,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         return(false);
     //fprintf(stderr,"connectblock ht.%d\n",(int32_t)pindex->GetHeight());
     AssertLockHeld(cs_main);
+    CPerfTimer perfTimer(perfConnectBlock);
     bool fExpensiveChecks = true;
     if (fCheckpointsEnabled) {
         CBlockIndex *pindexLastCheckpoint = Checkpoints::GetLastCheckpoint(chainparams.Checkpoints());
@@ -3439,6 +3616,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             fExpensiveChecks = false;
         }
     }
+    // Blocks under a notarized block vouched for by -assumevalidnotarized, but
+    // past the last checkpoint, still have their proofs checked, but not their
+    // scripts or CC conditions
+    bool fCheckScripts = fExpensiveChecks && !IsAssumedValidNotarized(pindex);
     auto verifier = libzcash::ProofVerifier::Strict();
     auto disabledVerifier = libzcash::ProofVerifier::Disabled();
     int32_t futureblock;
@@ -3556,11 +3737,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             sleep(1);
         }
     }
-    CCheckQueueControl<CScriptCheck> control(fExpensiveChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    CCheckQueueControl<CScriptCheck> control(fCheckScripts && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
-    int nInputs = 0;
+    int nInputs = 0, nOutputs = 0;
     uint64_t valueout;
     int64_t voutsum = 0, prevsum = 0, interest, sum = 0, stakeTxValue = 0;
     unsigned int nSigOps = 0;
@@ -3598,12 +3779,17 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     auto consensusBranchId = CurrentEpochBranchId(pindex->GetHeight(), Params().GetConsensus());
 
     std::vector<PrecomputedTransactionData> txdata;
-    txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+    const bool fHaveTxData = pvTxData != NULL && pvTxData->size() == block.vtx.size();
+    if (fHaveTxData)
+        txdata = *pvTxData;
+    else
+        txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = block.vtx[i];
         const uint256 txhash = tx.GetHash();
         nInputs += tx.vin.size();
+        nOutputs += tx.vout.size();
         nSigOps += GetLegacySigOpCount(tx);
         if (nSigOps > MAX_BLOCK_SIGOPS)
             return state.DoS(100, error("ConnectBlock(): too many sigops"),
@@ -3664,7 +3850,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                                  REJECT_INVALID, "bad-blk-sigops");
         }
 
-        txdata.emplace_back(tx);
+        if (!fHaveTxData)
+            txdata.emplace_back(tx);
 
         valueout = tx.GetValueOut();
         if ( KOMODO_VALUETOOBIG(valueout) != 0 )
@@ -3689,7 +3876,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             //fprintf(stderr, "tx.%s nFees.%li interest.%li\n", tx.GetHash().ToString().c_str(), stakeTxValue, interest);
 
             std::vector<CScriptCheck> vChecks;
-            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, false, txdata[i], chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL))
+            if (!ContextualCheckInputs(tx, state, view, fCheckScripts, flags, false, txdata[i], chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
             control.Add(vChecks);
         }
@@ -3766,6 +3953,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
     int64_t nTime1 = GetTimeMicros(); nTimeConnect += nTime1 - nTimeStart;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs-1), nTimeConnect * 0.000001);
+    LogPrint("bench", "      - Coins: %u spent, %u created (%.0f coins/s)\n", nInputs - 1, nOutputs, nTime1 == nTimeStart ? 0 : 1000000.0 * (nInputs - 1 + nOutputs) / (nTime1 - nTimeStart));
 
     blockReward += nFees + sum;
     if ( ASSETCHAINS_COMMISSION != 0 || ASSETCHAINS_FOUNDERS_REWARD != 0 ) //ASSETCHAINS_OVERRIDE_PUBKEY33[0] != 0 &&
@@ -3804,6 +3992,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (fJustCheck)
         return true;
+    perfConnectBlockTransactions.Add(block.vtx.size());
 
     // Write undo information to disk
     //fprintf(stderr,"nFile.%d isNull %d vs isvalid %d nStatus %x\n",(int32_t)pindex->nFile,pindex->GetUndoPos().IsNull(),pindex->IsValid(BLOCK_VALID_SCRIPTS),(uint32_t)pindex->nStatus);
@@ -3840,26 +4029,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     ConnectNotarisations(block, pindex->GetHeight()); // MoMoM notarisation DB.
 
-    if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
-            return AbortNode(state, "Failed to write transaction index");
-    if (fAddressIndex) {
-        if (!pblocktree->WriteAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to write address index");
-        }
-
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            return AbortNode(state, "Failed to write address unspent index");
-        }
-    }
-
-    if (fSpentIndex)
-        if (!pblocktree->UpdateSpentIndex(spentIndex))
-            return AbortNode(state, "Failed to write transaction index");
+    if (pblockfilterdb != NULL)
+        if (!pblockfilterdb->WriteFilter(block.GetHash(), CBlockFilter(block)))
+            return AbortNode(state, "Failed to write block filter");
 
+    unsigned int logicalTS = 0;
     if (fTimestampIndex)
     {
-        unsigned int logicalTS = pindex->nTime;
+        logicalTS = pindex->nTime;
         unsigned int prevLogicalTS = 0;
 
         // retrieve logical timestamp of the previous block
@@ -3871,12 +4048,20 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             logicalTS = prevLogicalTS + 1;
             LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, pindex->nTime, prevLogicalTS, logicalTS);
         }
+    }
 
-        if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(logicalTS, pindex->GetBlockHash())))
-            return AbortNode(state, "Failed to write timestamp index");
-
-        if (!pblocktree->WriteTimestampBlockIndex(CTimestampBlockIndexKey(pindex->GetBlockHash()), CTimestampBlockIndexValue(logicalTS)))
-            return AbortNode(state, "Failed to write blockhash index");
+    if (fTxIndex || fAddressIndex || fSpentIndex || fTimestampIndex) {
+        // All the indexes of the block go to disk in one batch
+        std::vector<std::pair<uint256, CDiskTxPos> > vNoTxIndex;
+        std::vector<std::pair<CAddressIndexKey, CAmount> > vNoAddressIndex;
+        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vNoAddressUnspentIndex;
+        std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vNoSpentIndex;
+        if (!pblocktree->WriteBlockIndexes(fTxIndex ? vPos : vNoTxIndex,
+                                           fAddressIndex ? addressIndex : vNoAddressIndex,
+                                           fAddressIndex ? addressUnspentIndex : vNoAddressUnspentIndex,
+                                           fSpentIndex ? spentIndex : vNoSpentIndex,
+                                           pindex->GetBlockHash(), logicalTS))
+            return AbortNode(state, "Failed to write block indexes");
     }
 
     // add this block to the view's block chain
@@ -3947,6 +4132,8 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         if (nLastSetChain == 0) {
             nLastSetChain = nNow;
         }
+        if (pcoinsflush != NULL && pcoinsflush->WriteFailed())
+            return AbortNode(state, "Failed to write to coin database");
         size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
         // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
         bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > nCoinCacheUsage;
@@ -3976,13 +4163,19 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
                 }
                 std::vector<const CBlockIndex*> vBlocks;
                 vBlocks.reserve(setDirtyBlockIndex.size());
+                std::vector<CBlockIndex*> vTrim;
                 for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
                     vBlocks.push_back(*it);
+                    if (fTrimSolutions && (*it)->HasSolution())
+                        vTrim.push_back(*it);
                     setDirtyBlockIndex.erase(it++);
                 }
                 if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                     return AbortNode(state, "Files to write to block index database");
                 }
+                // the solutions are on disk now
+                BOOST_FOREACH(CBlockIndex* pindex, vTrim)
+                    pindex->TrimSolution();
             }
             // Finally remove any pruned files
             if (fFlushForPrune)
@@ -4001,6 +4194,10 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
             // Flush the chainstate (which may refer to block index entries).
             if (!pcoinsTip->Flush())
                 return AbortNode(state, "Failed to write to coin database");
+            // The write itself goes on in the background, unless the
+            // caller needs it on disk or block files are being pruned.
+            if ((mode == FLUSH_STATE_ALWAYS || fFlushForPrune) && pcoinsflush != NULL && !pcoinsflush->Sync())
+                return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
         }
         if ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
@@ -4030,6 +4227,7 @@ void PruneAndFlush() {
 void static UpdateTip(CBlockIndex *pindexNew) {
     const CChainParams& chainParams = Params();
     chainActive.SetTip(pindexNew);
+    momAccumulator.Update(pindexNew);
 
     // New best block
     nTimeBestReceived = GetTime();
@@ -4113,6 +4311,8 @@ bool static DisconnectTip(CValidationState &state, bool fBare = false) {
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
         DisconnectNotarisations(block);
+        if (pblockfilterdb != NULL)
+            pblockfilterdb->EraseFilter(block.GetHash());
     }
     pindexDelete->segid = -2;
     pindexDelete->nNotaryPay = 0; 
@@ -4254,10 +4454,11 @@ static int64_t nTimePostConnect = 0;
 
 /**
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
- * corresponding to pindexNew, to bypass loading it again from disk.
+ * corresponding to pindexNew, to bypass loading it again from disk, and pvTxData
+ * optionally its precomputed sighash midstates.
  * You probably want to call mempool.removeWithoutBranchId after this, with cs_main held.
  */
-bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *pblock) {
+bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *pblock, const std::vector<PrecomputedTransactionData>* pvTxData = NULL) {
 
     assert(pindexNew->pprev == chainActive.Tip());
     // Read block from disk.
@@ -4284,7 +4485,7 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, true);
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, true, pvTxData);
         KOMODO_CONNECTING = -1;
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
@@ -4307,6 +4508,11 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
+    if (fDebug) {
+        uint64_t nHits, nMisses;
+        pcoinsTip->GetCacheStats(nHits, nMisses);
+        LogPrint("bench", "  - Coins cache: %u hits, %u misses (%.1f%% hit rate)\n", nHits, nMisses, nHits + nMisses == 0 ? 0 : 100.0 * nHits / (nHits + nMisses));
+    }
     // Write the chain state to disk, if necessary.
     if ( KOMODO_NSPV_FULLNODE )
     {
@@ -4324,6 +4530,7 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
 
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    CheckAssumedValidNotarized();
     if ( KOMODO_NSPV_FULLNODE )
     {
         // Tell wallet about transactions that went from mempool
@@ -4562,9 +4769,22 @@ static bool ActivateBestChainStep(bool fSkipdpow, CValidationState &state, CBloc
         }
         nHeight = nTargetHeight;
 
+        // Have the blocks after the first read and prepared while it connects,
+        // adding to what earlier steps of ActivateBestChain queued
+        std::vector<CBlockIndex*> vpindexPrefetch(vpindexToConnect.rbegin(), vpindexToConnect.rend());
+        if (pblock != NULL && !vpindexPrefetch.empty() && vpindexPrefetch.back() == pindexMostWork)
+            vpindexPrefetch.pop_back();
+        blockPrefetcher.Start(vpindexPrefetch);
+
         // Connect new blocks.
         BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
-            if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL)) {
+            CBlock *pblockConnect = pindexConnect == pindexMostWork ? pblock : NULL;
+            std::shared_ptr<CPrefetchedBlock> prefetched;
+            if (pblockConnect == NULL)
+                prefetched = blockPrefetcher.Get(pindexConnect);
+            if (prefetched && prefetched->fRead)
+                pblockConnect = &prefetched->block;
+            if (!ConnectTip(state, pindexConnect, pblockConnect, prefetched && prefetched->fRead ? &prefetched->txdata : NULL)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -4604,6 +4824,67 @@ static bool ActivateBestChainStep(bool fSkipdpow, CValidationState &state, CBloc
     return true;
 }
 
+/**
+ * Transactions of block a compact block sends whole, besides the coinbase:
+ * the staking tx that closes a PoS block and notarisations, which are built
+ * by the block's own miner or notaries and rarely reach other mempools in time.
+ * The PoW blocks of a mixed PoW/PoS chain have no staking tx to send.
+ */
+static std::set<uint16_t> GetCompactPrefill(const CBlock& block, int32_t nHeight)
+{
+    std::set<uint16_t> setPrefill;
+    if (ASSETCHAINS_STAKED != 0 && block.vtx.size() > 1 && komodo_isPoS((CBlock *)&block, nHeight, 0) != 0)
+        setPrefill.insert(block.vtx.size() - 1);
+
+    NotarisationsInBlock nibs;
+    if (GetBlockNotarisations(block.GetHash(), nibs)) {
+        BOOST_FOREACH(const Notarisation& n, nibs) {
+            for (size_t i = 1; i < block.vtx.size(); i++) {
+                if (block.vtx[i].GetHash() == n.first) {
+                    setPrefill.insert(i);
+                    break;
+                }
+            }
+        }
+    }
+    return setPrefill;
+}
+
+/** The last tip we relayed, full and compact, so peers asking for it don't cost a disk read */
+static CCriticalSection cs_mostRecentBlock;
+static uint256 hashMostRecentBlock;
+static std::shared_ptr<const CBlock> mostRecentBlock;
+static std::shared_ptr<const CBlockHeaderAndShortTxIDs> mostRecentCompactBlock;
+
+static void SetMostRecentBlock(const CBlock& block, int32_t nHeight)
+{
+    std::shared_ptr<const CBlock> pblock = std::make_shared<const CBlock>(block);
+    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock;
+    if (block.vtx.size() <= (size_t)std::numeric_limits<uint16_t>::max() + 1)
+        pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs>(block, GetCompactPrefill(block, nHeight));
+
+    LOCK(cs_mostRecentBlock);
+    hashMostRecentBlock = block.GetHash();
+    mostRecentBlock = pblock;
+    mostRecentCompactBlock = pcmpctblock;
+}
+
+static std::shared_ptr<const CBlock> GetMostRecentBlock(const uint256& hash)
+{
+    LOCK(cs_mostRecentBlock);
+    if (hash != hashMostRecentBlock)
+        return std::shared_ptr<const CBlock>();
+    return mostRecentBlock;
+}
+
+static std::shared_ptr<const CBlockHeaderAndShortTxIDs> GetMostRecentCompactBlock(const uint256& hash)
+{
+    LOCK(cs_mostRecentBlock);
+    if (hash != hashMostRecentBlock)
+        return std::shared_ptr<const CBlockHeaderAndShortTxIDs>();
+    return mostRecentCompactBlock;
+}
+
 /**
  * Make the best chain active, in multiple steps. The result is either failure
  * or an activated best chain. pblock is either NULL or a pointer to a block
@@ -4622,11 +4903,15 @@ bool ActivateBestChain(bool fSkipdpow, CValidationState &state, CBlock *pblock)
             pindexMostWork = FindMostWorkChain();
 
             // Whether we have anything to do at all.
-            if (pindexMostWork == NULL || pindexMostWork == chainActive.Tip())
+            if (pindexMostWork == NULL || pindexMostWork == chainActive.Tip()) {
+                blockPrefetcher.Stop();
                 return true;
+            }
 
-            if (!ActivateBestChainStep(fSkipdpow, state, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL))
+            if (!ActivateBestChainStep(fSkipdpow, state, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : NULL)) {
+                blockPrefetcher.Stop();
                 return false;
+            }
             pindexNewTip = chainActive.Tip();
             fInitialDownload = IsInitialBlockDownload();
         }
@@ -4635,6 +4920,8 @@ bool ActivateBestChain(bool fSkipdpow, CValidationState &state, CBlock *pblock)
         // Notifications/callbacks that can run without cs_main
         if (!fInitialDownload) {
             uint256 hashNewTip = pindexNewTip->GetBlockHash();
+            if (pblock && pblock->GetHash() == hashNewTip)
+                SetMostRecentBlock(*pblock, pindexNewTip->GetHeight());
             // Relay inventory, but don't relay old inventory during initial block download.
             int nBlockEstimate = 0;
             if (fCheckpointsEnabled)
@@ -4652,6 +4939,8 @@ bool ActivateBestChain(bool fSkipdpow, CValidationState &state, CBlock *pblock)
             uiInterface.NotifyBlockTip(hashNewTip);
         } //else fprintf(stderr,"initial download skips propagation\n");
     } while(pindexMostWork != chainActive.Tip());
+    // Whatever is left in the prefetch window is past the new tip
+    blockPrefetcher.Stop();
     CheckBlockIndex();
 
     // Write changes periodically to disk, after relay.
@@ -4684,7 +4973,7 @@ bool InvalidateBlock(CValidationState& state, CBlockIndex *pindex) {
             return false;
         }
     }
-    //LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+    LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
 
     // The resulting new best tip may not be in setBlockIndexCandidates anymore, so
     // add it again.
@@ -4736,10 +5025,10 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex) {
     return true;
 }
 
-CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
+CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256* phash = NULL)
 {
     // Check for duplicate
-    uint256 hash = block.GetHash();
+    uint256 hash = phash != NULL ? *phash : block.GetHash();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
 
@@ -4951,6 +5240,7 @@ bool FindBlockPos(int32_t tmpflag,CValidationState &state, CDiskBlockPos &pos, u
                     tmpBlockFiles[1].SetNull();
                     pos.nFile = TMPFILE_START+1;
                     pos.nPos = (*ptr)[1].nSize;
+                    blockFileCache.Invalidate(pos.nFile);
                     boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
                     LogPrintf("Prune: deleted temp blk (%05u)\n",nFile);    
                 }
@@ -4978,6 +5268,7 @@ bool FindBlockPos(int32_t tmpflag,CValidationState &state, CDiskBlockPos &pos, u
                     tmpBlockFiles[0].SetNull();
                     pos.nFile = TMPFILE_START;
                     pos.nPos = (*ptr)[0].nSize;
+                    blockFileCache.Invalidate(pos.nFile);
                     boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
                     LogPrintf("Prune: deleted temp blk (%05u)\n",nFile);  
                 }
@@ -5458,21 +5749,21 @@ bool ContextualCheckBlock(int32_t slowflag,const CBlock& block, CValidationState
     return true;
 }
 
-bool AcceptBlockHeader(int32_t *futureblockp,const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex)
+bool AcceptBlockHeader(int32_t *futureblockp,const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, const uint256* phash)
 {
     static uint256 zero;
     const CChainParams& chainparams = Params();
     AssertLockHeld(cs_main);
 
     // Check for duplicate
-    uint256 hash = block.GetHash();
+    uint256 hash = phash != NULL ? *phash : block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = NULL;
     if (miSelf != mapBlockIndex.end())
     {
         // Block header is already known.
         if ( (pindex = miSelf->second) == 0 )
-            miSelf->second = pindex = AddToBlockIndex(block);
+            miSelf->second = pindex = AddToBlockIndex(block, &hash);
         if (ppindex)
             *ppindex = pindex;
         if ( pindex != 0 && (pindex->nStatus & BLOCK_FAILED_MASK) != 0 )
@@ -5533,7 +5824,7 @@ bool AcceptBlockHeader(int32_t *futureblockp,const CBlockHeader& block, CValidat
     }
     if (pindex == NULL)
     {
-        if ( (pindex= AddToBlockIndex(block)) != 0 )
+        if ( (pindex= AddToBlockIndex(block, &hash)) != 0 )
         {
             miSelf = mapBlockIndex.find(hash);
             if (miSelf != mapBlockIndex.end())
@@ -5941,6 +6232,7 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockFileCache.Invalidate(pos.nFile);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -6073,10 +6365,13 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
 bool static LoadBlockIndexDB()
 {
     const CChainParams& chainparams = Params();
+    int64_t nStart = GetTimeMillis();
     LogPrintf("%s: start loading guts\n", __func__);
     if (!pblocktree->LoadBlockIndexGuts())
         return false;
     LogPrintf("%s: loaded guts\n", __func__);
+    if (fStartupBench)
+        LogPrintf("startupbench: %s guts %dms\n", __func__, GetTimeMillis() - nStart);
     boost::this_thread::interruption_point();
 
     // Calculate chainPower
@@ -6091,6 +6386,8 @@ bool static LoadBlockIndexDB()
     //fprintf(stderr,"load blockindexDB paired %u\n",(uint32_t)time(NULL));
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
     //fprintf(stderr,"load blockindexDB sorted %u\n",(uint32_t)time(NULL));
+    if (fStartupBench)
+        LogPrintf("startupbench: %s sorted %u entries by height %dms\n", __func__, vSortedByHeight.size(), GetTimeMillis() - nStart);
     BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
@@ -6147,6 +6444,8 @@ bool static LoadBlockIndexDB()
         //komodo_pindex_init(pindex,(int32_t)pindex->GetHeight());
     }
     //fprintf(stderr,"load blockindexDB chained %u\n",(uint32_t)time(NULL));
+    if (fStartupBench)
+        LogPrintf("startupbench: %s chain work and candidates %dms\n", __func__, GetTimeMillis() - nStart);
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
@@ -6526,6 +6825,7 @@ void UnloadBlockIndex()
     setDirtyFileInfo.clear();
     mapNodeState.clear();
     recentRejects.reset(NULL);
+    momAccumulator.Clear();
 
     BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
         delete entry.second;
@@ -6611,108 +6911,198 @@ bool InitBlockIndex() {
 
 
 
-bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
+// Map of disk positions for blocks with unknown parent (only used for reindex)
+static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+
+/**
+ * Hand one block of an imported file to ProcessNewBlock, then the blocks
+ * found earlier in the file that were waiting for it. fKnown says block
+ * is already stored and was not deserialized. Returns false on an error
+ * that ends the import.
+ */
+static bool ImportBlock(CBlock& block, const uint256& hash, bool fKnown, CDiskBlockPos *dbp, int& nLoaded)
 {
     const CChainParams& chainparams = Params();
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+    // detect out of order blocks, and store them for later
+    if (!fKnown && hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                 block.hashPrevBlock.ToString());
+        if (dbp)
+            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+        return true;
+    }
+
+    // process in case the block isn't known yet
+    if (!fKnown && (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0)) {
+        CValidationState state;
+        if (ProcessNewBlock(0,0,state, NULL, &block, true, dbp))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && komodo_blockheight(hash) % 1000 == 0) {
+        LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), komodo_blockheight(hash));
+    }
+
+    // Recursively process earlier encountered successors of this block
+    deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            CBlock child;
+            if (ReadBlockFromDisk(mapBlockIndex.count(hash)!=0?mapBlockIndex[hash]->GetHeight():0,child, it->second,1))
+            {
+                LogPrintf("%s: Processing out of order child %s of %s\n", __func__, child.GetHash().ToString(),
+                          head.ToString());
+                CValidationState dummy;
+                if (ProcessNewBlock(0,0,dummy, NULL, &child, true, &it->second))
+                {
+                    nLoaded++;
+                    queue.push_back(child.GetHash());
+                }
+            }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+        }
+    }
+    return true;
+}
+
+static void LogImportRate(int nLoaded, int64_t nStart, int64_t nStartCPU)
+{
+    if (nLoaded > 0) {
+        // CPU use over wall time shows how much of the machine the import kept busy
+        int64_t nElapsed = std::max<int64_t>(GetTimeMillis() - nStart, 1);
+        LogPrintf("Loaded %i blocks from external file in %dms (%.1f blocks/s, %.0f%% CPU)\n", nLoaded, nElapsed,
+                  nLoaded * 1000.0 / nElapsed, (GetProcessCPUMicros() - nStartCPU) * 0.1 / nElapsed);
+    }
+}
+
+void ScanBlockFile(FILE* fileIn, CDiskBlockPos *dbp, const std::function<bool(CBlock&)>& fnBlock)
+{
+    const CChainParams& chainparams = Params();
+    // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+    //CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+    CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE(10000000), MAX_BLOCK_SIZE(10000000)+8, SER_DISK, CLIENT_VERSION);
+    uint64_t nRewind = blkdat.GetPos();
+    while (!blkdat.eof()) {
+        boost::this_thread::interruption_point();
+
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[MESSAGE_START_SIZE];
+            blkdat.FindByte(chainparams.MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (nSize < 80 || nSize > MAX_BLOCK_SIZE(10000000))
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            break;
+        }
+        try {
+            // read block
+            CBlock block;
+            uint64_t nBlockPos = blkdat.GetPos();
+            if (dbp)
+                dbp->nPos = nBlockPos;
+            blkdat.SetLimit(nBlockPos + nSize);
+            blkdat.SetPos(nBlockPos);
+            blkdat >> block;
+
+            nRewind = blkdat.GetPos();
+            if (!fnBlock(block))
+                break;
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+    }
+}
+
+bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
+{
     int64_t nStart = GetTimeMillis();
+    int64_t nStartCPU = GetProcessCPUMicros();
 
     int nLoaded = 0;
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        //CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE(10000000), MAX_BLOCK_SIZE(10000000)+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
+        ScanBlockFile(fileIn, dbp, [&](CBlock& block) {
+            return ImportBlock(block, block.GetHash(), false, dbp, nLoaded);
+        });
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+    LogImportRate(nLoaded, nStart, nStartCPU);
+    return nLoaded > 0;
+}
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(Params().MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE(10000000))
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
-            try {
-                // read block
-                CBlock block;
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                blkdat >> block;
-                
-                nRewind = blkdat.GetPos();
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                             block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+/** Set fKnown on the blocks of an import batch we already have, so they aren't parsed */
+static void MarkKnownBlocks(std::vector<CImportedBlock>& vBatch)
+{
+    LOCK(cs_main);
+    BOOST_FOREACH(CImportedBlock& imported, vBatch) {
+        BlockMap::iterator mi = mapBlockIndex.find(imported.hash);
+        imported.fKnown = mi != mapBlockIndex.end() && mi->second != NULL && (mi->second->nStatus & BLOCK_HAVE_DATA);
+    }
+}
+
+bool ImportBlockFile(FILE* fileIn, const boost::filesystem::path& path, CDiskBlockPos *dbp)
+{
+    int nThreads = GetArg("-importthreads", DEFAULT_IMPORT_THREADS);
+    if (nThreads <= 0)
+        nThreads = GetNumCores();
+    nThreads = std::min(nThreads, MAX_IMPORT_THREADS);
+
+    std::shared_ptr<const CBlockFileMapping> mapping;
+    if (nThreads > 1)
+        mapping = CBlockFileMapping::Map(path);
+    if (!mapping)
+        return LoadExternalBlockFile(fileIn, dbp);
+    // The mapping keeps its own reference to the file
+    fclose(fileIn);
+
+    int64_t nStart = GetTimeMillis();
+    int64_t nStartCPU = GetProcessCPUMicros();
+    int nLoaded = 0;
+    try {
+        CBlockFileParser parser(mapping, Params().MessageStart(), MAX_BLOCK_SIZE(10000000), nThreads, MarkKnownBlocks);
+        LogPrint("reindex", "%s: %u blocks in %s, parsing on %d threads\n", __func__, parser.GetBlockCount(), path.string(), nThreads);
+        std::vector<CImportedBlock> vBatch;
+        bool fContinue = true;
+        while (fContinue && parser.NextBatch(vBatch)) {
+            BOOST_FOREACH(CImportedBlock& imported, vBatch) {
+                boost::this_thread::interruption_point();
+                if (!imported.fKnown && !imported.fParsed) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, imported.strError);
                     continue;
                 }
-
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(0,0,state, NULL, &block, true, dbp))
-                        nLoaded++;
-                    if (state.IsError())
+                try {
+                    if (dbp)
+                        dbp->nPos = imported.span.nPos;
+                    if (!ImportBlock(imported.block, imported.hash, imported.fKnown, dbp, nLoaded)) {
+                        fContinue = false;
                         break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && komodo_blockheight(hash) % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), komodo_blockheight(hash));
-                }
-
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        
-                        if (ReadBlockFromDisk(mapBlockIndex.count(hash)!=0?mapBlockIndex[hash]->GetHeight():0,block, it->second,1))
-                        {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                      head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(0,0,dummy, NULL, &block, true, &it->second))
-                            {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
                     }
+                } catch (const std::exception& e) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
-    if (nLoaded > 0)
-        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    LogImportRate(nLoaded, nStart, nStartCPU);
     return nLoaded > 0;
 }
 
@@ -7010,8 +7400,6 @@ void static ProcessGetData(CNode* pfrom)
 
     vector<CInv> vNotFound;
 
-    LOCK(cs_main);
-
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->nSendSize >= SendBufferSize())
@@ -7022,40 +7410,66 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
-                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end())
+                bool fCompact = false;
+                CBlockIndex* pindex = NULL;
+                uint256 hashTip;
                 {
-                    if (chainActive.Contains(mi->second)) {
-                        send = true;
-                    } else {
-                        static const int nOneMonth = 30 * 24 * 60 * 60;
-                        // To prevent fingerprinting attacks, only send blocks outside of the active
-                        // chain if they are valid, and no more than a month older (both in time, and in
-                        // best equivalent proof of work) than the best header chain we know about.
-                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
-                        (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
-                        (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, Params().GetConsensus()) < nOneMonth);
-                        if (!send) {
-                            LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                    LOCK(cs_main);
+                    BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+                    if (mi != mapBlockIndex.end())
+                    {
+                        if (chainActive.Contains(mi->second)) {
+                            send = true;
+                        } else {
+                            static const int nOneMonth = 30 * 24 * 60 * 60;
+                            // To prevent fingerprinting attacks, only send blocks outside of the active
+                            // chain if they are valid, and no more than a month older (both in time, and in
+                            // best equivalent proof of work) than the best header chain we know about.
+                            send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
+                            (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
+                            (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, Params().GetConsensus()) < nOneMonth);
+                            if (!send) {
+                                LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                            }
                         }
+                        pindex = mi->second;
                     }
+                    // Pruned nodes may have deleted the block, so check whether
+                    // it's available before trying to send.
+                    send = send && (pindex->nStatus & BLOCK_HAVE_DATA);
+                    hashTip = chainActive.Tip()->GetBlockHash();
+                    // Older blocks won't be in the peer's mempool, send those whole
+                    fCompact = send && inv.type == MSG_CMPCT_BLOCK && pindex->GetHeight() >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
                 }
-                // Pruned nodes may have deleted the block, so check whether
-                // it's available before trying to send.
-                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
+                if (send)
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second,1))
+                    // Send block from disk. Read without cs_main, so serving a
+                    // large block does not hold up validation. The tip we just
+                    // relayed is kept in memory, as everyone asks for it at once.
+                    CBlock blockRead;
+                    std::shared_ptr<const CBlock> pblockRecent = GetMostRecentBlock(inv.hash);
+                    if (!pblockRecent && !ReadBlockFromDisk(blockRead, pindex, 1))
                     {
-                        assert(!"cannot load block from disk");
+                        // Only pruning may have removed it since the check above
+                        LOCK(cs_main);
+                        if (pindex->nStatus & BLOCK_HAVE_DATA)
+                            assert(!"cannot load block from disk");
                     }
                     else
                     {
-                        if (inv.type == MSG_BLOCK)
+                        const CBlock& block = pblockRecent ? *pblockRecent : blockRead;
+                        if (fCompact && block.vtx.size() <= (size_t)std::numeric_limits<uint16_t>::max() + 1)
+                        {
+                            std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = GetMostRecentCompactBlock(inv.hash);
+                            if (pcmpctblock)
+                                pfrom->PushMessage("cmpctblock", *pcmpctblock);
+                            else
+                                pfrom->PushMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block, GetCompactPrefill(block, pindex->GetHeight())));
+                        }
+                        else if (inv.type == MSG_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                         {
                             //uint256 hash; int32_t z;
                             //hash = block.GetHash();
@@ -7077,10 +7491,18 @@ void static ProcessGetData(CNode* pfrom)
                                 // they must either disconnect and retry or request the full block.
                                 // Thus, the protocol spec specified allows for us to provide duplicate txn here,
                                 // however we MUST always provide at least what the remote peer needs
+                                // This runs on a serving thread, so setInventoryKnown is read under
+                                // cs_inventory; the sends happen after it is released
                                 typedef std::pair<unsigned int, uint256> PairType;
-                                BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
-                                    pfrom->PushMessage("tx", block.vtx[pair.first]);
+                                std::vector<unsigned int> vUnknownTx;
+                                {
+                                    LOCK(pfrom->cs_inventory);
+                                    BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
+                                    if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
+                                        vUnknownTx.push_back(pair.first);
+                                }
+                                BOOST_FOREACH(unsigned int nTx, vUnknownTx)
+                                    pfrom->PushMessage("tx", block.vtx[nTx]);
                             }
                             // else
                             // no response
@@ -7093,7 +7515,7 @@ void static ProcessGetData(CNode* pfrom)
                         // and we want it right after the last block so they don't
                         // wait for other stuff first.
                         vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+                        vInv.push_back(CInv(MSG_BLOCK, hashTip));
                         pfrom->PushMessage("inv", vInv);
                         pfrom->hashContinue.SetNull();
                     }
@@ -7129,7 +7551,7 @@ void static ProcessGetData(CNode* pfrom)
             // Track requests for our stuff.
             GetMainSignals().Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -7148,6 +7570,33 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+/** Validate a block pfrom sent us in a block, cmpctblock or blocktxn message */
+static void ProcessReceivedBlock(CNode* pfrom, CBlock& block, const string& strCommand)
+{
+    CValidationState state;
+    // Process all blocks from whitelisted peers, even if not requested,
+    // unless we're still syncing with the network.
+    // Such an unrequested block may still be processed, subject to the
+    // conditions in AcceptBlock().
+    bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
+    ProcessNewBlock(0,0,state, pfrom, &block, forceProcessing, NULL);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), block.GetHash());
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+        return;
+    }
+
+    // The peers that give us new tips first get them pushed compact from now on
+    LOCK(cs_main);
+    if (!IsInitialBlockDownload() && chainActive.Tip()->GetBlockHash() == block.GetHash())
+        MaybeSetPeerAsAnnouncingCompact(pfrom);
+}
+
 #include "komodo_nSPV_defs.h"
 #include "komodo_nSPV.h"            // shared defines, structs, serdes, purge functions
 #include "komodo_nSPV_fullnode.h"   // nSPV fullnode handling of the getnSPV request messages
@@ -7346,6 +7795,15 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        // Tell the peer we take new blocks announced by headers, and compact
+        // blocks, announced that way until we ask for more. Older nodes
+        // ignore the unknown messages.
+        if ( KOMODO_NSPV_SUPERLITE == 0 )
+        {
+            pfrom->PushMessage("sendheaders");
+            pfrom->PushMessage("sendcmpct", false, (uint64_t)1);
+        }
     }
 
 
@@ -7536,6 +7994,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         {
             std::vector<uint8_t> payload;
             vRecv >> payload;
+            // The nSPV handlers read chain state without taking cs_main themselves,
+            // which only held while they ran on the message handler thread
+            LOCK(cs_main);
             komodo_nSPVreq(pfrom,payload);
         }
         return(true);
@@ -7594,7 +8055,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     CNodeState *nodestate = State(pfrom->GetId());
                     if (chainActive.Tip()->GetBlockTime() > GetTime() - chainparams.GetConsensus().nPowTargetSpacing * 20 &&
                         nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-                        vToFetch.push_back(inv);
+                        // Near the tip the peer's transactions are mostly in our mempool already
+                        vToFetch.push_back(CInv(nodestate->fSupportsCompact ? MSG_CMPCT_BLOCK : MSG_BLOCK, inv.hash));
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
                         MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
@@ -7623,6 +8085,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         vRecv >> vInv;
         if (vInv.size() > MAX_INV_SZ)
         {
+            // Served off the message handler thread, without cs_main
+            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 20);
             return error("message getdata size() = %u", vInv.size());
         }
@@ -7680,57 +8144,67 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         uint256 hashStop;
         vRecv >> locator >> hashStop;
 
-        LOCK(cs_main);
-
-        if (chainActive.LastTip() != 0 && chainActive.LastTip()->GetHeight() > 100000 && IsInitialBlockDownload())
+        // The headers to send, nCount of them ending at pindexLast
+        CBlockIndex* pindexLast = NULL;
+        int nCount = 0;
         {
-            //fprintf(stderr,"dont process getheaders during initial download\n");
-            return true;
-        }
-        CBlockIndex* pindex = NULL;
-        if (locator.IsNull())
-        {
-            // If locator is null, return the hashStop block
-            BlockMap::iterator mi = mapBlockIndex.find(hashStop);
-            if (mi == mapBlockIndex.end())
+            LOCK(cs_main);
+
+            if (chainActive.LastTip() != 0 && chainActive.LastTip()->GetHeight() > 100000 && IsInitialBlockDownload())
             {
-                //fprintf(stderr,"mi == end()\n");
+                //fprintf(stderr,"dont process getheaders during initial download\n");
                 return true;
             }
-            pindex = (*mi).second;
-        }
-        else
-        {
-            // Find the last block the caller has in the main chain
-            pindex = FindForkInGlobalIndex(chainActive, locator);
-            if (pindex)
-                pindex = chainActive.Next(pindex);
-        }
+            CBlockIndex* pindex = NULL;
+            if (locator.IsNull())
+            {
+                // If locator is null, return the hashStop block
+                BlockMap::iterator mi = mapBlockIndex.find(hashStop);
+                if (mi == mapBlockIndex.end())
+                {
+                    //fprintf(stderr,"mi == end()\n");
+                    return true;
+                }
+                pindex = (*mi).second;
+            }
+            else
+            {
+                // Find the last block the caller has in the main chain
+                pindex = FindForkInGlobalIndex(chainActive, locator);
+                if (pindex)
+                    pindex = chainActive.Next(pindex);
+            }
 
-        // we must use CNetworkBlockHeader, as CBlockHeader won't include the 0x00 nTx count at the end for compatibility
-        vector<CNetworkBlockHeader> vHeaders;
-        int nLimit = MAX_HEADERS_RESULTS;
-        LogPrint("net", "getheaders %d to %s from peer=%d\n", (pindex ? pindex->GetHeight() : -1), hashStop.ToString(), pfrom->id);
-        //if ( pfrom->lasthdrsreq >= chainActive.Height()-MAX_HEADERS_RESULTS || pfrom->lasthdrsreq != (int32_t)(pindex ? pindex->GetHeight() : -1) )// no need to ever suppress this
-        {
-            pfrom->lasthdrsreq = (int32_t)(pindex ? pindex->GetHeight() : -1);
-            for (; pindex; pindex = chainActive.Next(pindex))
+            int nLimit = MAX_HEADERS_RESULTS;
+            LogPrint("net", "getheaders %d to %s from peer=%d\n", (pindex ? pindex->GetHeight() : -1), hashStop.ToString(), pfrom->id);
+            //if ( pfrom->lasthdrsreq >= chainActive.Height()-MAX_HEADERS_RESULTS || pfrom->lasthdrsreq != (int32_t)(pindex ? pindex->GetHeight() : -1) )// no need to ever suppress this
             {
-                CBlockHeader h = pindex->GetBlockHeader();
-                //printf("size.%i, solution size.%i\n", (int)sizeof(h), (int)h.nSolution.size());
-                //printf("hash.%s prevhash.%s nonce.%s\n", h.GetHash().ToString().c_str(), h.hashPrevBlock.ToString().c_str(), h.nNonce.ToString().c_str());
-                vHeaders.push_back(pindex->GetBlockHeader());
-                if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
-                    break;
+                pfrom->lasthdrsreq = (int32_t)(pindex ? pindex->GetHeight() : -1);
+                for (; pindex; pindex = chainActive.Next(pindex))
+                {
+                    pindexLast = pindex;
+                    nCount++;
+                    if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
+                        break;
+                }
             }
-            pfrom->PushMessage("headers", vHeaders);
+            /*else if ( IS_KOMODO_NOTARY != 0 )
+            {
+                static uint32_t counter;
+                if ( counter++ < 3 )
+                    fprintf(stderr,"you can ignore redundant getheaders from peer.%d %d prev.%d\n",(int32_t)pfrom->id,(int32_t)(pindex ? pindex->GetHeight() : -1),pfrom->lasthdrsreq);
+            }*/
+            if (pindexLast != NULL)
+                UpdateBestHeaderSent(pfrom->GetId(), pindexLast);
         }
-        /*else if ( IS_KOMODO_NOTARY != 0 )
-        {
-            static uint32_t counter;
-            if ( counter++ < 3 )
-                fprintf(stderr,"you can ignore redundant getheaders from peer.%d %d prev.%d\n",(int32_t)pfrom->id,(int32_t)(pindex ? pindex->GetHeight() : -1),pfrom->lasthdrsreq);
-        }*/
+
+        // Mostly copied from the header cache rather than built from the block index
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        if (pindexLast != NULL)
+            headerCache.WriteHeaders(ss, pindexLast, nCount);
+        else
+            WriteCompactSize(ss, 0);
+        pfrom->PushMessage("headers", ss);
     }
 
 
@@ -7886,6 +8360,42 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Hash the whole message at once, which lets VerusHash chains run
+        // several headers through the hash side by side
+        std::vector<uint256> vHashes;
+        CBlockHeader::GetHashes(headers, vHashes);
+
+        // The cheap check first: the headers must form a chain
+        for (unsigned int n = 1; n < nCount; n++) {
+            if (headers[n].hashPrevBlock != vHashes[n - 1]) {
+                LOCK(cs_main);
+                Misbehaving(pfrom->GetId(), 20);
+                return error("non-continuous headers sequence");
+            }
+        }
+
+        // Verify the solutions of the headers new to us in parallel before
+        // taking cs_main for the rest; AcceptBlockHeader below then finds
+        // them in the cache, and skips the known ones as it always has.
+        // Only for headers that connect, and in batches that double in size
+        // from one, stopping at the first that fails: a peer gets no more
+        // solutions checked than about twice the valid ones it sent. The
+        // invalid one is left for the serial pass to find and punish.
+        std::vector<const CBlockHeader*> vpNewHeaders;
+        {
+            LOCK(cs_main);
+            if (nCount > 0 && mapBlockIndex.count(headers[0].hashPrevBlock) != 0)
+                for (unsigned int n = 0; n < nCount; n++)
+                    if (mapBlockIndex.count(vHashes[n]) == 0)
+                        vpNewHeaders.push_back(&headers[n]);
+        }
+        for (size_t nDone = 0, nBatch = 1; nDone < vpNewHeaders.size(); nDone += nBatch, nBatch *= 2) {
+            std::vector<const CBlockHeader*> vpBatch(vpNewHeaders.begin() + nDone,
+                                                     vpNewHeaders.begin() + std::min(nDone + nBatch, vpNewHeaders.size()));
+            if (!CheckEquihashSolutions(vpBatch))
+                break;
+        }
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -7893,6 +8403,21 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
 
+        // An announcement that doesn't connect, as after one we missed:
+        // ask for the headers in between. A peer that keeps sending these
+        // gets penalised every MAX_UNCONNECTING_HEADERS in a row.
+        CNodeState *nodestate = State(pfrom->GetId());
+        if (nCount <= MAX_BLOCKS_TO_ANNOUNCE && mapBlockIndex.count(headers[0].hashPrevBlock) == 0) {
+            nodestate->nUnconnectingHeaders++;
+            LogPrint("net", "unconnecting headers announcement from peer=%d, getheaders (%d), nUnconnectingHeaders=%d\n", pfrom->id, pindexBestHeader->GetHeight(), nodestate->nUnconnectingHeaders);
+            pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), uint256());
+            if (nodestate->nUnconnectingHeaders % MAX_UNCONNECTING_HEADERS == 0)
+                Misbehaving(pfrom->GetId(), 20);
+            return true;
+        }
+        if (mapBlockIndex.count(headers[0].hashPrevBlock) != 0)
+            nodestate->nUnconnectingHeaders = 0;
+
         bool hasNewHeaders = true;
 
         // only KMD have checkpoints in sources, so, using IsInitialBlockDownload() here is
@@ -7915,11 +8440,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             // more headers later.  This prevents multiple chains of redundant
             // getheader requests from running in parallel if triggered by incoming
             // blocks while the node is still in initial headers sync.
-            hasNewHeaders = (mapBlockIndex.count(headers.back().GetHash()) == 0);
+            hasNewHeaders = (mapBlockIndex.count(vHashes.back()) == 0);
         }
 
         CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
             //printf("size.%i, solution size.%i\n", (int)sizeof(header), (int)header.nSolution.size());
             //printf("hash.%s prevhash.%s nonce.%s\n", header.GetHash().ToString().c_str(), header.hashPrevBlock.ToString().c_str(), header.nNonce.ToString().c_str());
 
@@ -7929,7 +8455,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 return error("non-continuous headers sequence");
             }
             int32_t futureblock;
-            if (!AcceptBlockHeader(&futureblock,header, state, &pindexLast)) {
+            if (!AcceptBlockHeader(&futureblock,header, state, &pindexLast, &vHashes[i])) {
                 int nDoS;
                 if (state.IsInvalid(nDoS) && futureblock == 0)
                 {
@@ -7943,6 +8469,34 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         if (pindexLast)
             UpdateBlockAvailability(pfrom->GetId(), pindexLast->GetBlockHash());
 
+        // New blocks announced by headers are fetched right away, saving the
+        // inv round-trip; the one on our tip as a compact block
+        if (pindexLast && nCount <= MAX_BLOCKS_TO_ANNOUNCE && !IsInitialBlockDownload() &&
+            pindexLast->chainPower > chainActive.Tip()->chainPower) {
+            vector<CBlockIndex*> vToFetch;
+            CBlockIndex *pindexWalk = pindexLast;
+            while (pindexWalk && !chainActive.Contains(pindexWalk) && vToFetch.size() <= MAX_BLOCKS_TO_ANNOUNCE) {
+                if (!(pindexWalk->nStatus & BLOCK_HAVE_DATA) && !mapBlocksInFlight.count(pindexWalk->GetBlockHash()))
+                    vToFetch.push_back(pindexWalk);
+                pindexWalk = pindexWalk->pprev;
+            }
+            // A longer fork is left to the regular block download
+            if (pindexWalk && chainActive.Contains(pindexWalk)) {
+                vector<CInv> vGetData;
+                BOOST_REVERSE_FOREACH(CBlockIndex *pindex, vToFetch) {
+                    if (nodestate->nBlocksInFlight >= MAX_BLOCKS_IN_TRANSIT_PER_PEER)
+                        break;
+                    bool fCompact = nodestate->fSupportsCompact && pindex->pprev == chainActive.Tip();
+                    vGetData.push_back(CInv(fCompact ? MSG_CMPCT_BLOCK : MSG_BLOCK, pindex->GetBlockHash()));
+                    MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), chainparams.GetConsensus(), pindex);
+                }
+                if (!vGetData.empty()) {
+                    LogPrint("net", "fetching %u announced block(s) up to %s from peer=%d\n", vGetData.size(), pindexLast->GetBlockHash().ToString(), pfrom->id);
+                    pfrom->PushMessage("getdata", vGetData);
+                }
+            }
+        }
+
         /* debug log */
         // if (!hasNewHeaders && nCount == MAX_HEADERS_RESULTS && pindexLast) {
         //         static int64_t bytes_saved;
@@ -7976,23 +8530,195 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         pfrom->AddInventoryKnown(inv);
 
-        CValidationState state;
-        // Process all blocks from whitelisted peers, even if not requested,
-        // unless we're still syncing with the network.
-        // Such an unrequested block may still be processed, subject to the
-        // conditions in AcceptBlock().
-        bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
-        ProcessNewBlock(0,0,state, pfrom, &block, forceProcessing, NULL);
-        int nDoS;
-        if (state.IsInvalid(nDoS)) {
-            pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0) {
+        ProcessReceivedBlock(pfrom, block, strCommand);
+    }
+
+
+    else if (strCommand == "sendheaders")
+    {
+        LOCK(cs_main);
+        State(pfrom->GetId())->fPreferHeaders = true;
+    }
+
+
+    else if (strCommand == "sendcmpct")
+    {
+        bool fAnnounceUsingCmpctBlock = false;
+        uint64_t nCmpctBlockVersion = 0;
+        vRecv >> fAnnounceUsingCmpctBlock >> nCmpctBlockVersion;
+        if (nCmpctBlockVersion == 1) {
+            LOCK(cs_main);
+            CNodeState *nodestate = State(pfrom->GetId());
+            nodestate->fSupportsCompact = true;
+            nodestate->fPreferCompactAnnounce = fAnnounceUsingCmpctBlock;
+        }
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex)
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        const uint256 hash = cmpctblock.header.GetHash();
+        LogPrint("net", "received cmpctblock %s peer=%d\n", hash.ToString(), pfrom->id);
+        pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hash));
+
+        CBlock block;
+        bool fBlockReconstructed = false;
+        {
+            LOCK(cs_main);
+
+            if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end()) {
+                // Doesn't connect to anything we know, catch up on headers first
+                if (!IsInitialBlockDownload())
+                    pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), uint256());
+                return true;
+            }
+
+            CBlockIndex *pindex = NULL;
+            CValidationState state;
+            int32_t futureblock;
+            if (!AcceptBlockHeader(&futureblock, cmpctblock.header, state, &pindex)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS) && futureblock == 0) {
+                    if (nDoS > 0)
+                        Misbehaving(pfrom->GetId(), nDoS);
+                    return error("invalid header in cmpctblock from peer=%d", pfrom->id);
+                }
+                return true;
+            }
+            UpdateBlockAvailability(pfrom->GetId(), hash);
+
+            if (pindex->nStatus & BLOCK_HAVE_DATA)
+                return true;
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+            bool fInFlightFromPeer = itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == pfrom->GetId();
+            CNodeState *nodestate = State(pfrom->GetId());
+            if (pindex->pprev != chainActive.Tip()) {
+                // Only a block on our tip can be rebuilt from our mempool;
+                // if we asked this peer for it, take it whole instead
+                if (fInFlightFromPeer)
+                    pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, hash)));
+                return true;
+            }
+            if (nodestate->partialBlock && nodestate->partialBlock->header.GetHash() == hash)
+                return true;
+
+            std::shared_ptr<PartiallyDownloadedBlock> partialBlock = std::make_shared<PartiallyDownloadedBlock>(&mempool);
+            ReadStatus status = partialBlock->InitData(cmpctblock);
+            if (status == READ_STATUS_INVALID) {
+                if (fInFlightFromPeer)
+                    MarkBlockAsReceived(hash);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("invalid cmpctblock %s from peer=%d", hash.ToString(), pfrom->id);
+            }
+
+            std::vector<uint16_t> vMissing;
+            if (status == READ_STATUS_OK) {
+                vMissing = partialBlock->GetMissing();
+                if (vMissing.empty()) {
+                    status = partialBlock->FillBlock(block, std::vector<CTransaction>());
+                    fBlockReconstructed = status == READ_STATUS_OK;
+                }
+            }
+            if (status == READ_STATUS_FAILED) {
+                // Short id collision, the whole block costs one more round-trip
+                MarkBlockAsInFlight(pfrom->GetId(), hash, chainparams.GetConsensus(), pindex);
+                pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, hash)));
+                return true;
+            }
+            if (!fBlockReconstructed) {
+                BlockTransactionsRequest req;
+                req.blockhash = hash;
+                req.indexes = vMissing;
+                nodestate->partialBlock = partialBlock;
+                MarkBlockAsInFlight(pfrom->GetId(), hash, chainparams.GetConsensus(), pindex);
+                pfrom->PushMessage("getblocktxn", req);
+            }
+        }
+
+        if (fBlockReconstructed)
+            ProcessReceivedBlock(pfrom, block, strCommand);
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        // Served from the most recent block when we can, from disk otherwise,
+        // in either case without cs_main
+        CBlock blockRead;
+        std::shared_ptr<const CBlock> pblockRecent = GetMostRecentBlock(req.blockhash);
+        if (!pblockRecent) {
+            CBlockIndex *pindex = NULL;
+            {
                 LOCK(cs_main);
-                Misbehaving(pfrom->GetId(), nDoS);
+                BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+                if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                    LogPrint("net", "peer=%d asked for transactions of block %s we don't have\n", pfrom->id, req.blockhash.ToString());
+                    return true;
+                }
+                pindex = mi->second;
+                if (pindex->GetHeight() < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+                    // Too old to have been sent compact by us, answer with the whole block
+                    LogPrint("net", "peer=%d asked for transactions of block %s more than %d deep\n", pfrom->id, req.blockhash.ToString(), MAX_BLOCKTXN_DEPTH);
+                    pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+                    return true;
+                }
+            }
+            if (!ReadBlockFromDisk(blockRead, pindex, 1))
+                return error("getblocktxn: cannot load block %s from disk", req.blockhash.ToString());
+        }
+        const CBlock& block = pblockRecent ? *pblockRecent : blockRead;
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                LOCK(cs_main);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent a getblocktxn with out-of-bounds tx indexes", pfrom->id);
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex)
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        bool fBlockReconstructed = false;
+        {
+            LOCK(cs_main);
+            CNodeState *nodestate = State(pfrom->GetId());
+            std::shared_ptr<PartiallyDownloadedBlock> partialBlock = nodestate->partialBlock;
+            if (!partialBlock || partialBlock->header.GetHash() != resp.blockhash) {
+                LogPrint("net", "peer=%d sent transactions of block %s we didn't ask for\n", pfrom->id, resp.blockhash.ToString());
+                return true;
             }
+            nodestate->partialBlock.reset();
+
+            ReadStatus status = partialBlock->FillBlock(block, resp.txn);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(resp.blockhash);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent blocktxn not matching its cmpctblock %s", pfrom->id, resp.blockhash.ToString());
+            } else if (status == READ_STATUS_FAILED) {
+                // A mempool transaction matched the wrong short id, fall back to the whole block
+                pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, resp.blockhash)));
+            } else
+                fBlockReconstructed = true;
         }
 
+        if (fBlockReconstructed)
+            ProcessReceivedBlock(pfrom, block, strCommand);
     }
 
 
@@ -8152,6 +8878,59 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     return true;
 }
 
+/** ProcessMessage, logging rather than propagating whatever a malformed message throws */
+static bool TryProcessMessage(CNode* pfrom, const string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, unsigned int nMessageSize)
+{
+    bool fRet = false;
+    try
+    {
+        fRet = ProcessMessage(pfrom, strCommand, vRecv, nTimeReceived);
+        boost::this_thread::interruption_point();
+    }
+    catch (const std::ios_base::failure& e)
+    {
+        pfrom->PushMessage("reject", strCommand, REJECT_MALFORMED, string("error parsing message"));
+        if (strstr(e.what(), "end of data"))
+        {
+            // Allow exceptions from under-length message on vRecv
+            LogPrintf("%s(%s, %u bytes): Exception '%s' caught, normally caused by a message being shorter than its stated length\n", __func__, SanitizeString(strCommand), nMessageSize, e.what());
+        }
+        else if (strstr(e.what(), "size too large"))
+        {
+            // Allow exceptions from over-long size
+            LogPrintf("%s(%s, %u bytes): Exception '%s' caught\n", __func__, SanitizeString(strCommand), nMessageSize, e.what());
+        }
+        else
+        {
+            //PrintExceptionContinue(&e, "ProcessMessages()");
+        }
+    }
+    catch (const boost::thread_interrupted&) {
+        throw;
+    }
+    catch (const std::exception& e) {
+        PrintExceptionContinue(&e, "ProcessMessages()");
+    } catch (...) {
+        PrintExceptionContinue(NULL, "ProcessMessages()");
+    }
+
+    if (!fRet)
+        LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
+    return fRet;
+}
+
+/** Whether strCommand only asks for chain data, so it can be answered on the serving threads */
+static bool IsServingCommand(const string& strCommand)
+{
+    return strCommand == "getdata" || strCommand == "getblocks" || strCommand == "getheaders" ||
+           strCommand == "getblocktxn" || (strCommand == "getnSPV" && KOMODO_NSPV == 0);
+}
+
+static void ServeMessage(CNode* pfrom, const string& strCommand, boost::shared_ptr<CDataStream> pvRecv, int64_t nTimeReceived, unsigned int nMessageSize)
+{
+    TryProcessMessage(pfrom, strCommand, *pvRecv, nTimeReceived, nMessageSize);
+}
+
 // requires LOCK(cs_vRecvMsg)
 bool ProcessMessages(CNode* pfrom)
 {
@@ -8168,8 +8947,17 @@ bool ProcessMessages(CNode* pfrom)
     //
     bool fOk = true;
 
-    if (!pfrom->vRecvGetData.empty())
+    // The serving threads own the peer until its current request is answered
+    if (pfrom->fServing)
+        return fOk;
+
+    // Nothing can be answered while the send buffer is full, so don't hand
+    // the peer to a serving thread just to have it bounce straight back
+    if (!pfrom->vRecvGetData.empty() && pfrom->nSendSize < SendBufferSize()) {
+        if (QueueServingTask(pfrom, boost::bind(&ProcessGetData, pfrom)))
+            return fOk;
         ProcessGetData(pfrom);
+    }
 
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return fOk;
@@ -8225,42 +9013,16 @@ bool ProcessMessages(CNode* pfrom)
             continue;
         }
 
-        // Process message
-        bool fRet = false;
-        try
-        {
-            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
-            boost::this_thread::interruption_point();
-        }
-        catch (const std::ios_base::failure& e)
-        {
-            pfrom->PushMessage("reject", strCommand, REJECT_MALFORMED, string("error parsing message"));
-            if (strstr(e.what(), "end of data"))
-            {
-                // Allow exceptions from under-length message on vRecv
-                LogPrintf("%s(%s, %u bytes): Exception '%s' caught, normally caused by a message being shorter than its stated length\n", __func__, SanitizeString(strCommand), nMessageSize, e.what());
-            }
-            else if (strstr(e.what(), "size too large"))
-            {
-                // Allow exceptions from over-long size
-                LogPrintf("%s(%s, %u bytes): Exception '%s' caught\n", __func__, SanitizeString(strCommand), nMessageSize, e.what());
-            }
-            else
-            {
-                //PrintExceptionContinue(&e, "ProcessMessages()");
-            }
-        }
-        catch (const boost::thread_interrupted&) {
-            throw;
-        }
-        catch (const std::exception& e) {
-            PrintExceptionContinue(&e, "ProcessMessages()");
-        } catch (...) {
-            PrintExceptionContinue(NULL, "ProcessMessages()");
+        // Requests for chain data go to the serving threads, the peer's next
+        // message waits until this one is answered
+        if (pfrom->nVersion != 0 && IsServingCommand(strCommand)) {
+            boost::shared_ptr<CDataStream> pvRecv(new CDataStream(vRecv));
+            if (QueueServingTask(pfrom, boost::bind(&ServeMessage, pfrom, strCommand, pvRecv, msg.nTime, nMessageSize)))
+                break;
         }
 
-        if (!fRet)
-            LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
+        // Process message
+        TryProcessMessage(pfrom, strCommand, vRecv, msg.nTime, nMessageSize);
 
         break;
     }
@@ -8276,6 +9038,10 @@ bool ProcessMessages(CNode* pfrom)
 bool SendMessages(CNode* pto, bool fSendTrickle)
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
+    // Headers to announce, serialized once cs_main is released as a
+    // trimmed solution is read back from disk
+    const CBlockIndex* pindexAnnounce = NULL;
+    int nAnnounce = 0;
     {
         // Don't send anything until we get its version message
         if (pto->nVersion == 0)
@@ -8410,6 +9176,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         vector<CInv> vInv;
         vector<CInv> vInvWait;
+        vector<uint256> vBlockHashesToAnnounce;
         {
             LOCK(pto->cs_inventory);
             vInv.reserve(pto->vInventoryToSend.size());
@@ -8437,6 +9204,26 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     }
                 }
 
+                // Push a new tip straight to high-bandwidth compact block peers,
+                // saving them the getdata round-trip
+                if (inv.type == MSG_BLOCK && state.fPreferCompactAnnounce)
+                {
+                    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = GetMostRecentCompactBlock(inv.hash);
+                    if (pcmpctblock)
+                    {
+                        if (pto->setInventoryKnown.insert(inv).second)
+                            pto->PushMessage("cmpctblock", *pcmpctblock);
+                        continue;
+                    }
+                }
+
+                // Announced by headers below, if they connect
+                if (inv.type == MSG_BLOCK && state.fPreferHeaders)
+                {
+                    vBlockHashesToAnnounce.push_back(inv.hash);
+                    continue;
+                }
+
                 // returns true if wasn't already contained in the set
                 if (pto->setInventoryKnown.insert(inv).second)
                 {
@@ -8450,6 +9237,50 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             }
             pto->vInventoryToSend = vInvWait;
         }
+
+        //
+        // Message: headers, new blocks to a peer that asked for them that way.
+        // Only a short run on our chain that connects to a header the peer
+        // has; anything else falls back to an inv of the last block.
+        //
+        if (!vBlockHashesToAnnounce.empty())
+        {
+            ProcessBlockAvailability(pto->GetId());
+            vector<CBlockIndex*> vAnnounce;
+            bool fRevertToInv = vBlockHashesToAnnounce.size() > MAX_BLOCKS_TO_ANNOUNCE;
+            BOOST_FOREACH(const uint256& hash, vBlockHashesToAnnounce)
+            {
+                if (fRevertToInv)
+                    break;
+                BlockMap::iterator mi = mapBlockIndex.find(hash);
+                if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second))
+                    fRevertToInv = true;
+                else if (!vAnnounce.empty() && mi->second->pprev != vAnnounce.back())
+                    fRevertToInv = true;
+                else if (vAnnounce.empty() && PeerHasHeader(&state, mi->second))
+                    continue;
+                else if (vAnnounce.empty() && !PeerHasHeader(&state, mi->second->pprev))
+                    fRevertToInv = true;
+                else
+                    vAnnounce.push_back(mi->second);
+            }
+            if (!fRevertToInv && !vAnnounce.empty())
+            {
+                BOOST_FOREACH(CBlockIndex* pindex, vAnnounce)
+                    pto->AddInventoryKnown(CInv(MSG_BLOCK, pindex->GetBlockHash()));
+                LogPrint("net", "announcing %u header(s) up to %s to peer=%d\n", vAnnounce.size(), vAnnounce.back()->GetBlockHash().ToString(), pto->id);
+                pindexAnnounce = vAnnounce.back();
+                nAnnounce = vAnnounce.size();
+                UpdateBestHeaderSent(pto->GetId(), vAnnounce.back());
+            }
+            else if (fRevertToInv)
+            {
+                CInv inv(MSG_BLOCK, vBlockHashesToAnnounce.back());
+                LOCK(pto->cs_inventory);
+                if (pto->setInventoryKnown.insert(inv).second)
+                    vInv.push_back(inv);
+            }
+        }
         if (!vInv.empty())
             pto->PushMessage("inv", vInv);
 
@@ -8548,6 +9379,12 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             pto->PushMessage("getdata", vGetData);
 
     }
+    if (pindexAnnounce != NULL)
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        headerCache.WriteHeaders(ss, pindexAnnounce, nAnnounce);
+        pto->PushMessage("headers", ss);
+    }
     return true;
 }
 
@@ -46,6 +46,7 @@
 
 #include <algorithm>
 #include <exception>
+#include <functional>
 #include <map>
 #include <set>
 #include <stdint.h>
@@ -57,6 +58,7 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewBackgroundFlush;
 class CBloomFilter;
 class CInv;
 class CScriptCheck;
@@ -85,6 +87,8 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 static const unsigned int MAX_STANDARD_TX_SIGOPS = MAX_BLOCK_SIGOPS/5;
 /** Default for -minrelaytxfee, minimum relay fee for transactions */
 static const unsigned int DEFAULT_MIN_RELAY_TX_FEE = 100;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 /** Default for -txexpirydelta, in number of blocks */
@@ -107,6 +111,18 @@ static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached its tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 160;
+/** Blocks at most this far below the tip are answered as cmpctblock when asked for one */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Blocks at most this far below the tip are answered to getblocktxn, deeper ones are sent whole */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+/** Most new blocks announced to a sendheaders peer in one headers message, more go by inv */
+static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
+/** Unconnecting headers announcements in a row from one peer before it is penalised */
+static const int MAX_UNCONNECTING_HEADERS = 10;
+/** Default for -trimsolutions, keep block index solutions on disk only */
+static const bool DEFAULT_TRIM_SOLUTIONS = true;
+/** Blocks past the -assumevalidnotarized block within which a notarisation must cover it */
+static const int ASSUMEVALID_NOTARIZED_WINDOW = 1440;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
@@ -125,6 +141,8 @@ static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 #define DEFAULT_ADDRESSINDEX (GetArg("-ac_cc",0) != 0 || GetArg("-ac_ccactivate",0) != 0)
 #define DEFAULT_SPENTINDEX (GetArg("-ac_cc",0) != 0 || GetArg("-ac_ccactivate",0) != 0)
 static const bool DEFAULT_TIMESTAMPINDEX = false;
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+static const bool DEFAULT_STARTUPBENCH = false;
 static const unsigned int DEFAULT_DB_MAX_OPEN_FILES = 1000;
 static const bool DEFAULT_DB_COMPRESSION = true;
 
@@ -160,6 +178,10 @@ extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Scripts of this block and its ancestors are not checked, null to check them all */
+extern uint256 hashAssumeValidNotarized;
+extern bool fTrimSolutions;
+extern bool fStartupBench;
 // TODO: remove this flag by structuring our code such that
 // it is unneeded for testing
 extern bool fCoinbaseEnforcedProtectionEnabled;
@@ -220,8 +242,21 @@ FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Translation to a filesystem path */
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
+/**
+ * Scan fileIn, which it takes over, for blocks the way an external block file
+ * is read, handing each to fnBlock (and its position to dbp when set) until
+ * fnBlock returns false or the file ends. Throws std::runtime_error on I/O errors.
+ */
+void ScanBlockFile(FILE* fileIn, CDiskBlockPos *dbp, const std::function<bool(CBlock&)>& fnBlock);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/**
+ * Import blocks from the file at path, opened as fileIn, which it takes over.
+ * Maps the file and parses its blocks on -importthreads threads, falling
+ * back to LoadExternalBlockFile when the file can't be mapped or parsing
+ * is serial.
+ */
+bool ImportBlockFile(FILE* fileIn, const boost::filesystem::path& path, CDiskBlockPos *dbp = NULL);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex();
 /** Load the block tree and coins database from disk */
@@ -239,6 +274,16 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the Equihash checking thread */
+void ThreadEquihashCheck();
+/**
+ * Check the Equihash solutions of a batch of headers on the Equihash
+ * checking threads. Returns false if any of them is invalid; with fCache
+ * the valid ones are remembered, so the per header checks that follow
+ * are cache hits. Without checking threads this does nothing. Callers
+ * take turns at the threads, one batch at a time.
+ */
+bool CheckEquihashSolutions(const std::vector<const CBlockHeader*>& vpheaders, bool fCache = true);
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -806,6 +851,9 @@ bool GetAddressUnspent(uint160 addressHash, int type,
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos,bool checkPOW);
+bool ReadBlockFromDisk(int32_t height,CBlock& block, const CDiskBlockPos& pos,bool checkPOW);
+/** Read the header of the block at postx and the transaction stored at postx.nTxOffset after it */
+bool ReadTxFromDisk(const CDiskTxPos& postx, CBlockHeader& header, CTransaction& tx);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex,bool checkPOW);
 bool PruneOneBlockFile(bool tempfile, const int fileNumber);
 
@@ -817,8 +865,9 @@ bool PruneOneBlockFile(bool tempfile, const int fileNumber);
  *  of problems. Note that in any case, coins may be modified. */
 bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
 
-/** Apply the effects of this block (with given index) on the UTXO set represented by coins */
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false,bool fCheckPOW = false);
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins.
+ *  pvTxData, if given, holds the sighash midstates of every transaction, computed ahead of time. */
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false,bool fCheckPOW = false, const std::vector<PrecomputedTransactionData>* pvTxData = NULL);
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(int32_t *futureblockp,int32_t height,CBlockIndex *pindex,const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
@@ -841,7 +890,7 @@ bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex
  * If dbp is non-NULL, the file is known to already reside on disk
  */
 bool AcceptBlock(int32_t *futureblockp,CBlock& block, CValidationState& state, CBlockIndex **pindex, bool fRequested, CDiskBlockPos* dbp);
-bool AcceptBlockHeader(int32_t *futureblockp,const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL);
+bool AcceptBlockHeader(int32_t *futureblockp,const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL, const uint256* phash = NULL);
 
 
 
@@ -935,6 +984,9 @@ extern CCoinsViewCache *pcoinsTip;
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** The view below pcoinsTip that writes flushes in the background, if enabled (protected by cs_main) */
+extern CCoinsViewBackgroundFlush *pcoinsflush;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
@@ -187,6 +187,167 @@ int32_t komodo_waituntilelegible(uint32_t blocktime, int32_t stakeHeight, uint32
     return(1);
 }
 
+//
+// CreateNewBlock is called over and over against the same tip while a miner
+// or staker waits for a block. Most of the per-transaction work (input
+// lookups, priority, notary detection, script and CC checks) only depends on
+// the transaction, the tip and the active notary set, so the results are
+// kept here and reused until the tip changes. Entries are dropped as soon as
+// their transaction leaves the mempool. Guarded by cs_main and mempool.cs.
+//
+class CTemplateTxInfo
+{
+public:
+    double dPriority;                   // after ComputePriority, before mempool deltas
+    CAmount nTotalIn;
+    unsigned int nTxSize;
+    set<uint256> setDependsOn;          // in-mempool parents
+    std::vector<int8_t> vNotaries;      // notaries that signed a possible notarisation
+    bool fNotarisation;
+    bool fInputsChecked;                // ContextualCheckInputs passed at this tip
+    uint64_t nGeneration;
+
+    CTemplateTxInfo() : dPriority(0), nTotalIn(0), nTxSize(0), fNotarisation(false), fInputsChecked(false), nGeneration(0) { }
+};
+
+class CBlockTemplateCache
+{
+public:
+    uint256 hashTip;
+    uint32_t nBranchId;
+    uint256 hashNotaries;
+    uint256 hashCheckedTxs;             // transactions of the last template that passed TestBlockValidity
+    uint64_t nGeneration;
+    std::map<uint256, CTemplateTxInfo> mapTx;
+
+    CBlockTemplateCache() : nBranchId(0), nGeneration(0) { }
+
+    void Update(const uint256& hashTipIn, uint32_t nBranchIdIn, const uint256& hashNotariesIn)
+    {
+        if (hashTipIn != hashTip || nBranchIdIn != nBranchId || hashNotariesIn != hashNotaries)
+        {
+            mapTx.clear();
+            hashCheckedTxs.SetNull();
+            hashTip = hashTipIn;
+            nBranchId = nBranchIdIn;
+            hashNotaries = hashNotariesIn;
+        }
+        nGeneration++;
+    }
+
+    // Drop entries whose transaction was not seen in the mempool this round.
+    void Prune()
+    {
+        std::map<uint256, CTemplateTxInfo>::iterator it = mapTx.begin();
+        while (it != mapTx.end())
+        {
+            if (it->second.nGeneration != nGeneration)
+                mapTx.erase(it++);
+            else
+                ++it;
+        }
+    }
+};
+
+static CBlockTemplateCache templateCache;
+
+static uint256 GetTemplateTxsHash(const CBlock& block)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    for (size_t i = 1; i < block.vtx.size(); i++)
+        ss << block.vtx[i].GetHash();
+    return ss.GetHash();
+}
+
+// Everything CreateNewBlock needs to know about a mempool transaction that
+// does not change while the tip stays the same. Returns false if an input is
+// missing from both the chain and the mempool.
+static bool GetTemplateTxInfo(const CTransaction& tx, CCoinsViewCache& view, int nHeight, int8_t numSN, uint8_t notarypubkeys[64][33], CTemplateTxInfo& info)
+{
+    double dPriority = 0;
+    CAmount nTotalIn = 0;
+    if (tx.IsCoinImport())
+    {
+        CAmount nValueIn = GetCoinImportValue(tx); // burn amount
+        nTotalIn += nValueIn;
+        dPriority += (double)nValueIn * 1000;  // flat multiplier... max = 1e16.
+    } else {
+        bool fToCryptoAddress = false;
+        if ( numSN != 0 && notarypubkeys[0][0] != 0 && komodo_is_notarytx(tx) == 1 )
+            fToCryptoAddress = true;
+
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            if (tx.IsPegsImport() && txin.prevout.n==10e8)
+            {
+                CAmount nValueIn = GetCoinImportValue(tx); // burn amount
+                nTotalIn += nValueIn;
+                dPriority += (double)nValueIn * 1000;  // flat multiplier... max = 1e16.
+                continue;
+            }
+            // Read prev transaction
+            if (!view.HaveCoins(txin.prevout.hash))
+            {
+                // This should never happen; all transactions in the memory
+                // pool should connect to either transactions in the chain
+                // or other transactions in the memory pool.
+                CTxMemPool::indexed_transaction_set::const_iterator parent = mempool.mapTx.find(txin.prevout.hash);
+                if (parent == mempool.mapTx.end())
+                {
+                    LogPrintf("ERROR: mempool transaction missing input\n");
+                    // if (fDebug) assert("mempool transaction missing input" == 0);
+                    return false;
+                }
+
+                // Has to wait for dependencies
+                info.setDependsOn.insert(txin.prevout.hash);
+                nTotalIn += parent->GetTx().vout[txin.prevout.n].nValue;
+                continue;
+            }
+            const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+            assert(coins);
+
+            CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
+            nTotalIn += nValueIn;
+
+            int nConf = nHeight - coins->nHeight;
+
+            uint8_t *script; int32_t scriptlen; uint256 hash; CTransaction tx1;
+            // loop over notaries array and extract index of signers.
+            if ( fToCryptoAddress && myGetTransaction(txin.prevout.hash,tx1,hash) )
+            {
+                for (int8_t i = 0; i < numSN; i++) 
+                {
+                    script = (uint8_t *)&tx1.vout[txin.prevout.n].scriptPubKey[0];
+                    scriptlen = (int32_t)tx1.vout[txin.prevout.n].scriptPubKey.size();
+                    if ( scriptlen == 35 && script[0] == 33 && script[34] == OP_CHECKSIG && memcmp(script+1,notarypubkeys[i],33) == 0 )
+                    {
+                        // We can add the index of each notary to vector, and clear it if this notarisation is not valid later on.
+                        info.vNotaries.push_back(i);
+                    }
+                }
+            }
+            dPriority += (double)nValueIn * nConf;
+        }
+        if ( numSN != 0 && notarypubkeys[0][0] != 0 && info.vNotaries.size() >= numSN / 5 )
+        {
+            // check a notary didnt sign twice (this would be an invalid notarisation later on and cause problems)
+            std::set<int> checkdupes( info.vNotaries.begin(), info.vNotaries.end() );
+            if ( checkdupes.size() != info.vNotaries.size() ) 
+            {
+                fprintf(stderr, "possible notarisation is signed multiple times by same notary, passed as normal transaction.\n");
+            } else info.fNotarisation = true;
+        }
+        nTotalIn += tx.GetShieldedValueIn();
+    }
+
+    // Priority is sum(valuein * age) / modified_txsize
+    info.nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    info.dPriority = tx.ComputePriority(dPriority, info.nTxSize);
+    info.nTotalIn = nTotalIn;
+    return true;
+}
+
 CBlockTemplate* CreateNewBlock(CPubKey _pk,const CScript& _scriptPubKeyIn, int32_t gpucount, bool isStake)
 {
     CScript scriptPubKeyIn(_scriptPubKeyIn);
@@ -289,6 +450,8 @@ CBlockTemplate* CreateNewBlock(CPubKey _pk,const CScript& _scriptPubKeyIn, int32
             // Only use speical miner for notary pay chains.
             numSN = komodo_notaries(notarypubkeys, nHeight, pblock->nTime);
         }
+        templateCache.Update(pindexPrev->GetBlockHash(), consensusBranchId, Hash(&notarypubkeys[0][0], &notarypubkeys[0][0] + sizeof(notarypubkeys)));
+        uint32_t nNewTx = 0, nReusedTx = 0;
 
         CCoinsViewCache view(pcoinsTip);
         uint32_t expired; uint64_t commission;
@@ -334,104 +497,36 @@ CBlockTemplate* CreateNewBlock(CPubKey _pk,const CScript& _scriptPubKeyIn, int32
                 continue;
             }
 
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            bool fNotarisation = false;
-            std::vector<int8_t> TMP_NotarisationNotaries;
-            if (tx.IsCoinImport())
+            uint256 hash = tx.GetHash();
+            std::map<uint256, CTemplateTxInfo>::iterator cached = templateCache.mapTx.find(hash);
+            if (cached == templateCache.mapTx.end())
             {
-                CAmount nValueIn = GetCoinImportValue(tx); // burn amount
-                nTotalIn += nValueIn;
-                dPriority += (double)nValueIn * 1000;  // flat multiplier... max = 1e16.
-            } else {
-                TMP_NotarisationNotaries.clear();
-                bool fToCryptoAddress = false;
-                if ( numSN != 0 && notarypubkeys[0][0] != 0 && komodo_is_notarytx(tx) == 1 )
-                    fToCryptoAddress = true;
-
-                BOOST_FOREACH(const CTxIn& txin, tx.vin)
-                {
-                    if (tx.IsPegsImport() && txin.prevout.n==10e8)
-                    {
-                        CAmount nValueIn = GetCoinImportValue(tx); // burn amount
-                        nTotalIn += nValueIn;
-                        dPriority += (double)nValueIn * 1000;  // flat multiplier... max = 1e16.
-                        continue;
-                    }
-                    // Read prev transaction
-                    if (!view.HaveCoins(txin.prevout.hash))
-                    {
-                        // This should never happen; all transactions in the memory
-                        // pool should connect to either transactions in the chain
-                        // or other transactions in the memory pool.
-                        if (!mempool.mapTx.count(txin.prevout.hash))
-                        {
-                            LogPrintf("ERROR: mempool transaction missing input\n");
-                            // if (fDebug) assert("mempool transaction missing input" == 0);
-                            fMissingInputs = true;
-                            if (porphan)
-                                vOrphan.pop_back();
-                            break;
-                        }
-
-                        // Has to wait for dependencies
-                        if (!porphan)
-                        {
-                            // Use list for automatic deletion
-                            vOrphan.push_back(COrphan(&tx));
-                            porphan = &vOrphan.back();
-                        }
-                        mapDependers[txin.prevout.hash].push_back(porphan);
-                        porphan->setDependsOn.insert(txin.prevout.hash);
-                        nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
-                        continue;
-                    }
-                    const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                    assert(coins);
-
-                    CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                    nTotalIn += nValueIn;
-
-                    int nConf = nHeight - coins->nHeight;
-                    
-                    uint8_t *script; int32_t scriptlen; uint256 hash; CTransaction tx1;
-                    // loop over notaries array and extract index of signers.
-                    if ( fToCryptoAddress && myGetTransaction(txin.prevout.hash,tx1,hash) )
-                    {
-                        for (int8_t i = 0; i < numSN; i++) 
-                        {
-                            script = (uint8_t *)&tx1.vout[txin.prevout.n].scriptPubKey[0];
-                            scriptlen = (int32_t)tx1.vout[txin.prevout.n].scriptPubKey.size();
-                            if ( scriptlen == 35 && script[0] == 33 && script[34] == OP_CHECKSIG && memcmp(script+1,notarypubkeys[i],33) == 0 )
-                            {
-                                // We can add the index of each notary to vector, and clear it if this notarisation is not valid later on.
-                                TMP_NotarisationNotaries.push_back(i);                          
-                            }
-                        }
-                    }
-                    dPriority += (double)nValueIn * nConf;
-                }
-                if ( numSN != 0 && notarypubkeys[0][0] != 0 && TMP_NotarisationNotaries.size() >= numSN / 5 )
-                {
-                    // check a notary didnt sign twice (this would be an invalid notarisation later on and cause problems)
-                    std::set<int> checkdupes( TMP_NotarisationNotaries.begin(), TMP_NotarisationNotaries.end() );
-                    if ( checkdupes.size() != TMP_NotarisationNotaries.size() ) 
-                    {
-                        fprintf(stderr, "possible notarisation is signed multiple times by same notary, passed as normal transaction.\n");
-                    } else fNotarisation = true;
-                }
-                nTotalIn += tx.GetShieldedValueIn();
+                CTemplateTxInfo info;
+                if (!GetTemplateTxInfo(tx, view, nHeight, numSN, notarypubkeys, info))
+                    continue;
+                cached = templateCache.mapTx.insert(std::make_pair(hash, info)).first;
+                nNewTx++;
             }
+            else
+                nReusedTx++;
+            CTemplateTxInfo& info = cached->second;
+            info.nGeneration = templateCache.nGeneration;
 
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
+            COrphan* porphan = NULL;
+            if (!info.setDependsOn.empty())
+            {
+                // Use list for automatic deletion
+                vOrphan.push_back(COrphan(&tx));
+                porphan = &vOrphan.back();
+                porphan->setDependsOn = info.setDependsOn;
+                BOOST_FOREACH(const uint256& parent, info.setDependsOn)
+                    mapDependers[parent].push_back(porphan);
+            }
+            double dPriority = info.dPriority;
+            CAmount nTotalIn = info.nTotalIn;
+            unsigned int nTxSize = info.nTxSize;
+            bool fNotarisation = info.fNotarisation;
+            const std::vector<int8_t>& TMP_NotarisationNotaries = info.vNotaries;
             mempool.ApplyDeltas(hash, dPriority, nTotalIn);
 
             CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
@@ -478,6 +573,8 @@ CBlockTemplate* CreateNewBlock(CPubKey _pk,const CScript& _scriptPubKeyIn, int32
             else
                 vecPriority.push_back(TxPriority(dPriority, feeRate, &(mi->GetTx())));
         }
+        templateCache.Prune();
+        LogPrint("miner", "CreateNewBlock(): %u cached txs reused, %u new\n", nReusedTx, nNewTx);
 
         // Collect transactions into block
         uint64_t nBlockSize = 1000;
@@ -584,12 +681,19 @@ CBlockTemplate* CreateNewBlock(CPubKey _pk,const CScript& _scriptPubKeyIn, int32
             // Note that flags: we don't want to set mempool/IsStandard()
             // policy here, but we still have to ensure that the block we
             // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            PrecomputedTransactionData txdata(tx);
-            if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
+            // Inputs only have to be checked once per tip.
+            std::map<uint256, CTemplateTxInfo>::iterator cached = templateCache.mapTx.find(hash);
+            if (cached == templateCache.mapTx.end() || !cached->second.fInputsChecked)
             {
-                //fprintf(stderr,"context failure\n");
-                continue;
+                CValidationState state;
+                PrecomputedTransactionData txdata(tx);
+                if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
+                {
+                    //fprintf(stderr,"context failure\n");
+                    continue;
+                }
+                if (cached != templateCache.mapTx.end())
+                    cached->second.fInputsChecked = true;
             }
             UpdateCoins(tx, view, nHeight);
 
@@ -907,8 +1011,12 @@ CBlockTemplate* CreateNewBlock(CPubKey _pk,const CScript& _scriptPubKeyIn, int32
         else if ( ASSETCHAINS_CC == 0 && pindexPrev != 0 && ASSETCHAINS_STAKED == 0 && (ASSETCHAINS_SYMBOL[0] != 0 || IS_KOMODO_NOTARY == 0 || My_notaryid < 0) )
         {
             CValidationState state;
+            // the same set of transactions already passed against this tip, only the coinbase differs
+            uint256 hashTxs = GetTemplateTxsHash(*pblock);
             //fprintf(stderr,"check validity\n");
-            if ( !TestBlockValidity(state, *pblock, pindexPrev, false, false)) // invokes CC checks
+            if ( pblock->vtx.size() > 1 && hashTxs == templateCache.hashCheckedTxs )
+                LogPrint("miner", "CreateNewBlock(): skipping TestBlockValidity, transactions unchanged\n");
+            else if ( !TestBlockValidity(state, *pblock, pindexPrev, false, false)) // invokes CC checks
             {
                 if ( ASSETCHAINS_SYMBOL[0] == 0 || (ASSETCHAINS_SYMBOL[0] != 0 && !isStake) )
                 {
@@ -918,6 +1026,7 @@ CBlockTemplate* CreateNewBlock(CPubKey _pk,const CScript& _scriptPubKeyIn, int32
                 //throw std::runtime_error("CreateNewBlock(): TestBlockValidity failed"); // crashes the node, moved to GetBlockTemplate and issue return.
                 return(0);
             }
+            else templateCache.hashCheckedTxs = hashTxs;
             //fprintf(stderr,"valid\n");
         }
     }
@@ -0,0 +1,133 @@
+#include "momaccumulator.h"
+
+#include "chain.h"
+#include "hash.h"
+#include "utilstrencodings.h"
+
+#include <algorithm>
+
+CMoMAccumulator momAccumulator;
+
+static uint256 HashNodes(const uint256& left, const uint256& right)
+{
+    return Hash(BEGIN(left), END(left), BEGIN(right), END(right));
+}
+
+static int GetLevels(int nLeaves)
+{
+    int nLevels = 0;
+    while ((1 << nLevels) < nLeaves)
+        nLevels++;
+    return nLevels;
+}
+
+void CMoMAccumulator::Push(const uint256& hashBlock, const uint256& hashMerkleRoot)
+{
+    AssertLockHeld(cs);
+    if (vEntries.size() == WINDOW) {
+        vEntries.pop_front();
+        nFirstHeight++;
+    }
+    int nHeight = nFirstHeight + vEntries.size();
+
+    CEntry entry;
+    entry.hashBlock = hashBlock;
+    entry.vNodes.reserve(LEVELS + 1);
+    entry.vNodes.push_back(hashMerkleRoot);
+    for (int k = 1; k <= LEVELS && nHeight - (1 << k) + 1 >= nFirstHeight; k++) {
+        uint256 left = entry.vNodes[k - 1];
+        entry.vNodes.push_back(HashNodes(left, GetNode(k - 1, nHeight - (1 << (k - 1)))));
+    }
+    vEntries.push_back(entry);
+}
+
+const uint256& CMoMAccumulator::GetNode(int nLevel, int nHeight) const
+{
+    return vEntries[nHeight - nFirstHeight].vNodes[nLevel];
+}
+
+uint256 CMoMAccumulator::GetRoot(int nHeight, int nLeaves, int nLevels) const
+{
+    if (nLeaves == (1 << nLevels))
+        return GetNode(nLevels, nHeight);
+
+    // BuildMerkleTree pairs the last node of an odd level with itself
+    int nHalf = 1 << (nLevels - 1);
+    if (nLeaves <= nHalf) {
+        uint256 node = GetRoot(nHeight, nLeaves, nLevels - 1);
+        return HashNodes(node, node);
+    }
+    return HashNodes(GetNode(nLevels - 1, nHeight), GetRoot(nHeight - nHalf, nLeaves - nHalf, nLevels - 1));
+}
+
+bool CMoMAccumulator::IsCovered(int nHeight, int nDepth) const
+{
+    AssertLockHeld(cs);
+    if (vEntries.empty() || nDepth < 1 || nDepth > WINDOW)
+        return false;
+    return nHeight < nFirstHeight + (int)vEntries.size() && nHeight - nDepth + 1 >= nFirstHeight;
+}
+
+void CMoMAccumulator::Update(const CBlockIndex* pindexTip)
+{
+    LOCK(cs);
+    if (pindexTip == NULL) {
+        Clear();
+        return;
+    }
+
+    int nHeight = pindexTip->GetHeight();
+    if (!vEntries.empty()) {
+        int nTipHeight = nFirstHeight + vEntries.size() - 1;
+        if (nHeight == nTipHeight && vEntries.back().hashBlock == pindexTip->GetBlockHash())
+            return;
+        if (nHeight == nTipHeight + 1 && pindexTip->pprev->GetBlockHash() == vEntries.back().hashBlock) {
+            Push(pindexTip->GetBlockHash(), pindexTip->hashMerkleRoot);
+            return;
+        }
+        if (nHeight == nTipHeight - 1 && vEntries.size() > 1 && vEntries[vEntries.size() - 2].hashBlock == pindexTip->GetBlockHash()) {
+            vEntries.pop_back();
+            return;
+        }
+    }
+
+    // Not next to the current tip, e.g. at startup: start again from pindexTip
+    std::vector<const CBlockIndex*> vBlocks;
+    for (const CBlockIndex* pindex = pindexTip; pindex != NULL && vBlocks.size() < WINDOW; pindex = pindex->pprev)
+        vBlocks.push_back(pindex);
+    vEntries.clear();
+    nFirstHeight = vBlocks.back()->GetHeight();
+    for (std::vector<const CBlockIndex*>::reverse_iterator it = vBlocks.rbegin(); it != vBlocks.rend(); ++it)
+        Push((*it)->GetBlockHash(), (*it)->hashMerkleRoot);
+}
+
+void CMoMAccumulator::Clear()
+{
+    LOCK(cs);
+    vEntries.clear();
+    nFirstHeight = 0;
+}
+
+bool CMoMAccumulator::GetMoM(int nHeight, int nDepth, uint256& mom) const
+{
+    LOCK(cs);
+    if (!IsCovered(nHeight, nDepth))
+        return false;
+    mom = GetRoot(nHeight, nDepth, GetLevels(nDepth));
+    return true;
+}
+
+bool CMoMAccumulator::GetMoMBranch(int nHeight, int nDepth, int nIndex, std::vector<uint256>& vBranch) const
+{
+    LOCK(cs);
+    if (!IsCovered(nHeight, nDepth) || nIndex < 0 || nIndex >= nDepth)
+        return false;
+
+    // Sibling of the node holding nIndex on each level, the node itself when it has none
+    vBranch.clear();
+    for (int j = 0, nSize = nDepth; nSize > 1; j++, nSize = (nSize + 1) / 2) {
+        int nOffset = std::min((nIndex >> j) ^ 1, nSize - 1) << j;
+        vBranch.push_back(GetRoot(nHeight - nOffset, std::min(1 << j, nDepth - nOffset), j));
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+#ifndef MOMACCUMULATOR_H
+#define MOMACCUMULATOR_H
+
+#include "sync.h"
+#include "uint256.h"
+
+#include <deque>
+#include <vector>
+
+class CBlockIndex;
+
+/**
+ * Merkle subtrees over the block merkle roots of the last WINDOW blocks of
+ * the active chain, kept in step with the tip. A MoM is the merkle root
+ * (as built by BuildMerkleTree) of the merkle roots of blocks nHeight,
+ * nHeight-1, ..., nHeight-nDepth+1. For each block the accumulator keeps
+ * the root of the 2^k blocks ending at it for every k that fits, so any
+ * MoM and its branches inside the window come out of O(log nDepth) stored
+ * subtrees instead of a walk over every block in range.
+ *
+ * Callers fall back to building the tree from chainActive when a range is
+ * not covered.
+ */
+class CMoMAccumulator
+{
+public:
+    static const int LEVELS = 12;
+    static const int WINDOW = 1 << LEVELS;
+
+private:
+    struct CEntry {
+        uint256 hashBlock;
+        //! vNodes[k] is the root of the 2^k merkle roots ending at this block
+        std::vector<uint256> vNodes;
+    };
+
+    mutable CCriticalSection cs;
+    std::deque<CEntry> vEntries;
+    int nFirstHeight;
+
+    void Push(const uint256& hashBlock, const uint256& hashMerkleRoot);
+    const uint256& GetNode(int nLevel, int nHeight) const;
+    /** Root of nLeaves leaves ending at nHeight, padded out to nLevels levels */
+    uint256 GetRoot(int nHeight, int nLeaves, int nLevels) const;
+    bool IsCovered(int nHeight, int nDepth) const;
+
+public:
+    CMoMAccumulator() : nFirstHeight(0) {}
+
+    /** Follow the active chain to pindexTip, one block at a time when it is next to the current tip */
+    void Update(const CBlockIndex* pindexTip);
+    void Clear();
+
+    bool GetMoM(int nHeight, int nDepth, uint256& mom) const;
+    /** Branch from the merkle root of block nHeight-nIndex to the MoM, as GetMerkleBranch returns it */
+    bool GetMoMBranch(int nHeight, int nDepth, int nIndex, std::vector<uint256>& vBranch) const;
+};
+
+extern CMoMAccumulator momAccumulator;
+
+#endif // MOMACCUMULATOR_H
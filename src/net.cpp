@@ -39,6 +39,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -92,6 +96,22 @@ uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
+bool fUseEpoll = false;
+int nMaxSelectConnections = DEFAULT_MAX_PEER_CONNECTIONS;
+#ifdef HAVE_SYS_EPOLL_H
+static int hEpoll = -1;
+
+static void FallBackToSelect(const char* pszFailed)
+{
+    LogPrintf("%s failed: %s, falling back to select()\n", pszFailed, NetworkErrorString(errno));
+    fUseEpoll = false;
+    if (nMaxConnections > nMaxSelectConnections) {
+        LogPrintf("Using at most %i connections, all select() can wait on\n", nMaxSelectConnections);
+        nMaxConnections = nMaxSelectConnections;
+    }
+}
+#endif
+
 bool fAddressesInitialized = false;
 std::string strSubVersion;
 
@@ -117,6 +137,10 @@ CCriticalSection cs_nLastNodeId;
 static CSemaphore *semOutbound = NULL;
 static boost::condition_variable messageHandlerCondition;
 
+// Requests that only read chain data, answered off the message handler thread
+static CScheduler servingQueue;
+static int nServingThreads = 0;
+
 // Signals for message handling
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
@@ -374,6 +398,28 @@ CNode* FindNode(const CService& addr)
     return NULL;
 }
 
+/** Whether the socket handler can wait on hSocket, select() only takes sockets below FD_SETSIZE */
+static bool IsPollableSocket(SOCKET hSocket)
+{
+    return fUseEpoll || IsSelectableSocket(hSocket);
+}
+
+/** Add a new peer's socket to the epoll set, edge triggered for both directions */
+static void RegisterSocketEvents(CNode *pnode)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (hEpoll == -1)
+        return;
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("epoll_ctl failed for peer=%d: %s\n", pnode->id, NetworkErrorString(errno));
+        pnode->CloseSocketDisconnect();
+    }
+#endif
+}
+
 CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
 {
     if (pszDest == NULL) {
@@ -400,7 +446,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!IsPollableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -411,6 +457,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
         // Add node
         CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
         pnode->AddRef();
+        RegisterSocketEvents(pnode);
 
         {
             LOCK(cs_vNodes);
@@ -700,20 +747,47 @@ void SocketSendData(CNode *pnode)
     std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
+#ifdef _WIN32
         const CSerializeData &data = *it;
         assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        size_t nQueued = data.size() - pnode->nSendOffset;
+        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], nQueued, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+        // Hand the queued messages to the kernel in place, several per call
+        struct iovec vIov[64];
+        int nIov = 0;
+        size_t nQueued = 0;
+        for (std::deque<CSerializeData>::iterator itIov = it; itIov != pnode->vSendMsg.end() && nIov < 64; ++itIov, ++nIov) {
+            size_t nOffset = nIov == 0 ? pnode->nSendOffset : 0;
+            assert(itIov->size() > nOffset);
+            vIov[nIov].iov_base = (void*)&(*itIov)[nOffset];
+            vIov[nIov].iov_len = itIov->size() - nOffset;
+            nQueued += vIov[nIov].iov_len;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = vIov;
+        msg.msg_iovlen = nIov;
+        int nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+            size_t nSent = nBytes;
+            while (nSent > 0) {
+                size_t nLeft = it->size() - pnode->nSendOffset;
+                if (nSent < nLeft) {
+                    pnode->nSendOffset += nSent;
+                    break;
+                }
+                nSent -= nLeft;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= it->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            if ((size_t)nBytes < nQueued) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -964,7 +1038,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!IsPollableSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1008,6 +1082,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     CNode* pnode = new CNode(hSocket, addr, "", true);
     pnode->AddRef();
     pnode->fWhitelisted = whitelisted;
+    RegisterSocketEvents(pnode);
 
     LogPrint("net", "connection from %s accepted\n", addr.ToString());
 
@@ -1017,9 +1092,213 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+enum SocketRecvResult {
+    RECV_DRAINED,   //!< nothing left to read until the socket signals again
+    RECV_MORE,      //!< stopped after nMaxReads, the socket may still have data
+    RECV_THROTTLED, //!< the receive buffer is full, read again once it drains
+};
+
+/** Read from pnode's socket until it would block, at most nMaxReads times */
+static SocketRecvResult SocketRecvData(CNode *pnode, unsigned int nMaxReads)
+{
+    AssertLockHeld(pnode->cs_vRecvMsg);
+    for (unsigned int i = 0; i < nMaxReads; i++)
+    {
+        if (pnode->hSocket == INVALID_SOCKET)
+            return RECV_DRAINED;
+        if (!pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete() &&
+            pnode->GetTotalRecvSize() > ReceiveFloodSize())
+            return RECV_THROTTLED;
+
+        // typical socket buffer is 8K-64K
+        char pchBuf[0x10000];
+        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+        if (nBytes > 0)
+        {
+            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+                pnode->CloseSocketDisconnect();
+            pnode->nLastRecv = GetTime();
+            pnode->nRecvBytes += nBytes;
+            pnode->RecordBytesRecv(nBytes);
+        }
+        else if (nBytes == 0)
+        {
+            // socket closed gracefully
+            if (!pnode->fDisconnect)
+                LogPrint("net", "socket closed\n");
+            pnode->CloseSocketDisconnect();
+            return RECV_DRAINED;
+        }
+        else
+        {
+            // error
+            int nErr = WSAGetLastError();
+            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+            {
+                if (!pnode->fDisconnect)
+                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+                pnode->CloseSocketDisconnect();
+            }
+            return RECV_DRAINED;
+        }
+    }
+    return RECV_MORE;
+}
+
+static void InactivityCheck(CNode *pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static const int SOCKET_RECV = 1;
+static const int SOCKET_SEND = 2;
+//! the socket can make progress without waiting for another event
+static const int SOCKET_RETRY = 4;
+
+/**
+ * One round of the epoll socket handler. Peers are only looked at when
+ * their socket signals, or while they sit in mapPending because an earlier
+ * round left readiness unused: a busy lock, a full receive buffer or the
+ * per-round read budget. Sockets are edge triggered, so that readiness
+ * would not be reported again. Each entry of mapPending holds a reference
+ * on its node.
+ */
+static void ServiceSocketsEpoll(std::map<CNode*, int>& mapPending, int64_t& nLastInactivityCheck)
+{
+    bool fRetry = false;
+    for (std::map<CNode*, int>::const_iterator it = mapPending.begin(); it != mapPending.end(); ++it)
+        fRetry |= (it->second & SOCKET_RETRY) != 0;
+
+    struct epoll_event vEvents[256];
+    int nEvents = epoll_wait(hEpoll, vEvents, 256, fRetry ? 0 : 50);
+    boost::this_thread::interruption_point();
+    if (nEvents < 0) {
+        if (errno != EINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+            MilliSleep(50);
+        }
+        nEvents = 0;
+    }
+
+    std::map<CNode*, int> mapReady;
+    mapReady.swap(mapPending);
+    std::vector<const ListenSocket*> vListenReady;
+    {
+        LOCK(cs_vNodes);
+        for (int i = 0; i < nEvents; i++) {
+            bool fListenSocket = false;
+            BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+                if (vEvents[i].data.ptr == &hListenSocket) {
+                    vListenReady.push_back(&hListenSocket);
+                    fListenSocket = true;
+                }
+            }
+            if (fListenSocket)
+                continue;
+
+            // Nodes are only deleted by this thread, after their socket was closed
+            CNode* pnode = (CNode*)vEvents[i].data.ptr;
+            int nFlags = 0;
+            if (vEvents[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                nFlags |= SOCKET_RECV;
+            if (vEvents[i].events & EPOLLOUT)
+                nFlags |= SOCKET_SEND;
+            std::map<CNode*, int>::iterator it = mapReady.find(pnode);
+            if (it == mapReady.end()) {
+                pnode->AddRef();
+                mapReady[pnode] = nFlags;
+            } else {
+                it->second |= nFlags;
+            }
+        }
+    }
+
+    //
+    // Accept new connections
+    //
+    BOOST_FOREACH(const ListenSocket* pListenSocket, vListenReady)
+        AcceptConnection(*pListenSocket);
+
+    //
+    // Service each ready socket
+    //
+    std::vector<CNode*> vRelease;
+    for (std::map<CNode*, int>::iterator it = mapReady.begin(); it != mapReady.end(); ++it)
+    {
+        CNode* pnode = it->first;
+        int nPending = 0;
+        if ((it->second & SOCKET_RECV) && pnode->hSocket != INVALID_SOCKET)
+        {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (!lockRecv)
+                nPending |= SOCKET_RECV | SOCKET_RETRY;
+            else {
+                // Cap each round at 256KB so one fast peer can't starve the rest
+                SocketRecvResult result = SocketRecvData(pnode, 4);
+                if (result == RECV_MORE)
+                    nPending |= SOCKET_RECV | SOCKET_RETRY;
+                else if (result == RECV_THROTTLED)
+                    nPending |= SOCKET_RECV;
+            }
+        }
+        if ((it->second & SOCKET_SEND) && pnode->hSocket != INVALID_SOCKET)
+        {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (!lockSend)
+                nPending |= SOCKET_SEND | SOCKET_RETRY;
+            else if (!pnode->vSendMsg.empty())
+                SocketSendData(pnode);
+        }
+
+        if (nPending && pnode->hSocket != INVALID_SOCKET)
+            mapPending[pnode] = nPending;
+        else
+            vRelease.push_back(pnode);
+    }
+
+    int64_t nTime = GetTime();
+    LOCK(cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vRelease)
+        pnode->Release();
+    if (nTime != nLastInactivityCheck) {
+        nLastInactivityCheck = nTime;
+        BOOST_FOREACH(CNode* pnode, vNodes)
+            InactivityCheck(pnode);
+    }
+}
+#endif
+
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+#ifdef HAVE_SYS_EPOLL_H
+    std::map<CNode*, int> mapPending;
+    int64_t nLastInactivityCheck = 0;
+#endif
     while (true)
     {
         //
@@ -1085,6 +1364,13 @@ void ThreadSocketHandler()
             uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
         }
 
+#ifdef HAVE_SYS_EPOLL_H
+        if (hEpoll != -1) {
+            ServiceSocketsEpoll(mapPending, nLastInactivityCheck);
+            continue;
+        }
+#endif
+
         //
         // Find which sockets have data to receive
         //
@@ -1201,39 +1487,7 @@ void ThreadSocketHandler()
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
-                {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0)
-                        {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        }
-                        else if (nBytes == 0)
-                        {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
+                    SocketRecvData(pnode, 1);
             }
 
             //
@@ -1251,30 +1505,7 @@ void ThreadSocketHandler()
             //
             // Inactivity checking
             //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60)
-            {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-            }
+            InactivityCheck(pnode);
         }
         {
             LOCK(cs_vNodes);
@@ -1572,6 +1803,42 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 }
 
 
+static void RunServingTask(CNode* pnode, const boost::function<void()>& f)
+{
+    try {
+        f();
+    }
+    catch (const boost::thread_interrupted&) {
+        throw;
+    }
+    catch (const std::exception& e) {
+        PrintExceptionContinue(&e, "RunServingTask()");
+    } catch (...) {
+        PrintExceptionContinue(NULL, "RunServingTask()");
+    }
+
+    pnode->fServing = false;
+    {
+        LOCK(cs_vNodes);
+        pnode->Release();
+    }
+    messageHandlerCondition.notify_one();
+}
+
+bool QueueServingTask(CNode* pnode, const boost::function<void()>& f)
+{
+    if (nServingThreads == 0)
+        return false;
+
+    {
+        LOCK(cs_vNodes);
+        pnode->AddRef();
+    }
+    pnode->fServing = true;
+    servingQueue.schedule(boost::bind(&RunServingTask, pnode, f), boost::chrono::system_clock::now());
+    return true;
+}
+
 void ThreadMessageHandler()
 {
     boost::mutex condition_mutex;
@@ -1609,7 +1876,8 @@ void ThreadMessageHandler()
                     if (!g_signals.ProcessMessages(pnode))
                         pnode->CloseSocketDisconnect();
 
-                    if (pnode->nSendSize < SendBufferSize())
+                    // A peer being served is picked up again once its task finishes
+                    if (!pnode->fServing && pnode->nSendSize < SendBufferSize())
                     {
                         if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
                         {
@@ -1804,6 +2072,28 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
            addrman.size(), GetTimeMillis() - nStart);
     fAddressesInitialized = true;
 
+    // Before the outbound semaphore, which is sized by nMaxConnections
+#ifdef HAVE_SYS_EPOLL_H
+    if (fUseEpoll && hEpoll == -1) {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll == -1)
+            FallBackToSelect("epoll_create1");
+        BOOST_FOREACH(ListenSocket& hListenSocket, vhListenSocket) {
+            if (hEpoll == -1)
+                break;
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = &hListenSocket;
+            if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0) {
+                FallBackToSelect("epoll_ctl for a listening socket");
+                close(hEpoll);
+                hEpoll = -1;
+            }
+        }
+    }
+#endif
+    LogPrintf("Using %s to wait on sockets\n", fUseEpoll ? "epoll" : "select");
+
     if (semOutbound == NULL) {
         // initialize semaphore
         int nMaxOutbound = min(MAX_OUTBOUND_CONNECTIONS, nMaxConnections);
@@ -1815,6 +2105,7 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     Discover(threadGroup);
 
+
     // skip DNS seeds for staked chains.
     extern int8_t is_STAKED(const char *chain_name);
     extern char ASSETCHAINS_SYMBOL[65];
@@ -1839,6 +2130,12 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Initiate outbound connections
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
+    // Serve blocks, headers and nSPV requests
+    nServingThreads = std::max((int)GetArg("-servingthreads", DEFAULT_SERVING_THREADS), 0);
+    CScheduler::Function servingLoop = boost::bind(&CScheduler::serviceQueue, &servingQueue);
+    for (int i = 0; i < nServingThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "msgserve", servingLoop));
+
     // Process messages
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
 
@@ -1886,6 +2183,11 @@ public:
         vNodes.clear();
         vNodesDisconnected.clear();
         vhListenSocket.clear();
+#ifdef HAVE_SYS_EPOLL_H
+        if (hEpoll != -1)
+            close(hEpoll);
+        hEpoll = -1;
+#endif
         delete semOutbound;
         semOutbound = NULL;
         delete pnodeLocalHost;
@@ -2125,6 +2427,7 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fServing = false;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
@@ -35,6 +35,7 @@
 #include "utilstrencodings.h"
 #include "util.h"
 
+#include <atomic>
 #include <deque>
 #include <stdint.h>
 
@@ -44,6 +45,7 @@
 
 #include <boost/filesystem/path.hpp>
 #include <boost/foreach.hpp>
+#include <boost/function.hpp>
 #include <boost/signals2/signal.hpp>
 
 class CAddrMan;
@@ -75,6 +77,10 @@ static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 384;
+/** -epoll default */
+static const bool DEFAULT_EPOLL = true;
+/** -servingthreads default, threads serving blocks, headers and nSPV requests to peers */
+static const int DEFAULT_SERVING_THREADS = 2;
 /** The period before a network upgrade activates, where connections to upgrading peers are preferred (in blocks). */
 static const int NETWORK_UPGRADE_PEER_PREFERENCE_BLOCK_PERIOD = 24 * 24 * 3;
 
@@ -94,6 +100,13 @@ bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhite
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode *pnode);
+/**
+ * Run f for pnode on the serving threads. pnode is marked fServing until f
+ * returns, and the message handler leaves its messages alone meanwhile, so
+ * the peer's requests are still answered in order. Returns false without
+ * running f when -servingthreads=0.
+ */
+bool QueueServingTask(CNode *pnode, const boost::function<void()>& f);
 
 typedef int NodeId;
 
@@ -163,6 +176,10 @@ extern uint64_t nLocalHostNonce;
 extern CAddrMan addrman;
 /** Maximum number of connections to simultaneously allow (aka connection slots) */
 extern int nMaxConnections;
+/** Wait on epoll instead of select(), so connections are not capped at FD_SETSIZE */
+extern bool fUseEpoll;
+/** Connections select() leaves room for, the cap put back if epoll cannot be used after all */
+extern int nMaxSelectConnections;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
@@ -305,6 +322,8 @@ public:
     bool fNetworkNode;
     bool fSuccessfullyConnected;
     bool fDisconnect;
+    //! A request from this peer is being answered on the serving threads, see QueueServingTask
+    std::atomic<bool> fServing;
     // We use fRelayTxes for two purposes -
     // a) it allows us to not relay tx invs before receiving the peer's version message
     // b) the peer may tell us in its version message that we should not relay tx invs
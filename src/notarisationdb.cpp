@@ -5,6 +5,12 @@
 #include "crosschain.h"
 #include "main.h"
 #include "notaries_staked.h"
+#include "perfstats.h"
+#include "sync.h"
+
+#include <algorithm>
+#include <deque>
+#include <map>
 
 #include <boost/foreach.hpp>
 
@@ -73,9 +79,68 @@ bool IsTXSCL(const char* symbol)
 }
 
 
+/**
+ * Notarisations of recent blocks, including the many blocks without any,
+ * so the backwards scans over chainActive that gather MoMs for a MoMoM
+ * stay in memory. Entries are dropped oldest first.
+ */
+static const size_t MAX_CACHED_BLOCK_NOTARISATIONS = 5760;
+static CCriticalSection cs_blockNotarisations;
+static std::map<uint256, NotarisationsInBlock> mapBlockNotarisations;
+static std::deque<uint256> queueBlockNotarisations;
+
+static void AddBlockNotarisations(const uint256 &blockHash, const NotarisationsInBlock &nibs, bool fOverwrite)
+{
+    LOCK(cs_blockNotarisations);
+    std::pair<std::map<uint256, NotarisationsInBlock>::iterator, bool> ret =
+        mapBlockNotarisations.insert(std::make_pair(blockHash, nibs));
+    if (!ret.second) {
+        if (fOverwrite)
+            ret.first->second = nibs;
+        return;
+    }
+    queueBlockNotarisations.push_back(blockHash);
+    while (queueBlockNotarisations.size() > MAX_CACHED_BLOCK_NOTARISATIONS) {
+        mapBlockNotarisations.erase(queueBlockNotarisations.front());
+        queueBlockNotarisations.pop_front();
+    }
+}
+
+
+void CacheBlockNotarisations(const uint256 &blockHash, const NotarisationsInBlock &nibs)
+{
+    AddBlockNotarisations(blockHash, nibs, true);
+}
+
+
+void UncacheBlockNotarisations(const uint256 &blockHash)
+{
+    LOCK(cs_blockNotarisations);
+    if (mapBlockNotarisations.erase(blockHash) == 0)
+        return;
+    // A disconnected block is a recent one, near the back. Left in the queue,
+    // its hash would evict the entry of a later re-add before its time.
+    std::deque<uint256>::reverse_iterator it = std::find(queueBlockNotarisations.rbegin(), queueBlockNotarisations.rend(), blockHash);
+    if (it != queueBlockNotarisations.rend())
+        queueBlockNotarisations.erase(std::next(it).base());
+}
+
+
 bool GetBlockNotarisations(uint256 blockHash, NotarisationsInBlock &nibs)
 {
-    return pnotarisations->Read(blockHash, nibs);
+    {
+        LOCK(cs_blockNotarisations);
+        std::map<uint256, NotarisationsInBlock>::const_iterator it = mapBlockNotarisations.find(blockHash);
+        if (it != mapBlockNotarisations.end()) {
+            nibs = it->second;
+            return !nibs.empty();
+        }
+    }
+    // Blocks are only written with notarisations in them
+    bool fFound = pnotarisations->Read(blockHash, nibs);
+    // Don't overwrite what a block connected or disconnected in the meantime
+    AddBlockNotarisations(blockHash, fFound ? nibs : NotarisationsInBlock(), false);
+    return fFound;
 }
 
 
@@ -116,6 +181,7 @@ void EraseBackNotarisations(const NotarisationsInBlock notarisations, CDBBatch &
  */
 int ScanNotarisationsDB(int height, std::string symbol, int scanLimitBlocks, Notarisation& out)
 {
+    CPerfTimer perfTimer(perfNotarisationScan);
     if (height < 0 || height > chainActive.Height())
         return false;
 
@@ -138,6 +204,7 @@ int ScanNotarisationsDB(int height, std::string symbol, int scanLimitBlocks, Not
 
 int ScanNotarisationsDB2(int height, std::string symbol, int scanLimitBlocks, Notarisation& out)
 {
+    CPerfTimer perfTimer(perfNotarisationScan);
     int32_t i,maxheight,ht;
     maxheight = chainActive.Height();
     if ( height < 0 || height > maxheight )
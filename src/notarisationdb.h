@@ -20,6 +20,8 @@ typedef std::vector<Notarisation> NotarisationsInBlock;
 
 NotarisationsInBlock ScanBlockNotarisations(const CBlock &block, int nHeight);
 bool GetBlockNotarisations(uint256 blockHash, NotarisationsInBlock &nibs);
+void CacheBlockNotarisations(const uint256 &blockHash, const NotarisationsInBlock &nibs);
+void UncacheBlockNotarisations(const uint256 &blockHash);
 bool GetBackNotarisation(uint256 notarisationHash, Notarisation &n);
 void WriteBackNotarisations(const NotarisationsInBlock notarisations, CDBBatch &batch);
 void EraseBackNotarisations(const NotarisationsInBlock notarisations, CDBBatch &batch);
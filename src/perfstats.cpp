@@ -0,0 +1,245 @@
+#include "perfstats.h"
+
+#include "crypto/common.h"
+#include "tinyformat.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+#include <boost/thread/tss.hpp>
+
+CPerfStat perfConnectBlock("connectblock", "Time spent in ConnectBlock, block template checks included", CPerfStat::HISTOGRAM);
+CPerfStat perfConnectBlockTransactions("connectblock_transactions", "Transactions in the blocks connected to the tip", CPerfStat::COUNTER);
+CPerfStat perfKomodoConnectBlock("komodo_connectblock", "Time spent updating the komodo state with a connected block", CPerfStat::HISTOGRAM);
+CPerfStat perfKomodoCheckPOW("komodo_checkpow", "Time spent checking the proof of work or stake of a block", CPerfStat::HISTOGRAM);
+CPerfStat perfKomodoStaked("komodo_staked", "Time spent looking for a utxo to stake a block with", CPerfStat::HISTOGRAM);
+CPerfStat perfNotarisationScan("notarisation_scan", "Time spent scanning back through blocks for a notarisation", CPerfStat::HISTOGRAM);
+CPerfStatFamily perfCCEval("cc_eval", "Time spent evaluating a crypto-condition, by evalcode", CPerfStat::HISTOGRAM, "evalcode");
+CPerfStat perfCCEvalCClib("cc_eval", "Time spent evaluating a crypto-condition, by evalcode", CPerfStat::HISTOGRAM, "evalcode", "cclib");
+CPerfStat perfCCEvalOther("cc_eval", "Time spent evaluating a crypto-condition, by evalcode", CPerfStat::HISTOGRAM, "evalcode", "other");
+CPerfStat perfCCEvalRejects("cc_eval_rejects", "Crypto-condition evaluations that failed", CPerfStat::COUNTER);
+CPerfStatFamily perfNSPVRequests("nspv_request", "Time spent answering an nSPV request, by request type", CPerfStat::HISTOGRAM, "request");
+CPerfStat perfNSPVOtherRequests("nspv_request", "Time spent answering an nSPV request, by request type", CPerfStat::HISTOGRAM, "request", "other");
+
+namespace {
+
+//! A stat's slot: count, sum and histogram buckets
+const int PERF_SLOT_SIZE = 2 + PERF_HISTOGRAM_BUCKETS;
+
+struct CPerfSlots
+{
+    std::atomic<uint64_t> values[MAX_PERF_STATS * PERF_SLOT_SIZE];
+
+    CPerfSlots()
+    {
+        for (int i = 0; i < MAX_PERF_STATS * PERF_SLOT_SIZE; i++)
+            values[i].store(0, std::memory_order_relaxed);
+    }
+};
+
+struct CPerfRegistry
+{
+    std::mutex cs;
+    std::vector<const CPerfStat*> vStats;
+    //! Slots of every thread that ever recorded, those of exited threads are handed out again
+    std::vector<CPerfSlots*> vSlots;
+    std::vector<CPerfSlots*> vFreeSlots;
+};
+
+// Never destroyed, threads may still record while the process exits
+CPerfRegistry& Registry()
+{
+    static CPerfRegistry* registry = new CPerfRegistry();
+    return *registry;
+}
+
+thread_local CPerfSlots* perfThreadSlots = NULL;
+
+void ReleaseSlots(CPerfSlots* pslots)
+{
+    CPerfRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.cs);
+    registry.vFreeSlots.push_back(pslots);
+}
+
+CPerfSlots* AttachSlots()
+{
+    // Only there to hand the slots back when the thread exits
+    static boost::thread_specific_ptr<CPerfSlots>* pexit = new boost::thread_specific_ptr<CPerfSlots>(ReleaseSlots);
+    CPerfRegistry& registry = Registry();
+    CPerfSlots* pslots;
+    {
+        std::lock_guard<std::mutex> lock(registry.cs);
+        if (!registry.vFreeSlots.empty()) {
+            pslots = registry.vFreeSlots.back();
+            registry.vFreeSlots.pop_back();
+        } else {
+            pslots = new CPerfSlots();
+            registry.vSlots.push_back(pslots);
+        }
+    }
+    pexit->reset(pslots);
+    perfThreadSlots = pslots;
+    return pslots;
+}
+
+}
+
+CPerfStat::CPerfStat(const std::string& strNameIn, const std::string& strHelpIn, Kind kindIn,
+                     const std::string& strLabelNameIn, const std::string& strLabelIn) :
+    strName(strNameIn), strHelp(strHelpIn), kind(kindIn), strLabelName(strLabelNameIn), strLabel(strLabelIn), nIndex(-1)
+{
+    CPerfRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.cs);
+    if (registry.vStats.size() < (size_t)MAX_PERF_STATS) {
+        nIndex = registry.vStats.size();
+        registry.vStats.push_back(this);
+    }
+}
+
+std::atomic<uint64_t>* CPerfStat::Slot() const
+{
+    if (nIndex < 0)
+        return NULL;
+    CPerfSlots* pslots = perfThreadSlots;
+    if (pslots == NULL)
+        pslots = AttachSlots();
+    return &pslots->values[nIndex * PERF_SLOT_SIZE];
+}
+
+void CPerfStat::Record(int64_t nNanos) const
+{
+    std::atomic<uint64_t>* p = Slot();
+    if (p == NULL)
+        return;
+    if (nNanos < 0)
+        nNanos = 0;
+    Bump(p[0], 1);
+    Bump(p[1], nNanos);
+    Bump(p[2 + PerfBucket(nNanos)], 1);
+}
+
+CPerfStatFamily::CPerfStatFamily(const std::string& strNameIn, const std::string& strHelpIn, CPerfStat::Kind kindIn, const std::string& strLabelNameIn) :
+    strName(strNameIn), strHelp(strHelpIn), kind(kindIn), strLabelName(strLabelNameIn)
+{
+    for (int i = 0; i < 256; i++)
+        members[i].store(NULL, std::memory_order_relaxed);
+}
+
+const CPerfStat& CPerfStatFamily::Get(uint8_t code)
+{
+    CPerfStat* pstat = members[code].load(std::memory_order_acquire);
+    if (pstat != NULL)
+        return *pstat;
+    std::lock_guard<std::mutex> lock(cs);
+    pstat = members[code].load(std::memory_order_relaxed);
+    if (pstat == NULL) {
+        pstat = new CPerfStat(strName, strHelp, kind, strLabelName, strprintf("0x%02x", code));
+        members[code].store(pstat, std::memory_order_release);
+    }
+    return *pstat;
+}
+
+uint64_t PerfBucketMicros(int nBucket)
+{
+    return nBucket < PERF_HISTOGRAM_BUCKETS - 1 ? (uint64_t)1 << nBucket : 0;
+}
+
+int PerfBucket(int64_t nNanos)
+{
+    // Rounded up, the bucket bounds are inclusive
+    uint64_t nMicros = nNanos <= 0 ? 0 : (nNanos + 999) / 1000;
+    return nMicros <= 1 ? 0 : std::min<int>(CountBits(nMicros - 1), PERF_HISTOGRAM_BUCKETS - 1);
+}
+
+uint64_t CPerfStatValues::QuantileMicros(double q) const
+{
+    if (nCount == 0)
+        return 0;
+    uint64_t nTarget = std::max<uint64_t>(1, q * nCount + 0.5);
+    uint64_t nSeen = 0;
+    for (int i = 0; i < PERF_HISTOGRAM_BUCKETS - 1; i++) {
+        nSeen += vBuckets[i];
+        if (nSeen >= nTarget)
+            return PerfBucketMicros(i);
+    }
+    // Slower than the last bound, which is all that is known
+    return PerfBucketMicros(PERF_HISTOGRAM_BUCKETS - 2);
+}
+
+std::vector<CPerfStatValues> GetPerfStats()
+{
+    CPerfRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.cs);
+    std::vector<CPerfStatValues> vValues(registry.vStats.size());
+    for (size_t i = 0; i < registry.vStats.size(); i++) {
+        CPerfStatValues& values = vValues[i];
+        values.pstat = registry.vStats[i];
+        values.nCount = 0;
+        values.nSumNanos = 0;
+        std::fill(values.vBuckets, values.vBuckets + PERF_HISTOGRAM_BUCKETS, 0);
+        for (size_t j = 0; j < registry.vSlots.size(); j++) {
+            const std::atomic<uint64_t>* p = &registry.vSlots[j]->values[i * PERF_SLOT_SIZE];
+            values.nCount += p[0].load(std::memory_order_relaxed);
+            values.nSumNanos += p[1].load(std::memory_order_relaxed);
+            for (int k = 0; k < PERF_HISTOGRAM_BUCKETS; k++)
+                values.vBuckets[k] += p[2 + k].load(std::memory_order_relaxed);
+        }
+    }
+    return vValues;
+}
+
+static std::string PrometheusLabels(const CPerfStat& stat, const std::string& strExtra = "")
+{
+    std::string strLabels;
+    if (!stat.GetLabelName().empty())
+        strLabels = strprintf("%s=\"%s\"", stat.GetLabelName(), stat.GetLabel());
+    if (!strExtra.empty())
+        strLabels += (strLabels.empty() ? "" : ",") + strExtra;
+    return strLabels.empty() ? "" : "{" + strLabels + "}";
+}
+
+std::string FormatPerfStatsPrometheus()
+{
+    std::vector<CPerfStatValues> vValues = GetPerfStats();
+
+    // Members of a family are registered as they are first used, so they
+    // are gathered under their name first
+    std::vector<std::string> vNames;
+    std::map<std::string, std::vector<const CPerfStatValues*> > mapByName;
+    for (size_t i = 0; i < vValues.size(); i++) {
+        const std::string& strName = vValues[i].pstat->GetName();
+        if (!mapByName.count(strName))
+            vNames.push_back(strName);
+        mapByName[strName].push_back(&vValues[i]);
+    }
+
+    std::string strOut;
+    for (size_t i = 0; i < vNames.size(); i++) {
+        const std::vector<const CPerfStatValues*>& vMembers = mapByName[vNames[i]];
+        const CPerfStat& first = *vMembers[0]->pstat;
+        std::string strName = vNames[i].compare(0, 7, "komodo_") == 0 ? vNames[i] : "komodo_" + vNames[i];
+        if (first.GetKind() == CPerfStat::COUNTER) {
+            strName += "_total";
+            strOut += strprintf("# HELP %s %s\n# TYPE %s counter\n", strName, first.GetHelp(), strName);
+            for (size_t j = 0; j < vMembers.size(); j++)
+                strOut += strprintf("%s%s %u\n", strName, PrometheusLabels(*vMembers[j]->pstat), vMembers[j]->nCount);
+            continue;
+        }
+        strName += "_seconds";
+        strOut += strprintf("# HELP %s %s\n# TYPE %s histogram\n", strName, first.GetHelp(), strName);
+        for (size_t j = 0; j < vMembers.size(); j++) {
+            const CPerfStatValues& values = *vMembers[j];
+            uint64_t nCumulative = 0;
+            for (int k = 0; k < PERF_HISTOGRAM_BUCKETS; k++) {
+                nCumulative += values.vBuckets[k];
+                std::string strLe = k < PERF_HISTOGRAM_BUCKETS - 1 ? strprintf("le=\"%g\"", PerfBucketMicros(k) * 1e-6) : "le=\"+Inf\"";
+                strOut += strprintf("%s_bucket%s %u\n", strName, PrometheusLabels(*values.pstat, strLe), nCumulative);
+            }
+            strOut += strprintf("%s_sum%s %.9f\n", strName, PrometheusLabels(*values.pstat), values.nSumNanos * 1e-9);
+            strOut += strprintf("%s_count%s %u\n", strName, PrometheusLabels(*values.pstat), values.nCount);
+        }
+    }
+    return strOut;
+}
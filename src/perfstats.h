@@ -0,0 +1,141 @@
+#ifndef KOMODO_PERFSTATS_H
+#define KOMODO_PERFSTATS_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Most stats the registry holds, the members of families included */
+static const int MAX_PERF_STATS = 128;
+/** Latency buckets: up to 1us, 2us, 4us, ... 2^24us, and anything slower */
+static const int PERF_HISTOGRAM_BUCKETS = 26;
+
+/**
+ * A counter or latency histogram in the performance stats registry. Every
+ * thread that records into a stat gets its own slot for it, written only
+ * by that thread with plain loads and stores, so recording takes no lock
+ * and shares no cache line. Reading sums the slots of every thread.
+ */
+class CPerfStat
+{
+public:
+    enum Kind { COUNTER, HISTOGRAM };
+
+    CPerfStat(const std::string& strNameIn, const std::string& strHelpIn, Kind kindIn,
+              const std::string& strLabelNameIn = "", const std::string& strLabelIn = "");
+
+    const std::string& GetName() const { return strName; }
+    const std::string& GetHelp() const { return strHelp; }
+    Kind GetKind() const { return kind; }
+    //! A member of a family tells apart from the others by this label
+    const std::string& GetLabelName() const { return strLabelName; }
+    const std::string& GetLabel() const { return strLabel; }
+
+    void Add(uint64_t n = 1) const
+    {
+        std::atomic<uint64_t>* p = Slot();
+        if (p != NULL)
+            Bump(p[0], n);
+    }
+
+    void Record(int64_t nNanos) const;
+
+private:
+    std::string strName;
+    std::string strHelp;
+    Kind kind;
+    std::string strLabelName;
+    std::string strLabel;
+    //! Where this stat is in a thread's slots, -1 once the registry is full
+    int nIndex;
+
+    std::atomic<uint64_t>* Slot() const;
+
+    static void Bump(std::atomic<uint64_t>& value, uint64_t n)
+    {
+        // Only this thread writes its slots
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    CPerfStat(const CPerfStat&);
+    CPerfStat& operator=(const CPerfStat&);
+};
+
+/** Stats of the same name told apart by a one byte code, like an evalcode, made as they are first used */
+class CPerfStatFamily
+{
+public:
+    CPerfStatFamily(const std::string& strNameIn, const std::string& strHelpIn, CPerfStat::Kind kindIn, const std::string& strLabelNameIn);
+
+    const CPerfStat& Get(uint8_t code);
+
+private:
+    std::string strName;
+    std::string strHelp;
+    CPerfStat::Kind kind;
+    std::string strLabelName;
+    std::mutex cs;
+    std::atomic<CPerfStat*> members[256];
+
+    CPerfStatFamily(const CPerfStatFamily&);
+    CPerfStatFamily& operator=(const CPerfStatFamily&);
+};
+
+/** Records the time from its construction to its destruction into a histogram */
+class CPerfTimer
+{
+public:
+    explicit CPerfTimer(const CPerfStat& statIn) : stat(statIn), start(std::chrono::steady_clock::now()) {}
+    ~CPerfTimer()
+    {
+        stat.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+private:
+    const CPerfStat& stat;
+    std::chrono::steady_clock::time_point start;
+};
+
+/** What a stat has recorded so far, over all threads */
+struct CPerfStatValues
+{
+    const CPerfStat* pstat;
+    //! Counter value, or the number of samples of a histogram
+    uint64_t nCount;
+    uint64_t nSumNanos;
+    uint64_t vBuckets[PERF_HISTOGRAM_BUCKETS];
+
+    /** Upper bound in microseconds of the bucket holding the given quantile, 0 without samples */
+    uint64_t QuantileMicros(double q) const;
+};
+
+/** Upper bound of a histogram bucket in microseconds, the last one has none */
+uint64_t PerfBucketMicros(int nBucket);
+/** The histogram bucket a latency falls in */
+int PerfBucket(int64_t nNanos);
+
+/** The current values of every registered stat, in registration order */
+std::vector<CPerfStatValues> GetPerfStats();
+
+/** Every stat in the Prometheus text exposition format, names prefixed with komodo_ */
+std::string FormatPerfStatsPrometheus();
+
+extern CPerfStat perfConnectBlock;
+extern CPerfStat perfConnectBlockTransactions;
+extern CPerfStat perfKomodoConnectBlock;
+extern CPerfStat perfKomodoCheckPOW;
+extern CPerfStat perfKomodoStaked;
+extern CPerfStat perfNotarisationScan;
+extern CPerfStatFamily perfCCEval;
+//! Evalcodes in the cclib range, and any other unknown ones, kept out of perfCCEval as the spender picks the code
+extern CPerfStat perfCCEvalCClib;
+extern CPerfStat perfCCEvalOther;
+extern CPerfStat perfCCEvalRejects;
+extern CPerfStatFamily perfNSPVRequests;
+//! Requests that are no known request type, kept out of perfNSPVRequests as a peer picks the byte
+extern CPerfStat perfNSPVOtherRequests;
+
+#endif // KOMODO_PERFSTATS_H
@@ -26,12 +26,17 @@
 #include "chainparams.h"
 #include "crypto/equihash.h"
 #include "primitives/block.h"
+#include "random.h"
 #include "streams.h"
 #include "uint256.h"
 #include "util.h"
 
 #include "sodium.h"
 
+#include <set>
+
+#include <boost/thread/shared_mutex.hpp>
+
 #ifdef ENABLE_RUST
 #include "librustzcash.h"
 #endif // ENABLE_RUST
@@ -648,11 +653,9 @@ uint32_t lwmaGetNextPOSRequired(const CBlockIndex* pindexLast, const Consensus::
         if (!pindexFirst)
             return nProofOfStakeLimit;
 
-        CBlockHeader hdr = pindexFirst->GetBlockHeader();
-
-        if (hdr.IsVerusPOSBlock())
+        if (pindexFirst->IsVerusPOSBlock())
         {
-            nBits = hdr.GetVerusPOSTarget();
+            nBits = pindexFirst->GetVerusPOSTarget();
             break;
         }
         pindexFirst = pindexFirst->pprev;
@@ -674,10 +677,9 @@ uint32_t lwmaGetNextPOSRequired(const CBlockIndex* pindexLast, const Consensus::
             if (!pindexFirst)
                 return nProofOfStakeLimit;
 
-            CBlockHeader hdr = pindexFirst->GetBlockHeader();
-            if (hdr.IsVerusPOSBlock())
+            if (pindexFirst->IsVerusPOSBlock())
             {
-                nBits = hdr.GetVerusPOSTarget();
+                nBits = pindexFirst->GetVerusPOSTarget();
                 break;
             }
         }
@@ -754,7 +756,71 @@ uint32_t lwmaGetNextPOSRequired(const CBlockIndex* pindexLast, const Consensus::
     return nextTarget.GetCompact();
 }
 
+namespace {
+
+/**
+ * Hashes of headers with a valid Equihash solution. The block hash
+ * commits to the solution, so a hit means this exact solution has been
+ * verified before. Only valid results are kept; an invalid header gets
+ * its sender punished and is not worth remembering.
+ */
+class CEquihashCache
+{
+private:
+    std::set<uint256> setValid;
+    boost::shared_mutex cs_equihashcache;
+
+public:
+    bool Get(const uint256 &hash)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_equihashcache);
+        return setValid.count(hash) != 0;
+    }
+
+    void Set(const uint256 &hash)
+    {
+        // ~100 bytes per entry, enough to cover a block download window
+        // worth of headers many times over
+        static const size_t nMaxCacheSize = 50000;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_equihashcache);
+
+        while (setValid.size() >= nMaxCacheSize)
+        {
+            // Evict a random entry, as the signature cache does
+            std::set<uint256>::iterator it = setValid.lower_bound(GetRandHash());
+            if (it == setValid.end())
+                it = setValid.begin();
+            setValid.erase(it);
+        }
+        setValid.insert(hash);
+    }
+};
+
+CEquihashCache equihashCache;
+
+}
+
 bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams& params)
+{
+    if (ASSETCHAINS_ALGO != ASSETCHAINS_EQUIHASH)
+        return true;
+
+    uint256 hash = pblock->GetHash();
+    if (equihashCache.Get(hash))
+        return true;
+    if (!CheckEquihashSolutionUncached(pblock, params))
+        return false;
+    equihashCache.Set(hash);
+    return true;
+}
+
+bool CEquihashCheck::operator()()
+{
+    return fCache ? CheckEquihashSolution(pheader, *pparams) : CheckEquihashSolutionUncached(pheader, *pparams);
+}
+
+bool CheckEquihashSolutionUncached(const CBlockHeader *pblock, const CChainParams& params)
 {
     if (ASSETCHAINS_ALGO != ASSETCHAINS_EQUIHASH)
         return true;
@@ -39,9 +39,39 @@ unsigned int CalculateNextWorkRequired(arith_uint256 bnAvg,
 
 unsigned int lwmaGetNextPOSRequired(const CBlockIndex* pindexLast, const Consensus::Params& params);
 
-/** Check whether the Equihash solution in a block header is valid */
+/**
+ * Check whether the Equihash solution in a block header is valid. Headers
+ * found valid are remembered by hash, so checking the same header again,
+ * as CheckBlock and komodo_checkPOW do after AcceptBlockHeader, is a
+ * cache lookup.
+ */
 bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams&);
 
+/** As CheckEquihashSolution, without consulting or filling the cache */
+bool CheckEquihashSolutionUncached(const CBlockHeader *pblock, const CChainParams&);
+
+/** One Equihash solution check, so batches of headers can run on a CCheckQueue */
+class CEquihashCheck
+{
+private:
+    const CBlockHeader *pheader;
+    const CChainParams *pparams;
+    bool fCache;
+
+public:
+    CEquihashCheck() : pheader(NULL), pparams(NULL), fCache(true) {}
+    CEquihashCheck(const CBlockHeader *pheaderIn, const CChainParams *pparamsIn, bool fCacheIn) :
+        pheader(pheaderIn), pparams(pparamsIn), fCache(fCacheIn) {}
+
+    bool operator()();
+
+    void swap(CEquihashCheck &check) {
+        std::swap(pheader, check.pheader);
+        std::swap(pparams, check.pparams);
+        std::swap(fCache, check.fCache);
+    }
+};
+
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
 bool CheckProofOfWork(const CBlockHeader &blkHeader, uint8_t *pubkey33, int32_t height, const Consensus::Params& params);
 CChainPower GetBlockProof(const CBlockIndex& block);
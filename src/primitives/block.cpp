@@ -21,6 +21,7 @@
 #include "primitives/block.h"
 
 #include "hash.h"
+#include "streams.h"
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 #include "crypto/common.h"
@@ -53,6 +54,45 @@ uint256 CBlockHeader::GetVerusV2Hash() const
         return SerializeVerusHashV2(*this);
 }
 
+void CBlockHeader::GetHashes(const std::vector<CBlockHeader>& headers, std::vector<uint256>& hashes)
+{
+    hashes.resize(headers.size());
+    if (hashFunction != &CBlockHeader::GetVerusV2Hash)
+    {
+        for (size_t i = 0; i < headers.size(); i++)
+            hashes[i] = headers[i].GetHash();
+        return;
+    }
+
+    // serialize everything first so the hashes can run side by side
+    std::vector<CDataStream> vSerialized;
+    std::vector<const unsigned char*> vData;
+    std::vector<size_t> vLens;
+    std::vector<size_t> vIndex;
+    vSerialized.reserve(headers.size());
+    for (size_t i = 0; i < headers.size(); i++)
+    {
+        if (headers[i].hashPrevBlock.IsNull())
+        {
+            hashes[i] = headers[i].GetHash();
+            continue;
+        }
+        vSerialized.push_back(CDataStream(SER_GETHASH, PROTOCOL_VERSION));
+        vSerialized.back() << headers[i];
+        vIndex.push_back(i);
+    }
+    for (size_t j = 0; j < vSerialized.size(); j++)
+    {
+        vData.push_back((const unsigned char*)&vSerialized[j][0]);
+        vLens.push_back(vSerialized[j].size());
+    }
+
+    std::vector<unsigned char> vResults(vIndex.size() * 32);
+    CVerusHashV2::HashBatch(vResults.data(), vData.data(), vLens.data(), vIndex.size());
+    for (size_t j = 0; j < vIndex.size(); j++)
+        memcpy(hashes[vIndex[j]].begin(), &vResults[j * 32], 32);
+}
+
 void CBlockHeader::SetSHA256DHash()
 {
     CBlockHeader::hashFunction = &CBlockHeader::GetSHA256DHash;
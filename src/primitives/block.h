@@ -108,6 +108,9 @@ public:
     uint256 GetVerusV2Hash() const;
     static void SetVerusHashV2();
 
+    /** GetHash() of each header, hashing several at once with VerusHash v2 */
+    static void GetHashes(const std::vector<CBlockHeader>& headers, std::vector<uint256>& hashes);
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
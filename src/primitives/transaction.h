@@ -37,6 +37,7 @@
 #endif
 
 #include <array>
+#include <memory>
 
 #include <boost/variant.hpp>
 
@@ -857,4 +858,6 @@ struct CMutableTransaction
     uint256 GetHash() const;
 };
 
+typedef std::shared_ptr<const CTransaction> CTransactionRef;
+
 #endif // BITCOIN_PRIMITIVES_TRANSACTION_H
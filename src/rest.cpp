@@ -22,6 +22,7 @@
 #include "primitives/transaction.h"
 #include "main.h"
 #include "httpserver.h"
+#include "perfstats.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
@@ -619,6 +620,13 @@ static const struct {
       {"/rest/getutxos", rest_getutxos},
 };
 
+static bool prometheus_metrics(HTTPRequest* req, const std::string& strURIPart)
+{
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+    req->WriteReply(HTTP_OK, FormatPerfStatsPrometheus());
+    return true;
+}
+
 bool StartREST()
 {
     for (unsigned int i = 0; i < ARRAYLEN(uri_prefixes); i++)
@@ -635,3 +643,14 @@ void StopREST()
     for (unsigned int i = 0; i < ARRAYLEN(uri_prefixes); i++)
         UnregisterHTTPHandler(uri_prefixes[i].prefix, false);
 }
+
+bool StartPrometheus()
+{
+    RegisterHTTPHandler("/metrics", true, prometheus_metrics);
+    return true;
+}
+
+void StopPrometheus()
+{
+    UnregisterHTTPHandler("/metrics", true);
+}
@@ -35,6 +35,7 @@
 #include "script/script.h"
 #include "script/script_error.h"
 #include "script/sign.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 
 #include <stdint.h>
@@ -150,7 +151,7 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     result.push_back(Pair("finalsaplingroot", blockindex->hashFinalSaplingRoot.GetHex()));
     result.push_back(Pair("time", (int64_t)blockindex->nTime));
     result.push_back(Pair("nonce", blockindex->nNonce.GetHex()));
-    result.push_back(Pair("solution", HexStr(blockindex->nSolution)));
+    result.push_back(Pair("solution", HexStr(blockindex->GetSolution())));
     result.push_back(Pair("bits", strprintf("%08x", blockindex->nBits)));
     result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
     result.push_back(Pair("chainwork", blockindex->chainPower.chainWork.GetHex()));
@@ -395,27 +396,9 @@ bool NSPV_inmempool(uint256 txid);
 
 bool myIsutxo_spentinmempool(uint256 &spenttxid,int32_t &spentvini,uint256 txid,int32_t vout)
 {
-    int32_t vini = 0;
     if ( KOMODO_NSPV_SUPERLITE )
         return(NSPV_spentinmempool(spenttxid,spentvini,txid,vout));
-    BOOST_FOREACH(const CTxMemPoolEntry &e,mempool.mapTx)
-    {
-        const CTransaction &tx = e.GetTx();
-        const uint256 &hash = tx.GetHash();
-        BOOST_FOREACH(const CTxIn &txin,tx.vin)
-        {
-            //fprintf(stderr,"%s/v%d ",uint256_str(str,txin.prevout.hash),txin.prevout.n);
-            if ( txin.prevout.n == vout && txin.prevout.hash == txid )
-            {
-                spenttxid = hash;
-                spentvini = vini;
-                return(true);
-            }
-            vini++;
-        }
-        //fprintf(stderr,"are vins for %s\n",uint256_str(str,hash));
-    }
-    return(false);
+    return(mempool.getSpender(COutPoint(txid,vout),spenttxid,spentvini));
 }
 
 bool mytxid_inmempool(uint256 txid)
@@ -1933,6 +1916,43 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
     return mempoolInfoToJSON();
 }
 
+UniValue getsigcacheinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "\nReturns details on the signature and crypto-condition verification cache.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": xxxxx             (numeric) Cached verification results\n"
+            "  \"maxentries\": xxxxx          (numeric) Capacity of the cache\n"
+            "  \"sighits\": xxxxx             (numeric) ECDSA signatures found in the cache\n"
+            "  \"sigmisses\": xxxxx           (numeric) ECDSA signatures not found in the cache\n"
+            "  \"sighitrate\": x.xxx          (numeric) Fraction of ECDSA lookups that hit\n"
+            "  \"cchits\": xxxxx              (numeric) Crypto-condition fulfillments found in the cache\n"
+            "  \"ccmisses\": xxxxx            (numeric) Crypto-condition fulfillments not found in the cache\n"
+            "  \"cchitrate\": x.xxx           (numeric) Fraction of crypto-condition lookups that hit\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", "")
+        );
+
+    CSignatureCacheStats stats = GetSignatureCacheStats();
+    uint64_t nSigLookups = stats.nSigHits + stats.nSigMisses;
+    uint64_t nCCLookups = stats.nCCHits + stats.nCCMisses;
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("entries", stats.nEntries));
+    ret.push_back(Pair("maxentries", stats.nMaxEntries));
+    ret.push_back(Pair("sighits", stats.nSigHits));
+    ret.push_back(Pair("sigmisses", stats.nSigMisses));
+    ret.push_back(Pair("sighitrate", nSigLookups ? (double)stats.nSigHits / nSigLookups : 0.0));
+    ret.push_back(Pair("cchits", stats.nCCHits));
+    ret.push_back(Pair("ccmisses", stats.nCCMisses));
+    ret.push_back(Pair("cchitrate", nCCLookups ? (double)stats.nCCHits / nCCLookups : 0.0));
+    return ret;
+}
+
 inline CBlockIndex* LookupBlockIndex(const uint256& hash)
 {
     AssertLockHeld(cs_main);
@@ -24,6 +24,7 @@
 #include "main.h"
 #include "net.h"
 #include "netbase.h"
+#include "perfstats.h"
 #include "rpc/server.h"
 #include "txmempool.h"
 #include "util.h"
@@ -191,6 +192,158 @@ UniValue geterablockheights(const UniValue& params, bool fHelp, const CPubKey& m
     return(ret);
 }
 
+static UniValue PerfStatToJSON(const CPerfStatValues& values)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("count", values.nCount));
+    if (values.pstat->GetKind() == CPerfStat::HISTOGRAM) {
+        obj.push_back(Pair("total_ms", values.nSumNanos * 1e-6));
+        obj.push_back(Pair("mean_us", values.nCount ? values.nSumNanos * 1e-3 / values.nCount : 0.0));
+        obj.push_back(Pair("p50_us", values.QuantileMicros(0.5)));
+        obj.push_back(Pair("p90_us", values.QuantileMicros(0.9)));
+        obj.push_back(Pair("p99_us", values.QuantileMicros(0.99)));
+    }
+    return obj;
+}
+
+UniValue getperfstats(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getperfstats\n"
+            "\nReturns the counters and latency histograms of the validation hot paths since startup.\n"
+            "Stats kept per evalcode or request type are objects keyed by that code.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"name\": {                 (object) A stat that has recorded something\n"
+            "    \"count\": xxxxx          (numeric) Counter value, or number of samples\n"
+            "    \"total_ms\": x.xxx       (numeric) Time spent in all samples\n"
+            "    \"mean_us\": x.xxx        (numeric) Average sample\n"
+            "    \"p50_us\": xxxxx         (numeric) Upper bound of the histogram bucket holding the median\n"
+            "    \"p90_us\": xxxxx         (numeric) Same for the 90th percentile\n"
+            "    \"p99_us\": xxxxx         (numeric) Same for the 99th percentile\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getperfstats", "")
+            + HelpExampleRpc("getperfstats", "")
+        );
+
+    UniValue ret(UniValue::VOBJ);
+    std::vector<CPerfStatValues> vValues = GetPerfStats();
+    // Members of a family come after the rest, grouped by name
+    std::map<std::string, UniValue> mapFamilies;
+    BOOST_FOREACH(const CPerfStatValues& values, vValues) {
+        const CPerfStat& stat = *values.pstat;
+        if (stat.GetLabelName().empty()) {
+            ret.push_back(Pair(stat.GetName(), PerfStatToJSON(values)));
+            continue;
+        }
+        if (!mapFamilies.count(stat.GetName()))
+            mapFamilies[stat.GetName()] = UniValue(UniValue::VOBJ);
+        mapFamilies[stat.GetName()].push_back(Pair(stat.GetLabel(), PerfStatToJSON(values)));
+    }
+    for (std::map<std::string, UniValue>::const_iterator it = mapFamilies.begin(); it != mapFamilies.end(); ++it)
+        ret.push_back(Pair(it->first, it->second));
+    return ret;
+}
+
+static void AddLockTimes(CPerfStatValues& values, const CPerfStatValues& more)
+{
+    values.nCount += more.nCount;
+    values.nSumNanos += more.nSumNanos;
+    for (int i = 0; i < PERF_HISTOGRAM_BUCKETS; i++)
+        values.vBuckets[i] += more.vBuckets[i];
+}
+
+static bool CompareLockWait(const CLockSiteProfile& a, const CLockSiteProfile& b)
+{
+    return a.wait.nSumNanos > b.wait.nSumNanos;
+}
+
+UniValue getlockprofile(const UniValue& params, bool fHelp, const CPubKey& mypk)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getlockprofile ( count )\n"
+            "\nReturns the lock sites that spent the most time waiting for their lock, as sampled\n"
+            "since the node started with -lockprofile. Only one acquisition in \"samplerate\" is timed.\n"
+            "\nArguments:\n"
+            "1. count              (numeric, optional, default=50) Number of sites to return\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"enabled\": true|false      (boolean) Whether acquisitions are being timed\n"
+            "  \"samplerate\": n            (numeric) One acquisition in this many is timed\n"
+            "  \"sites\": [\n"
+            "    {\n"
+            "      \"lock\": \"name\",          (string) The lock taken, as written at the site\n"
+            "      \"site\": \"file:line\",     (string) Where it is taken\n"
+            "      \"samples\": n            (numeric) Acquisitions timed\n"
+            "      \"contended\": n          (numeric) Timed acquisitions that had to wait\n"
+            "      \"wait_ms\": x.xxx        (numeric) Time the timed acquisitions spent waiting\n"
+            "      \"wait_p50_us\": n        (numeric) Upper bound of the histogram bucket holding the median wait\n"
+            "      \"wait_p99_us\": n        (numeric) Same for the 99th percentile\n"
+            "      \"hold_ms\": x.xxx        (numeric) Time the lock was held after the timed acquisitions\n"
+            "      \"hold_p50_us\": n        (numeric) Upper bound of the histogram bucket holding the median hold\n"
+            "      \"hold_p99_us\": n        (numeric) Same for the 99th percentile\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockprofile", "10")
+            + HelpExampleRpc("getlockprofile", "10")
+        );
+
+    int nCount = 50;
+    if (params.size() > 0)
+        nCount = params[0].get_int();
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+
+    // A site in a header is seen once for every file that includes it
+    std::map<std::string, CLockSiteProfile> mapSites;
+    BOOST_FOREACH(const CLockSiteProfile& profile, GetLockProfile()) {
+        std::string strKey = strprintf("%s %s:%d", profile.strName, profile.strFile, profile.nLine);
+        std::map<std::string, CLockSiteProfile>::iterator it = mapSites.find(strKey);
+        if (it == mapSites.end()) {
+            mapSites.insert(std::make_pair(strKey, profile));
+            continue;
+        }
+        it->second.nSamples += profile.nSamples;
+        it->second.nContended += profile.nContended;
+        AddLockTimes(it->second.wait, profile.wait);
+        AddLockTimes(it->second.hold, profile.hold);
+    }
+    std::vector<CLockSiteProfile> vSites;
+    for (std::map<std::string, CLockSiteProfile>::const_iterator it = mapSites.begin(); it != mapSites.end(); ++it)
+        vSites.push_back(it->second);
+    std::sort(vSites.begin(), vSites.end(), CompareLockWait);
+
+    UniValue sites(UniValue::VARR);
+    for (size_t i = 0; i < vSites.size() && i < (size_t)nCount; i++) {
+        const CLockSiteProfile& profile = vSites[i];
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("lock", profile.strName));
+        obj.push_back(Pair("site", strprintf("%s:%d", profile.strFile, profile.nLine)));
+        obj.push_back(Pair("samples", profile.nSamples));
+        obj.push_back(Pair("contended", profile.nContended));
+        obj.push_back(Pair("wait_ms", profile.wait.nSumNanos * 1e-6));
+        obj.push_back(Pair("wait_p50_us", profile.wait.QuantileMicros(0.5)));
+        obj.push_back(Pair("wait_p99_us", profile.wait.QuantileMicros(0.99)));
+        obj.push_back(Pair("hold_ms", profile.hold.nSumNanos * 1e-6));
+        obj.push_back(Pair("hold_p50_us", profile.hold.QuantileMicros(0.5)));
+        obj.push_back(Pair("hold_p99_us", profile.hold.QuantileMicros(0.99)));
+        sites.push_back(obj);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("enabled", fLockProfile.load()));
+    ret.push_back(Pair("samplerate", GetLockProfileSampleRate()));
+    ret.push_back(Pair("sites", sites));
+    return ret;
+}
+
 UniValue getinfo(const UniValue& params, bool fHelp, const CPubKey& mypk)
 {
     uint256 notarized_hash,notarized_desttxid; int32_t prevMoMheight,notarized_height,longestchain,kmdnotarized_height,txid_height;
@@ -1665,6 +1818,8 @@ static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
+    { "control",            "getperfstats",           &getperfstats,           true  },
+    { "control",            "getlockprofile",         &getlockprofile,         true  },
     { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
     { "util",               "z_validateaddress",      &z_validateaddress,      true  }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         true  },
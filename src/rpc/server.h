@@ -399,6 +399,8 @@ extern UniValue validateaddress(const UniValue& params, bool fHelp, const CPubKe
 extern UniValue txnotarizedconfirmed(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue decodeccopret(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue getinfo(const UniValue& params, bool fHelp, const CPubKey& mypk);
+extern UniValue getperfstats(const UniValue& params, bool fHelp, const CPubKey& mypk);
+extern UniValue getlockprofile(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue getiguanajson(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue getnotarysendmany(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue geterablockheights(const UniValue& params, bool fHelp, const CPubKey& mypk);
@@ -439,6 +441,7 @@ extern UniValue getbestblockhash(const UniValue& params, bool fHelp, const CPubK
 extern UniValue getdifficulty(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue settxfee(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue getmempoolinfo(const UniValue& params, bool fHelp, const CPubKey& mypk);
+extern UniValue getsigcacheinfo(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue getrawmempool(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue getblockhashes(const UniValue& params, bool fHelp, const CPubKey& mypk);
 extern UniValue getblockdeltas(const UniValue& params, bool fHelp, const CPubKey& mypk);
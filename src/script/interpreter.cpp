@@ -1392,19 +1392,38 @@ int TransactionSignatureChecker::CheckCryptoCondition(
         fprintf(stderr,"%02x",((uint8_t *)&sighash)[z]);
     fprintf(stderr," sighash nIn.%d nHashType.%d %.8f id.%d\n",(int32_t)nIn,(int32_t)nHashType,(double)amount/COIN,(int32_t)consensusBranchId);
      */
-    VerifyEval eval = [] (CC *cond, void *checker) {
-        //fprintf(stderr,"checker.%p\n",(TransactionSignatureChecker*)checker);
-        return ((TransactionSignatureChecker*)checker)->CheckEvalCondition(cond);
-    };
-    //fprintf(stderr,"non-checker path\n");
-    int out = cc_verify(cond, (const unsigned char*)&sighash, 32, 0,
-                        condBin.data(), condBin.size(), eval, (void*)this);
+    int out = VerifyCryptoCondition(cond, sighash, condBin, ffillBin);
     //fprintf(stderr,"out.%d from cc_verify\n",(int32_t)out);
     cc_free(cond);
     return out;
 }
 
 
+static int CheckEvalConditionCallback(CC *cond, void *checker)
+{
+    //fprintf(stderr,"checker.%p\n",(TransactionSignatureChecker*)checker);
+    return ((TransactionSignatureChecker*)checker)->CheckEvalCondition(cond);
+}
+
+
+int TransactionSignatureChecker::VerifyCryptoCondition(
+        const CC *cond,
+        const uint256& sighash,
+        const std::vector<unsigned char>& condBin,
+        const std::vector<unsigned char>& ffillBin) const
+{
+    //fprintf(stderr,"non-checker path\n");
+    return cc_verify(cond, (const unsigned char*)&sighash, 32, 0,
+                     condBin.data(), condBin.size(), CheckEvalConditionCallback, (void*)this);
+}
+
+
+int TransactionSignatureChecker::VerifyEvalConditions(const CC *cond) const
+{
+    return cc_verifyEval(cond, CheckEvalConditionCallback, (void*)this);
+}
+
+
 int TransactionSignatureChecker::CheckEvalCondition(const CC *cond) const
 {
     //fprintf(stderr, "Cannot check crypto-condition Eval outside of server, returning true in pre-checks\n");
@@ -20,6 +20,8 @@
 
 #include "sigcache.h"
 
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
@@ -27,81 +29,231 @@
 #ifdef _WIN32
 #undef __cpuid
 #endif
+#include <atomic>
+
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
 
 namespace {
 
 /**
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
- * again when accepted into the block chain)
+ * again when accepted into the block chain). Crypto-condition fulfillments
+ * share it, under a different key tag.
+ *
+ * Entries are salted SHA256 digests of what was verified, so the cache
+ * takes a fixed amount of memory set once from -maxsigcachesize. It is
+ * split into shards with a lock each, so script check threads rarely
+ * contend. Within a shard a key may live in either of two buckets of
+ * WAYS slots, as in cuckoo hashing. A full bucket pair first gives up
+ * slots written more than one generation ago, where a generation ends
+ * after half the shard has been rewritten, and otherwise a random slot.
+ * Random because that helps foil would-be DoS attackers who might try to
+ * pre-generate and re-use a set of valid signatures just-slightly-greater
+ * than our cache size.
  */
 class CSignatureCache
 {
+public:
+    enum KeyType { SIG = 0, CC = 1 };
+
 private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    static const size_t SHARDS = 16;
+    static const size_t WAYS = 4;
+
+    struct CShard {
+        boost::shared_mutex cs;
+        std::vector<uint256> vKeys;
+        //! generation each slot was written in, 0 for an empty slot
+        std::vector<uint8_t> vGeneration;
+        uint8_t nGeneration;
+        size_t nWritten;
+        size_t nEntries;
+    };
+
+    CShard shards[SHARDS];
+    size_t nBuckets;
+    uint256 nonce;
+    std::atomic<uint64_t> nHits[2];
+    std::atomic<uint64_t> nMisses[2];
+
+    CShard& GetShard(const uint256& key, size_t& nBucket1, size_t& nBucket2)
+    {
+        const unsigned char* p = key.begin();
+        nBucket1 = (ReadLE32(p + 4) % nBuckets) * WAYS;
+        nBucket2 = (ReadLE32(p + 8) % nBuckets) * WAYS;
+        return shards[ReadLE32(p) % SHARDS];
+    }
 
 public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    CSignatureCache()
+    {
+        int64_t nMaxEntries = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE);
+        nBuckets = nMaxEntries <= 0 ? 0 : (nMaxEntries + SHARDS * WAYS - 1) / (SHARDS * WAYS);
+        for (size_t i = 0; i < SHARDS; i++) {
+            shards[i].vKeys.resize(nBuckets * WAYS);
+            shards[i].vGeneration.resize(nBuckets * WAYS, 0);
+            shards[i].nGeneration = 1;
+            shards[i].nWritten = 0;
+            shards[i].nEntries = 0;
+        }
+        nonce = GetRandHash();
+        for (int i = 0; i < 2; i++) {
+            nHits[i] = 0;
+            nMisses[i] = 0;
+        }
+    }
+
+    uint256 GetKey(KeyType type, const uint256& hash, const std::vector<unsigned char>& vch1, const std::vector<unsigned char>& vch2) const
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        // Length prefixes keep (sig, pubkey) pairs from aliasing each other
+        unsigned char header[9];
+        header[0] = type;
+        WriteLE32(header + 1, vch1.size());
+        WriteLE32(header + 5, vch2.size());
+        uint256 key;
+        CSHA256().Write(nonce.begin(), 32).Write(header, sizeof(header)).Write(hash.begin(), 32)
+                 .Write(vch1.data(), vch1.size()).Write(vch2.data(), vch2.size()).Finalize(key.begin());
+        return key;
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
+    bool Get(KeyType type, const uint256& key)
+    {
+        if (nBuckets == 0)
+            return false;
+        size_t nBucket1, nBucket2;
+        CShard& shard = GetShard(key, nBucket1, nBucket2);
+        {
+            boost::shared_lock<boost::shared_mutex> lock(shard.cs);
+            for (size_t i = 0; i < WAYS; i++) {
+                if ((shard.vGeneration[nBucket1 + i] && shard.vKeys[nBucket1 + i] == key) ||
+                    (shard.vGeneration[nBucket2 + i] && shard.vKeys[nBucket2 + i] == key)) {
+                    nHits[type].fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+        }
+        nMisses[type].fetch_add(1, std::memory_order_relaxed);
         return false;
     }
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    void Set(const uint256& key)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there can be no more than 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
+        if (nBuckets == 0)
+            return;
+        size_t nBucket1, nBucket2;
+        CShard& shard = GetShard(key, nBucket1, nBucket2);
+        size_t vSlots[2 * WAYS];
+        for (size_t i = 0; i < WAYS; i++) {
+            vSlots[i] = nBucket1 + i;
+            vSlots[WAYS + i] = nBucket2 + i;
+        }
 
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        boost::unique_lock<boost::shared_mutex> lock(shard.cs);
+        for (size_t i = 0; i < 2 * WAYS; i++)
+            if (shard.vGeneration[vSlots[i]] && shard.vKeys[vSlots[i]] == key)
+                return;
 
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+        const uint8_t nPrevGeneration = shard.nGeneration == 1 ? 255 : shard.nGeneration - 1;
+        size_t nSlot = vSlots[GetRand(2 * WAYS)];
+        for (size_t i = 0; i < 2 * WAYS; i++) {
+            uint8_t nSlotGeneration = shard.vGeneration[vSlots[i]];
+            if (nSlotGeneration == 0) {
+                nSlot = vSlots[i];
+                break;
+            }
+            if (nSlotGeneration != shard.nGeneration && nSlotGeneration != nPrevGeneration)
+                nSlot = vSlots[i];
         }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+        if (shard.vGeneration[nSlot] == 0)
+            shard.nEntries++;
+        shard.vKeys[nSlot] = key;
+        shard.vGeneration[nSlot] = shard.nGeneration;
+        if (++shard.nWritten >= shard.vKeys.size() / 2) {
+            shard.nGeneration = shard.nGeneration == 255 ? 1 : shard.nGeneration + 1;
+            shard.nWritten = 0;
+        }
+    }
+
+    CSignatureCacheStats GetStats()
+    {
+        CSignatureCacheStats stats;
+        stats.nSigHits = nHits[SIG];
+        stats.nSigMisses = nMisses[SIG];
+        stats.nCCHits = nHits[CC];
+        stats.nCCMisses = nMisses[CC];
+        stats.nEntries = 0;
+        stats.nMaxEntries = 0;
+        for (size_t i = 0; i < SHARDS; i++) {
+            boost::shared_lock<boost::shared_mutex> lock(shards[i].cs);
+            stats.nEntries += shards[i].nEntries;
+            stats.nMaxEntries += shards[i].vKeys.size();
+        }
+        return stats;
     }
 };
 
+CSignatureCache& GetSignatureCache()
+{
+    // Sized on first use, once -maxsigcachesize has been parsed
+    static CSignatureCache signatureCache;
+    return signatureCache;
 }
 
-bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+}
+
+bool GetCachedSignature(const uint256& sighash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey)
 {
-    static CSignatureCache signatureCache;
+    CSignatureCache& cache = GetSignatureCache();
+    return cache.Get(CSignatureCache::SIG, cache.GetKey(CSignatureCache::SIG, sighash, vchSig, std::vector<unsigned char>(pubkey.begin(), pubkey.end())));
+}
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+void CacheSignature(const uint256& sighash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey)
+{
+    CSignatureCache& cache = GetSignatureCache();
+    cache.Set(cache.GetKey(CSignatureCache::SIG, sighash, vchSig, std::vector<unsigned char>(pubkey.begin(), pubkey.end())));
+}
+
+bool GetCachedCryptoCondition(const uint256& sighash, const std::vector<unsigned char>& condBin, const std::vector<unsigned char>& ffillBin)
+{
+    CSignatureCache& cache = GetSignatureCache();
+    return cache.Get(CSignatureCache::CC, cache.GetKey(CSignatureCache::CC, sighash, condBin, ffillBin));
+}
+
+void CacheCryptoCondition(const uint256& sighash, const std::vector<unsigned char>& condBin, const std::vector<unsigned char>& ffillBin)
+{
+    CSignatureCache& cache = GetSignatureCache();
+    cache.Set(cache.GetKey(CSignatureCache::CC, sighash, condBin, ffillBin));
+}
+
+CSignatureCacheStats GetSignatureCacheStats()
+{
+    return GetSignatureCache().GetStats();
+}
+
+bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
+    if (GetCachedSignature(sighash, vchSig, pubkey))
         return true;
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
 
     if (store)
-        signatureCache.Set(sighash, vchSig, pubkey);
+        CacheSignature(sighash, vchSig, pubkey);
     return true;
 }
+
+int CachingTransactionSignatureChecker::VerifyCryptoCondition(const CC *cond, const uint256& sighash, const std::vector<unsigned char>& condBin, const std::vector<unsigned char>& ffillBin) const
+{
+    if (GetCachedCryptoCondition(sighash, condBin, ffillBin))
+        return VerifyEvalConditions(cond);
+
+    if (!TransactionSignatureChecker::VerifyCryptoCondition(cond, sighash, condBin, ffillBin))
+        return 0;
+
+    if (store)
+        CacheCryptoCondition(sighash, condBin, ffillBin);
+    return 1;
+}
@@ -23,10 +23,41 @@
 
 #include "script/interpreter.h"
 
+#include <stdint.h>
 #include <vector>
 
 class CPubKey;
 
+/**
+ * Default -maxsigcachesize, in entries. Signature and crypto-condition
+ * results share the cache, and an entry takes 33 bytes.
+ */
+static const int64_t DEFAULT_MAX_SIG_CACHE_SIZE = 200000;
+
+struct CSignatureCacheStats
+{
+    uint64_t nSigHits;
+    uint64_t nSigMisses;
+    uint64_t nCCHits;
+    uint64_t nCCMisses;
+    uint64_t nEntries;
+    uint64_t nMaxEntries;
+};
+
+/** Whether the ECDSA signature vchSig by pubkey over sighash is known to be valid */
+bool GetCachedSignature(const uint256& sighash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey);
+void CacheSignature(const uint256& sighash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey);
+
+/**
+ * Whether the fulfillment ffillBin is known to match condBin and to carry
+ * valid signatures over sighash. Eval nodes depend on chain state and are
+ * not covered, callers must still run them on a hit.
+ */
+bool GetCachedCryptoCondition(const uint256& sighash, const std::vector<unsigned char>& condBin, const std::vector<unsigned char>& ffillBin);
+void CacheCryptoCondition(const uint256& sighash, const std::vector<unsigned char>& condBin, const std::vector<unsigned char>& ffillBin);
+
+CSignatureCacheStats GetSignatureCacheStats();
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
@@ -36,6 +67,7 @@ public:
     CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amount, bool storeIn, PrecomputedTransactionData& txdataIn) : TransactionSignatureChecker(txToIn, nInIn, amount, txdataIn), store(storeIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
+    int VerifyCryptoCondition(const CC *cond, const uint256& sighash, const std::vector<unsigned char>& condBin, const std::vector<unsigned char>& ffillBin) const;
 };
 
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -22,7 +22,10 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+#include <mutex>
 #include <stdio.h>
+#include <string.h>
 
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
@@ -189,3 +192,207 @@ void AssertLockHeldInternal(const char* pszName, const char* pszFile, int nLine,
 }
 
 #endif /* DEBUG_LOCKORDER */
+
+std::atomic<bool> fLockProfile(false);
+static std::atomic<int> nLockProfileSampleRate(DEFAULT_LOCK_PROFILE_SAMPLE);
+
+struct CLockSite
+{
+    //! Set last, once the rest is filled in
+    std::atomic<const char*> pszFile;
+    const char* pszName;
+    int nLine;
+    std::atomic<uint64_t> nSamples;
+    std::atomic<uint64_t> nContended;
+    //! Sum of nanoseconds, then the histogram buckets
+    std::atomic<uint64_t> vWait[1 + PERF_HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> vHold[1 + PERF_HISTOGRAM_BUCKETS];
+};
+
+// Allocated when the profiler is first turned on and never freed, as a
+// lock taken while it was on may be let go of at any time after
+static std::atomic<CLockSite*> vLockSites(NULL);
+static std::mutex csLockSites;
+
+void SetLockProfile(bool fEnable, int nSampleRate)
+{
+    if (fEnable && vLockSites.load() == NULL) {
+        std::lock_guard<std::mutex> lock(csLockSites);
+        if (vLockSites.load() == NULL) {
+            CLockSite* psites = new CLockSite[MAX_LOCK_PROFILE_SITES];
+            for (int i = 0; i < MAX_LOCK_PROFILE_SITES; i++) {
+                psites[i].pszFile.store(NULL, std::memory_order_relaxed);
+                psites[i].nSamples.store(0, std::memory_order_relaxed);
+                psites[i].nContended.store(0, std::memory_order_relaxed);
+                for (int j = 0; j < 1 + PERF_HISTOGRAM_BUCKETS; j++) {
+                    psites[i].vWait[j].store(0, std::memory_order_relaxed);
+                    psites[i].vHold[j].store(0, std::memory_order_relaxed);
+                }
+            }
+            vLockSites.store(psites);
+        }
+    }
+    nLockProfileSampleRate.store(std::max(nSampleRate, 1));
+    fLockProfile.store(fEnable);
+}
+
+int GetLockProfileSampleRate()
+{
+    return nLockProfileSampleRate.load();
+}
+
+bool SampleLock()
+{
+    // Every thread counts down to its next sample from a random point, so
+    // acquisitions that come in a fixed pattern are not always skipped
+    static thread_local uint32_t nCountdown = 0;
+    static thread_local uint32_t nRand = 0;
+    if (nCountdown > 0) {
+        nCountdown--;
+        return false;
+    }
+    if (nRand == 0)
+        nRand = (uint32_t)(uintptr_t)&nRand | 1;
+    nRand ^= nRand << 13;
+    nRand ^= nRand >> 17;
+    nRand ^= nRand << 5;
+    uint32_t nRate = nLockProfileSampleRate.load(std::memory_order_relaxed);
+    nCountdown = nRate > 1 ? nRand % (2 * nRate - 1) : 0;
+    return true;
+}
+
+CLockSite* FindLockSite(const char* pszName, const char* pszFile, int nLine)
+{
+    CLockSite* psites = vLockSites.load(std::memory_order_acquire);
+    if (psites == NULL)
+        return NULL;
+    // A LOCK in a header has a copy of __FILE__ in every translation unit
+    // that includes it, so sites go by the file name, not the pointer
+    size_t nHash = (size_t)nLine * 2654435761u;
+    for (const char* p = pszFile; *p; p++)
+        nHash = nHash * 31 + (unsigned char)*p;
+    for (int i = 0; i < MAX_LOCK_PROFILE_SITES; i++) {
+        CLockSite& site = psites[(nHash + i) % MAX_LOCK_PROFILE_SITES];
+        const char* pszSiteFile = site.pszFile.load(std::memory_order_acquire);
+        if (pszSiteFile == NULL) {
+            // A site new to the profiler, taken the first time only
+            std::lock_guard<std::mutex> lock(csLockSites);
+            pszSiteFile = site.pszFile.load(std::memory_order_acquire);
+            if (pszSiteFile == NULL) {
+                // The pthread wrappers are handed &mutex
+                site.pszName = pszName[0] == '&' ? pszName + 1 : pszName;
+                site.nLine = nLine;
+                site.pszFile.store(pszFile, std::memory_order_release);
+                return &site;
+            }
+        }
+        if (site.nLine == nLine && (pszSiteFile == pszFile || strcmp(pszSiteFile, pszFile) == 0))
+            return &site;
+    }
+    return NULL;
+}
+
+static void RecordLockTime(std::atomic<uint64_t>* pvalues, int64_t nNanos)
+{
+    if (nNanos < 0)
+        nNanos = 0;
+    pvalues[0].fetch_add(nNanos, std::memory_order_relaxed);
+    pvalues[1 + PerfBucket(nNanos)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void RecordLockWait(CLockSite* psite, bool fContended, int64_t nNanos)
+{
+    psite->nSamples.fetch_add(1, std::memory_order_relaxed);
+    if (fContended)
+        psite->nContended.fetch_add(1, std::memory_order_relaxed);
+    RecordLockTime(psite->vWait, nNanos);
+}
+
+void RecordLockHold(CLockSite* psite, int64_t nNanos)
+{
+    RecordLockTime(psite->vHold, nNanos);
+}
+
+static void LoadLockTimes(const std::atomic<uint64_t>* pvalues, CPerfStatValues& values)
+{
+    values.pstat = NULL;
+    values.nSumNanos = pvalues[0].load(std::memory_order_relaxed);
+    values.nCount = 0;
+    for (int i = 0; i < PERF_HISTOGRAM_BUCKETS; i++) {
+        values.vBuckets[i] = pvalues[1 + i].load(std::memory_order_relaxed);
+        values.nCount += values.vBuckets[i];
+    }
+}
+
+std::vector<CLockSiteProfile> GetLockProfile()
+{
+    std::vector<CLockSiteProfile> vProfile;
+    CLockSite* psites = vLockSites.load(std::memory_order_acquire);
+    if (psites == NULL)
+        return vProfile;
+    for (int i = 0; i < MAX_LOCK_PROFILE_SITES; i++) {
+        const CLockSite& site = psites[i];
+        const char* pszFile = site.pszFile.load(std::memory_order_acquire);
+        if (pszFile == NULL)
+            continue;
+        CLockSiteProfile profile;
+        profile.strName = site.pszName;
+        profile.strFile = pszFile;
+        profile.nLine = site.nLine;
+        profile.nSamples = site.nSamples.load(std::memory_order_relaxed);
+        profile.nContended = site.nContended.load(std::memory_order_relaxed);
+        LoadLockTimes(site.vWait, profile.wait);
+        LoadLockTimes(site.vHold, profile.hold);
+        vProfile.push_back(profile);
+    }
+    return vProfile;
+}
+
+namespace {
+//! A profiled pthread mutex this thread holds
+struct CHeldMutex
+{
+    pthread_mutex_t* pmutex;
+    CLockSite* psite;
+    int64_t nLockedNanos;
+};
+}
+
+static const int MAX_HELD_MUTEXES = 16;
+static thread_local CHeldMutex vHeldMutexes[MAX_HELD_MUTEXES];
+static thread_local int nHeldMutexes = 0;
+
+void ProfiledMutexLock(pthread_mutex_t* pmutex, const char* pszName, const char* pszFile, int nLine)
+{
+    if (!fLockProfile.load(std::memory_order_relaxed) || !SampleLock() || nHeldMutexes >= MAX_HELD_MUTEXES) {
+        pthread_mutex_lock(pmutex);
+        return;
+    }
+    CLockSite* psite = FindLockSite(pszName, pszFile, nLine);
+    if (psite == NULL) {
+        pthread_mutex_lock(pmutex);
+        return;
+    }
+    int64_t nStart = LockProfileNanos();
+    bool fContended = pthread_mutex_trylock(pmutex) != 0;
+    if (fContended)
+        pthread_mutex_lock(pmutex);
+    int64_t nLocked = LockProfileNanos();
+    RecordLockWait(psite, fContended, nLocked - nStart);
+    CHeldMutex& held = vHeldMutexes[nHeldMutexes++];
+    held.pmutex = pmutex;
+    held.psite = psite;
+    held.nLockedNanos = nLocked;
+}
+
+void ProfiledMutexUnlock(pthread_mutex_t* pmutex)
+{
+    for (int i = nHeldMutexes - 1; i >= 0; i--) {
+        if (vHeldMutexes[i].pmutex == pmutex) {
+            RecordLockHold(vHeldMutexes[i].psite, LockProfileNanos() - vHeldMutexes[i].nLockedNanos);
+            vHeldMutexes[i] = vHeldMutexes[--nHeldMutexes];
+            break;
+        }
+    }
+    pthread_mutex_unlock(pmutex);
+}
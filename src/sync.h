@@ -21,8 +21,15 @@
 #ifndef BITCOIN_SYNC_H
 #define BITCOIN_SYNC_H
 
+#include "perfstats.h"
 #include "threadsafety.h"
 
+#include <atomic>
+#include <chrono>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
 #undef __cpuid
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
@@ -115,16 +122,94 @@ void static inline AssertLockHeldInternal(const char* pszName, const char* pszFi
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/** Default for -lockprofile */
+static const bool DEFAULT_LOCK_PROFILE = false;
+/** Default for -lockprofilesample, one acquisition in this many is timed */
+static const int DEFAULT_LOCK_PROFILE_SAMPLE = 16;
+/** Most lock sites the profiler tells apart, acquisitions at any more are not timed */
+static const int MAX_LOCK_PROFILE_SITES = 2048;
+
+/**
+ * Lock contention profiler. While it is on, a sample of the acquisitions
+ * made through LOCK and the profiled pthread mutex wrappers is timed, and
+ * the time spent waiting for the lock and holding it goes into histograms
+ * kept per lock site: the lock expression and the file and line taking it.
+ * While it is off, taking a lock costs one more relaxed load.
+ */
+extern std::atomic<bool> fLockProfile;
+
+struct CLockSite;
+
+/** Turn the profiler on, timing one acquisition in nSampleRate, or off */
+void SetLockProfile(bool fEnable, int nSampleRate = DEFAULT_LOCK_PROFILE_SAMPLE);
+/** Whether this acquisition is one of the sample, only asked while the profiler is on */
+bool SampleLock();
+/** The site taking a lock, NULL once there are too many */
+CLockSite* FindLockSite(const char* pszName, const char* pszFile, int nLine);
+void RecordLockWait(CLockSite* psite, bool fContended, int64_t nNanos);
+void RecordLockHold(CLockSite* psite, int64_t nNanos);
+
+static inline int64_t LockProfileNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** What the profiler has seen at a lock site */
+struct CLockSiteProfile
+{
+    std::string strName;
+    std::string strFile;
+    int nLine;
+    //! Acquisitions timed, and how many of those had to wait
+    uint64_t nSamples;
+    uint64_t nContended;
+    CPerfStatValues wait;
+    CPerfStatValues hold;
+};
+
+/** The sites the profiler has timed acquisitions at, in no particular order */
+std::vector<CLockSiteProfile> GetLockProfile();
+int GetLockProfileSampleRate();
+
+/** pthread_mutex_lock and pthread_mutex_unlock, timed like LOCK while the profiler is on */
+void ProfiledMutexLock(pthread_mutex_t* pmutex, const char* pszName, const char* pszFile, int nLine);
+void ProfiledMutexUnlock(pthread_mutex_t* pmutex);
+
+#define LOCK_PTHREAD_MUTEX(pmutex) ProfiledMutexLock(pmutex, #pmutex, __FILE__, __LINE__)
+#define UNLOCK_PTHREAD_MUTEX(pmutex) ProfiledMutexUnlock(pmutex)
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
 {
 private:
     boost::unique_lock<Mutex> lock;
+    //! Where a timed acquisition was made, and when it got the lock
+    CLockSite* psite;
+    int64_t nLockedNanos;
+
+    void ProfiledEnter(const char* pszName, const char* pszFile, int nLine)
+    {
+        psite = FindLockSite(pszName, pszFile, nLine);
+        if (psite == NULL) {
+            lock.lock();
+            return;
+        }
+        int64_t nStart = LockProfileNanos();
+        bool fContended = !lock.try_lock();
+        if (fContended)
+            lock.lock();
+        nLockedNanos = LockProfileNanos();
+        RecordLockWait(psite, fContended, nLockedNanos - nStart);
+    }
 
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+        if (fLockProfile.load(std::memory_order_relaxed) && SampleLock()) {
+            ProfiledEnter(pszName, pszFile, nLine);
+            return;
+        }
 #ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock()) {
             PrintLockContention(pszName, pszFile, nLine);
@@ -145,7 +230,7 @@ private:
     }
 
 public:
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : lock(mutexIn, boost::defer_lock), psite(NULL), nLockedNanos(0)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -153,7 +238,7 @@ public:
             Enter(pszName, pszFile, nLine);
     }
 
-    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn)
+    CMutexLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn) : psite(NULL), nLockedNanos(0)
     {
         if (!pmutexIn) return;
 
@@ -166,8 +251,11 @@ public:
 
     ~CMutexLock() UNLOCK_FUNCTION()
     {
-        if (lock.owns_lock())
+        if (lock.owns_lock()) {
+            if (psite != NULL)
+                RecordLockHold(psite, LockProfileNanos() - nLockedNanos);
             LeaveCritical();
+        }
     }
 
     operator bool()
@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+#include "blockencodings.h"
+#include "main.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include "testutils.h"
+
+namespace TestBlockEncodings {
+
+    class TestBlockEncodings : public ::testing::Test {};
+
+    static void AddTx(CTxMemPool& pool, const CTransaction& tx)
+    {
+        CTxMemPoolEntry entry(tx, 0, GetTime(), 0, 1, pool.HasNoInputsOf(tx), false, 0);
+        pool.addUnchecked(tx.GetHash(), entry, false);
+    }
+
+    template <typename T>
+    static T RoundTrip(const T& obj)
+    {
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << obj;
+        T result;
+        stream >> result;
+        return result;
+    }
+
+    TEST(TestBlockEncodings, rebuilds_from_mempool_and_blocktxn)
+    {
+        CBlock block = newBlock(50);
+        CTxMemPool pool(CFeeRate(0));
+        for (size_t i = 1; i < block.vtx.size(); i++)
+            if (i % 7 != 0)
+                AddTx(pool, block.vtx[i]);
+
+        CBlockHeaderAndShortTxIDs cmpctblock = RoundTrip(CBlockHeaderAndShortTxIDs(block, std::set<uint16_t>()));
+        EXPECT_EQ(cmpctblock.header.GetHash(), block.GetHash());
+        EXPECT_EQ(cmpctblock.BlockTxCount(), block.vtx.size());
+        // 6 bytes per transaction instead of the transaction
+        EXPECT_LT(GetSerializeSize(cmpctblock, SER_NETWORK, PROTOCOL_VERSION),
+                  GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION) / 2);
+
+        PartiallyDownloadedBlock partialBlock(&pool);
+        ASSERT_EQ(partialBlock.InitData(cmpctblock), READ_STATUS_OK);
+        EXPECT_EQ(partialBlock.GetPrefilledCount(), 1u);
+        EXPECT_TRUE(partialBlock.IsTxAvailable(0));
+
+        BlockTransactionsRequest req;
+        req.blockhash = block.GetHash();
+        req.indexes = partialBlock.GetMissing();
+        ASSERT_EQ(req.indexes.size(), 7u);
+        for (size_t i = 0; i < req.indexes.size(); i++)
+            EXPECT_EQ(req.indexes[i], 7 * (i + 1));
+        req = RoundTrip(req);
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++)
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        resp = RoundTrip(resp);
+
+        CBlock rebuilt;
+        ASSERT_EQ(partialBlock.FillBlock(rebuilt, resp.txn), READ_STATUS_OK);
+        EXPECT_EQ(rebuilt.GetHash(), block.GetHash());
+        EXPECT_EQ(rebuilt.BuildMerkleTree(), block.hashMerkleRoot);
+        EXPECT_TRUE(rebuilt.nSolution == block.nSolution);
+    }
+
+    TEST(TestBlockEncodings, prefilled_transactions)
+    {
+        // The staking tx closing a PoS block is sent whole, next to the coinbase
+        CBlock block = newBlock(10);
+        std::set<uint16_t> setPrefill;
+        setPrefill.insert(block.vtx.size() - 1);
+        setPrefill.insert(3);
+        CBlockHeaderAndShortTxIDs cmpctblock = RoundTrip(CBlockHeaderAndShortTxIDs(block, setPrefill));
+
+        CTxMemPool pool(CFeeRate(0));
+        PartiallyDownloadedBlock partialBlock(&pool);
+        ASSERT_EQ(partialBlock.InitData(cmpctblock), READ_STATUS_OK);
+        EXPECT_EQ(partialBlock.GetPrefilledCount(), 3u);
+        EXPECT_TRUE(partialBlock.IsTxAvailable(3));
+        EXPECT_TRUE(partialBlock.IsTxAvailable(block.vtx.size() - 1));
+        EXPECT_EQ(partialBlock.GetMissing().size(), block.vtx.size() - 3);
+    }
+
+    TEST(TestBlockEncodings, wrong_transactions_fail)
+    {
+        CBlock block = newBlock(5);
+        CTxMemPool pool(CFeeRate(0));
+        CBlockHeaderAndShortTxIDs cmpctblock(block, std::set<uint16_t>());
+
+        PartiallyDownloadedBlock partialBlock(&pool);
+        ASSERT_EQ(partialBlock.InitData(cmpctblock), READ_STATUS_OK);
+        std::vector<CTransaction> vtx(block.vtx.begin() + 1, block.vtx.end());
+
+        // Too few or too many is the peer's fault
+        CBlock rebuilt;
+        std::vector<CTransaction> vtxShort(vtx.begin(), vtx.end() - 1);
+        EXPECT_EQ(partialBlock.FillBlock(rebuilt, vtxShort), READ_STATUS_INVALID);
+        std::vector<CTransaction> vtxLong(vtx);
+        vtxLong.push_back(newTx());
+        EXPECT_EQ(partialBlock.FillBlock(rebuilt, vtxLong), READ_STATUS_INVALID);
+
+        // A transaction that doesn't match the merkle root asks for the whole block
+        std::vector<CTransaction> vtxWrong(vtx);
+        vtxWrong[2] = newTx();
+        EXPECT_EQ(partialBlock.FillBlock(rebuilt, vtxWrong), READ_STATUS_FAILED);
+
+        EXPECT_EQ(partialBlock.FillBlock(rebuilt, vtx), READ_STATUS_OK);
+        EXPECT_EQ(rebuilt.GetHash(), block.GetHash());
+    }
+
+    TEST(TestBlockEncodings, rejects_bad_prefill_index)
+    {
+        CBlock block = newBlock(3);
+
+        // No short ids, so the one prefilled index points past the block
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << block.GetBlockHeader() << uint64_t(0);
+        WriteCompactSize(stream, 0);
+        std::vector<PrefilledTransaction> vPrefilled(1);
+        vPrefilled[0].index = 2;
+        vPrefilled[0].tx = block.vtx[2];
+        stream << vPrefilled;
+        stream >> cmpctblock;
+
+        CTxMemPool pool(CFeeRate(0));
+        PartiallyDownloadedBlock partialBlock(&pool);
+        EXPECT_EQ(partialBlock.InitData(cmpctblock), READ_STATUS_INVALID);
+    }
+}
@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+#include "blockfilter.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "clientversion.h"
+#include "random.h"
+
+namespace TestBlockFilter {
+
+    class TestBlockFilter : public ::testing::Test {};
+
+    static CScript RandomScript()
+    {
+        std::vector<unsigned char> vch(20);
+        GetRandBytes(vch.data(), vch.size());
+        return CScript() << OP_DUP << OP_HASH160 << vch << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+
+    TEST(TestBlockFilter, match_outputs_and_spends)
+    {
+        CBlock block;
+        std::vector<CScript> scripts;
+        for (int i = 0; i < 50; i++) {
+            CMutableTransaction mtx;
+            mtx.vin.resize(1);
+            mtx.vin[0].prevout.hash = GetRandHash();
+            mtx.vin[0].prevout.n = i;
+            mtx.vout.resize(1);
+            mtx.vout[0].scriptPubKey = RandomScript();
+            scripts.push_back(mtx.vout[0].scriptPubKey);
+            block.vtx.push_back(CTransaction(mtx));
+        }
+        CBlockFilter filter(block);
+        EXPECT_EQ(filter.nElements, 100u);
+        EXPECT_FALSE(filter.HasShielded());
+
+        const uint256 hash = block.GetHash();
+        for (int i = 0; i < 50; i++) {
+            BlockFilterElements query;
+            query.insert(std::vector<unsigned char>(scripts[i].begin(), scripts[i].end()));
+            EXPECT_TRUE(filter.MatchAny(hash, query));
+
+            BlockFilterElements spend;
+            const COutPoint& prevout = block.vtx[i].vin[0].prevout;
+            spend.insert(CBlockFilter::OutPointElement(prevout.hash, prevout.n));
+            EXPECT_TRUE(filter.MatchAny(hash, spend));
+        }
+
+        // Unrelated scripts should practically never match
+        BlockFilterElements other;
+        for (int i = 0; i < 20; i++) {
+            CScript script = RandomScript();
+            other.insert(std::vector<unsigned char>(script.begin(), script.end()));
+        }
+        EXPECT_FALSE(filter.MatchAny(hash, other));
+
+        // Round trip through serialization
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << filter;
+        CBlockFilter filter2;
+        ss >> filter2;
+        BlockFilterElements query;
+        query.insert(std::vector<unsigned char>(scripts[7].begin(), scripts[7].end()));
+        EXPECT_TRUE(filter2.MatchAny(hash, query));
+        EXPECT_FALSE(filter2.MatchAny(hash, other));
+    }
+
+    TEST(TestBlockFilter, match_bare_multisig_keys)
+    {
+        std::vector<std::vector<unsigned char> > vKeys;
+        for (int i = 0; i < 3; i++) {
+            std::vector<unsigned char> vch(33);
+            GetRandBytes(vch.data(), vch.size());
+            vch[0] = 0x02;
+            vKeys.push_back(vch);
+        }
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout.hash = GetRandHash();
+        mtx.vout.resize(1);
+        mtx.vout[0].scriptPubKey = CScript() << OP_1 << vKeys[0] << vKeys[1] << OP_2 << OP_CHECKMULTISIG;
+        CBlock block;
+        block.vtx.push_back(CTransaction(mtx));
+        CBlockFilter filter(block);
+        // The script, the spent outpoint and the two keys
+        EXPECT_EQ(filter.nElements, 4u);
+
+        // The wallet looks a bare multisig output up by any key in it
+        const uint256 hash = block.GetHash();
+        for (int i = 0; i < 2; i++) {
+            BlockFilterElements query;
+            query.insert(vKeys[i]);
+            EXPECT_TRUE(filter.MatchAny(hash, query));
+        }
+        BlockFilterElements other;
+        other.insert(vKeys[2]);
+        EXPECT_FALSE(filter.MatchAny(hash, other));
+    }
+
+    TEST(TestBlockFilter, empty_block)
+    {
+        CBlock block;
+        CBlockFilter filter(block);
+        EXPECT_EQ(filter.nElements, 0u);
+        BlockFilterElements query;
+        query.insert(std::vector<unsigned char>(1, 0x51));
+        EXPECT_FALSE(filter.MatchAny(block.GetHash(), query));
+    }
+}
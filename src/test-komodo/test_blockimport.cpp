@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+#include "blockimport.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "random.h"
+#include "streams.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include "testutils.h"
+
+namespace TestBlockImport {
+
+    class TestBlockImport : public ::testing::Test {};
+
+    // Blocks framed the way WriteBlockToDisk stores them, with junk in between
+    static boost::filesystem::path WriteBlockFile(const std::vector<CBlock>& vBlocks)
+    {
+        const CMessageHeader::MessageStartChars& pchMessageStart = Params().MessageStart();
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        for (size_t i = 0; i < vBlocks.size(); i++) {
+            // A message start with an implausible size in front of every other block
+            if (i % 2 == 1)
+                ss << FLATDATA(pchMessageStart) << (unsigned int)20;
+            ss << FLATDATA(pchMessageStart) << (unsigned int)GetSerializeSize(vBlocks[i], SER_DISK, CLIENT_VERSION) << vBlocks[i];
+        }
+        // Preallocated space
+        std::vector<char> vZeros(100000, 0);
+        ss.write(vZeros.data(), vZeros.size());
+
+        boost::filesystem::path path = GetTempPath() / strprintf("test_komodo_blk_%li_%i.dat", GetTime(), GetRand(100000));
+        boost::filesystem::ofstream file(path, std::ios::binary);
+        file.write(&ss[0], ss.size());
+        return path;
+    }
+
+    TEST(TestBlockImport, parses_blocks_in_file_order)
+    {
+        std::vector<CBlock> vBlocks;
+        for (int i = 0; i < 40; i++)
+            vBlocks.push_back(newBlock(i % 7));
+        boost::filesystem::path path = WriteBlockFile(vBlocks);
+        std::shared_ptr<const CBlockFileMapping> mapping = CBlockFileMapping::Map(path);
+        ASSERT_TRUE(mapping != NULL);
+
+        // Every fifth block is in the index already
+        CBlockFileParser parser(mapping, Params().MessageStart(), 2000000, 3, [&](std::vector<CImportedBlock>& vBatch) {
+            for (size_t i = 0; i < vBatch.size(); i++)
+                for (size_t j = 0; j < vBlocks.size(); j += 5)
+                    if (vBatch[i].hash == vBlocks[j].GetHash())
+                        vBatch[i].fKnown = true;
+        });
+        EXPECT_EQ(parser.GetBlockCount(), vBlocks.size());
+
+        std::vector<CImportedBlock> vBatch;
+        size_t n = 0;
+        while (parser.NextBatch(vBatch)) {
+            for (size_t i = 0; i < vBatch.size(); i++, n++) {
+                ASSERT_LT(n, vBlocks.size());
+                EXPECT_EQ(vBatch[i].hash, vBlocks[n].GetHash());
+                EXPECT_EQ(vBatch[i].fKnown, n % 5 == 0);
+                EXPECT_EQ(vBatch[i].fParsed, n % 5 != 0);
+                if (vBatch[i].fParsed) {
+                    EXPECT_EQ(vBatch[i].block.GetHash(), vBlocks[n].GetHash());
+                    EXPECT_EQ(vBatch[i].block.vtx.size(), vBlocks[n].vtx.size());
+                    EXPECT_EQ(vBatch[i].block.vtx.back().GetHash(), vBlocks[n].vtx.back().GetHash());
+                }
+            }
+        }
+        EXPECT_EQ(n, vBlocks.size());
+        boost::filesystem::remove(path);
+    }
+
+    TEST(TestBlockImport, finds_spans_past_junk)
+    {
+        const CMessageHeader::MessageStartChars& pchMessageStart = Params().MessageStart();
+        std::vector<char> vData(1000, 0);
+        // A truncated block at the end is left out
+        memcpy(&vData[10], pchMessageStart, MESSAGE_START_SIZE);
+        vData[14] = 100;
+        memcpy(&vData[900], pchMessageStart, MESSAGE_START_SIZE);
+        vData[904] = 200;
+
+        std::vector<CBlockFileSpan> vSpans;
+        FindBlockSpans(&vData[0], &vData[0] + vData.size(), pchMessageStart, 1000, vSpans);
+        ASSERT_EQ(vSpans.size(), 1u);
+        EXPECT_EQ(vSpans[0].nPos, 18u);
+        EXPECT_EQ(vSpans[0].nSize, 100u);
+    }
+}
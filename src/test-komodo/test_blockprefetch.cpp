@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include "blockprefetch.h"
+#include "coins.h"
+#include "random.h"
+#include "txdb.h"
+#include "util.h"
+
+#include "testutils.h"
+
+namespace TestBlockPrefetch {
+
+    class TestBlockPrefetch : public ::testing::Test {};
+
+    TEST(TestBlockPrefetch, staged_coins_are_handed_out_once)
+    {
+        useTempDatadir();
+        CCoinsViewDB db(1 << 23, true);
+        CCoinsViewPrefetch prefetch(&db);
+        CCoinsViewCache cache(&prefetch);
+
+        uint256 txid = GetRandHash();
+        *cache.ModifyCoins(txid) = newCoins(2);
+        cache.SetBestBlock(GetRandHash());
+        ASSERT_TRUE(cache.Flush());
+
+        // Only coins that exist are staged
+        std::vector<uint256> vTxids;
+        vTxids.push_back(txid);
+        vTxids.push_back(GetRandHash());
+        prefetch.Prefetch(vTxids);
+        uint64_t nStaged, nHits;
+        prefetch.GetPrefetchStats(nStaged, nHits);
+        EXPECT_EQ(nStaged, 1u);
+        EXPECT_EQ(nHits, 0u);
+        EXPECT_TRUE(prefetch.HaveCoins(txid));
+
+        const CCoins* pcoins = cache.AccessCoins(txid);
+        ASSERT_TRUE(pcoins != NULL);
+        EXPECT_EQ(pcoins->vout[1].nValue, 1001);
+        prefetch.GetPrefetchStats(nStaged, nHits);
+        EXPECT_EQ(nHits, 1u);
+
+        // The cache holds it now, the stage doesn't
+        CCoins coins;
+        ASSERT_TRUE(prefetch.GetCoins(txid, coins));
+        prefetch.GetPrefetchStats(nStaged, nHits);
+        EXPECT_EQ(nHits, 1u);
+    }
+
+    TEST(TestBlockPrefetch, flush_drops_staged_coins)
+    {
+        useTempDatadir();
+        CCoinsViewDB db(1 << 23, true);
+        CCoinsViewPrefetch prefetch(&db);
+        CCoinsViewCache cache(&prefetch);
+
+        uint256 txid = GetRandHash();
+        *cache.ModifyCoins(txid) = newCoins(3);
+        cache.SetBestBlock(GetRandHash());
+        ASSERT_TRUE(cache.Flush());
+        EXPECT_TRUE(cache.AccessCoins(txid) != NULL);
+
+        // Staged while the cache above still has its own, newer, copy
+        std::vector<uint256> vTxids(1, txid);
+        prefetch.Prefetch(vTxids);
+        cache.ModifyCoins(txid)->Spend(1);
+        cache.SetBestBlock(GetRandHash());
+        ASSERT_TRUE(cache.Flush());
+
+        // The emptied cache must not get the copy staged before the spend
+        const CCoins* pcoins = cache.AccessCoins(txid);
+        ASSERT_TRUE(pcoins != NULL);
+        EXPECT_TRUE(pcoins->IsAvailable(0));
+        EXPECT_FALSE(pcoins->IsAvailable(1));
+        EXPECT_TRUE(pcoins->IsAvailable(2));
+        uint64_t nStaged, nHits;
+        prefetch.GetPrefetchStats(nStaged, nHits);
+        EXPECT_EQ(nStaged, 1u);
+        EXPECT_EQ(nHits, 0u);
+    }
+}
@@ -0,0 +1,173 @@
+#include <gtest/gtest.h>
+#include "coins.h"
+#include "main.h"
+#include "random.h"
+#include "txdb.h"
+#include "util.h"
+
+#include "testutils.h"
+
+namespace TestCoinsFlush {
+
+    class TestCoinsFlush : public ::testing::Test {};
+
+    TEST(TestCoinsFlush, reads_see_flushed_state_before_and_after_write)
+    {
+        useTempDatadir();
+        CCoinsViewDB db(1 << 23, true);
+        CCoinsViewBackgroundFlush flush(&db);
+        CCoinsViewCache cache(&flush);
+
+        uint256 txidKept = GetRandHash(), txidSpent = GetRandHash(), hashBlock = GetRandHash();
+        *cache.ModifyCoins(txidKept) = newCoins(3);
+        *cache.ModifyCoins(txidSpent) = newCoins(1);
+        cache.SetBestBlock(hashBlock);
+        ASSERT_TRUE(cache.Flush());
+        ASSERT_TRUE(flush.Sync());
+        EXPECT_EQ(db.GetBestBlock(), hashBlock);
+
+        // Spend while the next snapshot may still be in flight
+        {
+            CCoinsModifier coins = cache.ModifyCoins(txidKept);
+            coins->Spend(1);
+        }
+        cache.ModifyCoins(txidSpent)->Spend(0);
+        uint256 hashNext = GetRandHash();
+        cache.SetBestBlock(hashNext);
+        ASSERT_TRUE(cache.Flush());
+
+        // The emptied cache refills from the snapshot, never the stale database
+        EXPECT_EQ(cache.GetBestBlock(), hashNext);
+        EXPECT_FALSE(cache.HaveCoins(txidSpent));
+        const CCoins* pcoins = cache.AccessCoins(txidKept);
+        ASSERT_TRUE(pcoins != NULL);
+        EXPECT_TRUE(pcoins->IsAvailable(0));
+        EXPECT_FALSE(pcoins->IsAvailable(1));
+        EXPECT_TRUE(pcoins->IsAvailable(2));
+
+        ASSERT_TRUE(flush.Sync());
+        EXPECT_FALSE(flush.WriteFailed());
+        EXPECT_EQ(db.GetBestBlock(), hashNext);
+        EXPECT_FALSE(db.HaveCoins(txidSpent));
+        CCoins dbcoins;
+        ASSERT_TRUE(db.GetCoins(txidKept, dbcoins));
+        EXPECT_FALSE(dbcoins.IsAvailable(1));
+        EXPECT_EQ(dbcoins.vout[2].nValue, 1002);
+    }
+
+    typedef std::map<uint256, CCoins> CoinsModel;
+
+    static void WriteCoins(CCoinsView* pbase, const CoinsModel& model, const uint256& hashBlock)
+    {
+        CCoinsViewCache cache(pbase);
+        for (CoinsModel::const_iterator it = model.begin(); it != model.end(); ++it)
+            *cache.ModifyCoins(it->first) = it->second;
+        cache.SetBestBlock(hashBlock);
+        ASSERT_TRUE(cache.Flush());
+    }
+
+    static void ExpectSameCoins(const CCoinsViewDB& db, const CoinsModel& model)
+    {
+        for (CoinsModel::const_iterator it = model.begin(); it != model.end(); ++it) {
+            CCoins coins;
+            EXPECT_EQ(db.GetCoins(it->first, coins), !it->second.IsPruned());
+            EXPECT_EQ(db.HaveCoins(it->first), !it->second.IsPruned());
+            for (unsigned int i = 0; i < std::max(coins.vout.size(), it->second.vout.size()); i++) {
+                EXPECT_EQ(coins.IsAvailable(i), it->second.IsAvailable(i));
+                if (coins.IsAvailable(i) && it->second.IsAvailable(i))
+                    EXPECT_TRUE(coins.vout[i] == it->second.vout[i]);
+            }
+        }
+    }
+
+    static void ExpectSameStats(const CCoinsViewDB& db, const CCoinsViewDB& ref)
+    {
+        CCoinsStats stats, refstats;
+        ASSERT_TRUE(db.GetStats(stats));
+        ASSERT_TRUE(ref.GetStats(refstats));
+        EXPECT_EQ(stats.hashBlock, refstats.hashBlock);
+        EXPECT_EQ(stats.nTransactions, refstats.nTransactions);
+        EXPECT_EQ(stats.nTransactionOutputs, refstats.nTransactionOutputs);
+        EXPECT_EQ(stats.nSerializedSize, refstats.nSerializedSize);
+        EXPECT_EQ(stats.nTotalAmount, refstats.nTotalAmount);
+        EXPECT_EQ(stats.hashSerialized, refstats.hashSerialized);
+    }
+
+    TEST(TestCoinsFlush, outpoint_layout_matches_txid_layout)
+    {
+        useTempDatadir();
+        uint256 hashBlock = GetRandHash();
+        // GetStats looks the height of the best block up
+        CBlockIndex index;
+        mapBlockIndex[hashBlock] = &index;
+
+        CoinsModel model;
+        for (int i = 0; i < 50; i++) {
+            CCoins coins = newCoins(1 + i % 5);
+            if (i % 3 == 0)
+                coins.Spend(0);
+            model[GetRandHash()] = coins;
+        }
+        CCoinsViewDB db(1 << 23, true);
+        WriteCoins(&db, model, hashBlock);
+        CCoinsStats statsBefore;
+        ASSERT_TRUE(db.GetStats(statsBefore));
+
+        // Both record kinds are read while the chainstate is part migrated
+        ASSERT_TRUE(db.StartCoinsMigration());
+        EXPECT_EQ(db.GetCoinsLayout(), COINS_LAYOUT_MIGRATING);
+        size_t nMigrated, nTotal = 0;
+        bool fDone = false;
+        while (!fDone) {
+            ASSERT_TRUE(db.MigrateCoins(7, nMigrated, fDone));
+            nTotal += nMigrated;
+            ExpectSameCoins(db, model);
+            CCoinsStats stats;
+            ASSERT_TRUE(db.GetStats(stats));
+            EXPECT_EQ(stats.hashSerialized, statsBefore.hashSerialized);
+            EXPECT_EQ(stats.nSerializedSize, statsBefore.nSerializedSize);
+        }
+        size_t nUnspent = 0;
+        for (CoinsModel::const_iterator it = model.begin(); it != model.end(); ++it)
+            nUnspent += !it->second.IsPruned();
+        EXPECT_EQ(nTotal, nUnspent);
+        EXPECT_EQ(db.GetCoinsLayout(), COINS_LAYOUT_OUTPOINT);
+
+        // BatchWrite only rewrites the outputs that changed
+        {
+            CCoinsViewCache cache(&db);
+            int n = 0;
+            for (CoinsModel::iterator it = model.begin(); it != model.end(); ++it, n++) {
+                if (n % 4 == 0) {
+                    cache.ModifyCoins(it->first)->Spend(it->second.vout.size() - 1);
+                    it->second.Spend(it->second.vout.size() - 1);
+                } else if (n % 4 == 1) {
+                    CCoinsModifier coins = cache.ModifyCoins(it->first);
+                    for (unsigned int i = 0; i < coins->vout.size(); i++)
+                        coins->Spend(i);
+                    for (unsigned int i = 0; i < it->second.vout.size(); i++)
+                        it->second.Spend(i);
+                }
+            }
+            uint256 txidNew = GetRandHash();
+            *cache.ModifyCoins(txidNew) = newCoins(3);
+            model[txidNew] = newCoins(3);
+            cache.SetBestBlock(hashBlock);
+            ASSERT_TRUE(cache.Flush());
+        }
+        ExpectSameCoins(db, model);
+
+        // The same coins in the per transaction layout give the same stats
+        useTempDatadir();
+        CCoinsViewDB ref(1 << 23, true);
+        CoinsModel unspent;
+        for (CoinsModel::const_iterator it = model.begin(); it != model.end(); ++it)
+            if (!it->second.IsPruned())
+                unspent.insert(*it);
+        WriteCoins(&ref, unspent, hashBlock);
+        EXPECT_EQ(ref.GetCoinsLayout(), COINS_LAYOUT_TXID);
+        ExpectSameStats(db, ref);
+
+        mapBlockIndex.erase(hashBlock);
+    }
+}
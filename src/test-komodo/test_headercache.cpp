@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+#include "chain.h"
+#include "headercache.h"
+#include "main.h"
+#include "random.h"
+#include "streams.h"
+#include "version.h"
+
+namespace TestHeaderCache {
+
+    class TestHeaderCache : public ::testing::Test {};
+
+    // Block index entries with solutions in memory, forking off at nForkHeight
+    class FakeChain
+    {
+    public:
+        std::vector<uint256> vHashes;
+        std::vector<CBlockIndex> vBlocks;
+
+        FakeChain(int nHeight, const FakeChain* pfork = NULL, int nForkHeight = 0) : vHashes(nHeight + 1), vBlocks(nHeight + 1)
+        {
+            for (int i = 0; i <= nHeight; i++) {
+                bool fShared = pfork && i <= nForkHeight;
+                vHashes[i] = fShared ? pfork->vHashes[i] : GetRandHash();
+                vBlocks[i] = fShared ? pfork->vBlocks[i] : CBlockIndex();
+                if (!fShared) {
+                    vBlocks[i].nVersion = 4;
+                    vBlocks[i].hashMerkleRoot = GetRandHash();
+                    vBlocks[i].nTime = i;
+                    vBlocks[i].nSolution.resize(1344);
+                    GetRandBytes(vBlocks[i].nSolution.data(), vBlocks[i].nSolution.size());
+                }
+                vBlocks[i].phashBlock = &vHashes[i];
+                vBlocks[i].SetHeight(i);
+                vBlocks[i].pprev = i > 0 ? &vBlocks[i - 1] : NULL;
+                vBlocks[i].BuildSkip();
+            }
+        }
+    };
+
+    // What getheaders sent before the cache
+    static std::string Expected(const CBlockIndex* pindexLast, int nCount)
+    {
+        std::vector<CNetworkBlockHeader> vHeaders(nCount);
+        const CBlockIndex* pindex = pindexLast;
+        for (int i = nCount - 1; i >= 0; i--, pindex = pindex->pprev)
+            vHeaders[i] = pindex->GetBlockHeader();
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << vHeaders;
+        return ss.str();
+    }
+
+    static std::string Written(CHeaderCache& cache, const CBlockIndex* pindexLast, int nCount)
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        cache.WriteHeaders(ss, pindexLast, nCount);
+        return ss.str();
+    }
+
+    TEST(TestHeaderCache, matches_serialized_headers)
+    {
+        const int B = CHeaderCache::BUCKET_SIZE;
+        FakeChain chain(3 * B + 50);
+        {
+            LOCK(cs_main);
+            chainActive.SetTip(&chain.vBlocks.back());
+        }
+
+        CHeaderCache cache;
+        int vStarts[] = {0, 1, B - 1, B, B + 17, 2 * B, 3 * B - 5, 3 * B + 40};
+        // Twice, the second time from the cache
+        for (int n = 0; n < 2; n++) {
+            for (size_t s = 0; s < sizeof(vStarts) / sizeof(vStarts[0]); s++) {
+                int nLast = std::min(vStarts[s] + B - 1, 3 * B + 50);
+                const CBlockIndex* pindexLast = &chain.vBlocks[nLast];
+                int nCount = nLast - vStarts[s] + 1;
+                EXPECT_EQ(Written(cache, pindexLast, nCount), Expected(pindexLast, nCount)) << vStarts[s];
+            }
+        }
+        EXPECT_EQ(Written(cache, &chain.vBlocks[5], 1), Expected(&chain.vBlocks[5], 1));
+
+        LOCK(cs_main);
+        chainActive.SetTip(NULL);
+    }
+
+    TEST(TestHeaderCache, follows_reorgs)
+    {
+        const int B = CHeaderCache::BUCKET_SIZE;
+        FakeChain chain(3 * B), fork(3 * B + 10, &chain, B + 20);
+        CHeaderCache cache;
+        {
+            LOCK(cs_main);
+            chainActive.SetTip(&chain.vBlocks.back());
+        }
+        const CBlockIndex* pindexLast = &chain.vBlocks[2 * B + 10];
+        EXPECT_EQ(Written(cache, pindexLast, B), Expected(pindexLast, B));
+
+        // The cached buckets of the old chain must not leak into the new one
+        {
+            LOCK(cs_main);
+            chainActive.SetTip(&fork.vBlocks.back());
+        }
+        pindexLast = &fork.vBlocks[2 * B + 10];
+        EXPECT_EQ(Written(cache, pindexLast, B), Expected(pindexLast, B));
+
+        // Nor into a side chain we are asked about
+        pindexLast = &chain.vBlocks[2 * B + 10];
+        EXPECT_EQ(Written(cache, pindexLast, B), Expected(pindexLast, B));
+
+        LOCK(cs_main);
+        chainActive.SetTip(NULL);
+    }
+
+    TEST(TestHeaderCache, stays_within_size)
+    {
+        const int B = CHeaderCache::BUCKET_SIZE;
+        FakeChain chain(10 * B);
+        {
+            LOCK(cs_main);
+            chainActive.SetTip(&chain.vBlocks.back());
+        }
+        // Room for about two buckets
+        CHeaderCache cache;
+        cache.SetMaxSize(2 * B * 1600);
+        for (int i = 0; i < 9; i++) {
+            const CBlockIndex* pindexLast = &chain.vBlocks[(i + 1) * B - 1];
+            EXPECT_EQ(Written(cache, pindexLast, B), Expected(pindexLast, B));
+        }
+        const CBlockIndex* pindexLast = &chain.vBlocks[B - 1];
+        EXPECT_EQ(Written(cache, pindexLast, B), Expected(pindexLast, B));
+
+        LOCK(cs_main);
+        chainActive.SetTip(NULL);
+    }
+}
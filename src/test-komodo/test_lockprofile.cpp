@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+#include "sync.h"
+#include "utiltime.h"
+
+#include <boost/thread.hpp>
+
+namespace TestLockProfile {
+
+    class TestLockProfile : public ::testing::Test {};
+
+    // Every line a lock is taken at is a site of its own, these are added up
+    static CLockSiteProfile Sum(const std::vector<CLockSiteProfile>& vProfile, const std::string& strName)
+    {
+        CLockSiteProfile sum;
+        sum.nSamples = sum.nContended = 0;
+        sum.wait.nCount = sum.wait.nSumNanos = sum.hold.nCount = sum.hold.nSumNanos = 0;
+        for (size_t i = 0; i < vProfile.size(); i++) {
+            if (vProfile[i].strName != strName)
+                continue;
+            sum.nSamples += vProfile[i].nSamples;
+            sum.nContended += vProfile[i].nContended;
+            sum.wait.nCount += vProfile[i].wait.nCount;
+            sum.wait.nSumNanos += vProfile[i].wait.nSumNanos;
+            sum.hold.nCount += vProfile[i].hold.nCount;
+            sum.hold.nSumNanos += vProfile[i].hold.nSumNanos;
+        }
+        return sum;
+    }
+
+    static CCriticalSection csTestProfile;
+    static pthread_mutex_t mutexTestProfile = PTHREAD_MUTEX_INITIALIZER;
+
+    TEST(TestLockProfile, times_contended_sites)
+    {
+        SetLockProfile(true, 1);
+        boost::thread holder;
+        {
+            LOCK(csTestProfile);
+            holder = boost::thread([]() {
+                LOCK(csTestProfile);
+                LOCK_PTHREAD_MUTEX(&mutexTestProfile);
+                MilliSleep(5);
+                UNLOCK_PTHREAD_MUTEX(&mutexTestProfile);
+            });
+            MilliSleep(20);
+        }
+        holder.join();
+        SetLockProfile(false);
+
+        std::vector<CLockSiteProfile> vProfile = GetLockProfile();
+        CLockSiteProfile cs = Sum(vProfile, "csTestProfile");
+        CLockSiteProfile mutex = Sum(vProfile, "mutexTestProfile");
+        // Both acquisitions of csTestProfile are timed, the second one waits for the first
+        EXPECT_EQ(cs.nSamples, 2u);
+        EXPECT_EQ(cs.nContended, 1u);
+        EXPECT_EQ(cs.wait.nCount, 2u);
+        EXPECT_GE(cs.wait.nSumNanos, 10000000u);
+        EXPECT_GE(cs.hold.nSumNanos, 25000000u);
+        EXPECT_EQ(mutex.nSamples, 1u);
+        EXPECT_EQ(mutex.nContended, 0u);
+        EXPECT_GE(mutex.hold.nSumNanos, 5000000u);
+
+        // Nothing is timed while the profiler is off
+        {
+            LOCK(csTestProfile);
+        }
+        EXPECT_EQ(Sum(GetLockProfile(), "csTestProfile").nSamples, 2u);
+    }
+
+    TEST(TestLockProfile, header_sites_are_one_site)
+    {
+        SetLockProfile(true, 1);
+        // __FILE__ of a header, as two translation units including it have it.
+        // The site table keeps the pointer for good, so these can't be on the stack
+        static const char szFile1[] = "test_lockprofile_header.h";
+        static const char szFile2[] = "test_lockprofile_header.h";
+        CLockSite* psite = FindLockSite("csHeader", szFile1, 42);
+        ASSERT_TRUE(psite != NULL);
+        EXPECT_EQ(FindLockSite("csHeader", szFile2, 42), psite);
+        EXPECT_NE(FindLockSite("csHeader", szFile2, 43), psite);
+        SetLockProfile(false);
+
+        std::vector<CLockSiteProfile> vProfile = GetLockProfile();
+        int nSites = 0;
+        for (size_t i = 0; i < vProfile.size(); i++)
+            if (vProfile[i].strFile == szFile1 && vProfile[i].nLine == 42)
+                nSites++;
+        EXPECT_EQ(nSites, 1);
+    }
+}
@@ -0,0 +1,186 @@
+#include <gtest/gtest.h>
+#include "main.h"
+#include "random.h"
+#include "txmempool.h"
+#include "utilstrencodings.h"
+
+namespace TestMempoolLimit {
+
+    class TestMempoolLimit : public ::testing::Test {};
+
+    // pubkey every notarisation pays to in its first output
+    static const char* CRYPTO777_PUBKEY = "020e46e79a2a8d12b9b5d12c7a91adb4e454edfae43c0a0cb805427d2ac7613fd9";
+
+    static CMutableTransaction NewTx(const uint256& prevHash, uint32_t prevN, int nOutputs)
+    {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout.hash = prevHash;
+        mtx.vin[0].prevout.n = prevN;
+        mtx.vout.resize(nOutputs);
+        for (int i = 0; i < nOutputs; i++) {
+            std::vector<unsigned char> vch(20);
+            GetRandBytes(vch.data(), vch.size());
+            mtx.vout[i].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << vch << OP_EQUALVERIFY << OP_CHECKSIG;
+            mtx.vout[i].nValue = 1000;
+        }
+        return mtx;
+    }
+
+    static void AddTx(CTxMemPool& pool, const CTransaction& tx, CAmount nFee, bool fExempt = false)
+    {
+        CTxMemPoolEntry entry(tx, nFee, GetTime(), 0, 1, pool.HasNoInputsOf(tx), false, 0);
+        entry.SetEvictionExempt(fExempt);
+        pool.addUnchecked(tx.GetHash(), entry, false);
+    }
+
+    TEST(TestMempoolLimit, stress_fill_stays_bounded)
+    {
+        CTxMemPool pool(CFeeRate(0));
+        std::vector<std::pair<CAmount, uint256> > vTxs;
+        for (int i = 0; i < 5000; i++) {
+            CTransaction tx(NewTx(GetRandHash(), 0, 2));
+            CAmount nFee = GetRand(100) * 1000;
+            AddTx(pool, tx, nFee);
+            vTxs.push_back(std::make_pair(nFee, tx.GetHash()));
+        }
+        const size_t nLimit = pool.DynamicMemoryUsage() / 3;
+
+        // Keep adding on top of a full pool, the way AcceptToMemoryPool does
+        pool.TrimToSize(nLimit);
+        for (int i = 0; i < 5000; i++) {
+            CTransaction tx(NewTx(GetRandHash(), 0, 2));
+            CAmount nFee = GetRand(100) * 1000;
+            AddTx(pool, tx, nFee);
+            vTxs.push_back(std::make_pair(nFee, tx.GetHash()));
+            pool.TrimToSize(nLimit);
+            ASSERT_LE(pool.DynamicMemoryUsage(), nLimit);
+        }
+        EXPECT_GT(pool.size(), 0u);
+        EXPECT_GT(pool.GetMinFee(nLimit).GetFeePerK(), 0);
+
+        // The transactions are all the same size, so none that was evicted
+        // can have paid more than the cheapest one kept
+        CAmount nMinKept = std::numeric_limits<CAmount>::max(), nMaxEvicted = -1;
+        for (size_t i = 0; i < vTxs.size(); i++) {
+            if (pool.exists(vTxs[i].second))
+                nMinKept = std::min(nMinKept, vTxs[i].first);
+            else
+                nMaxEvicted = std::max(nMaxEvicted, vTxs[i].first);
+        }
+        EXPECT_LE(nMaxEvicted, nMinKept);
+
+        pool.clear();
+        EXPECT_EQ(pool.size(), 0u);
+        EXPECT_EQ(pool.DynamicMemoryUsage(), 0u);
+    }
+
+    TEST(TestMempoolLimit, child_pays_for_parent)
+    {
+        CTxMemPool pool(CFeeRate(0));
+        CTransaction parent(NewTx(GetRandHash(), 0, 1));
+        CTransaction child(NewTx(parent.GetHash(), 0, 1));
+        AddTx(pool, parent, 0);
+        AddTx(pool, child, 200000);
+
+        std::vector<uint256> vFillers;
+        for (int i = 0; i < 100; i++) {
+            CTransaction tx(NewTx(GetRandHash(), 0, 1));
+            AddTx(pool, tx, 10000);
+            vFillers.push_back(tx.GetHash());
+        }
+
+        pool.TrimToSize(pool.DynamicMemoryUsage() / 2);
+        EXPECT_TRUE(pool.exists(parent.GetHash()));
+        EXPECT_TRUE(pool.exists(child.GetHash()));
+        int nEvicted = 0;
+        for (size_t i = 0; i < vFillers.size(); i++)
+            nEvicted += !pool.exists(vFillers[i]);
+        EXPECT_GT(nEvicted, 0);
+
+        // Evicting the parent takes the child with it
+        pool.TrimToSize(0);
+        EXPECT_EQ(pool.size(), 0u);
+    }
+
+    TEST(TestMempoolLimit, paying_crypto777_is_not_a_notarisation)
+    {
+        // Anyone can pay CRYPTO777, without notary inputs that is all it is
+        CMutableTransaction mtx = NewTx(GetRandHash(), 0, 2);
+        mtx.vout[0].scriptPubKey = CScript() << ParseHex(CRYPTO777_PUBKEY) << OP_CHECKSIG;
+        CCoinsView viewDummy;
+        CCoinsViewCache view(&viewDummy);
+        EXPECT_FALSE(CTxMemPool::IsSignedNotarisation(CTransaction(mtx), view, 1, GetTime()));
+    }
+
+    TEST(TestMempoolLimit, notarisations_are_exempt)
+    {
+        CTxMemPool pool(CFeeRate(0));
+        CMutableTransaction mtx = NewTx(GetRandHash(), 0, 2);
+        mtx.vout[0].scriptPubKey = CScript() << ParseHex(CRYPTO777_PUBKEY) << OP_CHECKSIG;
+        CTransaction notarisation(mtx);
+
+        AddTx(pool, notarisation, 0, true);
+        for (int i = 0; i < 20; i++)
+            AddTx(pool, CTransaction(NewTx(GetRandHash(), 0, 1)), 50000);
+
+        pool.TrimToSize(0);
+        EXPECT_EQ(pool.size(), 1u);
+        EXPECT_TRUE(pool.exists(notarisation.GetHash()));
+    }
+
+    TEST(TestMempoolLimit, exempt_child_does_not_shield_parent)
+    {
+        CTxMemPool pool(CFeeRate(0));
+        CTransaction parent(NewTx(GetRandHash(), 0, 1));
+        CMutableTransaction mtx = NewTx(parent.GetHash(), 0, 2);
+        mtx.vout[0].scriptPubKey = CScript() << ParseHex(CRYPTO777_PUBKEY) << OP_CHECKSIG;
+        CTransaction child(mtx);
+        AddTx(pool, parent, 0);
+        AddTx(pool, child, 0, true);
+
+        // The child can't stay without its parent, so both go
+        pool.TrimToSize(0);
+        EXPECT_EQ(pool.size(), 0u);
+    }
+
+    TEST(TestMempoolLimit, exempt_bytes_are_capped)
+    {
+        CTxMemPool pool(CFeeRate(0));
+        std::vector<uint256> vExempt;
+        while (pool.HasExemptRoom(1000)) {
+            CMutableTransaction mtx = NewTx(GetRandHash(), 0, 2);
+            mtx.vout[0].scriptPubKey = CScript() << ParseHex(CRYPTO777_PUBKEY) << OP_CHECKSIG;
+            CTransaction tx(mtx);
+            AddTx(pool, tx, 0, true);
+            vExempt.push_back(tx.GetHash());
+        }
+        // Added as exempt past the cap, it is an ordinary entry
+        CMutableTransaction mtx = NewTx(GetRandHash(), 0, 2);
+        mtx.vout[0].scriptPubKey = CScript() << ParseHex(CRYPTO777_PUBKEY) << OP_CHECKSIG;
+        CTransaction over(mtx);
+        AddTx(pool, over, 0, true);
+
+        pool.TrimToSize(0);
+        EXPECT_FALSE(pool.exists(over.GetHash()));
+        EXPECT_EQ(pool.size(), vExempt.size());
+    }
+
+    TEST(TestMempoolLimit, scan_steps_over_exempt_entries)
+    {
+        // More exempt notarisations than one scan looks at, all cheaper
+        // than the one transaction that can go
+        CTxMemPool pool(CFeeRate(0));
+        for (int i = 0; i < CTxMemPool::TRIM_SCAN_LIMIT + 50; i++) {
+            CMutableTransaction mtx = NewTx(GetRandHash(), 0, 2);
+            mtx.vout[0].scriptPubKey = CScript() << ParseHex(CRYPTO777_PUBKEY) << OP_CHECKSIG;
+            AddTx(pool, CTransaction(mtx), 0, true);
+        }
+        CTransaction tx(NewTx(GetRandHash(), 0, 1));
+        AddTx(pool, tx, 50000);
+
+        pool.TrimToSize(0);
+        EXPECT_FALSE(pool.exists(tx.GetHash()));
+        EXPECT_EQ(pool.size(), (size_t)CTxMemPool::TRIM_SCAN_LIMIT + 50);
+    }
+}
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+#include "chain.h"
+#include "momaccumulator.h"
+#include "primitives/block.h"
+#include "random.h"
+
+namespace TestMoMAccumulator {
+
+    class TestMoMAccumulator : public ::testing::Test {};
+
+    // Block index entries with random merkle roots, forking off at nForkHeight
+    class FakeChain
+    {
+    public:
+        std::vector<uint256> vHashes;
+        std::vector<CBlockIndex> vBlocks;
+
+        FakeChain(int nHeight, const FakeChain* pfork = NULL, int nForkHeight = 0) : vHashes(nHeight + 1), vBlocks(nHeight + 1)
+        {
+            for (int i = 0; i <= nHeight; i++) {
+                bool fShared = pfork && i <= nForkHeight;
+                vHashes[i] = fShared ? pfork->vHashes[i] : GetRandHash();
+                vBlocks[i].hashMerkleRoot = fShared ? pfork->vBlocks[i].hashMerkleRoot : GetRandHash();
+                vBlocks[i].phashBlock = &vHashes[i];
+                vBlocks[i].SetHeight(i);
+                vBlocks[i].pprev = i > 0 ? &vBlocks[i - 1] : NULL;
+            }
+        }
+
+        std::vector<uint256> Leaves(int nHeight, int nDepth) const
+        {
+            std::vector<uint256> leaves;
+            for (int i = 0; i < nDepth; i++)
+                leaves.push_back(vBlocks[nHeight - i].hashMerkleRoot);
+            return leaves;
+        }
+    };
+
+    static void CheckRange(const CMoMAccumulator& acc, const FakeChain& chain, int nHeight, int nDepth)
+    {
+        std::vector<uint256> leaves = chain.Leaves(nHeight, nDepth), tree;
+        bool fMutated;
+        uint256 expected = BuildMerkleTree(&fMutated, leaves, tree);
+
+        uint256 mom;
+        ASSERT_TRUE(acc.GetMoM(nHeight, nDepth, mom)) << nHeight << " " << nDepth;
+        EXPECT_EQ(mom, expected) << nHeight << " " << nDepth;
+
+        for (int nIndex = 0; nIndex < nDepth; nIndex += 1 + nDepth / 7) {
+            std::vector<uint256> vBranch;
+            ASSERT_TRUE(acc.GetMoMBranch(nHeight, nDepth, nIndex, vBranch));
+            EXPECT_EQ(vBranch, GetMerkleBranch(nIndex, nDepth, tree)) << nHeight << " " << nDepth << " " << nIndex;
+        }
+    }
+
+    TEST(TestMoMAccumulator, matches_merkle_tree)
+    {
+        FakeChain chain(300);
+        CMoMAccumulator acc;
+        for (int i = 0; i <= 300; i++)
+            acc.Update(&chain.vBlocks[i]);
+
+        int vDepths[] = {1, 2, 3, 5, 8, 13, 16, 17, 31, 64, 100, 255, 256, 257, 300};
+        for (int d = 0; d < sizeof(vDepths) / sizeof(vDepths[0]); d++) {
+            CheckRange(acc, chain, 300, vDepths[d]);
+            if (vDepths[d] <= 250)
+                CheckRange(acc, chain, 250, vDepths[d]);
+        }
+
+        uint256 mom;
+        EXPECT_FALSE(acc.GetMoM(301, 1, mom));
+        EXPECT_FALSE(acc.GetMoM(300, 302, mom));
+        EXPECT_FALSE(acc.GetMoM(300, 0, mom));
+    }
+
+    TEST(TestMoMAccumulator, follows_reorgs)
+    {
+        FakeChain chain(200), fork(210, &chain, 180);
+        CMoMAccumulator acc;
+        for (int i = 0; i <= 200; i++)
+            acc.Update(&chain.vBlocks[i]);
+
+        // Disconnect back to the fork point, then connect the other branch
+        for (int i = 199; i >= 180; i--)
+            acc.Update(&chain.vBlocks[i]);
+        for (int i = 181; i <= 210; i++)
+            acc.Update(&fork.vBlocks[i]);
+        CheckRange(acc, fork, 210, 50);
+        CheckRange(acc, fork, 185, 185);
+
+        // A tip that does not extend the current one starts over
+        acc.Update(&chain.vBlocks[200]);
+        CheckRange(acc, chain, 200, 33);
+    }
+
+    TEST(TestMoMAccumulator, window_slides)
+    {
+        int nHeight = CMoMAccumulator::WINDOW + 100;
+        FakeChain chain(nHeight);
+        CMoMAccumulator acc;
+        acc.Update(&chain.vBlocks[1000]);
+        for (int i = 1001; i <= nHeight; i++)
+            acc.Update(&chain.vBlocks[i]);
+
+        CheckRange(acc, chain, nHeight, CMoMAccumulator::WINDOW);
+        CheckRange(acc, chain, nHeight - 1, 1000);
+        uint256 mom;
+        EXPECT_FALSE(acc.GetMoM(nHeight, CMoMAccumulator::WINDOW + 1, mom));
+        EXPECT_FALSE(acc.GetMoM(nHeight - CMoMAccumulator::WINDOW, 1, mom));
+    }
+}
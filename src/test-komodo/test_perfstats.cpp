@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+#include "perfstats.h"
+
+#include <boost/thread.hpp>
+
+namespace TestPerfStats {
+
+    class TestPerfStats : public ::testing::Test {};
+
+    // The registry keeps pointers to its stats for the life of the process
+    static CPerfStat statLatency("test_latency", "Latency recorded by the tests", CPerfStat::HISTOGRAM);
+    static CPerfStat statEvents("test_events", "Events counted by the tests", CPerfStat::COUNTER);
+    static CPerfStatFamily statCodes("test_codes", "Latency by code recorded by the tests", CPerfStat::HISTOGRAM, "code");
+
+    static const CPerfStatValues* Find(const std::vector<CPerfStatValues>& vValues, const CPerfStat& stat)
+    {
+        for (size_t i = 0; i < vValues.size(); i++)
+            if (vValues[i].pstat == &stat)
+                return &vValues[i];
+        return NULL;
+    }
+
+    TEST(TestPerfStats, threads_add_up)
+    {
+        boost::thread_group group;
+        for (int t = 0; t < 4; t++) {
+            group.create_thread([]() {
+                for (int i = 0; i < 1000; i++) {
+                    statEvents.Add();
+                    statLatency.Record(1500);
+                }
+                statLatency.Record(3000000000LL);
+            });
+        }
+        group.join_all();
+        // Slots of the threads that exited are used again
+        group.create_thread([]() { statEvents.Add(10); });
+        group.join_all();
+
+        std::vector<CPerfStatValues> vValues = GetPerfStats();
+        const CPerfStatValues* pevents = Find(vValues, statEvents);
+        const CPerfStatValues* platency = Find(vValues, statLatency);
+        ASSERT_TRUE(pevents != NULL);
+        ASSERT_TRUE(platency != NULL);
+        EXPECT_EQ(pevents->nCount, 4010u);
+        EXPECT_EQ(platency->nCount, 4004u);
+        EXPECT_EQ(platency->nSumNanos, 4000u * 1500 + 4u * 3000000000ULL);
+
+        // 1.5us is in the bucket up to 2us, 3s in the one up to 2^22us
+        EXPECT_EQ(platency->vBuckets[1], 4000u);
+        EXPECT_EQ(platency->vBuckets[22], 4u);
+        EXPECT_EQ(platency->QuantileMicros(0.5), 2u);
+        EXPECT_EQ(platency->QuantileMicros(1.0), 1u << 22);
+    }
+
+    TEST(TestPerfStats, families_and_prometheus_text)
+    {
+        statCodes.Get(0xe3).Record(500);
+        statCodes.Get(0x11).Record(500);
+        EXPECT_EQ(&statCodes.Get(0xe3), &statCodes.Get(0xe3));
+
+        std::string strText = FormatPerfStatsPrometheus();
+        EXPECT_NE(strText.find("# TYPE komodo_test_events_total counter\n"), std::string::npos);
+        EXPECT_NE(strText.find("# TYPE komodo_test_codes_seconds histogram\n"), std::string::npos);
+        EXPECT_NE(strText.find("komodo_test_codes_seconds_bucket{code=\"0xe3\",le=\"1e-06\"} 1\n"), std::string::npos);
+        EXPECT_NE(strText.find("komodo_test_codes_seconds_count{code=\"0x11\"} 1\n"), std::string::npos);
+        EXPECT_NE(strText.find("komodo_test_latency_seconds_bucket{le=\"+Inf\"}"), std::string::npos);
+        // One header per name, not per member
+        size_t nPos = strText.find("# TYPE komodo_test_codes_seconds");
+        EXPECT_EQ(strText.find("# TYPE komodo_test_codes_seconds", nPos + 1), std::string::npos);
+    }
+}
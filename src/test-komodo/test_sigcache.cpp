@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+#include "pubkey.h"
+#include "random.h"
+#include "script/sigcache.h"
+
+namespace TestSigCache {
+
+    class TestSigCache : public ::testing::Test {};
+
+    static std::vector<unsigned char> RandBytes(size_t nSize)
+    {
+        std::vector<unsigned char> vch(nSize);
+        GetRandBytes(vch.data(), vch.size());
+        return vch;
+    }
+
+    TEST(TestSigCache, signatures_and_conditions_are_kept_apart)
+    {
+        uint256 sighash = GetRandHash();
+        std::vector<unsigned char> vchSig = RandBytes(71), vchPubKey = RandBytes(33);
+        vchPubKey[0] = 0x02;
+        CPubKey pubkey(vchPubKey.begin(), vchPubKey.end());
+
+        CSignatureCacheStats before = GetSignatureCacheStats();
+        EXPECT_FALSE(GetCachedSignature(sighash, vchSig, pubkey));
+        CacheSignature(sighash, vchSig, pubkey);
+        EXPECT_TRUE(GetCachedSignature(sighash, vchSig, pubkey));
+        EXPECT_FALSE(GetCachedSignature(GetRandHash(), vchSig, pubkey));
+
+        // The same bytes under the crypto-condition tag are a different entry
+        EXPECT_FALSE(GetCachedCryptoCondition(sighash, vchSig, vchPubKey));
+        CacheCryptoCondition(sighash, vchSig, vchPubKey);
+        EXPECT_TRUE(GetCachedCryptoCondition(sighash, vchSig, vchPubKey));
+        EXPECT_FALSE(GetCachedCryptoCondition(sighash, vchPubKey, vchSig));
+
+        CSignatureCacheStats after = GetSignatureCacheStats();
+        EXPECT_EQ(after.nSigHits - before.nSigHits, 1u);
+        EXPECT_EQ(after.nSigMisses - before.nSigMisses, 2u);
+        EXPECT_EQ(after.nCCHits - before.nCCHits, 1u);
+        EXPECT_EQ(after.nCCMisses - before.nCCMisses, 2u);
+    }
+
+    TEST(TestSigCache, stays_within_capacity)
+    {
+        uint256 sighash = GetRandHash();
+        CPubKey pubkey;
+        size_t nMaxEntries = GetSignatureCacheStats().nMaxEntries;
+        std::vector<std::vector<unsigned char> > vSigs;
+        for (size_t i = 0; i < nMaxEntries * 3 / 2; i++) {
+            vSigs.push_back(RandBytes(71));
+            CacheSignature(sighash, vSigs.back(), pubkey);
+        }
+        CSignatureCacheStats stats = GetSignatureCacheStats();
+        EXPECT_LE(stats.nEntries, stats.nMaxEntries);
+
+        // Most of the latest entries survive eviction
+        int nHits = 0;
+        for (size_t i = vSigs.size() - 1000; i < vSigs.size(); i++)
+            nHits += GetCachedSignature(sighash, vSigs[i], pubkey);
+        EXPECT_GT(nHits, 900);
+    }
+}
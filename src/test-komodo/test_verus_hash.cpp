@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include "crypto/verus_hash.h"
+#include "random.h"
+
+#include <vector>
+
+namespace TestVerusHash {
+
+    class TestVerusHash : public ::testing::Test {};
+
+    // Lengths around the 32 byte block size, a block header with and without
+    // its solution, and an empty input, so lanes of one batch finish apart
+    static const size_t vLens[] = {0, 1, 31, 32, 33, 63, 64, 65, 100, 140, 1487, 2000, 96, 5};
+
+    static void ExpectBatchMatchesHash(size_t n)
+    {
+        std::vector<std::vector<unsigned char> > vInputs(n);
+        std::vector<const unsigned char*> vData(n);
+        std::vector<size_t> vSizes(n);
+        for (size_t i = 0; i < n; i++) {
+            vInputs[i].resize(vLens[i % (sizeof(vLens) / sizeof(vLens[0]))] + 1);
+            GetRandBytes(vInputs[i].data(), vInputs[i].size());
+            vData[i] = vInputs[i].data();
+            vSizes[i] = vInputs[i].size() - 1;
+        }
+        std::vector<unsigned char> vResults(n * 32 + 1);
+        CVerusHashV2::HashBatch(vResults.data(), vData.data(), vSizes.data(), n);
+        for (size_t i = 0; i < n; i++) {
+            unsigned char hash[32];
+            CVerusHashV2::Hash(hash, vData[i], vSizes[i]);
+            EXPECT_EQ(memcmp(hash, &vResults[i * 32], 32), 0) << "input " << i << " of " << n << ", " << vSizes[i] << " bytes";
+        }
+    }
+
+    static void ExpectBatchesMatchHash()
+    {
+        // Whole groups of four lanes, and groups with one to three left over
+        for (size_t n = 0; n <= 17; n++)
+            ExpectBatchMatchesHash(n);
+        ExpectBatchMatchesHash(2000);
+    }
+
+    TEST(TestVerusHash, batch_matches_hash_portable)
+    {
+        CVerusHashV2::init(false);
+        ExpectBatchesMatchHash();
+        CVerusHashV2::init();
+    }
+
+    TEST(TestVerusHash, batch_matches_hash_optimized)
+    {
+        if (!IsCPUVerusOptimized())
+            return;
+        CVerusHashV2::init(true);
+        ExpectBatchesMatchHash();
+        CVerusHashV2::init();
+    }
+
+    TEST(TestVerusHash, portable_matches_optimized)
+    {
+        if (!IsCPUVerusOptimized())
+            return;
+        std::vector<unsigned char> vInput(1487);
+        GetRandBytes(vInput.data(), vInput.size());
+        for (size_t nLen = 0; nLen <= vInput.size(); nLen += 37) {
+            unsigned char hashPortable[32], hashOptimized[32];
+            CVerusHashV2::init(false);
+            CVerusHashV2::Hash(hashPortable, vInput.data(), nLen);
+            CVerusHashV2::init(true);
+            CVerusHashV2::Hash(hashOptimized, vInput.data(), nLen);
+            EXPECT_EQ(memcmp(hashPortable, hashOptimized, 32), 0) << nLen << " bytes";
+        }
+        CVerusHashV2::init();
+    }
+}
@@ -36,6 +36,79 @@ int64_t nMockTime;
 extern uint32_t USE_EXTERNAL_PUBKEY;
 extern std::string NOTARY_PUBKEY;
 
+/*
+ * Point -datadir at a fresh directory, for tests that open databases
+ */
+void useTempDatadir()
+{
+    ClearDatadirCache();
+    auto pathTemp = GetTempPath() / strprintf("test_komodo_%li_%i", GetTime(), GetRand(100000));
+    if (ASSETCHAINS_SYMBOL[0])
+        pathTemp = pathTemp / strprintf("_%s", ASSETCHAINS_SYMBOL);
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+}
+
+
+CCoins newCoins(int nOutputs)
+{
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = 100;
+    coins.vout.resize(nOutputs);
+    for (int i = 0; i < nOutputs; i++) {
+        coins.vout[i].nValue = 1000 + i;
+        coins.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+    return coins;
+}
+
+
+/*
+ * A spend of a random outpoint, for blocks that are never validated
+ */
+CMutableTransaction newTx()
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout.hash = GetRandHash();
+    mtx.vin[0].prevout.n = 0;
+    mtx.vout.resize(1);
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    mtx.vout[0].nValue = 1000;
+    return mtx;
+}
+
+
+/*
+ * Coinbase plus nTx spends, with a random equihash-sized solution
+ */
+CBlock newBlock(int nTx)
+{
+    CBlock block;
+    block.nVersion = 4;
+    block.hashPrevBlock = GetRandHash();
+    block.nTime = GetTime();
+    block.nBits = 0x200f0f0f;
+    block.nSolution.resize(1344);
+    GetRandBytes(block.nSolution.data(), block.nSolution.size());
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << GetRand(1000000) << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    coinbase.vout[0].nValue = 3 * COIN;
+    block.vtx.push_back(coinbase);
+    for (int i = 0; i < nTx; i++)
+        block.vtx.push_back(newTx());
+
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+
 void setupChain()
 {
     SelectParams(CBaseChainParams::REGTEST);
@@ -52,12 +125,7 @@ void setupChain()
     UnloadBlockIndex();
 
     // Init blockchain
-    ClearDatadirCache();
-    auto pathTemp = GetTempPath() / strprintf("test_komodo_%li_%i", GetTime(), GetRand(100000));
-    if (ASSETCHAINS_SYMBOL[0])
-        pathTemp = pathTemp / strprintf("_%s", ASSETCHAINS_SYMBOL);
-    boost::filesystem::create_directories(pathTemp);
-    mapArgs["-datadir"] = pathTemp.string();
+    useTempDatadir();
     pblocktree = new CBlockTreeDB(1 << 20, true);
     CCoinsViewDB *pcoinsdbview = new CCoinsViewDB(1 << 23, true);
     pcoinsTip = new CCoinsViewCache(pcoinsdbview);
@@ -17,6 +17,10 @@ extern std::string notarySecret;
 extern CKey notaryKey;
 
 
+void useTempDatadir();
+CCoins newCoins(int nOutputs);
+CMutableTransaction newTx();
+CBlock newBlock(int nTx);
 void setupChain();
 void generateBlock(CBlock *block=NULL);
 bool acceptTx(const CTransaction tx, CValidationState &state);
@@ -40,6 +40,7 @@ static const char DB_SAPLING_ANCHOR = 'Z';
 static const char DB_NULLIFIER = 's';
 static const char DB_SAPLING_NULLIFIER = 'S';
 static const char DB_COINS = 'c';
+static const char DB_COIN = 'C';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_ADDRESSINDEX = 'd';
@@ -55,13 +56,86 @@ static const char DB_BEST_SAPLING_ANCHOR = 'z';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_COINS_LAYOUT = 'L';
+static const char DB_VERSION = 'V';
 
+namespace {
 
-CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
+/** Key of a per outpoint record; the index is big endian so a txid's outputs iterate in order */
+struct CoinKey {
+    uint256 txid;
+    uint32_t n;
+
+    CoinKey() : n(0) {}
+    CoinKey(const uint256 &txidIn, uint32_t nIn) : txid(txidIn), n(nIn) {}
+
+    template<typename Stream>
+    void Serialize(Stream &s) const {
+        ::Serialize(s, txid);
+        ser_writedata32be(s, n);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s) {
+        ::Unserialize(s, txid);
+        n = ser_readdata32be(s);
+    }
+};
+
+/** Value of a per outpoint record: the output and the CCoins header fields */
+struct CoinRecord {
+    int nVersion;
+    int nHeight;
+    bool fCoinBase;
+    CTxOut out;
+
+    CoinRecord() : nVersion(0), nHeight(0), fCoinBase(false) {}
+    CoinRecord(const CCoins &coins, uint32_t n) : nVersion(coins.nVersion), nHeight(coins.nHeight), fCoinBase(coins.fCoinBase), out(coins.vout[n]) {}
+
+    template<typename Stream>
+    void Serialize(Stream &s) const {
+        uint64_t nCode = (uint64_t)nHeight * 2 + (fCoinBase ? 1 : 0);
+        ::Serialize(s, VARINT(this->nVersion));
+        ::Serialize(s, VARINT(nCode));
+        ::Serialize(s, CTxOutCompressor(REF(out)));
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s) {
+        uint64_t nCode = 0;
+        ::Unserialize(s, VARINT(this->nVersion));
+        ::Unserialize(s, VARINT(nCode));
+        nHeight = nCode / 2;
+        fCoinBase = nCode & 1;
+        ::Unserialize(s, REF(CTxOutCompressor(out)));
+    }
+};
+
+/** Write the unspent outputs of coins as per outpoint records */
+void WriteOutpointCoins(CDBBatch &batch, const uint256 &txid, const CCoins &coins)
+{
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        if (!coins.vout[i].IsNull())
+            batch.Write(make_pair(DB_COIN, CoinKey(txid, i)), CoinRecord(coins, i));
+    }
+}
+
+}
+
+
+CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe), nLayout(COINS_LAYOUT_TXID), nVersion(0) {
+    unsigned char layout = COINS_LAYOUT_TXID;
+    if (db.Read(DB_COINS_LAYOUT, layout))
+        nLayout = layout;
+    db.Read(DB_VERSION, nVersion);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe), nLayout(COINS_LAYOUT_TXID), nVersion(0)
 {
+    unsigned char layout = COINS_LAYOUT_TXID;
+    if (db.Read(DB_COINS_LAYOUT, layout))
+        nLayout = layout;
+    db.Read(DB_VERSION, nVersion);
 }
 
 
@@ -105,12 +179,98 @@ bool CCoinsViewDB::GetNullifier(const uint256 &nf, ShieldedType type) const {
     return db.Read(make_pair(dbChar, nf), spent);
 }
 
+bool CCoinsViewDB::ReadOutpointCoins(const uint256 &txid, CCoins &coins) const {
+    coins.Clear();
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    pcursor->Seek(make_pair(DB_COIN, CoinKey(txid, 0)));
+    std::pair<char, CoinKey> key;
+    while (pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_COIN && key.second.txid == txid) {
+        CoinRecord record;
+        if (!pcursor->GetValue(record))
+            return error("%s: unable to read coin %s:%u", __func__, txid.ToString(), key.second.n);
+        coins.nVersion = record.nVersion;
+        coins.nHeight = record.nHeight;
+        coins.fCoinBase = record.fCoinBase;
+        if (coins.vout.size() <= key.second.n)
+            coins.vout.resize(key.second.n + 1);
+        coins.vout[key.second.n] = record.out;
+        pcursor->Next();
+    }
+    return !coins.vout.empty();
+}
+
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+    // While migrating, look at the old record first: migration only ever
+    // moves a transaction from 'c' to 'C', so it cannot slip between the reads
+    int layout = nLayout;
+    if (layout != COINS_LAYOUT_OUTPOINT && db.Read(make_pair(DB_COINS, txid), coins))
+        return true;
+    if (layout == COINS_LAYOUT_TXID)
+        return false;
+    return ReadOutpointCoins(txid, coins);
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+    int layout = nLayout;
+    if (layout != COINS_LAYOUT_OUTPOINT && db.Exists(make_pair(DB_COINS, txid)))
+        return true;
+    if (layout == COINS_LAYOUT_TXID)
+        return false;
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    pcursor->Seek(make_pair(DB_COIN, CoinKey(txid, 0)));
+    std::pair<char, CoinKey> key;
+    return pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_COIN && key.second.txid == txid;
+}
+
+bool CCoinsViewDB::StartCoinsMigration() {
+    LOCK(cs_layout);
+    if (nLayout != COINS_LAYOUT_TXID)
+        return true;
+    // Marks the chainstate as one a binary before CHAINSTATE_VERSION can't read
+    CDBBatch batch(db);
+    batch.Write(DB_VERSION, CHAINSTATE_VERSION);
+    batch.Write(DB_COINS_LAYOUT, (unsigned char)COINS_LAYOUT_MIGRATING);
+    if (!db.WriteBatch(batch, true))
+        return false;
+    nVersion = CHAINSTATE_VERSION;
+    nLayout = COINS_LAYOUT_MIGRATING;
+    return true;
+}
+
+bool CCoinsViewDB::MigrateCoins(size_t nMaxTxs, size_t &nMigrated, bool &fDone) {
+    LOCK(cs_layout);
+    nMigrated = 0;
+    fDone = nLayout == COINS_LAYOUT_OUTPOINT;
+    if (nLayout != COINS_LAYOUT_MIGRATING)
+        return true;
+
+    // Resume where the last step stopped; seeking from the start would
+    // skip over the tombstones of everything migrated so far every time
+    CDBBatch batch(db);
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, hashMigrateNext));
+    std::pair<char, uint256> key;
+    while (nMigrated < nMaxTxs && pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_COINS) {
+        CCoins coins;
+        if (!pcursor->GetValue(coins))
+            return error("%s: unable to read coins %s", __func__, key.second.ToString());
+        WriteOutpointCoins(batch, key.second, coins);
+        batch.Erase(key);
+        nMigrated++;
+        pcursor->Next();
+    }
+
+    if (nMigrated < nMaxTxs) {
+        batch.Write(DB_COINS_LAYOUT, (unsigned char)COINS_LAYOUT_OUTPOINT);
+        fDone = true;
+    } else {
+        hashMigrateNext = key.second; // erased by this batch, so the next Seek lands after it
+    }
+    if (!db.WriteBatch(batch))
+        return false;
+    if (fDone)
+        nLayout = COINS_LAYOUT_OUTPOINT;
+    return true;
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -139,9 +299,9 @@ uint256 CCoinsViewDB::GetBestAnchor(ShieldedType type) const {
     return hashBestAnchor;
 }
 
-void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char& dbChar)
+void BatchWriteNullifiers(CDBBatch& batch, const CNullifiersMap& mapToUse, const char& dbChar)
 {
-    for (CNullifiersMap::iterator it = mapToUse.begin(); it != mapToUse.end();) {
+    for (CNullifiersMap::const_iterator it = mapToUse.begin(); it != mapToUse.end(); it++) {
         if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
             if (!it->second.entered)
                 batch.Erase(make_pair(dbChar, it->first));
@@ -149,15 +309,13 @@ void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char&
                 batch.Write(make_pair(dbChar, it->first), true);
             // TODO: changed++? ... See comment in CCoinsViewDB::BatchWrite. If this is needed we could return an int
         }
-        CNullifiersMap::iterator itOld = it++;
-        mapToUse.erase(itOld);
     }
 }
 
 template<typename Map, typename MapIterator, typename MapEntry, typename Tree>
-void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
+void BatchWriteAnchors(CDBBatch& batch, const Map& mapToUse, const char& dbChar)
 {
-    for (MapIterator it = mapToUse.begin(); it != mapToUse.end();) {
+    for (MapIterator it = mapToUse.begin(); it != mapToUse.end(); it++) {
         if (it->second.flags & MapEntry::DIRTY) {
             if (!it->second.entered)
                 batch.Erase(make_pair(dbChar, it->first));
@@ -168,8 +326,6 @@ void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
             }
             // TODO: changed++?
         }
-        MapIterator itOld = it++;
-        mapToUse.erase(itOld);
     }
 }
 
@@ -181,24 +337,47 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
                               CAnchorsSaplingMap &mapSaplingAnchors,
                               CNullifiersMap &mapSproutNullifiers,
                               CNullifiersMap &mapSaplingNullifiers) {
+    LOCK(cs_layout);
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
-            else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+            const CCoins &coins = it->second.coins;
+            if (nLayout == COINS_LAYOUT_TXID) {
+                if (coins.IsPruned())
+                    batch.Erase(make_pair(DB_COINS, it->first));
+                else
+                    batch.Write(make_pair(DB_COINS, it->first), coins);
+            } else {
+                // Only touch the outputs that changed. A FRESH entry is not
+                // in the database yet, so there is nothing to compare with.
+                CCoins dbcoins;
+                if (!(it->second.flags & CCoinsCacheEntry::FRESH)) {
+                    if (nLayout == COINS_LAYOUT_MIGRATING && db.Read(make_pair(DB_COINS, it->first), dbcoins)) {
+                        batch.Erase(make_pair(DB_COINS, it->first));
+                        dbcoins.Clear(); // none of its outputs has a 'C' record yet
+                    } else {
+                        ReadOutpointCoins(it->first, dbcoins);
+                    }
+                }
+                bool fSameHeader = dbcoins.nHeight == coins.nHeight && dbcoins.fCoinBase == coins.fCoinBase && dbcoins.nVersion == coins.nVersion;
+                for (unsigned int i = 0; i < std::max(coins.vout.size(), dbcoins.vout.size()); i++) {
+                    bool fUnspent = i < coins.vout.size() && !coins.vout[i].IsNull();
+                    bool fOnDisk = i < dbcoins.vout.size() && !dbcoins.vout[i].IsNull();
+                    if (fUnspent && !(fOnDisk && fSameHeader && dbcoins.vout[i] == coins.vout[i]))
+                        batch.Write(make_pair(DB_COIN, CoinKey(it->first, i)), CoinRecord(coins, i));
+                    else if (!fUnspent && fOnDisk)
+                        batch.Erase(make_pair(DB_COIN, CoinKey(it->first, i)));
+                }
+            }
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
 
-    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry, SproutMerkleTree>(batch, mapSproutAnchors, DB_SPROUT_ANCHOR);
-    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR);
+    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::const_iterator, CAnchorsSproutCacheEntry, SproutMerkleTree>(batch, mapSproutAnchors, DB_SPROUT_ANCHOR);
+    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::const_iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR);
 
     ::BatchWriteNullifiers(batch, mapSproutNullifiers, DB_NULLIFIER);
     ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER);
@@ -214,6 +393,196 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
     return db.WriteBatch(batch);
 }
 
+CCoinsViewBackgroundFlush::CCoinsViewBackgroundFlush(CCoinsViewDB *dbIn) : CCoinsViewBacked(dbIn), db(dbIn), fWriteFailed(false) {}
+
+CCoinsViewBackgroundFlush::~CCoinsViewBackgroundFlush()
+{
+    WaitForWrite();
+}
+
+bool CCoinsViewBackgroundFlush::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
+    {
+        LOCK(cs);
+        if (pending) {
+            CAnchorsSproutMap::const_iterator it = pending->mapSproutAnchors.find(rt);
+            if (it != pending->mapSproutAnchors.end()) {
+                if (!it->second.entered)
+                    return false;
+                tree = it->second.tree;
+                return true;
+            }
+        }
+    }
+    return base->GetSproutAnchorAt(rt, tree);
+}
+
+bool CCoinsViewBackgroundFlush::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
+    {
+        LOCK(cs);
+        if (pending) {
+            CAnchorsSaplingMap::const_iterator it = pending->mapSaplingAnchors.find(rt);
+            if (it != pending->mapSaplingAnchors.end()) {
+                if (!it->second.entered)
+                    return false;
+                tree = it->second.tree;
+                return true;
+            }
+        }
+    }
+    return base->GetSaplingAnchorAt(rt, tree);
+}
+
+bool CCoinsViewBackgroundFlush::GetNullifier(const uint256 &nullifier, ShieldedType type) const {
+    {
+        LOCK(cs);
+        if (pending) {
+            const CNullifiersMap* mapToUse;
+            switch (type) {
+                case SPROUT:
+                    mapToUse = &pending->mapSproutNullifiers;
+                    break;
+                case SAPLING:
+                    mapToUse = &pending->mapSaplingNullifiers;
+                    break;
+                default:
+                    throw runtime_error("Unknown shielded type");
+            }
+            CNullifiersMap::const_iterator it = mapToUse->find(nullifier);
+            if (it != mapToUse->end())
+                return it->second.entered;
+        }
+    }
+    return base->GetNullifier(nullifier, type);
+}
+
+bool CCoinsViewBackgroundFlush::GetCoins(const uint256 &txid, CCoins &coins) const {
+    {
+        LOCK(cs);
+        if (pending) {
+            CCoinsMap::const_iterator it = pending->mapCoins.find(txid);
+            if (it != pending->mapCoins.end()) {
+                coins = it->second.coins;
+                return !coins.IsPruned();
+            }
+        }
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewBackgroundFlush::HaveCoins(const uint256 &txid) const {
+    {
+        LOCK(cs);
+        if (pending) {
+            CCoinsMap::const_iterator it = pending->mapCoins.find(txid);
+            if (it != pending->mapCoins.end())
+                return !it->second.coins.IsPruned();
+        }
+    }
+    return base->HaveCoins(txid);
+}
+
+uint256 CCoinsViewBackgroundFlush::GetBestBlock() const {
+    {
+        LOCK(cs);
+        if (pending && !pending->hashBlock.IsNull())
+            return pending->hashBlock;
+    }
+    return base->GetBestBlock();
+}
+
+uint256 CCoinsViewBackgroundFlush::GetBestAnchor(ShieldedType type) const {
+    {
+        LOCK(cs);
+        if (pending) {
+            uint256 hashAnchor;
+            switch (type) {
+                case SPROUT:
+                    hashAnchor = pending->hashSproutAnchor;
+                    break;
+                case SAPLING:
+                    hashAnchor = pending->hashSaplingAnchor;
+                    break;
+                default:
+                    throw runtime_error("Unknown shielded type");
+            }
+            if (!hashAnchor.IsNull())
+                return hashAnchor;
+        }
+    }
+    return base->GetBestAnchor(type);
+}
+
+bool CCoinsViewBackgroundFlush::BatchWrite(CCoinsMap &mapCoins,
+                                           const uint256 &hashBlock,
+                                           const uint256 &hashSproutAnchor,
+                                           const uint256 &hashSaplingAnchor,
+                                           CAnchorsSproutMap &mapSproutAnchors,
+                                           CAnchorsSaplingMap &mapSaplingAnchors,
+                                           CNullifiersMap &mapSproutNullifiers,
+                                           CNullifiersMap &mapSaplingNullifiers) {
+    LOCK(cs_write);
+    if (!WaitForWrite())
+        return false;
+
+    // Swapping leaves the caller with empty maps, which is what it
+    // expects after a BatchWrite, and costs nothing under cs_main
+    std::unique_ptr<CSnapshot> snapshot(new CSnapshot());
+    snapshot->mapCoins.swap(mapCoins);
+    snapshot->hashBlock = hashBlock;
+    snapshot->hashSproutAnchor = hashSproutAnchor;
+    snapshot->hashSaplingAnchor = hashSaplingAnchor;
+    snapshot->mapSproutAnchors.swap(mapSproutAnchors);
+    snapshot->mapSaplingAnchors.swap(mapSaplingAnchors);
+    snapshot->mapSproutNullifiers.swap(mapSproutNullifiers);
+    snapshot->mapSaplingNullifiers.swap(mapSaplingNullifiers);
+    {
+        LOCK(cs);
+        pending.swap(snapshot);
+    }
+    threadWrite = boost::thread(boost::bind(&CCoinsViewBackgroundFlush::ThreadWrite, this));
+    return true;
+}
+
+void CCoinsViewBackgroundFlush::ThreadWrite()
+{
+    RenameThread("komodo-coinsflush");
+    int64_t nStart = GetTimeMicros();
+    // Nothing else modifies the snapshot until it is released below
+    CSnapshot &snapshot = *pending;
+    bool fOk = false;
+    try {
+        fOk = db->BatchWrite(snapshot.mapCoins, snapshot.hashBlock, snapshot.hashSproutAnchor, snapshot.hashSaplingAnchor,
+                             snapshot.mapSproutAnchors, snapshot.mapSaplingAnchors, snapshot.mapSproutNullifiers, snapshot.mapSaplingNullifiers);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    if (!fOk) {
+        // Keep serving the snapshot, the database does not have it
+        LogPrintf("%s: failed to write %u transactions to the coin database\n", __func__, snapshot.mapCoins.size());
+        fWriteFailed = true;
+        return;
+    }
+    LogPrint("coindb", "Background flush of %u transactions done in %.2fms\n", snapshot.mapCoins.size(), 0.001 * (GetTimeMicros() - nStart));
+
+    LOCK(cs);
+    pending.reset();
+}
+
+bool CCoinsViewBackgroundFlush::WaitForWrite() const
+{
+    LOCK(cs_write);
+    if (threadWrite.joinable())
+        threadWrite.join();
+    return !fWriteFailed;
+}
+
+bool CCoinsViewBackgroundFlush::GetStats(CCoinsStats &stats) const {
+    // Statistics are read straight from the database
+    if (!WaitForWrite())
+        return false;
+    return base->GetStats(stats);
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, bool compression, int maxOpenFiles) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, compression, maxOpenFiles) {
 }
 
@@ -237,42 +606,73 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
+bool CBlockTreeDB::ReadDiskBlockIndex(const uint256 &blockhash, CDiskBlockIndex &dbindex) {
+    return Read(make_pair(DB_BLOCK_INDEX, blockhash), dbindex);
+}
+
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    boost::scoped_ptr<CDBIterator> pcursor, pcoincursor;
+    {
+        // An iterator reads the database as it was when it was made. No batch
+        // or migration step may land between the two, or a transaction moved
+        // by it would be counted twice or not at all.
+        LOCK(cs_layout);
+        pcursor.reset(const_cast<CDBWrapper*>(&db)->NewIterator());
+        // Per outpoint records, merged in txid order with the per transaction
+        // ones so the result is the same whatever the layout
+        pcoincursor.reset(const_cast<CDBWrapper*>(&db)->NewIterator());
+        stats.hashBlock = GetBestBlock();
+    }
     pcursor->Seek(DB_COINS);
+    pcoincursor->Seek(DB_COIN);
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
+    while (true) {
         boost::this_thread::interruption_point();
         std::pair<char, uint256> key;
+        std::pair<char, CoinKey> coinkey;
+        bool fTx = pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_COINS;
+        bool fCoin = pcoincursor->Valid() && pcoincursor->GetKey(coinkey) && coinkey.first == DB_COIN;
+        if (!fTx && !fCoin)
+            break;
         CCoins coins;
-        if (pcursor->GetKey(key) && key.first == DB_COINS) {
-            if (pcursor->GetValue(coins)) {
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + pcursor->GetValueSize();
-                ss << VARINT(0);
-            } else {
+        if (fTx && (!fCoin || key.second < coinkey.second.txid)) {
+            if (!pcursor->GetValue(coins))
                 return error("CCoinsViewDB::GetStats() : unable to read value");
-            }
+            stats.nSerializedSize += 32 + pcursor->GetValueSize();
+            pcursor->Next();
         } else {
-            break;
+            const uint256 txid = coinkey.second.txid;
+            do {
+                CoinRecord record;
+                if (!pcoincursor->GetValue(record))
+                    return error("CCoinsViewDB::GetStats() : unable to read value");
+                coins.nVersion = record.nVersion;
+                coins.nHeight = record.nHeight;
+                coins.fCoinBase = record.fCoinBase;
+                coins.vout.resize(coinkey.second.n + 1);
+                coins.vout[coinkey.second.n] = record.out;
+                pcoincursor->Next();
+            } while (pcoincursor->Valid() && pcoincursor->GetKey(coinkey) && coinkey.first == DB_COIN && coinkey.second.txid == txid);
+            // what the record would take up in the per transaction layout
+            stats.nSerializedSize += 32 + ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION);
         }
-        pcursor->Next();
+        stats.nTransactions++;
+        for (unsigned int i=0; i<coins.vout.size(); i++) {
+            const CTxOut &out = coins.vout[i];
+            if (!out.IsNull()) {
+                stats.nTransactionOutputs++;
+                ss << VARINT(i+1);
+                ss << out;
+                nTotalAmount += out.nValue;
+            }
+        }
+        ss << VARINT(0);
     }
     {
         LOCK(cs_main);
@@ -330,6 +730,37 @@ bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey,
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::WriteBlockIndexes(const std::vector<std::pair<uint256, CDiskTxPos> > &txIndex,
+                                     const std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                                     const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &addressUnspentIndex,
+                                     const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &spentIndex,
+                                     const uint256 &blockhash, unsigned int logicalTS) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=txIndex.begin(); it!=txIndex.end(); it++)
+        batch.Write(make_pair(DB_TXINDEX, it->first), it->second);
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=addressIndex.begin(); it!=addressIndex.end(); it++)
+        batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=addressUnspentIndex.begin(); it!=addressUnspentIndex.end(); it++) {
+        if (it->second.IsNull()) {
+            batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
+        } else {
+            batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
+        }
+    }
+    for (std::vector<std::pair<CSpentIndexKey,CSpentIndexValue> >::const_iterator it=spentIndex.begin(); it!=spentIndex.end(); it++) {
+        if (it->second.IsNull()) {
+            batch.Erase(make_pair(DB_SPENTINDEX, it->first));
+        } else {
+            batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
+        }
+    }
+    if (logicalTS != 0) {
+        batch.Write(make_pair(DB_TIMESTAMPINDEX, CTimestampIndexKey(logicalTS, blockhash)), 0);
+        batch.Write(make_pair(DB_BLOCKHASHINDEX, CTimestampBlockIndexKey(blockhash)), CTimestampBlockIndexValue(logicalTS));
+    }
+    return WriteBatch(batch);
+}
+
 bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
@@ -685,62 +1116,158 @@ bool CBlockTreeDB::blockOnchainActive(const uint256 &hash) {
     return true;
 }
 
+/**
+ * Decoding block index records and recomputing their header hashes is most
+ * of the work at startup, and every record is independent. Raw records are
+ * read off the cursor in chunks and decoded by a set of worker threads,
+ * then inserted into a pre-sized mapBlockIndex and linked to their parents
+ * in a second pass once every entry exists. mapBlockIndex itself is only
+ * touched from the calling thread.
+ */
+struct CBlockIndexRecord
+{
+    uint256 hash;
+    uint256 hashPrev;
+    std::vector<char> vchValue;
+    CBlockIndex* pindex;
+    std::string strError;
+
+    CBlockIndexRecord() : pindex(NULL) { }
+};
+
+static const size_t BLOCK_INDEX_LOAD_CHUNK = 16384;
+
+static void DecodeBlockIndexRecords(std::vector<CBlockIndexRecord>& vRecords, size_t nBegin, size_t nEnd)
+{
+    for (size_t i = nBegin; i < nEnd; i++) {
+        CBlockIndexRecord& record = vRecords[i];
+        CDiskBlockIndex diskindex;
+        try {
+            CDataStream ssValue(record.vchValue.data(), record.vchValue.data() + record.vchValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> diskindex;
+        } catch (const std::exception& e) {
+            record.strError = "failed to read value";
+            continue;
+        }
+        std::vector<char>().swap(record.vchValue);
+
+        // Consistency check: the header stored under this key has to hash to the key
+        if (diskindex.GetBlockHash() != record.hash) {
+            record.strError = strprintf("block header inconsistency detected: on-disk = %s, key = %s", diskindex.ToString(), record.hash.ToString());
+            continue;
+        }
+        record.hashPrev = diskindex.hashPrev;
+
+        // Construct block index object
+        CBlockIndex* pindexNew = new CBlockIndex();
+        pindexNew->SetHeight(diskindex.GetHeight());
+        pindexNew->nFile          = diskindex.nFile;
+        pindexNew->nDataPos       = diskindex.nDataPos;
+        pindexNew->nUndoPos       = diskindex.nUndoPos;
+        pindexNew->hashSproutAnchor     = diskindex.hashSproutAnchor;
+        pindexNew->nVersion       = diskindex.nVersion;
+        pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+        pindexNew->hashFinalSaplingRoot   = diskindex.hashFinalSaplingRoot;
+        pindexNew->nTime          = diskindex.nTime;
+        pindexNew->nBits          = diskindex.nBits;
+        pindexNew->nNonce         = diskindex.nNonce;
+        pindexNew->nStatus        = diskindex.nStatus;
+        pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
+        pindexNew->nTx            = diskindex.nTx;
+        pindexNew->nSproutValue   = diskindex.nSproutValue;
+        pindexNew->nSaplingValue  = diskindex.nSaplingValue;
+        pindexNew->segid          = diskindex.segid;
+        pindexNew->nNotaryPay     = diskindex.nNotaryPay;
+        // the solution is only needed again when serving headers, leave it on disk
+        if (fTrimSolutions)
+            pindexNew->fSolutionTrimmed = true;
+        else
+            pindexNew->nSolution.swap(diskindex.nSolution);
+        record.pindex = pindexNew;
+    }
+}
+
+static void DecodeBlockIndexChunk(std::vector<CBlockIndexRecord>& vRecords, int nThreads)
+{
+    size_t nPerThread = (vRecords.size() + nThreads - 1) / nThreads;
+    boost::thread_group workers;
+    for (int t = 1; t < nThreads && t * nPerThread < vRecords.size(); t++)
+        workers.create_thread(boost::bind(&DecodeBlockIndexRecords, boost::ref(vRecords), t * nPerThread, std::min(vRecords.size(), (t + 1) * nPerThread)));
+    DecodeBlockIndexRecords(vRecords, 0, std::min(vRecords.size(), nPerThread));
+    workers.join_all();
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
+    int64_t nStart = GetTimeMillis();
+    int nThreads = std::max(1, std::min(GetNumCores(), MAX_SCRIPTCHECK_THREADS));
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
 
-    // Load mapBlockIndex
-    while (pcursor->Valid()) {
+    // Load and decode every record
+    std::vector<std::pair<CBlockIndex*, uint256> > vLoaded;
+    std::vector<uint256> vHashes;
+    bool fDone = false;
+    while (!fDone) {
         boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->SetHeight(diskindex.GetHeight());
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->hashSproutAnchor     = diskindex.hashSproutAnchor;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->hashFinalSaplingRoot   = diskindex.hashFinalSaplingRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nSolution      = diskindex.nSolution;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
-                pindexNew->nTx            = diskindex.nTx;
-                pindexNew->nSproutValue   = diskindex.nSproutValue;
-                pindexNew->nSaplingValue  = diskindex.nSaplingValue;
-                pindexNew->segid          = diskindex.segid;
-                pindexNew->nNotaryPay     = diskindex.nNotaryPay;
-//fprintf(stderr,"loadguts ht.%d\n",pindexNew->GetHeight());
-                // Consistency checks
-                auto header = pindexNew->GetBlockHeader();
-                if (header.GetHash() != pindexNew->GetBlockHash())
-                    return error("LoadBlockIndex(): block header inconsistency detected: on-disk = %s, in-memory = %s",
-                                 diskindex.ToString(),  pindexNew->ToString());
-                if ( 0 ) // POW will be checked before any block is connected
-                {
-                    uint8_t pubkey33[33];
-                    komodo_index2pubkey33(pubkey33,pindexNew,pindexNew->GetHeight());
-                    if (!CheckProofOfWork(header,pubkey33,pindexNew->GetHeight(),Params().GetConsensus()))
-                        return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
-                }
-                pcursor->Next();
-            } else {
-                return error("LoadBlockIndex() : failed to read value");
+        std::vector<CBlockIndexRecord> vRecords;
+        vRecords.reserve(BLOCK_INDEX_LOAD_CHUNK);
+        while (vRecords.size() < BLOCK_INDEX_LOAD_CHUNK) {
+            std::pair<char, uint256> key;
+            if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX) {
+                fDone = true;
+                break;
             }
-        } else {
-            break;
+            vRecords.push_back(CBlockIndexRecord());
+            vRecords.back().hash = key.second;
+            pcursor->GetValueBytes(vRecords.back().vchValue);
+            pcursor->Next();
+        }
+        DecodeBlockIndexChunk(vRecords, nThreads);
+
+        std::string strError;
+        BOOST_FOREACH(CBlockIndexRecord& record, vRecords) {
+            if (record.pindex == NULL) {
+                if (strError.empty())
+                    strError = record.strError;
+                continue;
+            }
+            vLoaded.push_back(std::make_pair(record.pindex, record.hashPrev));
+            vHashes.push_back(record.hash);
         }
+        if (!strError.empty()) {
+            BOOST_FOREACH(const PAIRTYPE(CBlockIndex*, uint256)& item, vLoaded)
+                delete item.first;
+            return error("LoadBlockIndex(): %s", strError);
+        }
+    }
+    int64_t nDecoded = GetTimeMillis();
+
+    // Insert into mapBlockIndex
+    mapBlockIndex.reserve(mapBlockIndex.size() + vLoaded.size());
+    for (size_t i = 0; i < vLoaded.size(); i++) {
+        CBlockIndex* pindexNew = vLoaded[i].first;
+        std::pair<BlockMap::iterator, bool> ret = mapBlockIndex.insert(std::make_pair(vHashes[i], pindexNew));
+        if (!ret.second) {
+            // already referenced before the load, keep the existing object
+            if (ret.first->second != NULL) {
+                *ret.first->second = *pindexNew;
+                delete pindexNew;
+                pindexNew = vLoaded[i].first = ret.first->second;
+            } else ret.first->second = pindexNew;
+        }
+        pindexNew->phashBlock = &ret.first->first;
     }
+    std::vector<uint256>().swap(vHashes);
+
+    // Link to parents
+    BOOST_FOREACH(const PAIRTYPE(CBlockIndex*, uint256)& item, vLoaded)
+        item.first->pprev = InsertBlockIndex(item.second);
+
+    if (fStartupBench)
+        LogPrintf("startupbench: %s decoded %u entries on %d threads in %dms, indexed in %dms\n", __func__, vLoaded.size(), nThreads, nDecoded - nStart, GetTimeMillis() - nDecoded);
+    LogPrintf("%s: loaded %u block index entries in %dms%s\n", __func__, vLoaded.size(), GetTimeMillis() - nStart, fTrimSolutions ? ", solutions left on disk" : "");
 
     return true;
 }
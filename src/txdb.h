@@ -23,15 +23,21 @@
 
 #include "coins.h"
 #include "dbwrapper.h"
+#include "sync.h"
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 #include <univalue.h>
 
+#include <boost/thread/thread.hpp>
+
 class CBlockFileInfo;
 class CBlockIndex;
+class CDiskBlockIndex;
 struct CDiskTxPos;
 struct CAddressUnspentKey;
 struct CAddressUnspentValue;
@@ -53,12 +59,47 @@ static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
 
-/** CCoinsView backed by the coin database (chainstate/) */
+//! -coinsbyoutpoint default
+static const bool DEFAULT_COINS_BY_OUTPOINT = false;
+//! -backgroundflush default
+static const bool DEFAULT_BACKGROUND_FLUSH = true;
+
+/**
+ * Chainstate version, written once the chainstate changes in a way older
+ * binaries can't read: 1 for the per outpoint layout. Binaries from before
+ * the marker don't check it, so -reindex is their only way back.
+ */
+static const int CHAINSTATE_VERSION = 1;
+
+/** How the chainstate stores unspent outputs */
+enum CoinsLayout {
+    COINS_LAYOUT_TXID = 0,      //! one CCoins record per transaction
+    COINS_LAYOUT_MIGRATING = 1, //! per transaction records are being moved to per outpoint ones
+    COINS_LAYOUT_OUTPOINT = 2,  //! one record per unspent output
+};
+
+/**
+ * CCoinsView backed by the coin database (chainstate/).
+ *
+ * With the per outpoint layout each unspent output is its own record,
+ * keyed by txid and output index, so spending one output of a large
+ * fan-out transaction erases one small record instead of rewriting the
+ * whole CCoins. GetCoins still returns the transaction's outputs as one
+ * CCoins, so nothing above this class sees the difference.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+    std::atomic<int> nLayout;
+    int nVersion; //! 0 unless written
+    uint256 hashMigrateNext; //! txid the next MigrateCoins step starts at
+    mutable CCriticalSection cs_layout; //! serializes BatchWrite with migration steps
+
     CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    /** Read the per outpoint records of txid into coins */
+    bool ReadOutpointCoins(const uint256 &txid, CCoins &coins) const;
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -69,6 +110,7 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     uint256 GetBestAnchor(ShieldedType type) const;
+    //! Leaves the passed maps untouched, so they can be read while they are written
     bool BatchWrite(CCoinsMap &mapCoins,
                     const uint256 &hashBlock,
                     const uint256 &hashSproutAnchor,
@@ -78,6 +120,87 @@ public:
                     CNullifiersMap &mapSproutNullifiers,
                     CNullifiersMap &mapSaplingNullifiers);
     bool GetStats(CCoinsStats &stats) const;
+
+    int GetCoinsLayout() const { return nLayout; }
+    /** A version above CHAINSTATE_VERSION was written by a newer binary and can't be read */
+    int GetVersion() const { return nVersion; }
+    /** Switch a per transaction chainstate to per outpoint records, migrating in the background */
+    bool StartCoinsMigration();
+    /**
+     * Move up to nMaxTxs per transaction records to per outpoint records,
+     * setting fDone once none are left. Returns false on a write error.
+     */
+    bool MigrateCoins(size_t nMaxTxs, size_t &nMigrated, bool &fDone);
+};
+
+/**
+ * CCoinsView between pcoinsTip and the coin database that takes the
+ * chainstate write off the flushing thread. BatchWrite takes over the
+ * flushed maps by swapping them into a snapshot and returns; a worker
+ * thread then commits the snapshot, best block marker included, in one
+ * database batch. Until that batch is committed reads are answered from
+ * the snapshot first, so the emptied cache above never sees the older
+ * state on disk.
+ *
+ * One snapshot is written at a time: a flush that arrives while the
+ * previous one is still being written waits for it. While a write is
+ * running the snapshot is held in addition to the refilling cache, so
+ * memory use can briefly reach twice -dbcache.
+ */
+class CCoinsViewBackgroundFlush : public CCoinsViewBacked
+{
+private:
+    struct CSnapshot {
+        CCoinsMap mapCoins;
+        uint256 hashBlock;
+        uint256 hashSproutAnchor;
+        uint256 hashSaplingAnchor;
+        CAnchorsSproutMap mapSproutAnchors;
+        CAnchorsSaplingMap mapSaplingAnchors;
+        CNullifiersMap mapSproutNullifiers;
+        CNullifiersMap mapSaplingNullifiers;
+    };
+
+    CCoinsViewDB *db;
+
+    //! Guards the pointer to the snapshot being written, not its contents,
+    //! which stay untouched until the write is done
+    mutable CCriticalSection cs;
+    std::unique_ptr<CSnapshot> pending;
+    std::atomic<bool> fWriteFailed;
+
+    //! Serializes starting a write with waiting for one
+    mutable CCriticalSection cs_write;
+    mutable boost::thread threadWrite;
+
+    void ThreadWrite();
+    bool WaitForWrite() const;
+
+public:
+    CCoinsViewBackgroundFlush(CCoinsViewDB *dbIn);
+    ~CCoinsViewBackgroundFlush();
+
+    bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
+    bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    bool GetNullifier(const uint256 &nullifier, ShieldedType type) const;
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    uint256 GetBestBlock() const;
+    uint256 GetBestAnchor(ShieldedType type) const;
+    bool BatchWrite(CCoinsMap &mapCoins,
+                    const uint256 &hashBlock,
+                    const uint256 &hashSproutAnchor,
+                    const uint256 &hashSaplingAnchor,
+                    CAnchorsSproutMap &mapSproutAnchors,
+                    CAnchorsSaplingMap &mapSaplingAnchors,
+                    CNullifiersMap &mapSproutNullifiers,
+                    CNullifiersMap &mapSaplingNullifiers);
+    bool GetStats(CCoinsStats &stats) const;
+
+    /** Wait until the last flush is on disk. Returns false if writing it failed. */
+    bool Sync() { return WaitForWrite(); }
+    /** Whether a background write has failed; the node has to shut down then */
+    bool WriteFailed() const { return fWriteFailed; }
 };
 
 /** Access to the block database (blocks/index/) */
@@ -93,12 +216,19 @@ public:
     bool EraseBatchSync(const std::vector<const CBlockIndex*>& blockinfo);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool ReadLastBlockFile(int &nFile);
+    bool ReadDiskBlockIndex(const uint256 &blockhash, CDiskBlockIndex &dbindex);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
     bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
     bool UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect);
+    /** Write the index entries of a connected block in one batch; a logicalTS of 0 skips the timestamp index */
+    bool WriteBlockIndexes(const std::vector<std::pair<uint256, CDiskTxPos> > &txIndex,
+                           const std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                           const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &addressUnspentIndex,
+                           const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &spentIndex,
+                           const uint256 &blockhash, unsigned int logicalTS);
     bool UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect);
     bool ReadAddressUnspentIndex(uint160 addressHash, int type,
                                  std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
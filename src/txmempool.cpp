@@ -23,8 +23,10 @@
 #include "clientversion.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "komodo_defs.h"
 #include "main.h"
 #include "policy/fees.h"
+#include "script/cc.h"
 #include "streams.h"
 #include "timedata.h"
 #include "util.h"
@@ -37,7 +39,8 @@ using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry():
     nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0),
-    hadNoDependencies(false), spendsCoinbase(false)
+    hadNoDependencies(false), spendsCoinbase(false), nInterestDeadline(std::numeric_limits<int64_t>::max()),
+    fEvictionExempt(false)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
@@ -48,12 +51,18 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                                  bool _spendsCoinbase, uint32_t _nBranchId):
     tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
     hadNoDependencies(poolHasNoInputsOf),
-    spendsCoinbase(_spendsCoinbase), nBranchId(_nBranchId)
+    spendsCoinbase(_spendsCoinbase), nBranchId(_nBranchId), fEvictionExempt(false)
 {
     nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
     nModSize = tx.CalculateModifiedSize(nTxSize);
     nUsageSize = RecursiveDynamicUsage(tx);
     feeRate = CFeeRate(nFee, nTxSize);
+
+    // komodo_validate_interest rejects a KMD tx once its locktime falls
+    // KOMODO_MAXMEMPOOLTIME behind the tip's median time past + 777
+    if ( ASSETCHAINS_SYMBOL[0] == 0 && tx.nLockTime >= LOCKTIME_THRESHOLD )
+        nInterestDeadline = (int64_t)tx.nLockTime + KOMODO_MAXMEMPOOLTIME;
+    else nInterestDeadline = std::numeric_limits<int64_t>::max();
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -71,7 +80,7 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
 }
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), lastRollingFeeUpdate(0), blockSinceLastRollingFeeBump(false), rollingMinimumFeeRate(0)
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
@@ -118,8 +127,18 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // Used by main.cpp AcceptToMemoryPool(), which DOES do
     // all the appropriate checks.
     LOCK(cs);
-    mapTx.insert(entry);
-    const CTransaction& tx = mapTx.find(hash)->GetTx();
+    if (entry.IsEvictionExempt() && !HasExemptRoom(entry.GetTxSize())) {
+        // The exempt bytes are capped, past that it is an ordinary entry
+        CTxMemPoolEntry entryCapped(entry);
+        entryCapped.SetEvictionExempt(false);
+        mapTx.insert(entryCapped);
+    } else {
+        mapTx.insert(entry);
+    }
+    const CTxMemPoolEntry& entryAdded = *mapTx.find(hash);
+    if (entryAdded.IsEvictionExempt())
+        nExemptTxSize += entryAdded.GetTxSize();
+    const CTransaction& tx = entryAdded.GetTx();
     mapRecentlyAddedTx[tx.GetHash()] = &tx;
     nRecentlyAddedSequence += 1;
     if (!tx.IsCoinImport()) {
@@ -382,6 +401,8 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
             removed.push_back(tx);
             totalTxSize -= mapTx.find(hash)->GetTxSize();
             cachedInnerUsage -= mapTx.find(hash)->DynamicMemoryUsage();
+            if (mapTx.find(hash)->IsEvictionExempt())
+                nExemptTxSize -= mapTx.find(hash)->GetTxSize();
             mapTx.erase(hash);
             nTransactionsUpdated++;
             minerPolicyEstimator->removeTx(hash);
@@ -513,21 +534,32 @@ extern char ASSETCHAINS_SYMBOL[];
 
 void CTxMemPool::removeExpired(unsigned int nBlockHeight)
 {
-    CBlockIndex *tipindex;
-    // Remove expired txs from the mempool
+    // Remove expired txs from the mempool. Both expiry rules are read off
+    // ordered indexes of mapTx, so only entries past their deadline are visited.
     LOCK(cs);
     list<CTransaction> transactionsToRemove;
-    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++)
-    {
-        const CTransaction& tx = it->GetTx();
-        tipindex = chainActive.LastTip();
+    const indexed_transaction_set::nth_index<2>::type& byExpiry = mapTx.get<2>();
+    for (indexed_transaction_set::nth_index<2>::type::const_iterator it = byExpiry.begin(); it != byExpiry.end() && it->GetExpiryHeight() < nBlockHeight; it++)
+        transactionsToRemove.push_back(it->GetTx());
 
-        bool fInterestNotValidated = ASSETCHAINS_SYMBOL[0] == 0 && tipindex != 0 && komodo_validate_interest(tx,tipindex->GetHeight()+1,tipindex->GetMedianTimePast() + 777,0) < 0;
-        if (IsExpiredTx(tx, nBlockHeight) || fInterestNotValidated)
+    CBlockIndex *tipindex = chainActive.LastTip();
+    if ( ASSETCHAINS_SYMBOL[0] == 0 && tipindex != 0 )
+    {
+        // The deadline is a lower bound; komodo_validate_interest still has the
+        // final say, e.g. while rewinding or at the early KMD heights it exempts
+        const int32_t txheight = tipindex->GetHeight() + 1;
+        const uint32_t cmptime = tipindex->GetMedianTimePast() + 777;
+        const indexed_transaction_set::nth_index<3>::type& byDeadline = mapTx.get<3>();
+        for (indexed_transaction_set::nth_index<3>::type::const_iterator it = byDeadline.begin(); it != byDeadline.end() && it->GetInterestDeadline() < (int64_t)cmptime; it++)
         {
-            if (fInterestNotValidated && tipindex != 0)
-                LogPrintf("Removing interest violate txid.%s nHeight.%d nTime.%u vs locktime.%u\n",tx.GetHash().ToString(),tipindex->GetHeight()+1,tipindex->GetMedianTimePast() + 777,tx.nLockTime);
-            transactionsToRemove.push_back(tx);
+            const CTransaction& tx = it->GetTx();
+            if (IsExpiredTx(tx, nBlockHeight))
+                continue;
+            if (komodo_validate_interest(tx,txheight,cmptime,0) < 0)
+            {
+                LogPrintf("Removing interest violate txid.%s nHeight.%d nTime.%u vs locktime.%u\n",tx.GetHash().ToString(),txheight,cmptime,tx.nLockTime);
+                transactionsToRemove.push_back(tx);
+            }
         }
     }
     for (const CTransaction& tx : transactionsToRemove) {
@@ -562,6 +594,8 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
     }
     // After the txs in the new block have been removed from the mempool, update policy estimates
     minerPolicyEstimator->processBlock(nBlockHeight, entries, fCurrentEstimate);
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = true;
 }
 
 /**
@@ -591,8 +625,19 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    mapRecentlyAddedTx.clear();
+    mapSproutNullifiers.clear();
+    mapSaplingNullifiers.clear();
+    mapAddress.clear();
+    mapAddressInserted.clear();
+    mapSpent.clear();
+    mapSpentInserted.clear();
+    lastRollingFeeUpdate = GetTime();
+    blockSinceLastRollingFeeBump = false;
+    rollingMinimumFeeRate = 0;
     totalTxSize = 0;
     cachedInnerUsage = 0;
+    nExemptTxSize = 0;
     ++nTransactionsUpdated;
 }
 
@@ -752,6 +797,69 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
     return true;
 }
 
+bool CTxMemPoolSnapshot::GetEvalKey(const CTransaction& tx, uint16_t& key)
+{
+    std::vector<unsigned char> vopret;
+    if (tx.vout.size() < 2 || !GetOpReturnData(tx.vout.back().scriptPubKey, vopret) || vopret.size() < 2)
+        return false;
+    key = EvalKey(vopret[0], vopret[1]);
+    return true;
+}
+
+const std::vector<CTransactionRef>& CTxMemPoolSnapshot::GetEvalTxs(uint8_t evalcode, uint8_t funcid) const
+{
+    static const std::vector<CTransactionRef> empty;
+    std::map<uint16_t, std::vector<CTransactionRef> >::const_iterator it = mapEval.find(EvalKey(evalcode, funcid));
+    return it == mapEval.end() ? empty : it->second;
+}
+
+void CTxMemPoolSnapshot::GetEvalTxs(uint8_t evalcode, std::vector<CTransactionRef>& txs) const
+{
+    std::map<uint16_t, std::vector<CTransactionRef> >::const_iterator it = mapEval.lower_bound(EvalKey(evalcode, 0));
+    for (; it != mapEval.end() && (it->first >> 8) == evalcode; ++it)
+        txs.insert(txs.end(), it->second.begin(), it->second.end());
+}
+
+std::shared_ptr<const CTxMemPoolSnapshot> CTxMemPool::GetSnapshot() const
+{
+    LOCK(cs);
+    if (snapshot && snapshot->nVersion == nTransactionsUpdated)
+        return snapshot;
+
+    std::shared_ptr<CTxMemPoolSnapshot> next = std::make_shared<CTxMemPoolSnapshot>();
+    next->nVersion = nTransactionsUpdated;
+    for (indexed_transaction_set::const_iterator mi = mapTx.begin(); mi != mapTx.end(); ++mi)
+    {
+        const CTransaction& tx = mi->GetTx();
+        const uint256& hash = tx.GetHash();
+        CTransactionRef ptx;
+        if (snapshot) {
+            std::map<uint256, CTransactionRef>::const_iterator prev = snapshot->mapTx.find(hash);
+            if (prev != snapshot->mapTx.end())
+                ptx = prev->second;
+        }
+        if (!ptx)
+            ptx = std::make_shared<const CTransaction>(tx);
+        next->mapTx.insert(next->mapTx.end(), std::make_pair(hash, ptx));
+        uint16_t key;
+        if (CTxMemPoolSnapshot::GetEvalKey(tx, key))
+            next->mapEval[key].push_back(ptx);
+    }
+    snapshot = next;
+    return snapshot;
+}
+
+bool CTxMemPool::getSpender(const COutPoint& outpoint, uint256& spendtxid, int32_t& spendvin) const
+{
+    LOCK(cs);
+    std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.find(outpoint);
+    if (it == mapNextTx.end())
+        return false;
+    spendtxid = it->second.ptx->GetHash();
+    spendvin = it->second.n;
+    return true;
+}
+
 CFeeRate CTxMemPool::estimateFee(int nBlocks) const
 {
     LOCK(cs);
@@ -914,6 +1022,176 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    // Estimate the overhead of mapTx to be 6 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 6 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + cachedInnerUsage;
+    // Estimate the overhead of mapTx to be 12 pointers (3 for each of its 4 ordered indexes) + an allocation, as no exact formula for boost::multi_index_contained is implemented.
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) +
+        memusage::DynamicUsage(mapRecentlyAddedTx) + memusage::DynamicUsage(mapSproutNullifiers) + memusage::DynamicUsage(mapSaplingNullifiers) +
+        memusage::DynamicUsage(mapAddress) + memusage::DynamicUsage(mapAddressInserted) + memusage::DynamicUsage(mapSpent) + memusage::DynamicUsage(mapSpentInserted) +
+        cachedInnerUsage;
+}
+
+int32_t komodo_is_notarytx(const CTransaction& tx);
+int32_t komodo_notaries(uint8_t pubkeys[64][33],int32_t height,uint32_t timestamp);
+
+bool CTxMemPool::IsSignedNotarisation(const CTransaction& tx, const CCoinsViewCache& view, int32_t nHeight, uint32_t nTime)
+{
+    // komodo_is_notarytx compares the 33 bytes after the first script byte,
+    // which anyone can pay to, so the signers are what counts
+    if (tx.vout.size() == 0 || tx.vout[0].scriptPubKey.size() < 34 || komodo_is_notarytx(tx) != 1)
+        return false;
+    std::vector<const CScript*> vSigners;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+        if (coins == NULL || !coins->IsAvailable(txin.prevout.n))
+            continue;
+        const CScript& script = coins->vout[txin.prevout.n].scriptPubKey;
+        if (script.size() == 35 && script[0] == 33 && script[34] == OP_CHECKSIG)
+            vSigners.push_back(&script);
+    }
+    if (vSigners.empty())
+        return false;
+
+    uint8_t notarypubkeys[64][33] = {0};
+    int32_t numSN = komodo_notaries(notarypubkeys, nHeight, nTime);
+    if (numSN <= 0 || notarypubkeys[0][0] == 0)
+        return false;
+    std::set<int32_t> setNotaries;
+    BOOST_FOREACH(const CScript* pscript, vSigners) {
+        for (int32_t i = 0; i < numSN; i++) {
+            if (memcmp(&(*pscript)[1], notarypubkeys[i], 33) == 0) {
+                setNotaries.insert(i);
+                break;
+            }
+        }
+    }
+    return setNotaries.size() >= std::max<size_t>(numSN / 5, 1);
+}
+
+bool CTxMemPool::HasExemptRoom(size_t nSize) const
+{
+    LOCK(cs);
+    return nExemptTxSize + nSize <= MAX_EXEMPT_TX_SIZE;
+}
+
+bool CTxMemPool::CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants) const
+{
+    LOCK(cs);
+    indexed_transaction_set::const_iterator itRoot = mapTx.find(hash);
+    bool fEvictable = itRoot == mapTx.end() || !itRoot->IsEvictionExempt();
+    std::deque<uint256> queue;
+    queue.push_back(hash);
+    setDescendants.insert(hash);
+    while (!queue.empty())
+    {
+        uint256 txid = queue.front();
+        queue.pop_front();
+        // mapNextTx is ordered by outpoint, so the spends of txid are adjacent
+        for (std::map<COutPoint, CInPoint>::const_iterator iter = mapNextTx.lower_bound(COutPoint(txid, 0));
+             iter != mapNextTx.end() && iter->first.hash == txid; ++iter)
+        {
+            const uint256& spender = iter->second.ptx->GetHash();
+            if (setDescendants.insert(spender).second)
+                queue.push_back(spender);
+        }
+    }
+    return fEvictable;
+}
+
+void CTxMemPool::trackPackageRemoved(const CFeeRate& rate)
+{
+    AssertLockHeld(cs);
+    if (rate.GetFeePerK() > rollingMinimumFeeRate) {
+        rollingMinimumFeeRate = rate.GetFeePerK();
+        blockSinceLastRollingFeeBump = false;
+    }
+}
+
+CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const
+{
+    LOCK(cs);
+    if (!blockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0)
+        return CFeeRate(llround(rollingMinimumFeeRate));
+
+    int64_t time = GetTime();
+    if (time > lastRollingFeeUpdate + 10) {
+        double halflife = ROLLING_FEE_HALFLIFE;
+        size_t usage = DynamicMemoryUsage();
+        if (usage < sizelimit / 4)
+            halflife /= 4;
+        else if (usage < sizelimit / 2)
+            halflife /= 2;
+
+        rollingMinimumFeeRate = rollingMinimumFeeRate / pow(2.0, (time - lastRollingFeeUpdate) / halflife);
+        lastRollingFeeUpdate = time;
+
+        if (rollingMinimumFeeRate < std::max<double>(::minRelayTxFee.GetFeePerK() / 2, 1)) {
+            rollingMinimumFeeRate = 0;
+            return CFeeRate(0);
+        }
+    }
+    return std::max(CFeeRate(llround(rollingMinimumFeeRate)), ::minRelayTxFee);
+}
+
+void CTxMemPool::TrimToSize(size_t sizelimit)
+{
+    LOCK(cs);
+    unsigned int nTxnRemoved = 0;
+    CFeeRate maxFeeRateRemoved(0);
+    while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit)
+    {
+        // Walk up from the lowest individual fee rate. A package never scores
+        // below its root's own rate, so the walk stops as soon as the next
+        // root pays more than the best package found so far.
+        const indexed_transaction_set::nth_index<1>::type& byFeeRate = mapTx.get<1>();
+        std::set<uint256> setEvict;
+        CFeeRate evictRate;
+        bool fFound = false;
+        int nScanned = 0;
+        for (indexed_transaction_set::nth_index<1>::type::const_reverse_iterator it = byFeeRate.rbegin();
+             it != byFeeRate.rend() && nScanned < TRIM_SCAN_LIMIT; ++it)
+        {
+            if (fFound && evictRate < it->GetFeeRate())
+                break;
+            // Exempt entries are stepped over without counting, or a run of
+            // them at the bottom would keep the pool over its limit
+            std::set<uint256> setPackage;
+            if (!CalculateDescendants(it->GetTx().GetHash(), setPackage))
+                continue;
+            nScanned++;
+            CAmount nPackageFees = 0;
+            size_t nPackageSize = 0;
+            BOOST_FOREACH(const uint256& txid, setPackage) {
+                indexed_transaction_set::const_iterator entry = mapTx.find(txid);
+                nPackageFees += entry->GetFee();
+                nPackageSize += entry->GetTxSize();
+                std::map<uint256, std::pair<double, CAmount> >::const_iterator delta = mapDeltas.find(txid);
+                if (delta != mapDeltas.end())
+                    nPackageFees += delta->second.second;
+            }
+            CFeeRate packageRate = std::max(it->GetFeeRate(), CFeeRate(std::max<CAmount>(nPackageFees, 0), nPackageSize));
+            if (!fFound || packageRate < evictRate) {
+                fFound = true;
+                evictRate = packageRate;
+                setEvict.swap(setPackage);
+            }
+        }
+        if (!fFound)
+            break; // only exempt transactions are left to look at
+
+        // Newcomers have to beat what was just evicted by at least the relay fee
+        CFeeRate removedRate(evictRate.GetFeePerK() + ::minRelayTxFee.GetFeePerK());
+        trackPackageRemoved(removedRate);
+        if (removedRate > maxFeeRateRemoved)
+            maxFeeRateRemoved = removedRate;
+
+        BOOST_FOREACH(const uint256& txid, setEvict) {
+            indexed_transaction_set::const_iterator entry = mapTx.find(txid);
+            if (entry == mapTx.end())
+                continue;
+            std::list<CTransaction> removed;
+            remove(entry->GetTx(), removed, true);
+            nTxnRemoved += removed.size();
+        }
+    }
+    if (nTxnRemoved > 0)
+        LogPrint("mempool", "Removed %u txn, rolling minimum fee bumped to %s\n", nTxnRemoved, maxFeeRateRemoved.ToString());
 }
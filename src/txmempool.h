@@ -22,6 +22,7 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "addressindex.h"
 #include "spentindex.h"
@@ -69,6 +70,8 @@ private:
     bool hadNoDependencies; //! Not dependent on any other txs when it entered the mempool
     bool spendsCoinbase; //! keep track of transactions that spend a coinbase
     uint32_t nBranchId; //! Branch ID this transaction is known to commit to, cached for efficiency
+    int64_t nInterestDeadline; //! Last tip median time past + 777 at which the KMD interest rule can still accept it
+    bool fEvictionExempt; //! A notarisation signed by enough notaries, never evicted for space
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -89,6 +92,11 @@ public:
 
     bool GetSpendsCoinbase() const { return spendsCoinbase; }
     uint32_t GetValidatedBranchId() const { return nBranchId; }
+    int64_t GetInterestDeadline() const { return nInterestDeadline; }
+    bool IsEvictionExempt() const { return fEvictionExempt; }
+    void SetEvictionExempt(bool fExempt) { fEvictionExempt = fExempt; }
+    /** Last block height the transaction can be mined at */
+    uint32_t GetExpiryHeight() const { return tx.nExpiryHeight == 0 ? std::numeric_limits<uint32_t>::max() : tx.nExpiryHeight; }
 };
 
 // extracts a TxMemPoolEntry's transaction hash
@@ -101,6 +109,26 @@ struct mempoolentry_txid
     }
 };
 
+// extracts the last height a TxMemPoolEntry's transaction can be mined at
+struct mempoolentry_expiry
+{
+    typedef uint32_t result_type;
+    result_type operator() (const CTxMemPoolEntry &entry) const
+    {
+        return entry.GetExpiryHeight();
+    }
+};
+
+// extracts the time after which a TxMemPoolEntry's transaction fails the KMD interest rule
+struct mempoolentry_interest_deadline
+{
+    typedef int64_t result_type;
+    result_type operator() (const CTxMemPoolEntry &entry) const
+    {
+        return entry.GetInterestDeadline();
+    }
+};
+
 class CompareTxMemPoolEntryByFee
 {
 public:
@@ -128,6 +156,30 @@ public:
     size_t DynamicMemoryUsage() const { return 0; }
 };
 
+/**
+ * Read-only copy of the mempool for CC code. Transactions are held by
+ * shared pointer and indexed by the evalcode and funcid at the start of their
+ * opret, so RPCs can look through the mempool without holding mempool.cs and
+ * without copying transactions. Consecutive snapshots share the transactions
+ * they have in common.
+ */
+class CTxMemPoolSnapshot
+{
+public:
+    unsigned int nVersion; //! GetTransactionsUpdated() when taken
+    std::map<uint256, CTransactionRef> mapTx;
+    std::map<uint16_t, std::vector<CTransactionRef> > mapEval; //! (evalcode << 8) | funcid
+
+    CTxMemPoolSnapshot() : nVersion(0) { }
+
+    static uint16_t EvalKey(uint8_t evalcode, uint8_t funcid) { return ((uint16_t)evalcode << 8) | funcid; }
+    static bool GetEvalKey(const CTransaction& tx, uint16_t& key);
+
+    const std::vector<CTransactionRef>& GetEvalTxs(uint8_t evalcode, uint8_t funcid) const;
+    //! Every transaction indexed under evalcode, whatever its funcid
+    void GetEvalTxs(uint8_t evalcode, std::vector<CTransactionRef>& txs) const;
+};
+
 /**
  * CTxMemPool stores valid-according-to-the-current-best-chain
  * transactions that may be included in the next block.
@@ -147,15 +199,23 @@ private:
 
     uint64_t totalTxSize = 0; //! sum of all mempool tx' byte sizes
     uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+    uint64_t nExemptTxSize = 0; //! sum of the byte sizes of the entries exempt from eviction
 
     std::map<uint256, const CTransaction*> mapRecentlyAddedTx;
     uint64_t nRecentlyAddedSequence = 0;
     uint64_t nNotifiedSequence = 0;
 
+    mutable std::shared_ptr<const CTxMemPoolSnapshot> snapshot; //! last snapshot handed out
+
     std::map<uint256, const CTransaction*> mapSproutNullifiers;
     std::map<uint256, const CTransaction*> mapSaplingNullifiers;
 
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! fee rate of the last package evicted by TrimToSize, decaying over time
+
     void checkNullifiers(ShieldedType type) const;
+    void trackPackageRemoved(const CFeeRate& rate);
     
 public:
     typedef boost::multi_index_container<
@@ -167,7 +227,11 @@ public:
             boost::multi_index::ordered_non_unique<
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByFee
-            >
+            >,
+            // sorted by expiry height
+            boost::multi_index::ordered_non_unique<mempoolentry_expiry>,
+            // sorted by interest deadline
+            boost::multi_index::ordered_non_unique<mempoolentry_interest_deadline>
         >
     > indexed_transaction_set;
 
@@ -221,6 +285,45 @@ public:
                         std::list<CTransaction>& conflicts, bool fCurrentEstimate = true);
     void removeWithoutBranchId(uint32_t nMemPoolBranchId);
     void clear();
+
+    /** Half-life of the minimum fee rate raised by TrimToSize, in seconds */
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12;
+    /** Most transactions TrimToSize scores when looking for the package to evict */
+    static const int TRIM_SCAN_LIMIT = 100;
+
+    /** Most bytes of entries exempt from eviction, later notarisations are treated like any other tx */
+    static const uint64_t MAX_EXEMPT_TX_SIZE = 2000000;
+
+    /**
+     * Whether tx is a notarisation signed by at least a fifth of the notaries
+     * of nHeight, checked the way the miner does: it pays CRYPTO777 and its
+     * inputs, looked up in view, spend distinct notary pubkey outputs.
+     * Entries of these are exempt from eviction while the pool has room for
+     * them under MAX_EXEMPT_TX_SIZE.
+     */
+    static bool IsSignedNotarisation(const CTransaction& tx, const CCoinsViewCache& view, int32_t nHeight, uint32_t nTime);
+    /** Whether nSize more bytes of exempt entries fit under MAX_EXEMPT_TX_SIZE */
+    bool HasExemptRoom(size_t nSize) const;
+
+    /**
+     * Collect the pool transactions that spend outputs of hash, directly or
+     * through other pool transactions, CC spends included. Returns false if
+     * hash itself is exempt from eviction; an exempt descendant goes along
+     * with the package rather than shield it.
+     */
+    bool CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants) const;
+
+    /**
+     * Evict the package with the lowest fee rate, together with everything
+     * spending from it, until the pool's memory usage is at most sizelimit.
+     * A package is scored by the greater of the root's own fee rate and that
+     * of the root with its descendants, so a parent paid for by its child is
+     * kept as long as the child.
+     */
+    void TrimToSize(size_t sizelimit);
+
+    /** Fee rate a new transaction must pay while the pool is, or recently was, full */
+    CFeeRate GetMinFee(size_t sizelimit) const;
     void queryHashes(std::vector<uint256>& vtxid);
     void pruneSpent(const uint256& hash, CCoins &coins);
     unsigned int GetTransactionsUpdated() const;
@@ -261,6 +364,12 @@ public:
 
     bool lookup(uint256 hash, CTransaction& result) const;
 
+    /** Current contents for CC code, rebuilt only after the mempool has changed */
+    std::shared_ptr<const CTxMemPoolSnapshot> GetSnapshot() const;
+
+    /** Find the mempool transaction spending an output, if any */
+    bool getSpender(const COutPoint& outpoint, uint256& spendtxid, int32_t& spendvin) const;
+
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
 
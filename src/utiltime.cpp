@@ -13,6 +13,12 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/thread.hpp>
 
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
 using namespace std;
 
 static int64_t nMockTime = 0;  //! For unit testing
@@ -41,6 +47,24 @@ int64_t GetTimeMicros()
             std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
+int64_t GetProcessCPUMicros()
+{
+#ifdef WIN32
+    FILETIME ftCreation, ftExit, ftKernel, ftUser;
+    if (!GetProcessTimes(GetCurrentProcess(), &ftCreation, &ftExit, &ftKernel, &ftUser))
+        return 0;
+    // In 100ns units
+    uint64_t nKernel = ((uint64_t)ftKernel.dwHighDateTime << 32) | ftKernel.dwLowDateTime;
+    uint64_t nUser = ((uint64_t)ftUser.dwHighDateTime << 32) | ftUser.dwLowDateTime;
+    return (nKernel + nUser) / 10;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return (int64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
 void MilliSleep(int64_t n)
 {
     boost::this_thread::sleep_for(boost::chrono::milliseconds(n));
@@ -12,6 +12,8 @@
 int64_t GetTime();
 int64_t GetTimeMillis();
 int64_t GetTimeMicros();
+/** CPU time used by all threads of the process so far */
+int64_t GetProcessCPUMicros();
 void SetMockTime(int64_t nMockTimeIn);
 void MilliSleep(int64_t n);
 
@@ -183,6 +183,10 @@ UniValue importprivkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
             + HelpExampleRpc("importprivkey", "\"mykey\", \"testing\", true, 1000")
         );
 
+    // The rescan releases cs_main between batches, so it runs outside this scope
+    CBlockIndex* pindexRescan = NULL;
+    CKeyID vchAddress;
+    {
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     EnsureWalletIsUnlocked();
@@ -218,7 +222,7 @@ UniValue importprivkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
 
     CPubKey pubkey = key.GetPubKey();
     assert(key.VerifyPubKey(pubkey));
-    CKeyID vchAddress = pubkey.GetID();
+    vchAddress = pubkey.GetID();
     {
         pwalletMain->MarkDirty();
         pwalletMain->SetAddressBook(vchAddress, strLabel, "receive");
@@ -237,9 +241,13 @@ UniValue importprivkey(const UniValue& params, bool fHelp, const CPubKey& mypk)
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
 
         if (fRescan) {
-            pwalletMain->ScanForWalletTransactions(chainActive[height], true);
+            pindexRescan = chainActive[height];
         }
     }
+    }
+
+    if (pindexRescan != NULL)
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
 
     return EncodeDestination(vchAddress);
 }
@@ -302,6 +310,9 @@ UniValue importaddress(const UniValue& params, bool fHelp, const CPubKey& mypk)
             + HelpExampleRpc("importaddress", "\"myaddress\", \"testing\", false")
         );
 
+    // The rescan releases cs_main between batches, so it runs outside this scope
+    bool fRescan = true;
+    {
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     CScript script;
@@ -321,7 +332,6 @@ UniValue importaddress(const UniValue& params, bool fHelp, const CPubKey& mypk)
         strLabel = params[1].get_str();
 
     // Whether to perform rescan after import
-    bool fRescan = true;
     if (params.size() > 2)
         fRescan = params[2].get_bool();
 
@@ -341,12 +351,13 @@ UniValue importaddress(const UniValue& params, bool fHelp, const CPubKey& mypk)
 
         if (!pwalletMain->AddWatchOnly(script))
             throw JSONRPCError(RPC_WALLET_ERROR, "Error adding address to wallet");
+    }
+    }
 
-        if (fRescan)
-        {
-            pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
-            pwalletMain->ReacceptWalletTransactions();
-        }
+    if (fRescan)
+    {
+        pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+        pwalletMain->ReacceptWalletTransactions();
     }
 
     return NullUniValue;
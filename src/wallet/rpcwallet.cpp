@@ -40,6 +40,7 @@
 #include "notaries_staked.h"
 
 #include "utiltime.h"
+#include "blockimport.h"
 #include "asyncrpcoperation.h"
 #include "asyncrpcqueue.h"
 #include "wallet/asyncrpcoperation_mergetoaddress.h"
@@ -3316,6 +3317,7 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp, const CPubKey& mypk)
             "  }\n"
             "  ...\n"
             "]\n"
+            "Benchmarks over an amount of data, like parseblockfile, also give its \"mbps\".\n"
             );
     }
 
@@ -3329,6 +3331,8 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp, const CPubKey& mypk)
     }
 
     std::vector<double> sample_times;
+    //! For benchmarks over an amount of data, the megabytes of each sample
+    std::vector<double> sample_megabytes;
 
     JSDescription samplejoinsplit;
 
@@ -3366,6 +3370,51 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp, const CPubKey& mypk)
 #endif
         } else if (benchmarktype == "verifyequihash") {
             sample_times.push_back(benchmark_verify_equihash());
+        } else if (benchmarktype == "verifyequihashbatch") {
+            // Headers per batch, a full headers message by default
+            int nHeaders = MAX_HEADERS_RESULTS;
+            if (params.size() >= 3) {
+                nHeaders = params[2].get_int();
+            }
+            if (nHeaders <= 0) {
+                throw JSONRPCError(RPC_TYPE_ERROR, "Invalid header count");
+            }
+            sample_times.push_back(benchmark_verify_equihash_batch(nHeaders));
+        } else if (benchmarktype == "verushashv2" || benchmarktype == "verushashv2batch") {
+            // Number of headers hashed per sample, one at a time or as a batch
+            int nHeaders = 10000;
+            if (params.size() >= 3) {
+                nHeaders = params[2].get_int();
+            }
+            if (nHeaders <= 0) {
+                throw JSONRPCError(RPC_TYPE_ERROR, "Invalid header count");
+            }
+            sample_times.push_back(benchmark_verus_hash_v2(nHeaders, benchmarktype == "verushashv2batch"));
+        } else if (benchmarktype == "getheaders" || benchmarktype == "getheaderscached") {
+            // Serializing one getheaders reply, built from the block index or from the header cache
+            sample_times.push_back(benchmark_getheaders(benchmarktype == "getheaderscached"));
+        } else if (benchmarktype == "parseblockfile") {
+            // Scanning and deserializing blk00000.dat as an import does, on the given number of threads
+            int nThreads = GetNumCores();
+            if (params.size() >= 3) {
+                nThreads = params[2].get_int();
+            }
+            if (nThreads <= 0) {
+                throw JSONRPCError(RPC_TYPE_ERROR, "Invalid thread count");
+            }
+            double dMegabytes = 0;
+            sample_times.push_back(benchmark_parse_block_file(0, std::min(nThreads, MAX_IMPORT_THREADS), dMegabytes));
+            sample_megabytes.push_back(dMegabytes);
+        } else if (benchmarktype == "replayblocks" || benchmarktype == "replayblocksassumevalid") {
+            // Connecting the last blocks of the chain again, with or without -assumevalidnotarized covering them
+            int nBlocks = 100;
+            if (params.size() >= 3) {
+                nBlocks = params[2].get_int();
+            }
+            if (nBlocks <= 0) {
+                throw JSONRPCError(RPC_TYPE_ERROR, "Invalid block count");
+            }
+            sample_times.push_back(benchmark_replay_blocks(nBlocks, benchmarktype == "replayblocksassumevalid"));
         } else if (benchmarktype == "validatelargetx") {
             // Number of inputs in the spending transaction that we will simulate
             int nInputs = 11130;
@@ -3411,9 +3460,11 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp, const CPubKey& mypk)
     }
 
     UniValue results(UniValue::VARR);
-    for (auto time : sample_times) {
+    for (size_t i = 0; i < sample_times.size(); i++) {
         UniValue result(UniValue::VOBJ);
-        result.push_back(Pair("runningtime", time));
+        result.push_back(Pair("runningtime", sample_times[i]));
+        if (i < sample_megabytes.size() && sample_times[i] > 0)
+            result.push_back(Pair("mbps", sample_megabytes[i] / sample_times[i]));
         results.push_back(result);
     }
 
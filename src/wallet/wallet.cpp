@@ -39,8 +39,11 @@
 #include "coins.h"
 #include "zcash/zip32.h"
 #include "cc/CCinclude.h"
+#include "blockfile.h"
+#include "blockfilter.h"
 
 #include <assert.h>
+#include <deque>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
@@ -582,6 +585,21 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
                        SaplingMerkleTree saplingTree,
                        bool added)
 {
+    {
+        LOCK(cs_wallet);
+        if (fRescanInProgress)
+        {
+            // Blocks above the rescan position are applied by the rescan itself
+            if (added && (pindexRescanLast == NULL || pindex->GetHeight() > pindexRescanLast->GetHeight()))
+                return;
+            if (!added)
+            {
+                if (pindex != pindexRescanLast)
+                    return;
+                pindexRescanLast = pindex->pprev;
+            }
+        }
+    }
     if (added) {
         IncrementNoteWitnesses(pindex, pblock, sproutTree, saplingTree);
     } else {
@@ -592,6 +610,10 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
 
 void CWallet::SetBestChain(const CBlockLocator& loc)
 {
+    LOCK(cs_wallet);
+    // A running rescan checkpoints its own position
+    if (fRescanInProgress)
+        return;
     CWalletDB walletdb(strWalletFile);
     SetBestChainINTERNAL(walletdb, loc);
 }
@@ -2867,18 +2889,258 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
     }
 }
 
+/** A block handed out by CRescanBlockReader */
+struct CRescanBlock
+{
+    CBlockIndex* pindex;
+    std::shared_ptr<const CBlock> pblock;
+    /** Set when only the header was loaded because this filter did not match */
+    std::shared_ptr<const CBlockFilter> pfilter;
+};
+
+/**
+ * Reads blocks from disk on a helper thread ahead of the wallet rescan, so
+ * that block deserialization overlaps with wallet processing. Blocks are
+ * handed back in the order they were requested. When a block filter index
+ * is available, blocks whose filter does not match the wallet elements are
+ * not read at all and come back header-only.
+ */
+class CRescanBlockReader
+{
+private:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    std::deque<CBlockIndex*> vPending;
+    std::deque<CRescanBlock> vReady;
+    std::shared_ptr<const BlockFilterElements> pelements;
+    size_t nMaxReady;
+    uint64_t nGeneration;
+    bool fReading;
+    bool fStop;
+    boost::thread thread;
+
+    void ThreadRead()
+    {
+        RenameThread("komodo-rescan");
+        while (true)
+        {
+            CRescanBlock entry;
+            std::shared_ptr<const BlockFilterElements> pfilterElements;
+            uint64_t nGen;
+            CBlockIndex* pindexNext;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (!fStop && (vPending.empty() || vReady.size() >= nMaxReady))
+                    cond.wait(lock);
+                if (fStop)
+                    return;
+                entry.pindex = vPending.front();
+                vPending.pop_front();
+                pindexNext = vPending.empty() ? NULL : vPending.front();
+                pfilterElements = pelements;
+                nGen = nGeneration;
+                fReading = true;
+            }
+            // Let the kernel page in the next block while this one is read
+            if (pindexNext != NULL)
+                blockFileCache.Prefetch(pindexNext->GetBlockPos());
+            if (pfilterElements && pblockfilterdb != NULL)
+            {
+                std::shared_ptr<CBlockFilter> pfilter(new CBlockFilter());
+                const uint256 hash = entry.pindex->GetBlockHash();
+                if (pblockfilterdb->ReadFilter(hash, *pfilter) && !pfilter->HasShielded() && !pfilter->MatchAny(hash, *pfilterElements))
+                {
+                    // Only the (empty) transaction list of a skipped block is
+                    // looked at, so its solution is not read back for it
+                    std::shared_ptr<CBlock> pheader(new CBlock());
+                    pheader->nVersion = entry.pindex->nVersion;
+                    pheader->hashPrevBlock = entry.pindex->pprev ? entry.pindex->pprev->GetBlockHash() : uint256();
+                    pheader->hashMerkleRoot = entry.pindex->hashMerkleRoot;
+                    pheader->hashFinalSaplingRoot = entry.pindex->hashFinalSaplingRoot;
+                    pheader->nTime = entry.pindex->nTime;
+                    pheader->nBits = entry.pindex->nBits;
+                    pheader->nNonce = entry.pindex->nNonce;
+                    entry.pblock = pheader;
+                    entry.pfilter = pfilter;
+                }
+            }
+            if (!entry.pblock)
+            {
+                std::shared_ptr<CBlock> pblock(new CBlock());
+                if (ReadBlockFromDisk(*pblock, entry.pindex, 1))
+                    entry.pblock = pblock;
+            }
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                fReading = false;
+                if (nGen == nGeneration)
+                    vReady.push_back(entry);
+                cond.notify_all();
+            }
+        }
+    }
+
+public:
+    CRescanBlockReader(size_t nMaxReadyIn) : nMaxReady(nMaxReadyIn), nGeneration(0), fReading(false), fStop(false)
+    {
+        thread = boost::thread(boost::bind(&CRescanBlockReader::ThreadRead, this));
+    }
+
+    ~CRescanBlockReader()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fStop = true;
+            cond.notify_all();
+        }
+        thread.join();
+    }
+
+    /** Wallet elements to match block filters against for blocks requested from now on */
+    void SetFilterElements(const BlockFilterElements& elements)
+    {
+        std::shared_ptr<const BlockFilterElements> pnew(new BlockFilterElements(elements));
+        boost::unique_lock<boost::mutex> lock(cs);
+        pelements = pnew;
+    }
+
+    void Request(CBlockIndex* pindex)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        vPending.push_back(pindex);
+        cond.notify_all();
+    }
+
+    /** Drop everything requested so far, e.g. after a reorg. */
+    void Reset()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        vPending.clear();
+        vReady.clear();
+        nGeneration++;
+        cond.notify_all();
+    }
+
+    /**
+     * Return the next block read ahead, which must be pindex. Falls back to
+     * a synchronous read if the queue holds something else or the read failed.
+     */
+    CRescanBlock Next(CBlockIndex* pindex)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (vReady.empty() && (fReading || !vPending.empty()))
+                cond.wait(lock);
+            if (!vReady.empty() && vReady.front().pindex == pindex && vReady.front().pblock)
+            {
+                CRescanBlock entry = vReady.front();
+                vReady.pop_front();
+                cond.notify_all();
+                return entry;
+            }
+        }
+        Reset();
+        return Read(pindex);
+    }
+
+    /** Read the full block synchronously */
+    static CRescanBlock Read(CBlockIndex* pindex)
+    {
+        CRescanBlock entry;
+        std::shared_ptr<CBlock> pblock(new CBlock());
+        ReadBlockFromDisk(*pblock, pindex, 1);
+        entry.pindex = pindex;
+        entry.pblock = pblock;
+        return entry;
+    }
+};
+
+/** Number of blocks processed under one acquisition of cs_main during a rescan */
+static const unsigned int RESCAN_BATCH_BLOCKS = 100;
+/** Number of blocks the rescan reader thread keeps deserialized ahead of the batch being processed */
+static const unsigned int RESCAN_READAHEAD_BLOCKS = 200;
+/** Minimum seconds between rescan progress checkpoints written to the wallet */
+static const int64_t RESCAN_CHECKPOINT_INTERVAL = 60;
+
+bool CWallet::IsRelevantForRescan(const CTransaction& tx, const std::set<uint256>& setBatchTxids)
+{
+    AssertLockHeld(cs_wallet);
+    if (mapWallet.count(tx.GetHash()))
+        return true;
+    // Shielded components need trial decryption and nullifier checks, so
+    // leave them to AddToWalletIfInvolvingMe.
+    if (!tx.vjoinsplit.empty() || !tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty())
+        return true;
+    if (!tx.IsCoinBase())
+    {
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            if (mapWallet.count(txin.prevout.hash) || setBatchTxids.count(txin.prevout.hash))
+                return true;
+        }
+    }
+    return IsMine(tx);
+}
+
+void CWallet::GetBlockFilterElements(BlockFilterElements& elements)
+{
+    AssertLockHeld(cs_wallet);
+    std::set<CKeyID> setKeys;
+    GetKeys(setKeys);
+    BOOST_FOREACH(const CKeyID& keyID, setKeys)
+    {
+        CScript script = GetScriptForDestination(keyID);
+        elements.insert(std::vector<unsigned char>(script.begin(), script.end()));
+        CPubKey pubkey;
+        if (GetPubKey(keyID, pubkey))
+        {
+            // pay-to-pubkey outputs, and cryptocondition outputs owned by this key
+            script = CScript() << ToByteVector(pubkey) << OP_CHECKSIG;
+            elements.insert(std::vector<unsigned char>(script.begin(), script.end()));
+            elements.insert(std::vector<unsigned char>(pubkey.begin(), pubkey.end()));
+        }
+    }
+    BOOST_FOREACH(const CScript& script, setWatchOnly)
+        elements.insert(std::vector<unsigned char>(script.begin(), script.end()));
+    for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); ++it)
+    {
+        CScript script = GetScriptForDestination(it->first);
+        elements.insert(std::vector<unsigned char>(script.begin(), script.end()));
+    }
+    // Spends of outputs we already know about
+    for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    {
+        const CWalletTx& wtx = it->second;
+        for (uint32_t i = 0; i < wtx.vout.size(); i++)
+        {
+            if (IsMine(wtx.vout[i]) != ISMINE_NO)
+                elements.insert(CBlockFilter::OutPointElement(it->first, i));
+        }
+    }
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ *
+ * Blocks are read ahead on a helper thread and processed in batches of
+ * RESCAN_BATCH_BLOCKS. cs_main is only held to apply a batch, and a
+ * transparent pre-filter runs under cs_wallet alone, so the node keeps
+ * validating while the rescan runs. Progress is checkpointed to the
+ * wallet so an interrupted rescan resumes on the next startup.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
     int64_t nNow = GetTime();
+    int64_t nLastCheckpoint = nNow;
     const CChainParams& chainParams = Params();
 
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart, dProgressTip;
+    bool fUseFilters = false;
+    BlockFilterElements filterElements;
 
     std::vector<uint256> myTxHashes;
 
@@ -2891,53 +3153,176 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
             pindex = chainActive.Next(pindex);
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.LastTip(), false);
-        while (pindex)
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.LastTip(), false);
+
+        fRescanInProgress = true;
+        pindexRescanLast = pindex ? pindex->pprev : chainActive.Tip();
+        if (pblockfilterdb != NULL)
+        {
+            fUseFilters = true;
+            GetBlockFilterElements(filterElements);
+        }
+        if (pindex && fFileBacked)
+        {
+            CWalletDB walletdb(strWalletFile);
+            walletdb.WriteRescanProgress(chainActive.GetLocator(pindex));
+        }
+    }
+
+    CRescanBlockReader reader(RESCAN_BATCH_BLOCKS + RESCAN_READAHEAD_BLOCKS);
+    if (fUseFilters)
+        reader.SetFilterElements(filterElements);
+    std::deque<CBlockIndex*> vRequested;
+    bool fDone = false;
+
+    while (!fDone)
+    {
+        // Queue up the blocks following the last one applied, resetting the
+        // reader if the chain moved under us.
+        {
+            LOCK2(cs_main, cs_wallet);
+            CBlockIndex* pindexNext = pindexRescanLast ? chainActive.Next(pindexRescanLast) : chainActive.Genesis();
+            if (pindexNext == NULL)
+            {
+                // Caught up with the tip: ChainTip has to take the next block
+                // from here, before cs_main is let go of
+                fRescanInProgress = false;
+                break;
+            }
+            if (!vRequested.empty() && (vRequested.front() != pindexNext || !chainActive.Contains(vRequested.back())))
+            {
+                reader.Reset();
+                vRequested.clear();
+            }
+            CBlockIndex* pindexRequest = vRequested.empty() ? pindexNext : chainActive.Next(vRequested.back());
+            while (pindexRequest && vRequested.size() < RESCAN_BATCH_BLOCKS + RESCAN_READAHEAD_BLOCKS)
+            {
+                reader.Request(pindexRequest);
+                vRequested.push_back(pindexRequest);
+                pindexRequest = chainActive.Next(pindexRequest);
+            }
+        }
+
+        std::vector<CRescanBlock> vBatch;
+        while (!vRequested.empty() && vBatch.size() < RESCAN_BATCH_BLOCKS)
         {
-            if (pindex->GetHeight() % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+            vBatch.push_back(reader.Next(vRequested.front()));
+            vRequested.pop_front();
+        }
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex,1);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+        // Transparent pre-filter, without cs_main
+        std::vector<std::vector<size_t> > vRelevant(vBatch.size());
+        size_t nFilterElements = filterElements.size();
+        {
+            LOCK(cs_wallet);
+            std::set<uint256> setBatchTxids;
+            for (size_t i = 0; i < vBatch.size(); i++)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate)) {
-                    myTxHashes.push_back(tx.GetHash());
-                    ret++;
+                // A block skipped by its filter may spend outputs found since the
+                // reader looked at it
+                if (vBatch[i].pfilter && vBatch[i].pfilter->MatchAny(vBatch[i].pindex->GetBlockHash(), filterElements))
+                    vBatch[i] = CRescanBlockReader::Read(vBatch[i].pindex);
+
+                const CBlock& block = *vBatch[i].pblock;
+                for (size_t j = 0; j < block.vtx.size(); j++)
+                {
+                    const CTransaction& tx = block.vtx[j];
+                    if (IsRelevantForRescan(tx, setBatchTxids))
+                    {
+                        vRelevant[i].push_back(j);
+                        setBatchTxids.insert(tx.GetHash());
+                        if (fUseFilters)
+                        {
+                            for (uint32_t n = 0; n < tx.vout.size(); n++)
+                                filterElements.insert(CBlockFilter::OutPointElement(tx.GetHash(), n));
+                        }
+                    }
                 }
             }
+        }
+        if (fUseFilters && filterElements.size() != nFilterElements)
+            reader.SetFilterElements(filterElements);
 
-            SproutMerkleTree sproutTree;
-            SaplingMerkleTree saplingTree;
-            // This should never fail: we should always be able to get the tree
-            // state on the path to the tip of our chain
-            assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
-            if (pindex->pprev) {
-                if (NetworkUpgradeActive(pindex->pprev->GetHeight(), Params().GetConsensus(), Consensus::UPGRADE_SAPLING)) {
-                    assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+        {
+            LOCK2(cs_main, cs_wallet);
+            for (size_t i = 0; i < vBatch.size(); i++)
+            {
+                pindex = vBatch[i].pindex;
+                // A reorg moved the chain away from what was read ahead
+                if (pindex != (pindexRescanLast ? chainActive.Next(pindexRescanLast) : chainActive.Genesis()))
+                    break;
+
+                if (pindex->GetHeight() % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                    ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+
+                const CBlock& block = *vBatch[i].pblock;
+                BOOST_FOREACH(size_t j, vRelevant[i])
+                {
+                    const CTransaction& tx = block.vtx[j];
+                    if (AddToWalletIfInvolvingMe(tx, &block, fUpdate)) {
+                        myTxHashes.push_back(tx.GetHash());
+                        ret++;
+                    }
+                }
+
+                SproutMerkleTree sproutTree;
+                SaplingMerkleTree saplingTree;
+                // This should never fail: we should always be able to get the tree
+                // state on the path to the tip of our chain
+                assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
+                if (pindex->pprev) {
+                    if (NetworkUpgradeActive(pindex->pprev->GetHeight(), Params().GetConsensus(), Consensus::UPGRADE_SAPLING)) {
+                        assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+                    }
+                }
+                // Increment note witness caches
+                pindexRescanLast = pindex;
+                ChainTip(pindex, &block, sproutTree, saplingTree, true);
+
+                if (GetTime() >= nNow + 60) {
+                    nNow = GetTime();
+                    LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->GetHeight(), Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
                 }
             }
-            // Increment note witness caches
-            ChainTip(pindex, &block, sproutTree, saplingTree, true);
 
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->GetHeight(), Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+            if (ShutdownRequested())
+            {
+                LogPrintf("Rescan interrupted at block %d, it will resume on the next start\n", pindexRescanLast ? pindexRescanLast->GetHeight() : 0);
+                fDone = true;
+            }
+            if ((fDone || GetTime() >= nLastCheckpoint + RESCAN_CHECKPOINT_INTERVAL) && pindexRescanLast && fFileBacked)
+            {
+                // Commit the wallet state reached so far, so a restart resumes from here
+                nLastCheckpoint = GetTime();
+                CBlockLocator locator = chainActive.GetLocator(pindexRescanLast);
+                CWalletDB walletdb(strWalletFile);
+                SetBestChainINTERNAL(walletdb, locator);
+                walletdb.WriteRescanProgress(locator);
+                myTxHashes.clear();
             }
         }
+    }
+
+    {
+        LOCK2(cs_main, cs_wallet);
+        fRescanInProgress = false;
 
-        // After rescanning, persist Sapling note data that might have changed, e.g. nullifiers.
-        // Do not flush the wallet here for performance reasons.
-        CWalletDB walletdb(strWalletFile, "r+", false);
-        for (auto hash : myTxHashes) {
-            CWalletTx wtx = mapWallet[hash];
-            if (!wtx.mapSaplingNoteData.empty()) {
-                if (!wtx.WriteToDisk(&walletdb)) {
-                    LogPrintf("Rescanning... WriteToDisk failed to update Sapling note data for: %s\n", hash.ToString());
+        if (fFileBacked)
+        {
+            // After rescanning, persist Sapling note data that might have changed, e.g. nullifiers.
+            // Do not flush the wallet here for performance reasons.
+            CWalletDB walletdb(strWalletFile, "r+", false);
+            for (auto hash : myTxHashes) {
+                CWalletTx wtx = mapWallet[hash];
+                if (!wtx.mapSaplingNoteData.empty()) {
+                    if (!wtx.WriteToDisk(&walletdb)) {
+                        LogPrintf("Rescanning... WriteToDisk failed to update Sapling note data for: %s\n", hash.ToString());
+                    }
                 }
             }
+            if (!ShutdownRequested())
+                walletdb.EraseRescanProgress();
         }
 
         ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
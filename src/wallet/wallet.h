@@ -808,6 +808,28 @@ protected:
      */
     void DecrementNoteWitnesses(const CBlockIndex* pindex);
 
+    /**
+     * While ScanForWalletTransactions is running with cs_main released
+     * between batches, this is the last block whose note witnesses have
+     * been applied by the rescan. ChainTip notifications above it are left
+     * to the rescan, and disconnects of it move it back.
+     */
+    bool fRescanInProgress;
+    const CBlockIndex* pindexRescanLast;
+
+    /**
+     * Cheap pre-check used by the rescan to skip transactions that cannot
+     * involve the wallet. setBatchTxids holds the txids already selected
+     * from the current batch, so chained spends are not missed.
+     */
+    bool IsRelevantForRescan(const CTransaction& tx, const std::set<uint256>& setBatchTxids);
+
+    /**
+     * Elements to look up in block filters during a rescan: our scripts,
+     * pubkeys (for cryptocondition outputs) and the outpoints of our outputs.
+     */
+    void GetBlockFilterElements(std::set<std::vector<unsigned char> >& elements);
+
     template <typename WalletDB>
     void SetBestChainINTERNAL(WalletDB& walletdb, const CBlockLocator& loc) {
         if (!walletdb.TxnBegin()) {
@@ -919,6 +941,8 @@ public:
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
         nWitnessCacheSize = 0;
+        fRescanInProgress = false;
+        pindexRescanLast = NULL;
     }
 
     /**
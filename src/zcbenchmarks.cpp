@@ -10,11 +10,13 @@
 #include "init.h"
 #include "primitives/transaction.h"
 #include "base58.h"
+#include "blockimport.h"
 #include "crypto/equihash.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
+#include "headercache.h"
 #include "main.h"
 #include "miner.h"
 #include "pow.h"
@@ -225,6 +227,157 @@ double benchmark_verify_equihash()
     return timer_stop(tv_start);
 }
 
+double benchmark_verify_equihash_batch(size_t nHeaders)
+{
+    // The same header over and over, so the cache has to stay out of it
+    CBlockHeader genesis_header = Params().GenesisBlock().GetBlockHeader();
+    std::vector<CBlockHeader> headers(nHeaders, genesis_header);
+    std::vector<const CBlockHeader*> vpheaders;
+    for (size_t i = 0; i < headers.size(); i++)
+        vpheaders.push_back(&headers[i]);
+    struct timeval tv_start;
+    timer_start(tv_start);
+    if (nScriptCheckThreads == 0) {
+        for (size_t i = 0; i < headers.size(); i++)
+            CheckEquihashSolutionUncached(&headers[i], Params());
+    } else {
+        CheckEquihashSolutions(vpheaders, false);
+    }
+    return timer_stop(tv_start);
+}
+
+double benchmark_verus_hash_v2(size_t nHeaders, bool fBatch)
+{
+    // Distinct full size headers, serialized up front so only hashing is timed
+    CBlockHeader header = Params().GenesisBlock().GetBlockHeader();
+    std::vector<CDataStream> vSerialized;
+    std::vector<const unsigned char*> vData;
+    std::vector<size_t> vLens;
+    for (size_t i = 0; i < nHeaders; i++) {
+        header.nNonce = ArithToUint256(arith_uint256(i));
+        vSerialized.push_back(CDataStream(SER_GETHASH, PROTOCOL_VERSION));
+        vSerialized.back() << header;
+    }
+    for (size_t i = 0; i < nHeaders; i++) {
+        vData.push_back((const unsigned char*)&vSerialized[i][0]);
+        vLens.push_back(vSerialized[i].size());
+    }
+    std::vector<unsigned char> vResults(nHeaders * 32);
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    if (fBatch) {
+        CVerusHashV2::HashBatch(vResults.data(), vData.data(), vLens.data(), nHeaders);
+    } else {
+        for (size_t i = 0; i < nHeaders; i++)
+            CVerusHashV2::Hash(&vResults[i * 32], vData[i], vLens[i]);
+    }
+    return timer_stop(tv_start);
+}
+
+double benchmark_getheaders(bool fCached)
+{
+    // One full headers message, a whole bucket of the header cache
+    const int nCount = CHeaderCache::BUCKET_SIZE;
+    if (chainActive.Height() < 2 * nCount - 1) {
+        throw JSONRPCError(RPC_MISC_ERROR, strprintf("Benchmark needs at least %d blocks", 2 * nCount - 1));
+    }
+    const CBlockIndex* pindexLast = chainActive[2 * nCount - 1];
+    if (fCached) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        headerCache.WriteHeaders(ss, pindexLast, nCount);
+    }
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    if (fCached) {
+        headerCache.WriteHeaders(ss, pindexLast, nCount);
+    } else {
+        // The way getheaders built its reply before the cache
+        std::vector<CNetworkBlockHeader> vHeaders(nCount);
+        const CBlockIndex* pindex = pindexLast;
+        for (int i = nCount - 1; i >= 0; i--, pindex = pindex->pprev)
+            vHeaders[i] = pindex->GetBlockHeader();
+        ss << vHeaders;
+    }
+    return timer_stop(tv_start);
+}
+
+double benchmark_parse_block_file(int nFile, int nThreads, double& dMegabytes)
+{
+    CDiskBlockPos pos(nFile, 0);
+    boost::filesystem::path path = GetBlockPosFilename(pos, "blk");
+    if (!boost::filesystem::exists(path)) {
+        throw JSONRPCError(RPC_MISC_ERROR, strprintf("No block file %s", path.string()));
+    }
+    dMegabytes = boost::filesystem::file_size(path) / 1048576.0;
+    size_t nBlocks = 0;
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    if (nThreads > 1) {
+        std::shared_ptr<const CBlockFileMapping> mapping = CBlockFileMapping::Map(path);
+        if (!mapping) {
+            throw JSONRPCError(RPC_MISC_ERROR, "Unable to map the block file");
+        }
+        CBlockFileParser parser(mapping, Params().MessageStart(), MAX_BLOCK_SIZE(10000000), nThreads);
+        std::vector<CImportedBlock> vBatch;
+        while (parser.NextBatch(vBatch)) {
+            BOOST_FOREACH(const CImportedBlock& imported, vBatch)
+                nBlocks += imported.fParsed;
+        }
+    } else {
+        // The scan LoadExternalBlockFile does, only counting the blocks
+        FILE* file = OpenBlockFile(pos, true);
+        if (file == NULL) {
+            throw JSONRPCError(RPC_MISC_ERROR, "Unable to open the block file");
+        }
+        ScanBlockFile(file, NULL, [&](CBlock& block) {
+            nBlocks++;
+            return true;
+        });
+    }
+    double dTime = timer_stop(tv_start);
+    LogPrintf("benchmark_parse_block_file: %u blocks, %.1fMB in %.3fs on %d threads, %.1fMB/s\n", nBlocks, dMegabytes, dTime, nThreads, dMegabytes / dTime);
+    return dTime;
+}
+
+double benchmark_replay_blocks(int nBlocks, bool fAssumeValid)
+{
+    // The last nBlocks of the chain, checked again on top of the coins they
+    // spent, with or without their scripts assumed valid
+    if (chainActive.Height() <= nBlocks) {
+        throw JSONRPCError(RPC_MISC_ERROR, strprintf("Benchmark needs more than %d blocks", nBlocks));
+    }
+    const int nFirst = chainActive.Height() - nBlocks + 1;
+    std::vector<CBlock> vBlocks(nBlocks);
+    CCoinsViewCache view(pcoinsTip);
+    CValidationState state;
+    for (int i = nBlocks - 1; i >= 0; i--) {
+        CBlockIndex* pindex = chainActive[nFirst + i];
+        bool fClean = true;
+        if (!ReadBlockFromDisk(vBlocks[i], pindex, false) || !DisconnectBlock(vBlocks[i], state, pindex, view, &fClean)) {
+            throw JSONRPCError(RPC_MISC_ERROR, strprintf("Unable to roll back block %d", pindex->GetHeight()));
+        }
+    }
+
+    uint256 hashSaved = hashAssumeValidNotarized;
+    hashAssumeValidNotarized = fAssumeValid ? chainActive.Tip()->GetBlockHash() : uint256();
+    struct timeval tv_start;
+    timer_start(tv_start);
+    for (int i = 0; i < nBlocks; i++) {
+        if (!ConnectBlock(vBlocks[i], state, chainActive[nFirst + i], view, true)) {
+            hashAssumeValidNotarized = hashSaved;
+            throw JSONRPCError(RPC_MISC_ERROR, strprintf("Unable to replay block %d: %s", nFirst + i, state.GetRejectReason()));
+        }
+    }
+    double dTime = timer_stop(tv_start);
+    hashAssumeValidNotarized = hashSaved;
+    LogPrintf("benchmark_replay_blocks: %d blocks in %.3fs%s\n", nBlocks, dTime, fAssumeValid ? ", scripts assumed valid" : "");
+    return dTime;
+}
+
 double benchmark_large_tx(size_t nInputs)
 {
     // Create priv/pub key
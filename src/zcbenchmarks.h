@@ -12,6 +12,11 @@ extern double benchmark_solve_equihash();
 extern std::vector<double> benchmark_solve_equihash_threaded(int nThreads);
 extern double benchmark_verify_joinsplit(const JSDescription &joinsplit);
 extern double benchmark_verify_equihash();
+extern double benchmark_verify_equihash_batch(size_t nHeaders);
+extern double benchmark_verus_hash_v2(size_t nHeaders, bool fBatch);
+extern double benchmark_getheaders(bool fCached);
+extern double benchmark_parse_block_file(int nFile, int nThreads, double& dMegabytes);
+extern double benchmark_replay_blocks(int nBlocks, bool fAssumeValid);
 extern double benchmark_large_tx(size_t nInputs);
 extern double benchmark_try_decrypt_notes(size_t nAddrs);
 extern double benchmark_increment_note_witnesses(size_t nTxs);